@@ -6,10 +6,19 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
+#include <X11/Xatom.h>
+#include <X11/XKBlib.h>
+#include <X11/Xlibint.h>              // XESetBeforeFlush: bytes sent, for --bench render
+
+// X11 Shared Memory Extension (software rasterizer backend)
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 
 // Standard C Library
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include <locale.h>
@@ -22,18 +31,35 @@
 
 // POSIX System Calls
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 // Process and Signal Management
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/poll.h>
 
+// Threading and Lock-free Synchronization
+#include <pthread.h>
+#include <stdatomic.h>
+
+// SIMD Intrinsics (glyph blending)
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // Debugging and Diagnostics
 #include <execinfo.h>
+#include <linux/perf_event.h>
 
 // ============================================================================
 // CONSTANTS AND CONFIGURATION
@@ -46,17 +72,119 @@
 #define CHAR_HEIGHT 16                    // Character height in pixels
 
 // Command and Input Configuration  
-#define MAX_COMMAND_LENGTH 256            // Maximum command length
+#define MAX_COMMAND_LENGTH 256            // Maximum length of job names and multiWatch entries
+#define MAX_COMMAND_LINE (128 * 1024)     // Longest command line (UTF-8 bytes) the editor will execute
+#define MAX_COMMAND_ARGS 1024             // Maximum arguments passed to one program
+#define LINE_EDITOR_INITIAL_CAPACITY 256  // First allocation of a line editor's gap buffer
+
+// Paste Configuration (X selections)
+#define PASTE_CHUNK_BYTES (64 * 1024)     // Initial paste buffer (kept between small pastes)
+#define PASTE_MAX_BYTES (64 * 1024 * 1024) // Largest selection accepted
+#define WINDOW_EVENT_MASK (ExposureMask | KeyPressMask | ButtonPressMask | ButtonReleaseMask | \
+                           Button1MotionMask | FocusChangeMask) // Events always selected
+
+// Selection Configuration (copying scrollback text to other clients)
+#define SELECTION_CHUNK_BYTES (64 * 1024) // Largest property written at once; bigger selections use INCR
+#define MULTI_CLICK_MS 400                // Max gap between the clicks of a double/triple click
+#define MAX_SELECTION_TRANSFERS 4         // Outgoing INCR transfers served at the same time
+
+// Scrollback Find Configuration
+#define FIND_MAX_TERM 256                 // Longest find term or pattern
+#define REGEX_MAX_NFA_STATES 1024         // NFA states a pattern may compile to
+#define REGEX_MAX_CLASSES 256             // Character classes (literals, [sets], '.') in a pattern
+#define REGEX_MAX_RANGES 512              // Character ranges across all classes
+#define REGEX_MAX_DFA_STATES 256          // DFA states built before a pattern is rejected as too complex
+
+// Cross-Tab Search Configuration (worker pool)
+#define GLOBAL_SEARCH_WORKERS 4           // Worker threads (fewer on machines with fewer CPUs)
+#define GLOBAL_SEARCH_CHUNK_LINES 256     // Lines or history entries per work item
+#define GLOBAL_SEARCH_FOLD_CHARS 4096     // Characters lower-cased at a time (longer entries go in windows)
+#define MAX_GLOBAL_SEARCH_RESULTS 200     // Best-ranked results kept per query
+#define GLOBAL_SEARCH_RECENCY_SPAN 1000000 // Score step per quality level (above any line or history index)
+#define GLOBAL_SEARCH_LABEL_WIDTH 14      // "tab:line" column of the results view
+#define MAX_GLOBAL_SEARCH_TASKS (MAX_TABS * ((SCROLLBACK_LINES + MAX_HISTORY_SIZE) / GLOBAL_SEARCH_CHUNK_LINES + 2))
 #define OUTPUT_BUFFER_SIZE 4096           // Output buffer size for command results
 #define UTF8_BUFFER_SIZE (BUFFER_COLS * 4) // UTF-8 conversion buffer size
 
 // History and Storage Configuration
 #define MAX_HISTORY_SIZE 10000            // Maximum command history entries
-#define SCROLLBACK_LINES 1000             // Scrollback buffer size
+#define SCROLLBACK_LINES 1000000          // Scrollback lines kept per tab
+
+// Scrollback Store Configuration (raw output bytes, decoded on demand)
+#define SCROLLBACK_SEGMENT_BYTES (64 * 1024) // Bytes per segment (a longer line gets a segment of its own)
+#define SCROLLBACK_INDEX_STRIDE 16        // Every 16th line's offset is indexed
+#define SCROLLBACK_MAX_BYTES (32 * 1024 * 1024) // Segment memory per tab (compressed size counts) before the oldest is dropped
+#define SCROLLBACK_HOT_SEGMENTS 4         // Newest sealed segments left uncompressed (~4 screens of typical output)
+#define DECOMPRESSED_CHUNK_CACHE 4        // Decompressed segments kept for scrolling and scans
+
+// Scrollback Compression Configuration (LZ4 block format)
+#define LZ4_HASH_BITS 12                  // Match finder table: 4096 positions
+#define LZ4_MIN_MATCH 4                   // Shortest match the format can express
+#define LZ4_LAST_LITERALS 5               // A block ends with at least 5 literals
+#define LZ4_MATCH_FIND_LIMIT 12           // No match may start in the last 12 bytes
+#define LZ4_BOUND(length) ((length) + (length) / 255 + 16) // Worst-case compressed size
+
+// Memory Budget Configuration (terminal content of all tabs)
+#define SCROLLBACK_MEMORY_BUDGET (128 * 1024 * 1024) // Resident scrollback before segments spill to disk (MYTERM_MEMORY_BUDGET_MB)
+#define SPILL_TARGET_EIGHTHS 7            // Eviction continues down to 7/8 of the budget
+
+// Session Snapshot Configuration
+#define SESSION_JOURNAL_MS 2000           // Sealed output and tab changes are appended to the journal this often
+#define SESSION_COMPACT_BYTES (64 * 1024 * 1024) // Journal size (and larger than the checkpoint) that triggers a checkpoint
+#define SESSION_RECORD_ALIGN 8            // Records start on 8-byte boundaries so mapped indexes can be read in place
+
+// Detached Server Configuration
+#define ATTACH_MAX_MESSAGE (2 * 1024 * 1024) // Largest message either side accepts (a paste of up to 2 MB)
+#define ATTACH_MAX_BACKLOG (8 * 1024 * 1024) // Unsent bytes after which the server drops a stuck client
+#define ATTACH_CONNECT_TIMEOUT_MS 3000    // How long --attach waits for a server it started
+#define ATTACH_KEY_TEXT 16                // Bytes of XLookupString text carried with a key
+
+// Control Socket Configuration (scripted automation, single-instance launches)
+#define SINGLE_INSTANCE_TIMEOUT_MS 2000   // How long a launch waits for the running instance to answer
+#define MAX_CONTROL_CLIENTS 16            // Scripts connected at once
+#define CONTROL_MAX_REQUEST (1024 * 1024) // Longest request line
+#define CONTROL_MAX_BACKLOG (8 * 1024 * 1024) // Unsent bytes after which a subscriber that stopped reading is dropped
+#define CONTROL_DEFAULT_LINES 100         // Scrollback lines a `lines` request returns by default
+#define CONTROL_MAX_LINES 10000           // ... and at most
+
+// Session Recording Configuration (MYTERM_RECORD, --replay)
+#define RECORDING_MAGIC "MYTREC01"        // First bytes of a recording file
+#define RECORDING_BUFFER_SIZE (256 * 1024) // Events buffered before a write to the recording file
+
+// Trace Configuration (MYTERM_TRACE)
+#define TRACE_RING_EVENTS 65536           // Events kept (the oldest are overwritten; 3 MB)
+
+// Benchmark Configuration (--bench)
+#define BENCH_RENDER_FRAMES 300           // Frames measured per render workload
+#define BENCH_WARMUP_FRAMES 20            // Frames drawn first (glyph atlas, frame pixmaps)
+#define BENCH_SPAWN_RUNS 10000            // `true` runs of the spawn workload
+#define BENCH_PIPELINE_RUNS 1000          // Runs of the 5-stage pipeline workload
+#define BENCH_CAT_RUNS 5                  // Runs of the cat workload ...
+#define BENCH_CAT_MB 32                   // ... and the size of the file it prints
+#define BENCH_COMMAND_WARMUP_RUNS 3       // Untimed runs before each command workload
+
+// Tab Hibernation Configuration
+#define HIBERNATE_IDLE_MS (10 * 60 * 1000) // Hidden this long -> buffers packed (MYTERM_HIBERNATE_MINUTES, 0 = never)
+#define HIBERNATE_CHECK_MS 30000          // How often hidden tabs are checked
+#define DECODED_LINE_CACHE_SIZE 256       // Decoded lines kept (all tabs; ~10 screens)
+#define DECODED_LINE_BUCKETS 512          // Hash buckets of the decoded-line cache (power of two)
 
 // Tab Management Configuration
 #define MAX_TABS 10                       // Maximum number of tabs
 #define MAX_TAB_NAME 32                   // Maximum tab name length
+#define MAX_COMMAND_BLOCKS 256            // Command blocks remembered per tab (oldest forgotten first)
+
+// Frame Cache Configuration (per-tab rendered pixmaps)
+#define FRAME_CACHE_BUDGET (12 * 1024 * 1024) // Pixmap memory kept for recently used tabs (~11 frames at 640x400)
+#define FRAME_ROW_TOP_PAD 4               // Row band starts this far below the previous baseline
+#define FRAME_HEADER_SIGNATURE_SIZE 512   // Bytes describing the tab bar and scroll indicator
+
+// Software Rasterizer Configuration (MIT-SHM backend)
+#define GLYPH_ATLAS_SLOTS 1024            // Distinct characters cached in the glyph atlas
+#define GLYPH_CELL_WIDTH 32               // Captured cell width (a multi-byte char draws several glyphs)
+#define GLYPH_CELL_HEIGHT 24              // Captured cell height
+#define GLYPH_BASELINE 16                 // Baseline row inside a captured cell
+#define GLYPH_ORIGIN_X 4                  // Pen position inside a cell (room for negative bearings)
 
 // MultiWatch Configuration (parallel command execution)
 #define MAX_MULTIWATCH_COMMANDS 10        // Maximum simultaneous commands
@@ -65,6 +193,20 @@
 // Background Jobs Configuration
 #define MAX_BG_JOBS 100                   // Maximum background jobs
 
+// Asynchronous Command Execution Configuration
+#define MAX_RUNNING_JOBS 32               // Maximum commands/pipelines alive at once (all tabs)
+#define MAX_PIPELINE_COMMANDS 16          // Maximum stages in a single pipeline
+#define COMMAND_TIMEOUT_MS 3000           // Kill a single command after 3 seconds
+#define PIPELINE_TIMEOUT_MS 5000          // Kill a pipeline after 5 seconds
+#define MULTIWATCH_STOP_GRACE_MS 1000     // SIGTERM grace period before SIGKILL on multiWatch stop
+
+// I/O Reader Thread Configuration
+#define IO_RING_SIZE (64 * 1024)          // Per-channel SPSC byte ring (must be a power of two)
+#define MAX_IO_CHANNELS (MAX_RUNNING_JOBS + MAX_MULTIWATCH_COMMANDS) // Child output streams
+#define IO_DRAIN_BUDGET (64 * 1024)       // Max bytes consumed per channel per frame
+#define FRAME_INTERVAL_MS 16              // Event loop wakeup interval while jobs are running
+#define IDLE_INTERVAL_MS 250              // Event loop wakeup interval when idle
+
 // ============================================================================
 // DATA STRUCTURES
 // ============================================================================
@@ -87,13 +229,532 @@ typedef struct
  */
 typedef struct
 {
-    pid_t pid;                           // Process ID
-    int fd;                              // File descriptor for output reading
+    pid_t pid;                           // Process ID (also its process group ID)
+    int channel;                         // I/O channel carrying the process output (-1 if none)
     char command[MAX_COMMAND_LENGTH];    // Command being executed
-    char temp_file[64];                  // Temporary file for output capture
     int active;                          // Whether process is still running
+    int finished_reported;               // Whether the "finished" message was printed
 } MultiWatchProcess;
 
+/**
+ * Byte Ring Structure
+ * Lock-free single-producer/single-consumer ring. The reader thread is the
+ * only writer of 'head', the UI thread the only writer of 'tail'. Both are
+ * free-running counters; the occupied size is always head - tail.
+ */
+typedef struct
+{
+    unsigned char data[IO_RING_SIZE];    // Ring storage
+    _Atomic size_t head;                 // Total bytes produced (reader thread)
+    _Atomic size_t tail;                 // Total bytes consumed (UI thread)
+} ByteRing;
+
+/**
+ * I/O Channel Structure
+ * One child output stream drained by the reader thread into a byte ring.
+ * Once a channel is ACTIVE its fd belongs to the reader thread, which is the
+ * only place it is ever read or closed.
+ */
+typedef struct
+{
+    ByteRing ring;                       // Bytes waiting for the UI thread
+    int fd;                              // Read end of the child output pipe
+    _Atomic int state;                   // IO_CHANNEL_FREE / IO_CHANNEL_ACTIVE / IO_CHANNEL_EOF
+    _Atomic int detach_requested;        // UI asks the reader to stop reading and close fd
+    _Atomic int stalled;                 // Reader skipped this fd because the ring was full
+    _Atomic int abandoned;               // UI dropped the channel; free it at EOF instead of keeping the ring
+
+    // UI thread only
+    int tab_id;                          // Owning tab (0 if the tab has been closed)
+    char partial_line[OUTPUT_BUFFER_SIZE]; // Incomplete trailing line carried between frames
+    int partial_length;                  // Bytes in partial_line
+} IOChannel;
+
+enum
+{
+    IO_CHANNEL_FREE = 0,
+    IO_CHANNEL_ACTIVE,
+    IO_CHANNEL_EOF
+};
+
+/**
+ * Command Job Structure
+ * A command or pipeline started by execute_command() that is still alive.
+ * The UI thread reaps it at frame time; output arrives through its channel.
+ */
+typedef struct
+{
+    int in_use;                          // Whether this slot holds a job
+    int tab_id;                          // Tab receiving the output (0 if orphaned)
+    pid_t pids[MAX_PIPELINE_COMMANDS];   // Process IDs of all stages
+    int exited[MAX_PIPELINE_COMMANDS];   // Whether each stage has been reaped
+    int pid_count;                       // Number of stages
+    int last_status;                     // Wait status of the last stage
+    int channel;                         // I/O channel index
+    int stopped;                         // Stopped by Ctrl+Z (no timeout while stopped)
+    int timed_out;                       // Deadline passed and SIGKILL was sent
+    long long deadline_ms;               // Monotonic time at which the job is killed
+    long timeout_ms;                     // Timeout applied when (re)started
+    size_t output_bytes;                 // Total bytes of output received
+    long long started_us;                // When the job was registered (trace spans)
+    unsigned long block_serial;          // Command block closed when the job finishes (0 if none)
+    char command[MAX_COMMAND_LENGTH];    // Command line for job listings
+} CommandJob;
+
+/**
+ * Glyph Atlas Entry
+ * Coverage of one character as drawn by the server's core font, captured
+ * once so the software rasterizer can blend it without any protocol traffic.
+ */
+typedef struct
+{
+    int in_use;                          // Whether this slot holds a glyph
+    wchar_t character;                   // Character drawn in this cell
+    int ink_left;                        // First inked column (GLYPH_CELL_WIDTH if blank)
+    int ink_right;                       // Last inked column (-1 if blank)
+    unsigned char coverage[GLYPH_CELL_HEIGHT][GLYPH_CELL_WIDTH]; // 0-255 per pixel
+} GlyphEntry;
+
+/**
+ * Frame Surface Structure
+ * Target of the frame drawing helpers: either an X drawable (server-side
+ * XDrawString path) or a client-side 32bpp image (software rasterizer).
+ */
+typedef struct
+{
+    Display *display;                    // Display owning the drawable
+    Drawable drawable;                   // Pixmap or window (Xlib path)
+    GC gc;                               // Graphics context (Xlib path)
+    XImage *raster;                      // Client-side image, or NULL for the Xlib path
+    unsigned long color;                 // Current foreground pixel
+} FrameSurface;
+
+/**
+ * Render Statistics Structure
+ * Per-renderer counters reported by the 'renderer' built-in.
+ */
+typedef struct
+{
+    unsigned long frames;                // draw_text_buffer() calls
+    unsigned long damaged_rows;          // Rows repainted
+    unsigned long total_us;              // Client-side time spent painting
+} RenderStats;
+
+enum
+{
+    RENDERER_XLIB = 0,                   // Server-side XDrawString per glyph
+    RENDERER_SHM,                        // Client-side rasterizer + XShmPutImage
+    RENDERER_COUNT
+};
+
+/**
+ * Phase Counters Structure
+ * Hardware counter totals of one phase, reported by the 'stats' built-in.
+ */
+enum
+{
+    PERF_PHASE_RENDER = 0,               // present_frame()
+    PERF_PHASE_PARSE,                    // Child output split into lines and stored
+    PERF_PHASE_SEARCH,                   // Find and history queries
+    PERF_PHASE_COMPLETION,               // Tab completion
+    PERF_PHASE_COUNT
+};
+
+enum
+{
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+typedef struct
+{
+    unsigned long long calls;            // Times the phase ran
+    unsigned long long wall_us;          // Wall-clock time inside it
+    unsigned long long counts[PERF_COUNTER_COUNT];
+} PhaseCounters;
+
+/**
+ * Trace Event Structures
+ * Slots of the MYTERM_TRACE ring, shared with forked children (see TRACE EXPORT).
+ */
+enum
+{
+    TRACE_FRAME = 0,                     // present_frame() (span)
+    TRACE_FORK,                          // A command stage was forked
+    TRACE_EXEC,                          // ... and is about to exec (recorded by the child)
+    TRACE_FIRST_OUTPUT,                  // A job's first output reached its tab
+    TRACE_EXIT,                          // A stage's exit status was collected
+    TRACE_REAP,                          // The job finished: all stages reaped, all output shown
+    TRACE_COMMAND,                       // A job from start to reap (span)
+    TRACE_READ,                          // One read() of child output by the reader thread (span)
+    TRACE_HISTORY_QUERY,                 // search_history() (span)
+    TRACE_FIND_QUERY,                    // find_next_match() (span)
+    TRACE_COMPLETION,                    // handle_tab_completion() (span)
+    TRACE_KIND_COUNT
+};
+
+typedef struct
+{
+    const char *name;                    // Event name in the trace viewer
+    const char *category;
+    int span;                            // Complete event with a duration, or an instant
+    const char *arg_names[2];            // Names of args[0] and args[1] (NULL = unused)
+} TraceKind;
+
+typedef struct
+{
+    _Atomic uint64_t sequence;           // Ring index + 1 once the slot is complete (0 while written)
+    int64_t start_us;                    // monotonic_us() time stamp
+    int64_t duration_us;                 // 0 for instants
+    int64_t args[2];
+    int32_t thread_id;                   // Kernel thread ID (a child's PID for exec)
+    uint16_t kind;                       // TRACE_*
+    uint16_t reserved;
+} TraceEvent;
+
+typedef struct
+{
+    _Atomic uint64_t next;               // Events ever recorded (slot = next % TRACE_RING_EVENTS)
+    TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+/**
+ * Line Editor Structure
+ * Gap buffer holding the command being typed. Text lives in
+ * text[0..gap_start) and text[gap_end..capacity); inserting at the cursor
+ * fills the gap, so typing is O(1) amortized and the gap only moves when
+ * the cursor has moved. A zeroed editor is a valid empty one.
+ */
+typedef struct
+{
+    wchar_t *text;                       // Buffer including the gap (NULL until first insert)
+    size_t capacity;                     // Allocated characters
+    size_t gap_start;                    // First character of the gap
+    size_t gap_end;                      // First character after the gap
+    size_t cursor;                       // Logical cursor position (0..length)
+} LineEditor;
+
+/**
+ * Paste Transfer Structure
+ * State of the one selection conversion in flight. Small selections arrive
+ * in a single SelectionNotify; large ones use the ICCCM INCR protocol and
+ * arrive as a series of property chunks ended by an empty one.
+ */
+typedef struct
+{
+    int active;                          // A conversion has been requested and not finished
+    int incr;                            // Owner is streaming chunks (INCR)
+    Atom selection;                      // PRIMARY or CLIPBOARD
+    Atom target;                         // UTF8_STRING, or STRING after a refused conversion
+    int tab_id;                          // Tab receiving the text
+    char *data;                          // Bytes received so far
+    size_t length;                       // Bytes in data
+    size_t capacity;                     // Allocated bytes
+    long long start_us;                  // When the paste was requested
+} PasteTransfer;
+
+/**
+ * Selection Range Structure
+ * A span of scrollback text in absolute line numbers, so it stays on the
+ * same text while new output scrolls the buffer. end_col is exclusive.
+ */
+typedef struct
+{
+    int tab_id;                          // Tab whose scrollback holds the text (0 if none)
+    unsigned long start_line;            // First selected line
+    int start_col;                       // First selected column on start_line
+    unsigned long end_line;              // Last selected line
+    int end_col;                         // Column after the last selected one on end_line
+} SelectionRange;
+
+/**
+ * Mouse Selection Structure
+ * The live PRIMARY selection. Only its two ends are stored; the text is
+ * produced when another client asks for it.
+ */
+typedef struct
+{
+    int tab_id;                          // Tab being selected in (0 if no selection)
+    unsigned long anchor_line;           // Where the button was pressed
+    int anchor_col;
+    unsigned long head_line;             // Where the pointer is now
+    int head_col;
+    int mode;                            // SELECT_CHARS / SELECT_WORDS / SELECT_LINES
+    int dragging;                        // Button 1 is held
+    int owned;                           // We currently own PRIMARY
+    Time last_click_time;                // For double/triple click detection
+    unsigned long last_click_line;
+    int last_click_col;
+    int click_count;                     // 1, 2 or 3
+} MouseSelection;
+
+enum
+{
+    SELECT_CHARS = 0,                    // Click-drag
+    SELECT_WORDS,                        // Double click
+    SELECT_LINES                         // Triple click
+};
+
+/**
+ * Selection Transfer Structure
+ * One outgoing INCR transfer. The next chunk is extracted only after the
+ * requestor has deleted the previous one, so memory stays at one chunk.
+ */
+typedef struct
+{
+    int active;                          // Transfer in progress
+    int incr;                            // PropertyChangeMask is selected on the requestor
+    Window requestor;                    // Client window receiving the text
+    Window owner;                        // Our window (the requestor too when we paste from ourselves)
+    Atom property;                       // Property the chunks are written to
+    Atom type;                           // UTF8_STRING or STRING
+    int latin1;                          // Encode as Latin-1 (STRING target)
+    SelectionRange range;                // Text being sent
+    unsigned long next_line;             // First line not yet extracted
+    char *chunk;                         // Next chunk to write (SELECTION_CHUNK_BYTES)
+    size_t chunk_length;                 // Bytes in chunk (0 once all data is sent)
+} SelectionTransfer;
+
+/**
+ * Regex DFA Structure
+ * A find pattern compiled once into a deterministic automaton. Characters are
+ * mapped to symbols (classes no pattern range boundary crosses) so the
+ * transition table stays small even for Unicode ranges.
+ */
+typedef struct
+{
+    int valid;                           // A pattern is compiled
+    int anchored_start;                  // Pattern began with '^'
+    int anchored_end;                    // Pattern ended with '$'
+    wchar_t *boundaries;                 // Sorted first characters of each symbol after symbol 0
+    int boundary_count;
+    int symbol_count;                    // boundary_count + 1
+    short ascii_symbols[128];            // Symbol of each ASCII character (no search needed)
+    int state_count;
+    short *transitions;                  // [state * symbol_count + symbol] -> state, -1 = dead
+    unsigned char *accepting;            // Per state: a match ends here
+} RegexDfa;
+
+/**
+ * Find State Structure
+ * Ctrl+F search over a tab's scrollback. The current match is kept as an
+ * absolute line number so it survives new output scrolling the buffer.
+ */
+typedef struct
+{
+    int active;                          // Find mode owns the command row
+    int regex;                           // Term is a regular expression
+    int fold_case;                       // Literal term matches any case (a smart-case global search)
+    wchar_t term[FIND_MAX_TERM];         // Literal or pattern being searched for
+    int term_length;
+    RegexDfa dfa;                        // Compiled pattern (regex mode)
+    const char *error;                   // Pattern error shown on the prompt (NULL if none)
+    int has_match;                       // match_* describe the current match
+    unsigned long match_line;            // Absolute scrollback line of the current match
+    int match_col;
+    int match_length;
+} FindState;
+
+enum
+{
+    CELL_STYLE_NORMAL = 0,               // Black on white
+    CELL_STYLE_REVERSE,                  // Selection or current find match
+    CELL_STYLE_UNDERLINE                 // Other find matches
+};
+
+/**
+ * Scrollback Segment Structure
+ * Raw output bytes of consecutive scrollback lines, each followed by '\n'.
+ * Once sealed the bytes never change, so search snapshots can share it.
+ */
+typedef struct
+{
+    char *bytes;
+    size_t length;                       // Bytes used
+    size_t capacity;                     // Bytes allocated
+    unsigned long first_line;            // Absolute number of the first line stored here
+    int line_count;
+    uint32_t *line_index;                // Offset of every SCROLLBACK_INDEX_STRIDE-th line
+    int index_capacity;
+    int sealed;                          // Full; no more lines are added
+    int references;                      // Owners (the tab, search snapshots, a compression job)
+    int compression_queued;              // Handed to the compressor (at most once)
+    unsigned char *compressed;           // LZ4 block replacing bytes (bytes is then NULL)
+    size_t compressed_length;
+    long long spill_offset;              // Position in the spill file (-1 = in memory)
+    unsigned long last_used;             // Scrollback clock when the UI last read it
+    size_t resident_bytes;               // What this segment adds to scrollback_resident_bytes
+    int mapped;                          // bytes/compressed/line_index point into a mapped session file
+    int journaled;                       // Written to the session journal or checkpoint
+} ScrollbackSegment;
+
+/**
+ * Spill Extent Structure
+ * A free range of the spill file.
+ */
+typedef struct
+{
+    long long offset;
+    size_t length;
+} SpillExtent;
+
+/**
+ * Compression Job Structure
+ * A sealed segment waiting for, or finished by, the compressor thread. The
+ * output buffer is allocated by the UI thread so the compressor never calls
+ * malloc().
+ */
+typedef struct CompressionJob
+{
+    ScrollbackSegment *segment;          // Holds one reference
+    int tab_id;                          // Tab that owned the segment when it was queued
+    unsigned char *output;               // LZ4_BOUND(segment->length) bytes
+    size_t output_capacity;
+    size_t output_length;                // 0 = did not fit (incompressible)
+    struct CompressionJob *next;
+} CompressionJob;
+
+/**
+ * Decompressed Chunk Structure
+ * A compressed segment's bytes, decompressed for the UI thread.
+ */
+typedef struct
+{
+    const ScrollbackSegment *segment;    // NULL = unused
+    char *bytes;                         // SCROLLBACK_SEGMENT_BYTES (allocated on first use)
+    unsigned long last_used;             // LRU stamp
+} DecompressedChunk;
+
+/**
+ * Decoded Line Structure
+ * An entry of the decoded-line LRU: one scrollback line as cells.
+ */
+typedef struct
+{
+    int tab_id;                          // 0 = unused
+    unsigned long line;                  // Absolute scrollback line
+    int hash_next;                       // Next entry in the bucket (-1 ends)
+    int lru_prev;                        // Towards the most recently used entry
+    int lru_next;                        // Towards the least recently used entry
+    wchar_t text[BUFFER_COLS];
+} DecodedLine;
+
+/**
+ * Global Search Result Structure
+ * One matching scrollback line or history entry. The text is copied so the
+ * results view never points into a snapshot that may be freed.
+ */
+typedef struct
+{
+    int tab_id;                          // Tab the match came from
+    int from_history;                    // 1 = command history entry, 0 = scrollback line
+    unsigned long line;                  // Absolute scrollback line, or history index
+    int match_col;                       // Match position inside text
+    long score;                          // Higher ranks first
+    wchar_t text[BUFFER_COLS + 1];       // Snippet around the match (terminated)
+} GlobalSearchResult;
+
+/**
+ * Global Search Source Structure
+ * A tab's scrollback or history as copied when the query started. Workers
+ * only ever read snapshots, never the live tabs.
+ */
+typedef struct
+{
+    int tab_id;
+    int from_history;                    // Which of the two arrays below is used
+    unsigned long first_line;            // Absolute number of the first line (scrollback)
+    int count;                           // Lines or history entries
+    ScrollbackSegment **segments;        // Scrollback segments (one reference each, held by the job)
+    int segment_count;
+    const wchar_t *history_text;         // History entries back to back, each terminated
+    const size_t *history_offsets;       // count + 1 offsets into history_text
+} GlobalSearchSource;
+
+/**
+ * Global Search Task Structure
+ * A chunk of one source; the unit workers claim.
+ */
+typedef struct
+{
+    int source;                          // Index into the job's sources
+    int begin;                           // First line or entry
+    int end;                             // One past the last
+} GlobalSearchTask;
+
+/**
+ * Global Search Job Structure
+ * One query over one snapshot. Workers claim tasks with an atomic counter and
+ * merge matches into the ranked results under the job's lock.
+ */
+typedef struct GlobalSearchJob
+{
+    wchar_t query[FIND_MAX_TERM];        // Query as typed
+    wchar_t folded_query[FIND_MAX_TERM]; // Lower-cased query
+    int query_length;
+    int case_sensitive;                  // Query has capitals (smart case)
+    GlobalSearchSource sources[MAX_TABS * 2];
+    int source_count;
+    GlobalSearchTask tasks[MAX_GLOBAL_SEARCH_TASKS];
+    int task_count;
+    atomic_int next_task;                // Next task a worker claims
+    atomic_int tasks_done;               // Tasks finished (or skipped after cancel)
+    atomic_int workers_inside;           // Workers that may still touch this job
+    atomic_int cancelled;                // The query changed; stop early
+    pthread_mutex_t lock;                // Guards the fields below
+    GlobalSearchResult results[MAX_GLOBAL_SEARCH_RESULTS]; // Best first
+    int result_count;
+    long total_matches;                  // Including those ranked out of results
+    unsigned long results_version;       // Bumped on every change
+    char *snapshot;                      // Single allocation behind all sources
+    struct GlobalSearchJob *next_retired; // Cancelled jobs waiting to be freed
+} GlobalSearchJob;
+
+/**
+ * Global Search View Structure
+ * UI-thread state of the Ctrl+Shift+F results view.
+ */
+typedef struct
+{
+    int active;                          // The view replaces the active tab's content
+    wchar_t query[FIND_MAX_TERM];
+    int query_length;
+    GlobalSearchJob *job;                // Job for the current query (NULL if none)
+    GlobalSearchJob *retired;            // Cancelled jobs some worker may still be inside
+    GlobalSearchResult results[MAX_GLOBAL_SEARCH_RESULTS]; // Copy shown on screen
+    int result_count;
+    long total_matches;
+    unsigned long results_version;       // Version of the job's results copied last
+    int selected;                        // Highlighted result
+    int view_top;                        // First result on screen
+    int done;                            // Every task of the job has finished
+    long long start_us;                  // When the query started
+    long long elapsed_us;                // Time to finish the whole search
+} GlobalSearchView;
+
+/**
+ * Command Block Structure
+ * One command's run in the scrollback, from its "Executing:" header line to
+ * the last line printed before it finished. Lines are absolute so a block
+ * stays valid while the scrollback shifts.
+ */
+typedef struct
+{
+    unsigned long serial;                // Per-tab block number (consecutive, first is 1)
+    unsigned long start_line;            // Header line
+    unsigned long end_line;              // Line after the last one (valid once finished)
+    int running;                         // Output may still arrive
+    int exit_status;                     // Exit code, 128 + signal, or -1 if it never ran
+    int folded;                          // Only the header is shown
+    int dropped_lines;                   // Output lines discarded to free scrollback rows
+    long long start_ms;                  // Monotonic start time
+    long long duration_ms;               // Run time (valid once finished)
+    char command[64];                    // Start of the command line, for listings
+} CommandBlock;
+
 /**
  * Tab Structure
  * Represents a single terminal tab with complete state
@@ -102,118 +763,866 @@ typedef struct
 {
     // Display and Rendering
     wchar_t text_buffer[BUFFER_ROWS][BUFFER_COLS];  // Visible text buffer
-    wchar_t scrollback_buffer[SCROLLBACK_LINES][BUFFER_COLS]; // History buffer
+    ScrollbackSegment **segments;        // Raw output, oldest first (see SCROLLBACK STORE)
+    int segment_count;
+    int segment_capacity;
+    size_t scrollback_bytes;             // Segment memory held
     int scrollback_count;                // Number of lines in scrollback
+    unsigned long scrollback_first_line; // Absolute number of the oldest kept line (lines dropped so far)
+    int scrollback_hint_valid;           // The fields below locate the last line looked up
+    unsigned long scrollback_hint_line;
+    int scrollback_hint_segment;
+    size_t scrollback_hint_offset;
     int scrollback_offset;               // Current scroll position
     int max_scrollback_offset;           // Maximum scroll position reached
     
+    // Background Rendering
+    int grid_stale;                      // text_buffer is out of date (output arrived while hidden)
+    int has_activity;                    // Unseen output since the tab was last shown
+
+    // Frame Cache (what the tab's pixmap currently shows)
+    Pixmap frame_pixmap;                 // Rendered frame (None if never drawn or evicted)
+    unsigned long frame_last_used;       // LRU stamp of the last draw
+    wchar_t frame_grid[BUFFER_ROWS][BUFFER_COLS]; // Grid contents drawn into the pixmap
+    int frame_cursor_row;                // Cursor row drawn into the pixmap
+    int frame_cursor_col;                // Cursor column drawn into the pixmap
+    char frame_header[FRAME_HEADER_SIGNATURE_SIZE]; // Tab bar state drawn into the pixmap
+    unsigned char frame_styles[BUFFER_ROWS][BUFFER_COLS]; // Cell decorations (CELL_STYLE_*) drawn per row
+    
     // Command Input and Editing
-    wchar_t current_command[MAX_COMMAND_LENGTH];    // Current command being typed
-    int command_length;                  // Length of current command
+    LineEditor editor;                   // Command being typed (may span several lines)
     int cursor_row;                      // Cursor row position
     int cursor_col;                      // Cursor column position  
-    int cursor_buffer_pos;               // Cursor position in command buffer
     
     // Command History
-    wchar_t command_history[MAX_HISTORY_SIZE][MAX_COMMAND_LENGTH];
+    wchar_t *command_history[MAX_HISTORY_SIZE]; // Heap copies, oldest first
     int history_count;                   // Total history entries
     int history_current;                 // Current position in history navigation
     
     // Search Functionality
     int search_mode;                     // Whether in reverse search mode
-    wchar_t search_buffer[MAX_COMMAND_LENGTH]; // Current search term
-    int search_pos;                      // Search term length
+    LineEditor search_buffer;            // Current search term
+    FindState find;                      // Scrollback find (Ctrl+F)
+
+    // Command Blocks (ring in scrollback order)
+    CommandBlock command_blocks[MAX_COMMAND_BLOCKS];
+    int block_first;                     // Ring index of the oldest block
+    int block_count;                     // Blocks in the ring
+    int folded_block_count;              // Blocks currently folded (0 = plain line mapping)
+    unsigned long next_block_serial;     // Serial of the next block
+    unsigned long pending_block_serial;  // Block begun by execute_command() and not yet given to a job
+    unsigned long block_cursor;          // Block jumped to last (0 if none)
+    int block_cursor_view;               // View start when block_cursor was set
     
+    // Hibernation (see TAB HIBERNATION)
+    long long last_viewed_ms;            // When the tab was last hidden (0 = never shown and left)
+    int hibernated;                      // Buffers packed until the tab is shown again
+    unsigned char *history_blob;         // History as LZ4-compressed NUL-terminated UTF-8 (NULL = resident)
+    size_t history_blob_length;
+    size_t history_blob_raw_length;      // Size once decompressed
+    size_t reclaimed_bytes;              // Given back by the last hibernation
+
+    // Session Journal (see SESSION SNAPSHOT)
+    int session_recorded;                // The journal holds a tab record for this tab
+    unsigned long journaled_first_line;  // scrollback_first_line when that record was written
+    unsigned long history_serial;        // History entries ever added
+    unsigned long journaled_history_serial; // History entries already in the journal
+
     // Process Management
     pid_t foreground_pid;                // PID of foreground process (-1 if none)
     
     // Tab Identification
+    int tab_id;                          // Stable identifier (survives tab array shifts)
     char tab_name[MAX_TAB_NAME];         // Display name of tab
     int active;                          // Whether this tab is currently active
 } Tab;
 
-// ============================================================================
-// GLOBAL VARIABLES
-// ============================================================================
+/**
+ * Spill Candidate Structure
+ * A segment that may be evicted, with the tab that owns it.
+ */
+typedef struct
+{
+    Tab *tab;
+    ScrollbackSegment *segment;
+} SpillCandidate;
 
-// Tab Management
-Tab tabs[MAX_TABS];                      // Array of all tabs
-int tab_count = 1;                       // Number of active tabs
-int active_tab_index = 0;                // Index of currently active tab
+/**
+ * Session File Header
+ * Starts the checkpoint and the journal. A journal only applies on top of the
+ * checkpoint with the same generation.
+ */
+typedef struct
+{
+    char magic[8];                       // "MYTCKPT1" or "MYTJRNL1"
+    uint64_t generation;
+} SessionFileHeader;
 
-// Background Job Management
-BGProcess bg_processes[MAX_BG_JOBS];     // Array of background processes
-int job_counter = 0;                     // Counter for job ID assignment
-int bg_job_count = 0;                    // Number of active background jobs
+/**
+ * Session Record Types
+ * Every record is a SessionRecordHeader followed by its payload.
+ */
+typedef enum
+{
+    SESSION_RECORD_TAB = 1,              // SessionTabRecord (the last one for a tab wins)
+    SESSION_RECORD_SEGMENT = 2,          // SessionSegmentRecord, line index, bytes
+    SESSION_RECORD_HISTORY = 3,          // SessionHistoryRecord, entries (LZ4 when packed_length > 0)
+    SESSION_RECORD_CLOSE = 4,            // SessionCloseRecord
+    SESSION_RECORD_STATE = 5             // SessionStateRecord, working directory
+} SessionRecordType;
 
-// MultiWatch Parallel Execution
-MultiWatchProcess multiwatch_processes[MAX_MULTIWATCH_COMMANDS]; // MultiWatch processes
-int multiwatch_count = 0;                // Number of active MultiWatch processes
-int multiwatch_mode = 0;                 // Whether MultiWatch mode is active
+typedef struct
+{
+    uint32_t type;                       // SessionRecordType
+    uint32_t length;                     // Payload bytes (the next record starts SESSION_RECORD_ALIGN-aligned)
+} SessionRecordHeader;
 
-// Signal Handling
-volatile sig_atomic_t signal_received = 0;  // Flag indicating signal received
-volatile sig_atomic_t which_signal = 0;     // Which specific signal was received
+typedef struct
+{
+    int32_t tab_id;
+    int32_t reserved;
+    uint64_t first_line;                 // Absolute number of the oldest kept line
+    char name[MAX_TAB_NAME];
+} SessionTabRecord;
 
-// ============================================================================
-// FUNCTION DECLARATIONS
-// ============================================================================
+typedef struct
+{
+    int32_t tab_id;
+    uint32_t line_count;
+    uint64_t first_line;                 // A segment starting at or before earlier ones replaces them
+    uint32_t length;                     // Raw bytes
+    uint32_t compressed_length;          // LZ4 block length (0 = stored raw)
+    uint32_t index_count;                // uint32_t line offsets that follow, padded to 8 bytes
+    uint32_t reserved;
+} SessionSegmentRecord;
 
-// Tab and buffer management
-void initialize_text_buffer(void);
-void initialize_tab(Tab *tab, const char *name);
-void create_new_tab(void);
-void close_current_tab(void);
-void handle_tab_click(int click_x);
+typedef struct
+{
+    int32_t tab_id;
+    uint32_t count;                      // Entries (appended to what the tab already has)
+    uint32_t raw_length;                 // NUL-terminated UTF-8 entries
+    uint32_t packed_length;              // LZ4 block length (0 = stored raw)
+} SessionHistoryRecord;
 
-// Command execution and processing
-void execute_command(Display *display, Window window, GC gc, Tab *tab, const char *command);
-void handle_enter_key(Display *display, Window window, GC gc, Tab *tab);
-void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_event);
-int is_safe_command(const char *command);
+typedef struct
+{
+    int32_t tab_id;
+    int32_t reserved;
+} SessionCloseRecord;
 
-// History management
-void add_to_history(Tab *tab, const char *command);
-void handle_history_command(Tab *tab);
-int search_history(Tab *tab, const wchar_t *search_term, wchar_t *result, int show_multiple);
-void enter_search_mode(Tab *tab);
-void handle_tab_completion(Tab *tab);
+typedef struct
+{
+    int32_t active_tab_id;
+    int32_t reserved;                    // Followed by the NUL-terminated working directory
+} SessionStateRecord;
 
-// Search and completion utilities
-int find_longest_common_substring(const char *str1, const char *str2);
-void debug_search(const char *search_term, const char *history_entry, int match_len);
+/**
+ * Attach Message Types
+ * Every message on the server socket is an AttachMessageHeader followed by
+ * its payload. Keys, clicks and pastes go to the server; screen updates
+ * (the first one is the whole screen) and the final quit come back.
+ */
+typedef enum
+{
+    ATTACH_KEY = 1,                      // Client -> server: AttachKeyMessage
+    ATTACH_BUTTON = 2,                   // Client -> server: AttachButtonMessage
+    ATTACH_PASTE = 3,                    // Client -> server: AttachPasteMessage, text
+    ATTACH_SCREEN = 4,                   // Server -> client: AttachScreenMessage, tabs, rows
+    ATTACH_QUIT = 5                      // Server -> client: (empty) detached or shutting down
+} AttachMessageType;
 
-// Display and rendering
-void draw_text_buffer(Display *display, Window window, GC gc);
-void update_command_display(Tab *tab);
-void update_command_display_with_prompt(Tab *tab, const char *prompt);
-void render_scrollback(Tab *tab);
-void add_text_to_buffer(Tab *tab, const char *text);
-void add_separator_line(Tab *tab);
-void add_timestamp_line(Tab *tab);
+typedef struct
+{
+    uint16_t type;                       // AttachMessageType
+    uint16_t reserved;
+    uint32_t length;                     // Payload bytes
+} AttachMessageHeader;
 
-// Scrollback and buffer management
-void scroll_buffer(Tab *tab);
-void scroll_up(Tab *tab);
-void scroll_down(Tab *tab);
-void scroll_to_bottom(Tab *tab);
+typedef struct
+{
+    uint32_t keysym;
+    uint32_t state;                      // X modifier mask
+    uint32_t text_length;
+    char text[ATTACH_KEY_TEXT];          // What XLookupString produced
+} AttachKeyMessage;
 
-// Background job management
-void handle_jobs_command(Tab *tab);
-void handle_fg_command(Tab *tab, const char *command);
+typedef struct
+{
+    int32_t x;
+    int32_t y;
+    uint32_t button;
+    uint32_t reserved;
+} AttachButtonMessage;
 
-// MultiWatch functionality
-void handle_multiwatch_command(Display *display, Window window, GC gc, Tab *tab, const char *command);
-void monitor_multiwatch_processes(Display *display, Window window, GC gc, Tab *tab);
-void cleanup_multiwatch(void);
+typedef struct
+{
+    uint32_t latin1;                     // Text is ISO 8859-1 rather than UTF-8
+    uint32_t reserved;                   // Followed by the text
+} AttachPasteMessage;
 
-// Signal handlers
-void handle_sigint(int sig);
-void handle_sigtstp(int sig);
-void handle_sigsegv(int sig);
+/**
+ * Attach Screen Update
+ * Carries only what changed since the last update: the tab bar when it
+ * changed, then each damaged row as an AttachRowHeader, its UTF-8 text
+ * (trailing blanks trimmed) and, for rows with highlights, one style byte
+ * per column.
+ */
+typedef struct
+{
+    uint8_t active_tab_index;
+    uint8_t tab_count;
+    uint8_t tabs_included;               // tab_count AttachTabEntry follow
+    uint8_t row_count;                   // Damaged rows that follow
+    int16_t cursor_row;
+    int16_t cursor_col;
+    int32_t scrollback_offset;
+    int32_t scrollback_count;            // Lines the scroll indicator counts (folded output excluded)
+} AttachScreenMessage;
 
-// Resource cleanup
-void cleanup_resources(Display *display, Window window, GC gc);
+typedef struct
+{
+    uint8_t has_activity;
+    char name[MAX_TAB_NAME];
+} AttachTabEntry;
+
+typedef struct
+{
+    uint8_t row;
+    uint8_t styled;                      // BUFFER_COLS style bytes follow the text
+    uint16_t text_length;
+} AttachRowHeader;
+
+/**
+ * Attach Connection
+ * One end of the server socket: bytes read but not yet parsed and bytes
+ * queued but not yet written (the socket is non-blocking on both sides).
+ */
+typedef struct
+{
+    int fd;                              // -1 = not connected
+    unsigned char *inbox;
+    size_t inbox_length;
+    size_t inbox_capacity;
+    unsigned char *outbox;
+    size_t outbox_length;
+    size_t outbox_capacity;
+} AttachConnection;
+
+/**
+ * Control Client
+ * A script connected to the control socket. Requests and replies are JSON
+ * lines; output of the subscribed tabs is streamed as events in between.
+ */
+typedef struct
+{
+    AttachConnection connection;         // fd -1 = free slot
+    int subscribed_tabs[MAX_TABS];       // Tab IDs whose output is streamed (0 = unused)
+    int overflowed;                      // Stopped reading; dropped at the next service
+} ControlClient;
+
+/**
+ * Control Request
+ * The fields of one request line. Strings point into the line (decoded in
+ * place); absent numbers keep has_* at 0.
+ */
+typedef struct
+{
+    const char *op;
+    const char *command;
+    long long id, tab, from, count, block;
+    int has_id, has_tab, has_from, has_count, has_block;
+} ControlRequest;
+
+/**
+ * Render Workload Structure
+ * One scenario of `--bench render`: optional setup, then one step per frame.
+ */
+typedef struct
+{
+    const char *name;                    // Name on the command line and in the report
+    const char *description;             // What the workload exercises
+    void (*setup)(Tab *tab);             // Prepares the workload's tab (NULL = nothing)
+    void (*step)(Tab *tab, int frame);   // Changes the model before frame number `frame`
+} RenderWorkload;
+
+/**
+ * Command Workload Structure
+ * One scenario of `--bench commands`: a command line run a fixed number of times.
+ */
+typedef struct
+{
+    const char *name;                    // Name on the command line and in the report
+    const char *description;             // What the workload runs
+    const char *command;                 // Command line (NULL = cat of the generated file)
+    int runs;                            // Timed runs
+} CommandWorkload;
+
+/**
+ * Recording Event Types
+ * A recording is a RecordingFileHeader followed by events, each a
+ * RecordingEventHeader and its payload. Input is kept as it arrived; work
+ * the event loop did on its own (child output, finished jobs, presented
+ * frames) is kept by its effect on the tabs, so a replay rebuilds every
+ * screen without running a single command.
+ */
+typedef enum
+{
+    RECORD_KEY = 1,                      // Input: AttachKeyMessage
+    RECORD_BUTTON = 2,                   // Input: AttachButtonMessage
+    RECORD_PASTE = 3,                    // Input: RecordTabPayload (flags = latin1), text
+    RECORD_CONTROL = 4,                  // Input: control request line
+    RECORD_EXPOSE = 5,                   // Input: (empty) window exposed
+    RECORD_OUTPUT = 6,                   // Effect: RecordTabPayload, text added to the tab's scrollback
+    RECORD_SEPARATOR = 7,                // Effect: RecordTabPayload
+    RECORD_JOB_END = 8,                  // Effect: RecordJobEnd
+    RECORD_MULTIWATCH_END = 9,           // Effect: (empty) every multiWatch command finished
+    RECORD_FRAME = 10,                   // Effect: (empty) a frame was presented
+    RECORD_END = 11                      // RecordEnd
+} RecordEventType;
+
+typedef struct
+{
+    char magic[8];                       // RECORDING_MAGIC
+    int64_t wall_start_us;               // Wall clock when recording started (command header timestamps)
+    uint32_t server;                     // Recorded by a --server (ESC detached a client)
+    uint32_t reserved;
+} RecordingFileHeader;
+
+typedef struct
+{
+    uint16_t type;                       // RecordEventType
+    uint16_t reserved;
+    uint32_t length;                     // Payload bytes
+    int64_t time_us;                     // Microseconds since recording started
+} RecordingEventHeader;
+
+typedef struct
+{
+    int32_t tab_id;
+    uint32_t flags;
+} RecordTabPayload;
+
+typedef struct
+{
+    int32_t tab_id;
+    int32_t exit_status;
+    uint64_t block_serial;
+    int64_t duration_ms;                 // Replayed instead of the replay's own clock
+} RecordJobEnd;
+
+typedef struct
+{
+    uint64_t checksum;                   // terminal_state_checksum() when recording stopped
+    uint64_t frames;                     // Frames presented while recording
+} RecordEnd;
+
+// ============================================================================
+// GLOBAL VARIABLES
+// ============================================================================
+
+// Tab Management
+Tab tabs[MAX_TABS];                      // Array of all tabs
+int tab_count = 1;                       // Number of active tabs
+int active_tab_index = 0;                // Index of currently active tab
+int tab_bar_dirty = 0;                   // A hidden tab's activity marker changed
+
+// Frame Scheduling and X Protocol Accounting
+int redraw_pending = 0;                  // A repaint was requested during this loop iteration
+int window_has_focus = 0;                // Tracked from FocusIn/FocusOut (avoids redundant XSetInputFocus)
+Atom wm_protocols_atom = None;           // WM_PROTOCOLS, interned once at startup
+Atom wm_delete_window_atom = None;       // WM_DELETE_WINDOW, interned once at startup
+Atom clipboard_atom = None;              // CLIPBOARD selection
+Atom utf8_string_atom = None;            // UTF8_STRING conversion target
+Atom incr_atom = None;                   // INCR (large selection transfer)
+Atom paste_property_atom = None;         // Window property the selection owner writes into
+PasteTransfer paste_transfer;            // Selection conversion in flight
+Atom targets_atom = None;                // TARGETS (formats we can convert our selections to)
+Atom net_active_window_atom = None;      // _NET_ACTIVE_WINDOW (asks the window manager to focus us)
+MouseSelection mouse_selection;          // Live PRIMARY selection
+SelectionRange clipboard_range;          // Range copied with Ctrl+Shift+C (tab_id 0 if none)
+SelectionTransfer selection_transfers[MAX_SELECTION_TRANSFERS]; // Outgoing INCR transfers
+unsigned long x_round_trips = 0;         // Requests we issued that block on a server reply
+unsigned long keystroke_count = 0;       // Key presses measured
+unsigned long keystroke_requests = 0;    // Requests sent in frames that handled key presses
+unsigned long keystroke_round_trips = 0; // Round trips in frames that handled key presses
+unsigned long long x_bytes_sent = 0;     // Bytes flushed to the X server (counted only by --bench render)
+
+// Frame Cache
+Display *frame_cache_display = NULL;     // Display owning the cached pixmaps
+size_t frame_cache_bytes = 0;            // Pixmap memory currently held by all tabs
+unsigned long frame_cache_clock = 0;     // LRU clock advanced on every draw
+
+// Software Rasterizer (MIT-SHM)
+int active_renderer = RENDERER_XLIB;     // Backend used by draw_text_buffer()
+const char *renderer_names[RENDERER_COUNT] = {"xlib", "shm"};
+RenderStats render_stats[RENDERER_COUNT]; // Per-backend frame statistics
+
+// Trace Export
+TraceRing *trace_ring = NULL;            // Shared anonymous mapping (NULL = not tracing)
+char trace_path[PATH_MAX];               // MYTERM_TRACE: where the trace is written on exit
+pid_t trace_pid = 0;                     // Terminal process (children never write the file)
+int trace_ui_thread = 0;                 // Kernel thread IDs named in the trace
+_Atomic int trace_reader_thread = 0;
+const TraceKind trace_kinds[TRACE_KIND_COUNT] = {
+    {"frame", "render", 1, {"rows", "cells"}},
+    {"fork", "command", 0, {"pid", "tab"}},
+    {"exec", "command", 0, {"pid", NULL}},
+    {"first output", "command", 0, {"pid", "bytes"}},
+    {"exit", "command", 0, {"pid", "status"}},
+    {"reap", "command", 0, {"pid", "exit_code"}},
+    {"command", "command", 1, {"pid", "exit_code"}},
+    {"read", "io", 1, {"bytes", "tab"}},
+    {"history query", "query", 1, {"found", NULL}},
+    {"find query", "query", 1, {"found", NULL}},
+    {"completion", "query", 1, {"tab", NULL}},
+};
+
+// Hardware Performance Counters
+int perf_group_fd = -1;                  // Leader of the counter group (-1 = not counting)
+int perf_counter_fds[PERF_COUNTER_COUNT];
+const char *perf_counter_names[PERF_COUNTER_COUNT] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+const char *perf_phase_names[PERF_PHASE_COUNT] = {"render", "parse", "search", "completion"};
+char perf_unavailable_reason[160] = "";  // Why the counters could not be opened
+PhaseCounters phase_counters[PERF_PHASE_COUNT];
+int perf_phase_depth = 0;                // Phases begun and not yet ended (only the outermost counts)
+int perf_current_phase = -1;             // Phase the running deltas belong to
+unsigned long long perf_phase_start[PERF_COUNTER_COUNT];
+long long perf_phase_start_us = 0;
+XImage *shm_image = NULL;                // Shared client-side frame image
+XShmSegmentInfo shm_segment;             // Shared memory segment behind shm_image
+int shm_completion_event_type = -1;      // Event type of ShmCompletion (-1 until initialized)
+int shm_put_pending = 0;                 // Server may still be reading shm_image
+int shm_image_tab_id = 0;                // Tab whose frame shm_image currently holds
+volatile int shm_attach_failed = 0;      // Set by the error handler during XShmAttach
+GlyphEntry glyph_atlas[GLYPH_ATLAS_SLOTS]; // Pre-rendered glyph coverage
+unsigned char font_advance[256];         // Core font advance width per byte
+Display *glyph_display = NULL;           // Display used to capture new glyphs
+Window glyph_window = 0;                 // Window used as the capture drawable
+
+// Background Job Management
+BGProcess bg_processes[MAX_BG_JOBS];     // Array of background processes
+int job_counter = 0;                     // Counter for job ID assignment
+int bg_job_count = 0;                    // Number of active background jobs
+
+// MultiWatch Parallel Execution
+MultiWatchProcess multiwatch_processes[MAX_MULTIWATCH_COMMANDS]; // MultiWatch processes
+int multiwatch_count = 0;                // Number of active MultiWatch processes
+int multiwatch_mode = 0;                 // Whether MultiWatch mode is active
+int multiwatch_tab_id = 0;               // Tab receiving MultiWatch output
+long long multiwatch_stop_deadline = 0;  // When set, SIGKILL stragglers after this time
+
+// Asynchronous Command Execution
+CommandJob running_jobs[MAX_RUNNING_JOBS]; // Commands that have not been reaped yet
+unsigned long long output_bytes_ingested = 0; // Child output drained into tabs (reported by --bench commands)
+int next_tab_id = 1;                     // Next stable tab identifier
+
+// I/O Reader Thread
+IOChannel io_channels[MAX_IO_CHANNELS];  // Child output streams
+pthread_t io_reader_thread;              // Thread draining child fds into rings
+int io_reader_running = 0;               // Whether the reader thread was started
+int io_wake_pipe[2] = {-1, -1};          // UI -> reader: channel set changed
+int ui_notify_pipe[2] = {-1, -1};        // Reader -> UI: new bytes or EOF available
+atomic_int io_reader_shutdown;           // Asks the reader thread to exit
+atomic_int ui_notify_pending;            // Coalesces reader -> UI notifications
+
+// Scrollback Store (decoded-line LRU, UI thread)
+DecodedLine decoded_lines[DECODED_LINE_CACHE_SIZE]; // Recently decoded scrollback lines
+int decoded_line_buckets[DECODED_LINE_BUCKETS]; // Hash chains (-1 ends)
+int decoded_lru_head = -1;               // Most recently used entry
+int decoded_lru_tail = -1;               // Least recently used entry
+int decoded_lines_ready = 0;             // Buckets and list set up
+unsigned long decoded_line_misses = 0;   // Lines decoded for the cache
+DecompressedChunk decompressed_chunks[DECOMPRESSED_CHUNK_CACHE]; // Recently read compressed segments
+unsigned long decompressed_chunk_clock = 0; // LRU clock of decompressed_chunks
+unsigned long decompressed_chunk_misses = 0; // Segments decompressed for the UI thread
+
+// Scrollback Compression (background thread)
+pthread_t compressor_thread;             // Compresses sealed segments
+int compressor_running = 0;              // Whether the thread was started
+pthread_mutex_t compressor_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the lists and flag below
+pthread_cond_t compressor_wake = PTHREAD_COND_INITIALIZER;   // New job or shutdown
+CompressionJob *compressor_queue = NULL; // Waiting jobs, oldest first
+CompressionJob *compressor_queue_tail = NULL;
+CompressionJob *compressor_finished = NULL; // Done jobs for the UI thread to apply
+int compressor_shutdown = 0;             // Asks the compressor to exit
+CompressionJob *compressor_deferred = NULL; // Done jobs whose segment a search snapshot still reads (UI thread)
+size_t compressed_input_bytes = 0;       // Raw bytes of segments compressed so far
+size_t compressed_output_bytes = 0;      // What they shrank to
+
+// Memory Budget and Spill File
+size_t memory_budget_bytes = SCROLLBACK_MEMORY_BUDGET; // 0 = no budget
+size_t scrollback_resident_bytes = 0;    // Sum of every segment's resident_bytes
+unsigned long scrollback_clock = 0;      // Advanced on every segment read by the UI thread
+int spill_fd = -1;                       // Unlinked spill file (-1 until the first eviction)
+int spill_failed = 0;                    // Spilling stopped after an I/O error
+long long spill_file_size = 0;           // End of the highest extent ever used
+size_t spill_live_bytes = 0;             // Bytes of segments currently spilled
+SpillExtent *spill_free_extents = NULL;  // Free ranges below spill_file_size, by offset
+int spill_free_count = 0;
+int spill_free_capacity = 0;
+unsigned long spill_evictions = 0;       // Segments written to the spill file
+unsigned long spill_reads = 0;           // Spilled segments read back
+unsigned char spill_read_buffer[LZ4_BOUND(SCROLLBACK_SEGMENT_BYTES)]; // UI-thread staging for spilled reads
+
+// Session Snapshot
+int session_enabled = 1;                 // Off with MYTERM_SESSION=0 or when another instance owns the files
+char session_directory[PATH_MAX];        // Holds checkpoint, journal and lock
+int session_lock_fd = -1;                // flock()ed for as long as this instance writes the session
+int session_journal_fd = -1;             // Append-only journal (-1 = not open)
+off_t session_journal_bytes = 0;         // Journal size
+off_t session_checkpoint_bytes = 0;      // Size of the current checkpoint
+uint64_t session_generation = 0;         // Generation of the current checkpoint and journal
+long long next_session_journal_ms = 0;   // When the event loop next appends to the journal
+int session_tab_ids[MAX_TABS];           // Tabs the journal knows about (to record closes)
+int session_tab_id_count = 0;
+int session_active_tab_id = 0;           // Active tab as last journaled
+char session_cwd[PATH_MAX];              // Working directory as last journaled
+void *session_mappings[2];               // Checkpoint and journal mapped at startup (segments point into them)
+size_t session_mapping_lengths[2];
+
+// Detached Server
+int server_mode = 0;                     // Running as `myterm --server` (no X connection)
+volatile sig_atomic_t quit_requested = 0; // Set by the `exit` built-in and, in a server, SIGTERM
+char attach_socket_path[PATH_MAX];       // UNIX socket the server listens on
+int server_listen_fd = -1;               // Server: listening socket
+AttachConnection attached_client = {-1, NULL, 0, 0, NULL, 0, 0}; // Server: the attached X client
+AttachConnection attach_server = {-1, NULL, 0, 0, NULL, 0, 0};   // Client: connection to the server
+int attach_screen_sent = 0;              // Server: the client holds a full screen (damage can be diffed)
+wchar_t attach_sent_grid[BUFFER_ROWS][BUFFER_COLS]; // Server: rows as the client last received them
+unsigned char attach_sent_styles[BUFFER_ROWS][BUFFER_COLS];
+AttachScreenMessage attach_sent_screen;  // Server: cursor, scroll position and active tab last sent
+AttachTabEntry attach_sent_tabs[MAX_TABS]; // Server: tab bar last sent
+unsigned long attach_updates_sent = 0;   // Server: screen updates and their bytes for this client
+unsigned long long attach_bytes_sent = 0;
+unsigned char attach_row_styles[BUFFER_ROWS][BUFFER_COLS]; // Client: highlights received from the server
+
+// Control Socket
+char control_socket_path[PATH_MAX];      // Exported to children as MYTERM_CONTROL_SOCKET
+int control_listen_fd = -1;
+ControlClient control_clients[MAX_CONTROL_CLIENTS];
+int control_subscription_count = 0;      // Subscriptions of all clients (publishing is skipped at 0)
+int raise_window_requested = 0;          // A single-instance launch opened a tab; bring the window up
+
+// Session Recording and Replay
+int recording_fd = -1;                   // MYTERM_RECORD target (-1 = not recording)
+pid_t recording_pid = 0;                 // Process writing it (forked children never touch it)
+unsigned char *recording_buffer = NULL;  // Events not yet written (plain memory: a child's exit() cannot flush it)
+size_t recording_buffered = 0;
+long long recording_start_us = 0;        // Monotonic time events are stamped against
+long long recording_wall_start_us = 0;   // Wall clock at that moment
+long long recording_event_us = 0;        // Stamp of the input being applied (recording or replay)
+int recording_input_depth = 0;           // >0 while input is applied (its effects are not recorded twice)
+unsigned long long recording_frames = 0; // Frames presented while recording
+int replay_active = 0;                   // Running `--replay`: commands are never started
+
+// Tab Hibernation
+long long hibernate_idle_ms = HIBERNATE_IDLE_MS; // Hidden time before a tab hibernates (0 = never)
+long long next_hibernation_check_ms = 0; // When service_tab_hibernation() looks again
+size_t hibernation_reclaimed_total = 0;  // Bytes given back by all hibernations
+
+// Cross-Tab Search
+GlobalSearchView global_search;          // Results view and current job (UI thread)
+pthread_t global_search_workers[GLOBAL_SEARCH_WORKERS]; // Worker pool (started on first search)
+int global_search_worker_count = 0;      // Workers running
+pthread_mutex_t global_search_pool_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the two fields below
+pthread_cond_t global_search_pool_wake = PTHREAD_COND_INITIALIZER;   // New job or shutdown
+GlobalSearchJob *global_search_current_job = NULL; // Job workers should pick tasks from
+int global_search_shutdown = 0;          // Asks the workers to exit
+
+// Signal Handling
+volatile sig_atomic_t signal_received = 0;  // Flag indicating signal received
+volatile sig_atomic_t which_signal = 0;     // Which specific signal was received
+
+// ============================================================================
+// FUNCTION DECLARATIONS
+// ============================================================================
+
+// Tab and buffer management
+void initialize_text_buffer(void);
+void initialize_tab(Tab *tab, const char *name);
+void create_new_tab(void);
+void close_current_tab(void);
+void handle_tab_click(int click_x);
+void handle_button_input(int x, int y, unsigned int button);
+void activate_tab(int tab_index);
+int tab_is_visible(Tab *tab);
+
+// Command execution and processing
+void execute_command(Display *display, Window window, GC gc, Tab *tab, const char *command);
+void handle_enter_key(Display *display, Window window, GC gc, Tab *tab);
+void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_event);
+void handle_key_input(Display *display, Window window, GC gc, KeySym key_symbol, unsigned int state,
+                      const char *key_buffer, int buffer_length, Time key_time);
+int is_safe_command(const char *command);
+
+// History management
+void add_to_history(Tab *tab, const wchar_t *command);
+void free_tab_input(Tab *tab);
+void handle_history_command(Tab *tab);
+int search_history(Tab *tab, const wchar_t *search_term, int *result_index, int show_multiple);
+void enter_search_mode(Tab *tab);
+void refresh_search_prompt(Tab *tab);
+void handle_tab_completion(Tab *tab);
+
+// Scrollback store
+void scrollback_append(Tab *tab, const char *text, size_t length);
+int scrollback_line_bytes(Tab *tab, int index, const char **bytes, size_t *length);
+int scrollback_segments_line(ScrollbackSegment *const *segments, int segment_count, unsigned long line,
+                             const char **bytes, size_t *length);
+int bytes_contain(const char *bytes, size_t length, const char *needle, size_t needle_length);
+int decode_scrollback_bytes(const char *bytes, size_t length, wchar_t *row);
+int scrollback_decode_line(Tab *tab, int index, wchar_t *row);
+const wchar_t *scrollback_line(Tab *tab, int index);
+void invalidate_decoded_lines(int tab_id, unsigned long from_line);
+int scrollback_replace_lines(Tab *tab, int index, int count, const char *replacement);
+void release_scrollback_segment(ScrollbackSegment *segment);
+void free_scrollback(Tab *tab);
+
+// Scrollback compression
+size_t lz4_compress_block(const unsigned char *source, size_t length, unsigned char *output, size_t capacity);
+long lz4_decompress_block(const unsigned char *source, size_t length, unsigned char *output, size_t capacity);
+const char *scrollback_segment_data(const ScrollbackSegment *segment);
+void forget_decompressed_chunk(const ScrollbackSegment *segment);
+void queue_segment_compression(Tab *tab, ScrollbackSegment *segment);
+size_t install_compressed_segment(Tab *tab, ScrollbackSegment *segment, unsigned char *output, size_t output_length);
+int service_scrollback_compression(void);
+void stop_scrollback_compressor(void);
+
+// Memory budget and spill file
+size_t segment_resident_size(const ScrollbackSegment *segment);
+void update_segment_accounting(ScrollbackSegment *segment);
+int load_segment_bytes(const ScrollbackSegment *segment, char *buffer, unsigned char *scratch);
+void spill_release(long long offset, size_t length);
+void enforce_memory_budget(void);
+void handle_memstat_command(Tab *tab);
+void close_spill_file(void);
+
+// Session snapshot
+void restore_session(void);
+void service_session_journal(void);
+void close_session(void);
+void unmap_session_files(void);
+
+// Detached server
+int start_server(void);
+void run_server(void);
+int connect_to_server(const char *program);
+void run_attached_client(Display *display, Window window, GC gc);
+void forward_paste(const char *data, size_t length, int latin1);
+void detach_attached_client(const char *reason);
+void close_attach_connections(void);
+
+// Control socket
+int start_control_socket(void);
+int control_poll_fds(struct pollfd *fds);
+void service_control_socket(void);
+void publish_tab_output(Tab *tab, unsigned long first_line, const char *text);
+void publish_block_end(Tab *tab, const CommandBlock *block);
+void close_control_socket(void);
+void single_instance_socket_path(char *path, size_t size);
+int open_in_running_instance(const char *path);
+
+// Session recording and replay
+time_t terminal_time(void);
+int start_recording(const char *path);
+void record_input(int type, const void *head, size_t head_length, const void *data, size_t data_length);
+void record_effect(int type, const void *payload, size_t length);
+void record_tab_effect(int type, Tab *tab, const char *text, size_t length);
+void record_block_end(Tab *tab, const CommandBlock *block);
+void finish_recording(void);
+uint64_t terminal_state_checksum(void);
+int run_replay(const char *path, int paced, Display *display, Window window, GC gc);
+
+// Benchmarks
+int run_render_benchmark(Display *display, Window window, GC gc, char **names, int name_count);
+int run_command_benchmark(char **names, int name_count);
+
+// Tab hibernation
+size_t hibernate_tab(Tab *tab);
+void wake_tab(Tab *tab);
+char *encode_history_entries(const Tab *tab, int first, size_t *encoded_length, size_t *resident);
+char *inflate_history_blob(const Tab *tab);
+int thaw_tab_history(Tab *tab);
+void service_tab_hibernation(void);
+void handle_hibernate_command(Tab *tab);
+
+// Gap-buffer line editor
+size_t line_editor_length(const LineEditor *editor);
+wchar_t line_editor_char_at(const LineEditor *editor, size_t index);
+void line_editor_free(LineEditor *editor);
+void line_editor_clear(LineEditor *editor);
+int line_editor_insert(LineEditor *editor, const wchar_t *text, size_t count);
+void line_editor_delete(LineEditor *editor, size_t start, size_t count);
+int line_editor_backspace(LineEditor *editor);
+void line_editor_set_cursor(LineEditor *editor, size_t position);
+int line_editor_set_text(LineEditor *editor, const wchar_t *text);
+const wchar_t *line_editor_contents(LineEditor *editor);
+size_t line_editor_line_start(const LineEditor *editor, size_t position);
+size_t line_editor_line_end(const LineEditor *editor, size_t position);
+size_t line_editor_word_left(const LineEditor *editor);
+size_t line_editor_word_right(const LineEditor *editor);
+char *wide_to_utf8(const wchar_t *text, size_t length);
+char *line_editor_to_utf8(LineEditor *editor, int join_lines);
+
+// X selection paste
+void request_paste(Display *display, Window window, Tab *tab, Atom selection, Time request_time);
+int handle_selection_notify(Display *display, Window window, XSelectionEvent *selection_event);
+int handle_paste_property(Display *display, Window window, XPropertyEvent *property_event);
+size_t insert_pasted_text(Tab *tab, const char *text, size_t length, int latin1);
+
+// Mouse selection and copy
+int scrollback_view_start(Tab *tab);
+const wchar_t *scrollback_line_at(Tab *tab, unsigned long line);
+int get_selection_range(SelectionRange *range);
+void selection_row_span(Tab *tab, int row, int *start_col, int *end_col);
+
+// Scrollback find
+int find_literal_in_line(const wchar_t *text, int length, int from, const wchar_t *needle, int needle_length);
+const char *regex_compile(RegexDfa *dfa, const wchar_t *pattern, int pattern_length);
+int regex_find_in_line(const RegexDfa *dfa, const wchar_t *text, int length, int from, int *match_length);
+void regex_free(RegexDfa *dfa);
+int find_next_match(Tab *tab, int direction, int restart);
+void compute_row_styles(Tab *tab, int row, unsigned char *styles);
+void update_find_display(Tab *tab);
+void enter_find_mode(Tab *tab);
+void exit_find_mode(Tab *tab);
+void handle_find_keypress(Tab *tab, KeySym key_symbol, wchar_t wide_character, int shift_pressed, int control_pressed);
+
+// Cross-tab search
+static void io_notify_ui(void);
+void restart_global_search(void);
+int service_global_search(void);
+void render_global_search_view(Tab *tab);
+void global_search_row_styles(int row, unsigned char *styles);
+void update_global_search_display(Tab *tab);
+void enter_global_search(Tab *tab);
+void exit_global_search(int open_selected);
+void handle_global_search_keypress(KeySym key_symbol, wchar_t wide_character, int control_pressed);
+void stop_global_search_workers(void);
+
+// Command blocks
+CommandBlock *find_command_block(Tab *tab, unsigned long serial);
+int scrollback_display_count(Tab *tab);
+int scrollback_row_index(Tab *tab, int row);
+int scrollback_display_row(Tab *tab, int index);
+CommandBlock *folded_block_at(Tab *tab, int index);
+int set_command_block_folded(Tab *tab, CommandBlock *block, int folded);
+void begin_command_block(Tab *tab, const char *command);
+void end_command_block(Tab *tab, unsigned long serial, int exit_status);
+void trim_command_blocks(Tab *tab);
+void reveal_scrollback_line(Tab *tab, int index);
+int jump_to_command_block(Tab *tab, int direction);
+int drop_command_block_output(Tab *tab, CommandBlock *block);
+void append_fold_summary(Tab *tab, CommandBlock *block, wchar_t *row_text);
+void handle_blocks_command(Tab *tab, const char *name, const char *argument);
+void clear_mouse_selection(Display *display, Time time);
+void handle_selection_press(Display *display, XButtonEvent *button_event);
+void handle_selection_motion(XMotionEvent *motion_event);
+void handle_selection_release(Display *display, Window window, XButtonEvent *button_event);
+void copy_selection_to_clipboard(Display *display, Window window, Tab *tab, Time time);
+size_t extract_selection_text(const SelectionRange *range, unsigned long *next_line,
+                              char *output, size_t capacity, int latin1);
+void handle_selection_request(Display *display, XSelectionRequestEvent *request);
+int handle_selection_transfer_property(Display *display, XPropertyEvent *property_event);
+void handle_selection_clear(XSelectionClearEvent *clear_event);
+
+// Search and completion utilities
+int find_longest_common_substring(const char *str1, const char *str2);
+void debug_search(const char *search_term, const char *history_entry, int match_len);
+
+// Display and rendering
+void draw_text_buffer(Display *display, Window window, GC gc);
+void present_frame(Display *display, Window window, GC gc);
+void release_frame_pixmap(Tab *tab);
+void release_all_frame_pixmaps(void);
+
+// MIT-SHM software rasterizer
+long long monotonic_us(void);
+void record_render_stats(long long paint_start_us, int damaged_rows);
+void raster_fill(XImage *image, int x, int y, int width, int height, unsigned long pixel);
+void raster_draw_glyph(XImage *image, int x, int baseline_y, wchar_t character, unsigned long pixel);
+void raster_draw_string(XImage *image, int x, int baseline_y, const char *text, int length, unsigned long pixel);
+int init_shm_renderer(Display *display, Window window, GC gc);
+void shutdown_shm_renderer(Display *display);
+void shm_paint_frame(Display *display, Drawable frame, GC gc, Tab *active_tab,
+                     int *row_damaged, int header_damaged, int full_frame);
+int set_renderer(Display *display, Window window, GC gc, int renderer);
+void handle_renderer_command(Display *display, Window window, GC gc, Tab *tab, const char *requested);
+
+// Trace export
+int start_trace(const char *path);
+void trace_write(int kind, int thread_id, long long start_us, long long duration_us, long long arg0, long long arg1);
+void trace_instant(int kind, long long arg0, long long arg1);
+void trace_complete(int kind, long long start_us, long long arg0, long long arg1);
+void trace_exec(void);
+int dump_trace(const char *path);
+void finish_trace(void);
+void handle_trace_command(Tab *tab, const char *argument, const char *path);
+
+// Hardware performance counters
+int start_perf_counters(void);
+void stop_perf_counters(void);
+void perf_phase_begin(int phase);
+void perf_phase_end(void);
+void format_phase_counters(const PhaseCounters *totals, unsigned long long divisor, char *line, size_t size);
+void handle_stats_command(Tab *tab, const char *argument);
+void update_command_display(Tab *tab);
+void update_command_display_with_prompt(Tab *tab, const char *prompt);
+void render_scrollback(Tab *tab);
+void add_text_to_buffer(Tab *tab, const char *text);
+void add_separator_line(Tab *tab);
+void add_timestamp_line(Tab *tab);
+
+// Scrollback and buffer management
+void scroll_buffer(Tab *tab);
+void scroll_up(Tab *tab);
+void scroll_down(Tab *tab);
+void scroll_to_bottom(Tab *tab);
+
+// Background job management
+void handle_jobs_command(Tab *tab);
+void handle_fg_command(Tab *tab, const char *command);
+
+// MultiWatch functionality
+void handle_multiwatch_command(Display *display, Window window, GC gc, Tab *tab, const char *command);
+int service_multiwatch(void);
+void stop_multiwatch(Tab *tab, const char *reason);
+void cleanup_multiwatch(void);
+
+// Asynchronous I/O reader thread
+long long monotonic_ms(void);
+int start_io_reader(void);
+void stop_io_reader(void);
+void io_reader_wake(void);
+int acquire_io_channel(int fd, int tab_id);
+void release_io_channel(int channel_index);
+void request_channel_detach(int channel_index);
+void abandon_io_channel(int channel_index);
+int io_channel_finished(int channel_index);
+size_t byte_ring_read(ByteRing *ring, unsigned char *destination, size_t max_bytes);
+size_t drain_io_channel(int channel_index, const char *label);
+void flush_io_channel(int channel_index, const char *label);
+
+// Command job management
+Tab *find_tab_by_id(int tab_id);
+int start_command_job(Tab *tab, const char *command, pid_t *pids, int pid_count, int output_fd, long timeout_ms);
+CommandJob *find_foreground_job(Tab *tab);
+CommandJob *find_job_by_pid(pid_t pid);
+void signal_command_job(CommandJob *job, int sig);
+void cancel_tab_jobs(Tab *tab);
+void terminate_all_jobs(void);
+int service_command_jobs(void);
+int service_child_io(void);
+int io_backlog_pending(void);
+int jobs_pending(void);
+
+// Signal handlers
+void handle_sigint(int sig);
+void handle_sigtstp(int sig);
+void handle_sigsegv(int sig);
+
+// Resource cleanup
+void cleanup_resources(Display *display, Window window, GC gc);
 void cleanup_resources_default(void);
 
 // X11 error handling
@@ -226,6 +1635,13 @@ void render_scrollback(Tab *tab)
     if (!tab)
         return;
 
+    // The cross-tab results view replaces the visible tab's content while open
+    if (global_search.active && tab_is_visible(tab))
+    {
+        render_global_search_view(tab);
+        return;
+    }
+
     // Clear the entire visible text buffer with spaces
     for (int row = 0; row < BUFFER_ROWS; row++)
     {
@@ -238,31 +1654,26 @@ void render_scrollback(Tab *tab)
     int total_scrollback_lines = tab->scrollback_count;
     int visible_content_lines = BUFFER_ROWS - 2; // Reserve 1 line for command prompt + 1 empty line at bottom
 
-    // Calculate which scrollback lines to display based on current scroll offset
-    int start_display_line = total_scrollback_lines - visible_content_lines - tab->scrollback_offset;
-
-    // Ensure start line stays within valid bounds
-    if (start_display_line < 0)
-        start_display_line = 0;
-    if (start_display_line > total_scrollback_lines - visible_content_lines)
-    {
-        start_display_line = total_scrollback_lines - visible_content_lines;
-    }
-    if (start_display_line < 0)
-        start_display_line = 0;
-
-    // Copy scrollback content to visible text buffer
+    // Copy scrollback content to visible text buffer (rows map past folded command output)
     for (int visible_row = 0; visible_row < visible_content_lines; visible_row++)
     {
-        int scrollback_line_index = start_display_line + visible_row;
+        int scrollback_line_index = scrollback_row_index(tab, visible_row);
         
         // Only copy if the scrollback line exists
         if (scrollback_line_index >= 0 && scrollback_line_index < total_scrollback_lines)
         {
-            // Copy each character from scrollback buffer to visible buffer
+            // Copy the decoded line into the visible buffer
+            const wchar_t *line = scrollback_line(tab, scrollback_line_index);
             for (int col = 0; col < BUFFER_COLS; col++)
             {
-                tab->text_buffer[visible_row][col] = tab->scrollback_buffer[scrollback_line_index][col];
+                tab->text_buffer[visible_row][col] = line[col];
+            }
+
+            // A folded command shows a summary after its header
+            CommandBlock *folded_block = folded_block_at(tab, scrollback_line_index);
+            if (folded_block)
+            {
+                append_fold_summary(tab, folded_block, tab->text_buffer[visible_row]);
             }
         }
     }
@@ -280,16 +1691,17 @@ void scroll_up(Tab *tab)
     // Calculate how many lines are actually visible for content
     // (subtracting 2 lines: 1 for command prompt, 1 for empty line at bottom)
     int visible_content_area = BUFFER_ROWS - 2;
+    int display_count = scrollback_display_count(tab); // Folded output takes no rows
     
     // If we don't have more content than can fit on screen, no scrolling needed
-    if (tab->scrollback_count <= visible_content_area)
+    if (display_count <= visible_content_area)
     {
         return; // Not enough content to scroll - everything fits on screen
     }
 
     // Calculate maximum possible scroll offset
     // This represents how far we can scroll before reaching the oldest content
-    int max_scroll_offset = tab->scrollback_count - visible_content_area;
+    int max_scroll_offset = display_count - visible_content_area;
     if (max_scroll_offset < 0)
         max_scroll_offset = 0;
 
@@ -369,8 +1781,19 @@ void cleanup_resources(Display *display, Window window, GC gc)
 {
     printf("Cleaning up resources...\n");
 
-    // Step 1: Cleanup multiwatch system resources first
+    // Step 1: Cleanup multiwatch system resources and running jobs first
+    // (a recording is finished first, while every tab still shows its last screen)
+    finish_recording();
+    close_attach_connections();
+    close_control_socket();
     cleanup_multiwatch();
+    terminate_all_jobs();
+    stop_io_reader();
+    stop_global_search_workers();
+    stop_scrollback_compressor();
+    close_session();
+    stop_perf_counters();
+    finish_trace();
 
     // Step 2: Cleanup background processes gracefully
     for (int bg_index = 0; bg_index < bg_job_count; bg_index++)
@@ -425,9 +1848,25 @@ void cleanup_resources(Display *display, Window window, GC gc)
             // Mark process as terminated
             tabs[tab_index].foreground_pid = -1;
         }
+
+        // Release the tab's line editor, history strings and scrollback
+        free_tab_input(&tabs[tab_index]);
     }
+    close_spill_file();
+    unmap_session_files();
 
     // Step 4: Cleanup X11 resources in reverse creation order
+    if (display) {
+        shutdown_shm_renderer(display);
+    }
+    release_all_frame_pixmaps();
+    free(paste_transfer.data);
+    paste_transfer.data = NULL;
+    for (int slot = 0; slot < MAX_SELECTION_TRANSFERS; slot++)
+    {
+        free(selection_transfers[slot].chunk);
+        selection_transfers[slot].chunk = NULL;
+    }
     if (gc) {
         XFreeGC(display, gc);  // Free graphics context
         printf("Freed graphics context\n");
@@ -458,14 +1897,12 @@ void handle_sigsegv(int sig)
     {
         Tab *tab = &tabs[active_tab_index];
         fprintf(stderr, "Tab State:\n");
-        fprintf(stderr, "  Search mode: %d, Search position: %d\n", tab->search_mode, tab->search_pos);
-        fprintf(stderr, "  Command length: %d, History count: %d\n", tab->command_length, tab->history_count);
+        fprintf(stderr, "  Search mode: %d, Search length: %zu\n", tab->search_mode,
+                line_editor_length(&tab->search_buffer));
+        fprintf(stderr, "  Command length: %zu (capacity %zu), History count: %d\n",
+                line_editor_length(&tab->editor), tab->editor.capacity, tab->history_count);
 
-        // Safely print string buffers with length limits to prevent buffer overread
-        fprintf(stderr, "  Search buffer: '%.*s'\n", 
-                (int)sizeof(tab->search_buffer), tab->search_buffer);
-        fprintf(stderr, "  Current command: '%.*s'\n", 
-                (int)sizeof(tab->current_command), tab->current_command);
+        // The editor text is not printed: its gap buffer may be mid-update when the fault hit
     }
     else
     {
@@ -548,18 +1985,15 @@ void close_current_tab()
         return;
     }
 
-    // Safely terminate any running process in the tab being closed
-    if (tabs[active_tab_index].foreground_pid > 0)
-    {
-        printf("Terminating process in tab %d (PID: %d)\n", 
-               active_tab_index, tabs[active_tab_index].foreground_pid);
-        
-        // Send termination signal to the foreground process
-        kill(tabs[active_tab_index].foreground_pid, SIGTERM);
-        
-        // Wait for the process to fully terminate to prevent zombie processes
-        waitpid(tabs[active_tab_index].foreground_pid, NULL, 0);
-    }
+    // Terminate any jobs running in the tab being closed; they are reaped
+    // asynchronously by the event loop so a stubborn child cannot hang the UI
+    cancel_tab_jobs(&tabs[active_tab_index]);
+
+    // Give the closed tab's cached frame back to the X server
+    release_frame_pixmap(&tabs[active_tab_index]);
+
+    // Free the closed tab's editor, history and scrollback (the shift below only moves pointers)
+    free_tab_input(&tabs[active_tab_index]);
 
     // Shift all subsequent tabs left to fill the gap left by the closed tab
     for (int target_index = active_tab_index; target_index < tab_count - 1; target_index++)
@@ -576,8 +2010,8 @@ void close_current_tab()
         active_tab_index = tab_count - 1;
     }
 
-    // Mark the new active tab as active
-    tabs[active_tab_index].active = 1;
+    // Mark the new active tab as active (materializing its grid if it was hidden)
+    activate_tab(active_tab_index);
 
     printf("Tab closed. Now %d tabs remaining. Active tab: %d\n", 
            tab_count, active_tab_index);
@@ -599,20 +2033,18 @@ void create_new_tab()
         // Step 1: Initialize the tab structure with zeros to ensure clean state
         memset(new_tab, 0, sizeof(Tab));
 
-        // Step 2: Set basic tab properties and state
-        new_tab->cursor_buffer_pos = 0;      // Cursor at start of command line
-        new_tab->command_length = 0;         // No command entered yet
+        // Step 2: Set basic tab properties and state (the zeroed editor is already empty)
         new_tab->cursor_row = BUFFER_ROWS - 1; // Cursor on bottom row (command line)
         new_tab->cursor_col = 2;             // Start after "> " prompt
         new_tab->foreground_pid = -1;        // No active process
         new_tab->history_count = 0;          // No command history yet
         new_tab->history_current = -1;       // Not browsing history
         new_tab->search_mode = 0;            // Search mode inactive
-        new_tab->search_pos = 0;             // No search text entered
+        new_tab->next_block_serial = 1;      // Serial 0 means "no block"
         new_tab->active = 0;                 // Not active yet (will be activated separately)
 
-        // Initialize search buffer to empty
-        memset(new_tab->search_buffer, 0, MAX_COMMAND_LENGTH);
+        // Assign a stable identifier used by jobs and I/O channels
+        new_tab->tab_id = next_tab_id++;
 
         // Copy tab name with safety null-termination
         snprintf(new_tab->tab_name, MAX_TAB_NAME, "%s", tab_name);
@@ -651,9 +2083,6 @@ void create_new_tab()
         new_tab->text_buffer[BUFFER_ROWS - 1][0] = '>';  // Prompt character
         new_tab->text_buffer[BUFFER_ROWS - 1][1] = ' ';  // Space after prompt
 
-        // Step 6: Initialize current command buffer
-        memset(new_tab->current_command, 0, MAX_COMMAND_LENGTH);
-
         // Successfully added the new tab
         tab_count++;
         
@@ -687,15 +2116,8 @@ void handle_tab_click(int click_x)
     // Validate the calculated tab index is within bounds
     if (clicked_tab_index >= 0 && clicked_tab_index < tab_count)
     {
-        // Deactivate the currently active tab if it exists and is valid
-        if (active_tab_index >= 0 && active_tab_index < tab_count)
-        {
-            tabs[active_tab_index].active = 0;
-        }
-
         // Activate the clicked tab
-        active_tab_index = clicked_tab_index;
-        tabs[active_tab_index].active = 1;
+        activate_tab(clicked_tab_index);
 
         printf("Switched to tab %d: %s\n", active_tab_index, tabs[active_tab_index].tab_name);
     }
@@ -706,6 +2128,66 @@ void handle_tab_click(int click_x)
     }
 }
 
+// Function to apply a mouse button the window or an attached client received
+// (tab bar clicks and the wheel; selection and paste buttons are handled by the window)
+void handle_button_input(int x, int y, unsigned int button)
+{
+    AttachButtonMessage message = {x, y, button, 0};
+    record_input(RECORD_BUTTON, &message, sizeof(message), NULL, 0);
+    recording_input_depth++;
+
+    if (y < CHAR_HEIGHT)
+        handle_tab_click(x);
+    else if (button == 4)
+        scroll_up(&tabs[active_tab_index]);
+    else if (button == 5)
+        scroll_down(&tabs[active_tab_index]);
+
+    recording_input_depth--;
+}
+
+// Function to make a tab the visible one, materializing its grid if output
+// arrived while it was hidden
+void activate_tab(int tab_index)
+{
+    // Safety check: ignore indices outside the live tab range
+    if (tab_index < 0 || tab_index >= tab_count)
+        return;
+
+    // Step 1: Exactly one tab is marked active (the one left starts its idle time)
+    for (int other_index = 0; other_index < tab_count; other_index++)
+    {
+        if (tabs[other_index].active && other_index != tab_index)
+            tabs[other_index].last_viewed_ms = monotonic_ms();
+        tabs[other_index].active = (other_index == tab_index);
+    }
+    active_tab_index = tab_index;
+
+    Tab *tab = &tabs[tab_index];
+    wake_tab(tab);
+
+    // Step 2: Hidden tabs only ingest into scrollback; rebuild the grid once now
+    if (tab->grid_stale || global_search.active)
+    {
+        render_scrollback(tab);
+        tab->grid_stale = 0;
+    }
+    else
+    {
+        update_command_display(tab);
+    }
+
+    // Step 3: The user is looking at it, so its output is no longer unseen
+    tab->has_activity = 0;
+}
+
+// Function to check whether a tab is the one currently drawn
+int tab_is_visible(Tab *tab)
+{
+    return tab && active_tab_index >= 0 && active_tab_index < tab_count &&
+           tab == &tabs[active_tab_index];
+}
+
 // Function to scroll the entire buffer up by one line
 void scroll_buffer(Tab *tab)
 {
@@ -747,74 +2229,38 @@ void add_text_to_buffer(Tab *tab, const char *text)
     if (!tab || !text)
         return;
 
-    // Step 1: Convert UTF-8 input to wide characters for display
-    wchar_t wide_buffer[OUTPUT_BUFFER_SIZE];
-    memset(wide_buffer, 0, sizeof(wide_buffer));
+    // Step 1: Store the raw bytes; lines are decoded only when they are viewed
+    unsigned long first_line_before = tab->scrollback_first_line;
+    unsigned long appended_line = tab->scrollback_first_line + tab->scrollback_count;
+    size_t text_length = strlen(text);
+    record_tab_effect(RECORD_OUTPUT, tab, text, text_length);
+    scrollback_append(tab, text, text_length);
+    publish_tab_output(tab, appended_line, text);
 
-    size_t converted_chars = mbstowcs(wide_buffer, text, OUTPUT_BUFFER_SIZE - 1);
-    
-    // Handle UTF-8 conversion failure with ASCII fallback
-    if (converted_chars == (size_t)-1)
+    // Step 2: Forget command blocks whose lines left the scrollback
+    if (tab->scrollback_first_line != first_line_before)
     {
-        // Conversion failed - fall back to simple ASCII character copying
-        for (int i = 0; text[i] != '\0' && i < OUTPUT_BUFFER_SIZE - 1; i++)
-        {
-            wide_buffer[i] = (wchar_t)(unsigned char)text[i];
-        }
-        wide_buffer[OUTPUT_BUFFER_SIZE - 1] = L'\0'; // Ensure null termination
+        trim_command_blocks(tab);
     }
 
-    // Step 2: Process the text for scrollback buffer storage
-    wchar_t scrollback_copy[OUTPUT_BUFFER_SIZE];
-    wcscpy(scrollback_copy, wide_buffer); // Create working copy for line splitting
-
-    wchar_t *current_line = scrollback_copy;
-    wchar_t *newline_position;
-
-    // Split the input text into individual lines based on newline characters
-    do
-    {
-        // Find the next newline character in the current line
-        newline_position = wcschr(current_line, L'\n');
-        if (newline_position)
-        {
-            *newline_position = L'\0'; // Temporarily terminate at newline
-        }
-
-        // Add the current line to scrollback buffer
-        if (tab->scrollback_count < SCROLLBACK_LINES)
-        {
-            // We have space - add to the end of scrollback buffer
-            wcsncpy(tab->scrollback_buffer[tab->scrollback_count], current_line, BUFFER_COLS - 1);
-            tab->scrollback_buffer[tab->scrollback_count][BUFFER_COLS - 1] = L'\0';
-            tab->scrollback_count++;
-        }
-        else
-        {
-            // Scrollback buffer is full - shift all lines up to make space
-            for (int i = 1; i < SCROLLBACK_LINES; i++)
-            {
-                wcscpy(tab->scrollback_buffer[i - 1], tab->scrollback_buffer[i]);
-            }
-            // Add new line at the bottom
-            wcsncpy(tab->scrollback_buffer[SCROLLBACK_LINES - 1], current_line, BUFFER_COLS - 1);
-            tab->scrollback_buffer[SCROLLBACK_LINES - 1][BUFFER_COLS - 1] = L'\0';
-        }
-
-        // Move to next line if we found a newline
-        if (newline_position)
-        {
-            current_line = newline_position + 1;
-        }
-    } while (newline_position);
-
     // Step 3: Reset scroll position when new text is added
     // This ensures we're always viewing the most recent content by default
     tab->scrollback_offset = 0;
     tab->max_scrollback_offset = 0;
 
-    // Step 4: Update the display to show the new content
-    render_scrollback(tab);
+    // Step 4: Only the visible tab renders; hidden tabs are materialized on activation
+    if (tab_is_visible(tab))
+    {
+        render_scrollback(tab);
+        return;
+    }
+
+    tab->grid_stale = 1;
+    if (!tab->has_activity)
+    {
+        tab->has_activity = 1;
+        tab_bar_dirty = 1; // The tab bar needs to show the activity marker
+    }
 }
 
 // Helper function to add a visual separator line between command outputs
@@ -823,6 +2269,14 @@ void add_separator_line(Tab *tab)
     // Safety check: ensure we have a valid tab
     if (!tab)
         return;
+    record_tab_effect(RECORD_SEPARATOR, tab, NULL, 0);
+
+    // Hidden tabs never touch their grid; it is rebuilt when the tab is activated
+    if (!tab_is_visible(tab))
+    {
+        tab->grid_stale = 1;
+        return;
+    }
 
     // Step 1: Manage cursor position - make room for the separator line
     if (tab->cursor_row >= BUFFER_ROWS - 1)
@@ -881,6 +2335,13 @@ void add_timestamp_line(Tab *tab)
     if (!tab)
         return;
 
+    // Hidden tabs never touch their grid; it is rebuilt when the tab is activated
+    if (!tab_is_visible(tab))
+    {
+        tab->grid_stale = 1;
+        return;
+    }
+
     // Step 1: Manage cursor position - make room for the timestamp line
     if (tab->cursor_row >= BUFFER_ROWS - 1)
     {
@@ -897,7 +2358,7 @@ void add_timestamp_line(Tab *tab)
     tab->cursor_col = 0;
 
     // Step 2: Generate formatted timestamp string
-    time_t current_time = time(NULL);
+    time_t current_time = terminal_time();
     struct tm *time_info = localtime(&current_time);
     char timestamp[64];
     
@@ -945,69 +2406,123 @@ void update_command_display(Tab *tab)
     // This provides visual separation between the command input and previous output
     int command_row = BUFFER_ROWS - 2;
 
+    // Find mode and the cross-tab search own the command row until they are left
+    if (global_search.active && tab_is_visible(tab))
+    {
+        update_global_search_display(tab);
+        return;
+    }
+    if (tab->find.active)
+    {
+        update_find_display(tab);
+        return;
+    }
+
     // Step 1: Clear the entire command line to remove any previous content
     for (int col = 0; col < BUFFER_COLS; col++)
     {
         tab->text_buffer[command_row][col] = L' ';
     }
 
-    // Step 2: Display the command prompt "> " at the beginning of the line
-    tab->text_buffer[command_row][0] = L'>';  // Prompt character
+    // Step 2: Find the logical line of a multi-line command that holds the cursor
+    LineEditor *editor = &tab->editor;
+    size_t line_start = line_editor_line_start(editor, editor->cursor);
+    size_t line_end = line_editor_line_end(editor, editor->cursor);
+    size_t cursor_in_line = editor->cursor - line_start;
+
+    // Step 3: Scroll horizontally so the cursor stays visible on long lines
+    size_t visible_columns = BUFFER_COLS - 2;
+    size_t view_start = 0;
+    if (cursor_in_line >= visible_columns)
+    {
+        view_start = cursor_in_line - visible_columns + 1;
+    }
+
+    // Step 4: Display the prompt - "> " first line, "+ " continuation, "< " scrolled
+    wchar_t prompt_character = L'>';
+    if (view_start > 0)
+        prompt_character = L'<';
+    else if (line_start > 0)
+        prompt_character = L'+';
+    tab->text_buffer[command_row][0] = prompt_character;
     tab->text_buffer[command_row][1] = L' ';  // Space after prompt
 
-    // Step 3: Display the current command text after the prompt
-    int display_col = 2; // Start after "> " prompt
+    // Step 5: Display the visible slice of the line after the prompt
+    int display_col = 2; // Start after the prompt
     
-    for (int command_index = 0; 
-         command_index < tab->command_length && display_col < BUFFER_COLS; 
+    for (size_t command_index = line_start + view_start; 
+         command_index < line_end && display_col < BUFFER_COLS; 
          command_index++)
     {
-        tab->text_buffer[command_row][display_col] = tab->current_command[command_index];
+        tab->text_buffer[command_row][display_col] = line_editor_char_at(editor, command_index);
         display_col++;
     }
 
-    // Step 4: Position the cursor appropriately within the command
-    // Cursor position is offset by 2 to account for the "> " prompt
-    tab->cursor_col = 2 + tab->cursor_buffer_pos;
+    // Step 6: Position the cursor appropriately within the command
+    // Cursor position is offset by 2 to account for the prompt
+    tab->cursor_col = 2 + (int)(cursor_in_line - view_start);
     
     // Set cursor to the command row (second-to-last row)
     tab->cursor_row = command_row;
 }
 
-void handle_tab_completion(Tab *tab)
+// Function to replace the word [word_start, cursor) with a completed filename
+static void replace_completion_word(Tab *tab, size_t word_start, const char *completion)
+{
+    // Convert the filename back to wide characters (ASCII fallback on failure)
+    size_t completion_length = strlen(completion);
+    wchar_t wide_completion[MAX_COMMAND_LENGTH];
+    if (completion_length >= MAX_COMMAND_LENGTH)
+        return; // Completions are filenames, never this long
+    size_t converted = mbstowcs(wide_completion, completion, completion_length + 1);
+    if (converted == (size_t)-1)
+    {
+        for (converted = 0; converted < completion_length; converted++)
+        {
+            wide_completion[converted] = (wchar_t)(unsigned char)completion[converted];
+        }
+    }
+
+    // Only the word is replaced - text after the cursor is kept
+    line_editor_delete(&tab->editor, word_start, tab->editor.cursor - word_start);
+    line_editor_set_cursor(&tab->editor, word_start);
+    line_editor_insert(&tab->editor, wide_completion, converted);
+}
+
+static void complete_current_word(Tab *tab)
 {
     // Step 1: Extract the current word being typed (from last space to cursor position)
-    int word_start = tab->cursor_buffer_pos - 1;
+    LineEditor *editor = &tab->editor;
+    size_t word_start = editor->cursor;
     
     // Find the start of the current word by searching backwards for a space
-    while (word_start >= 0 && tab->current_command[word_start] != L' ')
+    while (word_start > 0 && !iswspace(line_editor_char_at(editor, word_start - 1)))
     {
         word_start--;
     }
-    word_start++; // Move to the first character of the word (after the space)
-
-    // Calculate the length of the word to complete
-    int word_length = tab->cursor_buffer_pos - word_start;
 
     // If no word to complete, exit early
-    if (word_length <= 0)
+    if (editor->cursor == word_start)
     {
         return;
     }
 
     // Step 2: Convert wide character word to multibyte for filesystem operations
-    char current_word[MAX_COMMAND_LENGTH];
-    size_t converted = wcstombs(current_word, &tab->current_command[word_start], word_length);
-    
-    // Handle conversion failure with ASCII fallback
-    if (converted == (size_t)-1)
+    char *word_text = wide_to_utf8(line_editor_contents(editor) + word_start, editor->cursor - word_start);
+    if (!word_text)
     {
-        for (int i = 0; i < word_length && i < MAX_COMMAND_LENGTH - 1; i++)
-        {
-            current_word[i] = (char)tab->current_command[word_start + i];
-        }
+        return;
+    }
+    if (strlen(word_text) >= MAX_COMMAND_LENGTH)
+    {
+        // Longer than any filename - nothing can match
+        free(word_text);
+        return;
     }
-    current_word[word_length] = '\0'; // Ensure null termination
+    char current_word[MAX_COMMAND_LENGTH];
+    snprintf(current_word, sizeof(current_word), "%s", word_text);
+    free(word_text);
+    size_t word_length = strlen(current_word);
 
     // Step 3: Scan current directory for filename matches
     DIR *directory = opendir(".");
@@ -1076,35 +2591,12 @@ void handle_tab_completion(Tab *tab)
     else if (match_count == 1)
     {
         // Single match found - complete the word automatically
-        char *completion = matches[0];
-        int completion_length = strlen(completion);
+        replace_completion_word(tab, word_start, matches[0]);
 
-        // Replace current word with the complete filename
-        for (int i = 0; i < completion_length; i++)
+        // Add a trailing space when the completed word ends the line
+        if (editor->cursor == line_editor_length(editor))
         {
-            if (word_start + i < MAX_COMMAND_LENGTH - 1)
-            {
-                tab->current_command[word_start + i] = (wchar_t)completion[i];
-            }
-        }
-
-        // Update command buffer state
-        int new_command_length = word_start + completion_length;
-        if (new_command_length < MAX_COMMAND_LENGTH)
-        {
-            tab->current_command[new_command_length] = L'\0';
-            tab->command_length = new_command_length;
-            tab->cursor_buffer_pos = new_command_length;
-        }
-
-        // Add trailing space if we're not at the end of the line
-        if (tab->cursor_buffer_pos < MAX_COMMAND_LENGTH - 1 && 
-            tab->current_command[tab->cursor_buffer_pos] == L'\0')
-        {
-            tab->current_command[tab->cursor_buffer_pos] = L' ';
-            tab->command_length++;
-            tab->current_command[tab->command_length] = L'\0';
-            tab->cursor_buffer_pos++;
+            line_editor_insert(editor, L" ", 1);
         }
     }
     else
@@ -1113,26 +2605,7 @@ void handle_tab_completion(Tab *tab)
         if (strlen(common_prefix) > word_length)
         {
             // Complete to the longest common prefix of all matches
-            char *completion = common_prefix;
-            int completion_length = strlen(completion);
-
-            // Replace current word with common prefix
-            for (int i = 0; i < completion_length; i++)
-            {
-                if (word_start + i < MAX_COMMAND_LENGTH - 1)
-                {
-                    tab->current_command[word_start + i] = (wchar_t)completion[i];
-                }
-            }
-
-            // Update command buffer state
-            int new_command_length = word_start + completion_length;
-            if (new_command_length < MAX_COMMAND_LENGTH)
-            {
-                tab->current_command[new_command_length] = L'\0';
-                tab->command_length = new_command_length;
-                tab->cursor_buffer_pos = new_command_length;
-            }
+            replace_completion_word(tab, word_start, common_prefix);
         }
 
         // Step 5: Display all available matches to the user
@@ -1187,57 +2660,63 @@ void handle_tab_completion(Tab *tab)
     update_command_display(tab);
 }
 
+// Function to complete the word before the cursor (a completion phase for the hardware counters)
+void handle_tab_completion(Tab *tab)
+{
+    long long query_start_us = monotonic_us();
+    perf_phase_begin(PERF_PHASE_COMPLETION);
+    complete_current_word(tab);
+    perf_phase_end();
+    trace_complete(TRACE_COMPLETION, query_start_us, tab->tab_id, 0);
+}
+
 // Function to add a command to the command history
-void add_to_history(Tab *tab, const char *command)
+void add_to_history(Tab *tab, const wchar_t *command)
 {
     // Skip empty commands to avoid cluttering history
-    if (strlen(command) == 0)
+    if (wcslen(command) == 0)
         return;
 
-    // Step 1: Convert multibyte command to wide characters for consistent storage
-    wchar_t wide_command[MAX_COMMAND_LENGTH];
-    size_t converted_chars = mbstowcs(wide_command, command, MAX_COMMAND_LENGTH - 1);
-    
-    // Handle UTF-8 conversion failure with ASCII fallback
-    if (converted_chars == (size_t)-1)
-    {
-        // Fallback: convert character by character
-        for (int i = 0; command[i] != '\0' && i < MAX_COMMAND_LENGTH - 1; i++)
-        {
-            wide_command[i] = (wchar_t)(unsigned char)command[i];
-        }
-        wide_command[strlen(command)] = L'\0'; // Ensure null termination
-    }
+    // A tab that was never shown since it hibernated (or was restored) still has its history packed
+    thaw_tab_history(tab);
 
-    // Step 2: Check for duplicate commands (don't add consecutive duplicates)
+    // Step 1: Check for duplicate commands (don't add consecutive duplicates)
     if (tab->history_count > 0)
     {
         // Compare with the most recent history entry
         int last_history_index = tab->history_count - 1;
-        if (wcscmp(tab->command_history[last_history_index], wide_command) == 0)
+        if (wcscmp(tab->command_history[last_history_index], command) == 0)
         {
             return; // Skip if this command is same as the previous one
         }
     }
 
+    // Step 2: Keep a heap copy sized to the command (entries are no longer capped)
+    wchar_t *history_entry = wcsdup(command);
+    if (!history_entry)
+    {
+        printf("Error: Out of memory adding command to history\n");
+        return;
+    }
+
     // Step 3: Add command to history storage
     if (tab->history_count < MAX_HISTORY_SIZE)
     {
         // History has space - add to the end
-        wcscpy(tab->command_history[tab->history_count], wide_command);
+        tab->command_history[tab->history_count] = history_entry;
         tab->history_count++;
     }
     else
     {
-        // History is full - remove oldest entry and shift others up
-        for (int i = 1; i < MAX_HISTORY_SIZE; i++)
-        {
-            wcscpy(tab->command_history[i - 1], tab->command_history[i]);
-        }
+        // History is full - drop the oldest entry and shift the pointers up
+        free(tab->command_history[0]);
+        memmove(&tab->command_history[0], &tab->command_history[1],
+                (MAX_HISTORY_SIZE - 1) * sizeof(tab->command_history[0]));
         // Add new command to the end (now available after shift)
-        wcscpy(tab->command_history[MAX_HISTORY_SIZE - 1], wide_command);
+        tab->command_history[MAX_HISTORY_SIZE - 1] = history_entry;
         // Note: history_count remains MAX_HISTORY_SIZE since we're at capacity
     }
+    tab->history_serial++;               // The session journal picks it up
 
     // Step 4: Reset history navigation to the end (most recent command)
     tab->history_current = tab->history_count;
@@ -1246,6 +2725,27 @@ void add_to_history(Tab *tab, const char *command)
     // This allows easy navigation when using up/down arrows
 }
 
+// Function to release a tab's line editor, search term, history strings and scrollback
+void free_tab_input(Tab *tab)
+{
+    free_scrollback(tab);
+    line_editor_free(&tab->editor);
+    line_editor_free(&tab->search_buffer);
+    regex_free(&tab->find.dfa);
+    tab->find.active = 0;
+
+    for (int history_index = 0; history_index < tab->history_count; history_index++)
+    {
+        free(tab->command_history[history_index]);
+        tab->command_history[history_index] = NULL;
+    }
+    free(tab->history_blob);
+    tab->history_blob = NULL;
+    tab->hibernated = 0;
+    tab->history_count = 0;
+    tab->history_current = -1;
+}
+
 // Simple and reliable longest common substring function
 int find_longest_common_substring(const char *str1, const char *str2)
 {
@@ -1338,14 +2838,11 @@ void enter_search_mode(Tab *tab)
 
     // Step 1: Activate search mode and initialize search state
     tab->search_mode = 1;        // Enable search mode flag
-    tab->search_pos = 0;         // Start with empty search string
-    memset(tab->search_buffer, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t)); // Clear search buffer
+    line_editor_clear(&tab->search_buffer); // Start with empty search string
 
     // Step 2: Clear the current command line to prepare for search interface
     // This ensures the command line shows search prompts instead of regular commands
-    memset(tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-    tab->command_length = 0;     // Reset command length
-    tab->cursor_buffer_pos = 0;  // Reset cursor position
+    line_editor_clear(&tab->editor);
 
     // Step 3: Update display to show search prompt and mode
     // The prompt "(reverse-i-search)`': " indicates we're in reverse incremental search mode
@@ -1353,6 +2850,36 @@ void enter_search_mode(Tab *tab)
     update_command_display_with_prompt(tab, "(reverse-i-search)`': ");
 }
 
+// Function to redraw the reverse-i-search prompt with the best match for the current term
+void refresh_search_prompt(Tab *tab)
+{
+    char search_prompt[256];
+    size_t search_length = line_editor_length(&tab->search_buffer);
+    char *multibyte_search = wide_to_utf8(line_editor_contents(&tab->search_buffer), search_length);
+    if (!multibyte_search)
+        return;
+
+    // Perform search with the updated term
+    int found_index = -1;
+    int search_result = search_history(tab, line_editor_contents(&tab->search_buffer), &found_index, 0);
+
+    if (search_result == 1)
+    {
+        const wchar_t *found_command = tab->command_history[found_index];
+        char *multibyte_found = wide_to_utf8(found_command, wcslen(found_command));
+        snprintf(search_prompt, sizeof(search_prompt), "(reverse-i-search)`%s': %s", multibyte_search,
+                 multibyte_found ? multibyte_found : "");
+        free(multibyte_found);
+    }
+    else
+    {
+        snprintf(search_prompt, sizeof(search_prompt), "(reverse-i-search)`%s': ", multibyte_search);
+    }
+    free(multibyte_search);
+
+    update_command_display_with_prompt(tab, search_prompt);
+}
+
 // Debug function to trace search matching behavior
 // This helps diagnose issues with reverse-i-search functionality
 void debug_search(const char *search_term, const char *history_entry, int match_len)
@@ -1362,32 +2889,19 @@ void debug_search(const char *search_term, const char *history_entry, int match_
 }
 
 // Enhanced search_history function with proper multiple match display
-int search_history(Tab *tab, const wchar_t *search_term, wchar_t *result, int show_multiple)
+static int find_history_matches(Tab *tab, const wchar_t *search_term, int *result_index, int show_multiple)
 {
     // Step 1: Validate input parameters
-    if (!tab || !search_term || !result || wcslen(search_term) == 0)
+    if (!tab || !search_term || !result_index || wcslen(search_term) == 0)
     {
         return 0; // Invalid input or empty search term
     }
-    
-    // Ensure search term doesn't exceed buffer limits
-    if (wcslen(search_term) >= MAX_COMMAND_LENGTH)
-    {
-        return 0;
-    }
 
     // Step 2: Convert wide character search term to multibyte for string comparison
-    char multibyte_search[MAX_COMMAND_LENGTH * 4] = {0};
-    size_t converted_chars = wcstombs(multibyte_search, search_term, sizeof(multibyte_search) - 1);
-    
-    // Handle conversion failure with ASCII fallback
-    if (converted_chars == (size_t)-1)
+    char *multibyte_search = wide_to_utf8(search_term, wcslen(search_term));
+    if (!multibyte_search)
     {
-        for (int i = 0; i < MAX_COMMAND_LENGTH - 1 && search_term[i] != L'\0'; i++)
-        {
-            multibyte_search[i] = (char)search_term[i];
-        }
-        multibyte_search[wcslen(search_term)] = '\0';
+        return 0;
     }
 
     // Constants for match management
@@ -1396,15 +2910,14 @@ int search_history(Tab *tab, const wchar_t *search_term, wchar_t *result, int sh
     // Structure to store matching history entries with metadata
     typedef struct
     {
-        wchar_t command[MAX_COMMAND_LENGTH]; // The matching command text
         int match_length;                    // Length of the common substring match
-        int history_index;                   // Original position in history array
+        int history_index;                   // Position of the command in the history array
     } HistoryMatch;
 
-    HistoryMatch matches[MAX_DISPLAY_MATCHES] = {0};
+    HistoryMatch matches[MAX_DISPLAY_MATCHES] = {0}; // Best matches first, newest first among equals
     int match_count = 0;
 
-    // Step 3: Search through command history from most recent to oldest
+    // Step 3: Rank every history entry from most recent to oldest, keeping the best few for display
     for (int history_index = tab->history_count - 1; history_index >= 0; history_index--)
     {
         // Skip empty history entries
@@ -1412,32 +2925,30 @@ int search_history(Tab *tab, const wchar_t *search_term, wchar_t *result, int sh
             continue;
 
         // Convert history entry to multibyte for substring comparison
-        char multibyte_history[MAX_COMMAND_LENGTH * 4] = {0};
-        converted_chars = wcstombs(multibyte_history, tab->command_history[history_index], 
-                                 sizeof(multibyte_history) - 1);
-        if (converted_chars == (size_t)-1)
-        {
-            // Fallback conversion for non-UTF-8 strings
-            for (int j = 0; j < MAX_COMMAND_LENGTH - 1 && tab->command_history[history_index][j] != L'\0'; j++)
-            {
-                multibyte_history[j] = (char)tab->command_history[history_index][j];
-            }
-            multibyte_history[wcslen(tab->command_history[history_index])] = '\0';
-        }
+        char *multibyte_history = wide_to_utf8(tab->command_history[history_index],
+                                               wcslen(tab->command_history[history_index]));
+        if (!multibyte_history)
+            continue;
 
         // Calculate match quality using longest common substring
         int match_length = find_longest_common_substring(multibyte_search, multibyte_history);
+        free(multibyte_history);
 
-        // Store match if it meets minimum criteria and we have space
-        if (match_length >= 1 && match_count < MAX_DISPLAY_MATCHES)
-        {
-            matches[match_count].match_length = match_length;
-            matches[match_count].history_index = history_index;
-            wcsncpy(matches[match_count].command, tab->command_history[history_index], MAX_COMMAND_LENGTH - 1);
-            matches[match_count].command[MAX_COMMAND_LENGTH - 1] = L'\0';
+        // Store match if it meets minimum criteria and beats one already kept
+        if (match_length < 1)
+            continue;
+        int position = match_count;
+        while (position > 0 && matches[position - 1].match_length < match_length)
+            position--;
+        if (position >= MAX_DISPLAY_MATCHES)
+            continue;
+        if (match_count < MAX_DISPLAY_MATCHES)
             match_count++;
-        }
+        memmove(&matches[position + 1], &matches[position], (match_count - 1 - position) * sizeof(matches[0]));
+        matches[position].match_length = match_length;
+        matches[position].history_index = history_index;
     }
+    free(multibyte_search);
 
     // Step 4: Handle no matches found
     if (match_count == 0)
@@ -1455,46 +2966,43 @@ int search_history(Tab *tab, const wchar_t *search_term, wchar_t *result, int sh
         for (int match_index = 0; match_index < match_count; match_index++)
         {
             char display_line[256];
-            char multibyte_command[MAX_COMMAND_LENGTH * 4] = {0};
-
-            // Convert matching command to multibyte for display
-            wcstombs(multibyte_command, matches[match_index].command, sizeof(multibyte_command) - 1);
-            multibyte_command[sizeof(multibyte_command) - 1] = '\0';
+            const wchar_t *command = tab->command_history[matches[match_index].history_index];
+            char *multibyte_command = wide_to_utf8(command, wcslen(command));
 
             // Format: "  1: ls -la", "  2: ls -l", etc.
-            snprintf(display_line, sizeof(display_line), "  %d: %s", match_index + 1, multibyte_command);
+            snprintf(display_line, sizeof(display_line), "  %d: %.200s", match_index + 1,
+                     multibyte_command ? multibyte_command : "");
             add_text_to_buffer(tab, display_line);
+            free(multibyte_command);
         }
 
         add_text_to_buffer(tab, "Press number to select or refine search");
         return match_count; // Return count of matches for selection handling
     }
 
-    // Step 6: Return the single best match (longest common substring)
-    if (match_count > 0)
-    {
-        // Find the match with the longest common substring
-        int best_match_index = 0;
-        for (int match_index = 1; match_index < match_count; match_index++)
-        {
-            if (matches[match_index].match_length > matches[best_match_index].match_length)
-            {
-                best_match_index = match_index;
-            }
-        }
-        
-        // Copy the best matching command to the result buffer
-        wcsncpy(result, matches[best_match_index].command, MAX_COMMAND_LENGTH - 1);
-        result[MAX_COMMAND_LENGTH - 1] = L'\0';
-        return 1; // Success: single match returned
-    }
+    // Step 6: Return the single best match (longest common substring, kept first)
+    // Report which history entry matched; the caller copies it into its editor
+    *result_index = matches[0].history_index;
+    return 1; // Success: single match returned
+}
 
-    return 0; // No matches found (fallback)
+// Function to search the history (a search phase for the hardware counters)
+int search_history(Tab *tab, const wchar_t *search_term, int *result_index, int show_multiple)
+{
+    long long query_start_us = monotonic_us();
+    perf_phase_begin(PERF_PHASE_SEARCH);
+    if (tab)
+        thaw_tab_history(tab);
+    int result = find_history_matches(tab, search_term, result_index, show_multiple);
+    perf_phase_end();
+    trace_complete(TRACE_HISTORY_QUERY, query_start_us, result, 0);
+    return result;
 }
 
 void handle_history_command(Tab *tab)
 {
     // Step 1: Check if there is any command history to display
+    thaw_tab_history(tab);
     if (tab->history_count == 0)
     {
         add_text_to_buffer(tab, "No command history");
@@ -1515,38 +3023,18 @@ void handle_history_command(Tab *tab)
     for (int history_index = start_index; history_index < tab->history_count; history_index++)
     {
         char formatted_line[256];
-        char multibyte_command[MAX_COMMAND_LENGTH * 4] = {0};
 
         // Step 4: Convert wide character command to multibyte for display
-        size_t converted_chars = wcstombs(multibyte_command, 
-                                        tab->command_history[history_index], 
-                                        sizeof(multibyte_command) - 1);
-        
-        // Handle UTF-8 conversion failure with ASCII fallback
-        if (converted_chars == (size_t)-1)
-        {
-            // Fallback: convert each wide character individually
-            int char_index;
-            for (char_index = 0; 
-                 char_index < MAX_COMMAND_LENGTH - 1 && 
-                 tab->command_history[history_index][char_index] != L'\0'; 
-                 char_index++)
-            {
-                multibyte_command[char_index] = (char)tab->command_history[history_index][char_index];
-            }
-            multibyte_command[char_index] = '\0'; // Ensure null termination
-        }
-        else
-        {
-            multibyte_command[converted_chars] = '\0'; // Ensure null termination
-        }
+        char *multibyte_command = wide_to_utf8(tab->command_history[history_index],
+                                               wcslen(tab->command_history[history_index]));
 
         // Step 5: Format and display the history entry
         // Format: "  1: ls -la", "  2: cd /home/user", etc.
         // Limit display length to prevent buffer overflow and ensure readability
         snprintf(formatted_line, sizeof(formatted_line), "  %d: %.200s", 
                  history_index + 1,  // Show 1-based numbering for user-friendly display
-                 multibyte_command);
+                 multibyte_command ? multibyte_command : "");
+        free(multibyte_command);
         
         add_text_to_buffer(tab, formatted_line);
     }
@@ -1591,18 +3079,19 @@ void update_command_display_with_prompt(Tab *tab, const char *prompt)
 
     // Step 4: Display the current search buffer content after the prompt
     int display_column = prompt_length; // Start position for search text
+    size_t search_length = line_editor_length(&tab->search_buffer);
     
-    for (int search_index = 0; 
-         search_index < tab->search_pos && display_column < BUFFER_COLS; 
+    for (size_t search_index = 0; 
+         search_index < search_length && display_column < BUFFER_COLS; 
          search_index++)
     {
-        tab->text_buffer[tab->cursor_row][display_column] = tab->search_buffer[search_index];
+        tab->text_buffer[tab->cursor_row][display_column] = line_editor_char_at(&tab->search_buffer, search_index);
         display_column++;
     }
 
     // Step 5: Position the cursor appropriately
     // Cursor goes after both the prompt and the current search text
-    tab->cursor_col = prompt_length + tab->search_pos;
+    tab->cursor_col = prompt_length + (int)search_length;
     
     // Ensure cursor stays within buffer bounds
     if (tab->cursor_col >= BUFFER_COLS)
@@ -1616,38 +3105,48 @@ void update_command_display_with_prompt(Tab *tab, const char *prompt)
 // Function to initialize a tab's text buffer and state
 void initialize_tab(Tab *tab, const char *name)
 {
-    // Step 1: Initialize command input state
-    tab->cursor_buffer_pos = 0;      // Cursor at start of command buffer
-    tab->command_length = 0;         // No command entered yet
+    // Step 1: Initialize command input state (starts with empty, unallocated editors)
+    memset(&tab->editor, 0, sizeof(tab->editor));
+    memset(&tab->search_buffer, 0, sizeof(tab->search_buffer));
+    memset(&tab->find, 0, sizeof(tab->find)); // The slot may still hold a moved tab's pointers
+    tab->block_first = 0;            // No command blocks yet
+    tab->block_count = 0;
+    tab->folded_block_count = 0;
+    tab->next_block_serial = 1;
+    tab->pending_block_serial = 0;
+    tab->block_cursor = 0;
     tab->cursor_row = BUFFER_ROWS - 1; // Cursor on bottom row
     tab->cursor_col = 2;             // Start after "> " prompt
     tab->foreground_pid = -1;        // No active process
     tab->history_count = 0;          // Empty command history
     tab->history_current = -1;       // Not browsing history
     tab->search_mode = 0;            // Search mode inactive
-    tab->search_pos = 0;             // No search text entered
+    tab->last_viewed_ms = 0;         // Not hibernating
+    tab->hibernated = 0;
+    tab->history_blob = NULL;
+    tab->reclaimed_bytes = 0;
+    tab->session_recorded = 0;       // Journaled on the next pass
+    tab->history_serial = 0;
+    tab->journaled_history_serial = 0;
 
-    // Initialize search buffer with zeros
-    memset(tab->search_buffer, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
+    // Assign a stable identifier used by jobs and I/O channels
+    tab->tab_id = next_tab_id++;
 
     // Set tab name with safe string copying
     snprintf(tab->tab_name, MAX_TAB_NAME, "%s", name);
     tab->tab_name[MAX_TAB_NAME - 1] = '\0'; // Ensure null termination
 
-    // Step 2: Initialize scrollback buffer system
+    // Step 2: Initialize scrollback buffer system (segments are allocated by the first line)
+    tab->segments = NULL;            // The slot may still hold a moved tab's segments
+    tab->segment_count = 0;
+    tab->segment_capacity = 0;
+    tab->scrollback_bytes = 0;
+    tab->scrollback_hint_valid = 0;
     tab->scrollback_count = 0;       // No scrollback content yet
+    tab->scrollback_first_line = 0;
     tab->scrollback_offset = 0;      // Viewing most recent content
     tab->max_scrollback_offset = 0;  // No scroll history yet
 
-    // Clear scrollback buffer with spaces
-    for (int line_index = 0; line_index < SCROLLBACK_LINES; line_index++)
-    {
-        for (int col = 0; col < BUFFER_COLS; col++)
-        {
-            tab->scrollback_buffer[line_index][col] = L' ';
-        }
-    }
-
     // Step 3: Initialize visible text buffer with spaces (clear screen)
     for (int row = 0; row < BUFFER_ROWS; row++)
     {
@@ -1681,9 +3180,6 @@ void initialize_tab(Tab *tab, const char *name)
     // This leaves the bottom row empty for visual separation
     tab->text_buffer[BUFFER_ROWS - 2][0] = L'>';  // Prompt character
     tab->text_buffer[BUFFER_ROWS - 2][1] = L' ';  // Space after prompt
-
-    // Step 6: Initialize current command buffer
-    memset(tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
 }
 
 // Initialize the text buffer system and create the first default tab
@@ -1713,25 +3209,155 @@ void initialize_text_buffer()
            tab_count, active_tab_index);
 }
 
-// Function to draw the entire text buffer to the X11 window
-void draw_text_buffer(Display *display, Window window, GC gc)
+// Function to free a tab's cached frame pixmap
+void release_frame_pixmap(Tab *tab)
 {
-    // Clear the entire window to start with a fresh drawing surface
-    XClearWindow(display, window);
+    if (!tab || tab->frame_pixmap == None)
+        return;
 
-    // Step 1: Safety checks for tab system state
-    if (tab_count <= 0 || tab_count > MAX_TABS)
+    if (frame_cache_display)
+    {
+        XFreePixmap(frame_cache_display, tab->frame_pixmap);
+    }
+    tab->frame_pixmap = None;
+
+    size_t pixmap_bytes = (size_t)BUFFER_COLS * CHAR_WIDTH * BUFFER_ROWS * CHAR_HEIGHT * 4;
+    frame_cache_bytes = frame_cache_bytes > pixmap_bytes ? frame_cache_bytes - pixmap_bytes : 0;
+}
+
+// Function to free every cached frame (before the display is closed)
+void release_all_frame_pixmaps(void)
+{
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        release_frame_pixmap(&tabs[tab_index]);
+    }
+    frame_cache_bytes = 0;
+}
+
+// Function to get (or create) the cached frame pixmap for a tab, evicting the
+// least recently drawn tabs while the cache is over its budget
+static Pixmap acquire_frame_pixmap(Display *display, Window window, Tab *tab, int *created)
+{
+    *created = 0;
+    tab->frame_last_used = ++frame_cache_clock;
+    if (tab->frame_pixmap != None)
+        return tab->frame_pixmap;
+
+    frame_cache_display = display;
+    int pixmap_width = BUFFER_COLS * CHAR_WIDTH;
+    int pixmap_height = BUFFER_ROWS * CHAR_HEIGHT;
+    size_t pixmap_bytes = (size_t)pixmap_width * pixmap_height * 4;
+
+    // Step 1: Evict least recently used frames until the new one fits
+    while (frame_cache_bytes + pixmap_bytes > FRAME_CACHE_BUDGET)
+    {
+        Tab *victim = NULL;
+        for (int tab_index = 0; tab_index < tab_count; tab_index++)
+        {
+            Tab *candidate = &tabs[tab_index];
+            if (candidate == tab || candidate->frame_pixmap == None)
+                continue;
+            if (!victim || candidate->frame_last_used < victim->frame_last_used)
+                victim = candidate;
+        }
+        if (!victim)
+            break; // Nothing left to evict - the budget only holds this frame
+        printf("Frame cache: evicting %s\n", victim->tab_name);
+        release_frame_pixmap(victim);
+    }
+
+    // Step 2: Create the pixmap with the window's depth
+    tab->frame_pixmap = XCreatePixmap(display, window, pixmap_width, pixmap_height,
+                                      DefaultDepth(display, DefaultScreen(display)));
+    if (tab->frame_pixmap == None)
+        return None;
+
+    frame_cache_bytes += pixmap_bytes;
+    *created = 1;
+    return tab->frame_pixmap;
+}
+
+// Function to describe everything drawn in the header band, so a cached frame
+// can tell whether its tab bar is still current
+static void build_frame_header_signature(Tab *active_tab, char *signature, size_t signature_size)
+{
+    int written = snprintf(signature, signature_size, "%d|%d|%d|%d", tab_count, active_tab_index,
+                           active_tab->scrollback_offset, active_tab->scrollback_count);
+    for (int tab_index = 0; tab_index < tab_count && written > 0 && (size_t)written < signature_size; tab_index++)
+    {
+        written += snprintf(signature + written, signature_size - written, "|%d%s",
+                            tabs[tab_index].has_activity, tabs[tab_index].tab_name);
+    }
+}
+
+// Function to select the colour used by subsequent surface operations
+static void surface_set_color(FrameSurface *surface, unsigned long pixel)
+{
+    surface->color = pixel;
+    if (!surface->raster)
+    {
+        XSetForeground(surface->display, surface->gc, pixel);
+    }
+}
+
+// Function to fill a rectangle on a surface
+static void surface_fill(FrameSurface *surface, int x, int y, int width, int height)
+{
+    if (surface->raster)
+    {
+        raster_fill(surface->raster, x, y, width, height, surface->color);
         return;
-    if (active_tab_index < 0 || active_tab_index >= tab_count)
+    }
+    XFillRectangle(surface->display, surface->drawable, surface->gc, x, y, width, height);
+}
+
+// Function to draw a single-byte string on a surface (tab bar and indicators)
+static void surface_draw_string(FrameSurface *surface, int x, int y, const char *text, int length)
+{
+    if (surface->raster)
+    {
+        raster_draw_string(surface->raster, x, y, text, length, surface->color);
         return;
+    }
+    XDrawString(surface->display, surface->drawable, surface->gc, x, y, text, length);
+}
 
-    Tab *active_tab = &tabs[active_tab_index];
+// Function to draw one grid character on a surface
+static void surface_draw_char(FrameSurface *surface, int x, int y, wchar_t character)
+{
+    if (surface->raster)
+    {
+        raster_draw_glyph(surface->raster, x, y, character, surface->color);
+        return;
+    }
+
+    // Convert wide character to multibyte for X11 drawing
+    char multibyte_char[MB_CUR_MAX + 1];
+    int char_length = wctomb(multibyte_char, character);
+    if (char_length > 0)
+    {
+        multibyte_char[char_length] = '\0';
+        XDrawString(surface->display, surface->drawable, surface->gc, x, y, multibyte_char, char_length);
+    }
+    else
+    {
+        // Fallback for invalid characters - display question mark
+        char fallback_char[2] = {'?', '\0'};
+        XDrawString(surface->display, surface->drawable, surface->gc, x, y, fallback_char, 1);
+    }
+}
+
+// Function to draw the scroll indicator and tab headers onto a surface
+static void draw_frame_header(FrameSurface *surface, Tab *active_tab)
+{
+    Display *display = surface->display;
 
-    // Step 2: Draw scrollback position indicator if user has scrolled up
+    // Step 1: Draw scrollback position indicator if user has scrolled up
     if (active_tab->scrollback_offset > 0)
     {
         char scroll_indicator[64];
-        int total_scrollback_lines = active_tab->scrollback_count;
+        int total_scrollback_lines = scrollback_display_count(active_tab);
         int visible_content_lines = BUFFER_ROWS - 1; // Reserve bottom row for command line
         int current_scroll_position = total_scrollback_lines - visible_content_lines - active_tab->scrollback_offset;
 
@@ -1750,11 +3376,11 @@ void draw_text_buffer(Display *display, Window window, GC gc)
         snprintf(scroll_indicator, sizeof(scroll_indicator), "Scroll: %d%% (%d/%d lines)",
                  scroll_percentage, current_scroll_position, total_scrollback_lines);
 
-        XSetForeground(display, gc, BlackPixel(display, DefaultScreen(display)));
-        XDrawString(display, window, gc, 10, 15, scroll_indicator, strlen(scroll_indicator));
+        surface_set_color(surface, BlackPixel(display, DefaultScreen(display)));
+        surface_draw_string(surface, 10, 15, scroll_indicator, strlen(scroll_indicator));
     }
 
-    // Step 3: Draw tab headers at the top of the window
+    // Step 2: Draw tab headers at the top of the window
     int tab_width_chars = BUFFER_COLS / tab_count;
     if (tab_width_chars < 1)
         tab_width_chars = 1;
@@ -1771,18 +3397,16 @@ void draw_text_buffer(Display *display, Window window, GC gc)
         if (tab_index == active_tab_index)
         {
             // Active tab: black background with white text
-            XSetForeground(display, gc, BlackPixel(display, DefaultScreen(display)));
-            XFillRectangle(display, window, gc, tab_start_x * CHAR_WIDTH, 0,
-                           tab_width_chars * CHAR_WIDTH, CHAR_HEIGHT);
-            XSetForeground(display, gc, WhitePixel(display, DefaultScreen(display)));
+            surface_set_color(surface, BlackPixel(display, DefaultScreen(display)));
+            surface_fill(surface, tab_start_x * CHAR_WIDTH, 0, tab_width_chars * CHAR_WIDTH, CHAR_HEIGHT);
+            surface_set_color(surface, WhitePixel(display, DefaultScreen(display)));
         }
         else
         {
             // Inactive tab: white background with black text
-            XSetForeground(display, gc, WhitePixel(display, DefaultScreen(display)));
-            XFillRectangle(display, window, gc, tab_start_x * CHAR_WIDTH, 0,
-                           tab_width_chars * CHAR_WIDTH, CHAR_HEIGHT);
-            XSetForeground(display, gc, BlackPixel(display, DefaultScreen(display)));
+            surface_set_color(surface, WhitePixel(display, DefaultScreen(display)));
+            surface_fill(surface, tab_start_x * CHAR_WIDTH, 0, tab_width_chars * CHAR_WIDTH, CHAR_HEIGHT);
+            surface_set_color(surface, BlackPixel(display, DefaultScreen(display)));
         }
 
         // Prepare tab name for display with truncation if needed
@@ -1791,53 +3415,69 @@ void draw_text_buffer(Display *display, Window window, GC gc)
         if (max_display_chars > MAX_TAB_NAME - 1)
             max_display_chars = MAX_TAB_NAME - 1;
 
-        snprintf(display_name, max_display_chars + 1, "%s", tabs[tab_index].tab_name);
+        // Hidden tabs with unseen output get a leading '*' activity marker
+        snprintf(display_name, max_display_chars + 1, "%s%s",
+                 tabs[tab_index].has_activity ? "*" : "", tabs[tab_index].tab_name);
         display_name[max_display_chars] = '\0';
 
         // Draw the tab name centered within the tab header
-        XDrawString(display, window, gc,
-                    (tab_start_x + 1) * CHAR_WIDTH, CHAR_HEIGHT - 2,
-                    display_name, strlen(display_name));
+        surface_draw_string(surface, (tab_start_x + 1) * CHAR_WIDTH, CHAR_HEIGHT - 2,
+                            display_name, strlen(display_name));
     }
+}
 
-    // Step 4: Draw the text content of the active tab
-    XSetForeground(display, gc, BlackPixel(display, DefaultScreen(display)));
+// Function to draw the characters of one grid row onto a surface
+static void draw_frame_row(FrameSurface *surface, Tab *active_tab, int row)
+{
+    Display *display = surface->display;
+    unsigned long black_pixel = BlackPixel(display, DefaultScreen(display));
+    unsigned long white_pixel = WhitePixel(display, DefaultScreen(display));
+
+    // Selected cells and the current find match are drawn in reverse video,
+    // other find matches are underlined
+    unsigned char styles[BUFFER_COLS];
+    compute_row_styles(active_tab, row, styles);
+    int band_y = row * CHAR_HEIGHT + FRAME_ROW_TOP_PAD;
+    surface_set_color(surface, black_pixel);
+    for (int run_start = 0; run_start < BUFFER_COLS;)
+    {
+        int run_end = run_start + 1;
+        while (run_end < BUFFER_COLS && styles[run_end] == styles[run_start])
+            run_end++;
+
+        if (styles[run_start] == CELL_STYLE_REVERSE)
+            surface_fill(surface, run_start * CHAR_WIDTH, band_y, (run_end - run_start) * CHAR_WIDTH, CHAR_HEIGHT);
+        else if (styles[run_start] == CELL_STYLE_UNDERLINE)
+            surface_fill(surface, run_start * CHAR_WIDTH, band_y + CHAR_HEIGHT - 2,
+                         (run_end - run_start) * CHAR_WIDTH, 1);
+        run_start = run_end;
+    }
 
-    // Draw each character in the text buffer (excluding the bottom row for visual separation)
-    for (int row = 0; row < BUFFER_ROWS - 1; row++) // Stop before bottom row
+    for (int col = 0; col < BUFFER_COLS; col++)
     {
-        for (int col = 0; col < BUFFER_COLS; col++)
+        // Only draw non-space characters to improve performance
+        if (active_tab->text_buffer[row][col] != L' ')
         {
-            // Only draw non-space characters to improve performance
-            if (active_tab->text_buffer[row][col] != L' ')
-            {
-                int pixel_x = col * CHAR_WIDTH;
-                int pixel_y = (row + 1) * CHAR_HEIGHT; // +1 to account for tab header row
+            unsigned long pixel = (styles[col] == CELL_STYLE_REVERSE) ? white_pixel : black_pixel;
+            if (pixel != surface->color)
+                surface_set_color(surface, pixel);
 
-                // Ensure drawing coordinates are within window bounds
-                if (pixel_x >= 0 && pixel_x < BUFFER_COLS * CHAR_WIDTH &&
-                    pixel_y >= CHAR_HEIGHT && pixel_y < BUFFER_ROWS * CHAR_HEIGHT)
-                {
-                    // Convert wide character to multibyte for X11 drawing
-                    char multibyte_char[MB_CUR_MAX + 1];
-                    int char_length = wctomb(multibyte_char, active_tab->text_buffer[row][col]);
-                    if (char_length > 0)
-                    {
-                        multibyte_char[char_length] = '\0';
-                        XDrawString(display, window, gc, pixel_x, pixel_y, multibyte_char, char_length);
-                    }
-                    else
-                    {
-                        // Fallback for invalid characters - display question mark
-                        char fallback_char[2] = {'?', '\0'};
-                        XDrawString(display, window, gc, pixel_x, pixel_y, fallback_char, 1);
-                    }
-                }
+            int pixel_x = col * CHAR_WIDTH;
+            int pixel_y = (row + 1) * CHAR_HEIGHT; // +1 to account for tab header row
+
+            // Ensure drawing coordinates are within window bounds
+            if (pixel_x >= 0 && pixel_x < BUFFER_COLS * CHAR_WIDTH &&
+                pixel_y >= CHAR_HEIGHT && pixel_y < BUFFER_ROWS * CHAR_HEIGHT)
+            {
+                surface_draw_char(surface, pixel_x, pixel_y, active_tab->text_buffer[row][col]);
             }
         }
     }
+}
 
-    // Step 5: Draw the text cursor at current position
+// Function to draw the text cursor onto a surface
+static void draw_frame_cursor(FrameSurface *surface, Tab *active_tab)
+{
     int cursor_pixel_x = active_tab->cursor_col * CHAR_WIDTH;
     int cursor_pixel_y = (active_tab->cursor_row + 1) * CHAR_HEIGHT + 1; // +1 for tab header, +1 for vertical offset
 
@@ -1845,876 +3485,10886 @@ void draw_text_buffer(Display *display, Window window, GC gc)
     if (cursor_pixel_x >= 0 && cursor_pixel_x < BUFFER_COLS * CHAR_WIDTH &&
         cursor_pixel_y >= CHAR_HEIGHT && cursor_pixel_y < (BUFFER_ROWS + 1) * CHAR_HEIGHT)
     {
-        XDrawString(display, window, gc, cursor_pixel_x, cursor_pixel_y, "_", 1);
+        surface_set_color(surface, BlackPixel(surface->display, DefaultScreen(surface->display)));
+        surface_draw_string(surface, cursor_pixel_x, cursor_pixel_y, "_", 1);
     }
 }
 
-// Function to cleanup multiWatch processes and temporary files
-void cleanup_multiwatch()
+// Function to repaint the damaged parts of a frame onto a surface
+static void paint_frame_damage(FrameSurface *surface, Tab *active_tab, const int *row_damaged,
+                               int header_damaged, int full_frame)
 {
-    printf("Cleaning up multiWatch processes and resources\n");
+    Display *display = surface->display;
+    int frame_width = BUFFER_COLS * CHAR_WIDTH;
 
-    // Iterate through all registered multiwatch processes
-    for (int process_index = 0; process_index < multiwatch_count; process_index++)
+    // Step 1: Clear the damaged bands (or the whole frame) to the background
+    surface_set_color(surface, WhitePixel(display, DefaultScreen(display)));
+    if (full_frame)
+    {
+        surface_fill(surface, 0, 0, frame_width, BUFFER_ROWS * CHAR_HEIGHT);
+    }
+    else
     {
-        if (multiwatch_processes[process_index].active)
+        for (int row = 0; row < BUFFER_ROWS; row++)
         {
-            int process_pid = multiwatch_processes[process_index].pid;
-            printf("Terminating multiwatch process %d\n", process_pid);
-
-            // Step 1: Send SIGTERM to the entire process group
-            // This ensures all child processes created by the multiwatch command are also terminated
-            kill(-process_pid, SIGTERM);
-
-            // Step 2: Wait for graceful termination with timeout
-            int termination_status;
-            int wait_attempts = 0;
-            const int max_wait_attempts = 10; // 10 * 100ms = 1 second total timeout
-            
-            while (waitpid(process_pid, &termination_status, WNOHANG) == 0 && 
-                   wait_attempts < max_wait_attempts)
-            {
-                usleep(100000); // Wait 100ms between checks
-                wait_attempts++;
-            }
-
-            // Step 3: Force kill with SIGKILL if process still running after timeout
-            if (waitpid(process_pid, &termination_status, WNOHANG) == 0)
-            {
-                printf("Process %d still running after SIGTERM, forcing termination with SIGKILL\n", process_pid);
-                kill(-process_pid, SIGKILL); // Kill entire process group
-                waitpid(process_pid, &termination_status, 0); // Wait for confirmation
-            }
-
-            // Step 4: Close the file descriptor if it's still open
-            if (multiwatch_processes[process_index].fd != -1)
-            {
-                close(multiwatch_processes[process_index].fd);
-                multiwatch_processes[process_index].fd = -1; // Mark as closed
-                printf("Closed file descriptor for process %d\n", process_pid);
-            }
-
-            // Step 5: Remove the temporary file used for process communication
-            char *temp_filename = multiwatch_processes[process_index].temp_file;
-            if (unlink(temp_filename) == 0)
-            {
-                printf("Successfully removed temporary file: %s\n", temp_filename);
-            }
-            else if (errno != ENOENT) // ENOENT means file already doesn't exist
-            {
-                printf("Warning: Failed to remove temporary file %s: %s\n",
-                       temp_filename, strerror(errno));
-            }
-            else
-            {
-                printf("Temporary file already removed: %s\n", temp_filename);
-            }
-
-            // Mark this process slot as inactive for reuse
-            multiwatch_processes[process_index].active = 0;
-            printf("Completed cleanup for process %d\n", process_pid);
+            if (row_damaged[row])
+                surface_fill(surface, 0, row * CHAR_HEIGHT + FRAME_ROW_TOP_PAD, frame_width, CHAR_HEIGHT);
         }
+        if (header_damaged)
+            surface_fill(surface, 0, 0, frame_width, CHAR_HEIGHT);
     }
 
-    // Reset the multiwatch system state
-    multiwatch_count = 0;
-    printf("MultiWatch cleanup completed. All processes and resources cleaned up.\n");
+    // Step 2: Draw header, rows and cursor in the same order as a full repaint
+    if (header_damaged)
+    {
+        draw_frame_header(surface, active_tab);
+    }
+    for (int row = 0; row < BUFFER_ROWS - 1; row++) // Stop before bottom row
+    {
+        if (row_damaged[row])
+            draw_frame_row(surface, active_tab, row);
+    }
+    if (active_tab->cursor_row >= 0 && active_tab->cursor_row < BUFFER_ROWS &&
+        row_damaged[active_tab->cursor_row])
+    {
+        draw_frame_cursor(surface, active_tab);
+    }
+}
+
+// Function to request a repaint; the event loop presents at most one frame per
+// iteration, so bursts of keys and output are batched into a single flush
+void draw_text_buffer(Display *display, Window window, GC gc)
+{
+    (void)display;
+    (void)window;
+    (void)gc;
+    redraw_pending = 1;
 }
 
-// Function to monitor multiWatch processes and display their output in real-time
-void monitor_multiwatch_processes(Display *display, Window window, GC gc, Tab *tab)
+// Function to paint the active tab and present it to the X11 window
+void present_frame(Display *display, Window window, GC gc)
 {
-    struct pollfd file_descriptors[MAX_MULTIWATCH_COMMANDS];
-    char read_buffer[MULTIWATCH_BUFFER_SIZE];
-    int active_process_count = multiwatch_count;
-    const int max_read_attempts = 50; // 50 * 100ms = 5 second maximum monitoring time
-    int current_attempt = 0;
+    // Step 1: Safety checks for tab system state
+    if (tab_count <= 0 || tab_count > MAX_TABS)
+        return;
+    if (active_tab_index < 0 || active_tab_index >= tab_count)
+        return;
 
-    printf("Starting to monitor %d multiWatch processes\n", active_process_count);
+    Tab *active_tab = &tabs[active_tab_index];
+    int frame_width = BUFFER_COLS * CHAR_WIDTH;
+    int frame_height = BUFFER_ROWS * CHAR_HEIGHT;
+    long long paint_start_us = monotonic_us();
+    perf_phase_begin(PERF_PHASE_RENDER);     // Ended by record_render_stats()
 
-    // Main monitoring loop - continues while processes are active or we're within timeout
-    while ((active_process_count > 0 || current_attempt < max_read_attempts) && multiwatch_mode)
+    int row_damaged[BUFFER_ROWS];
+    for (int row = 0; row < BUFFER_ROWS; row++)
     {
-        // Step 1: Set up file descriptors for polling
-        int pollable_count = 0;
-        for (int process_index = 0; process_index < multiwatch_count; process_index++)
-        {
-            if (multiwatch_processes[process_index].active && 
-                multiwatch_processes[process_index].fd != -1)
-            {
-                file_descriptors[pollable_count].fd = multiwatch_processes[process_index].fd;
-                file_descriptors[pollable_count].events = POLLIN;  // Monitor for read readiness
-                file_descriptors[pollable_count].revents = 0;
-                pollable_count++;
-            }
-        }
+        row_damaged[row] = (row < BUFFER_ROWS - 1); // The bottom row is never drawn
+    }
 
-        // Step 2: Try immediate non-blocking read from all file descriptors
-        int data_was_read = 0;
-        for (int process_index = 0; process_index < multiwatch_count; process_index++)
-        {
-            if (multiwatch_processes[process_index].active && 
-                multiwatch_processes[process_index].fd != -1)
-            {
-                ssize_t bytes_read = read(multiwatch_processes[process_index].fd, 
-                                         read_buffer, sizeof(read_buffer) - 1);
-                
-                if (bytes_read > 0)
-                {
-                    data_was_read = 1;
-                    read_buffer[bytes_read] = '\0';
+    // Step 2: Find the tab's cached frame; without one, draw straight to the window
+    int created = 0;
+    Pixmap frame = acquire_frame_pixmap(display, window, active_tab, &created);
+    if (frame == None)
+    {
+        FrameSurface window_surface = {display, window, gc, NULL, 0};
+        paint_frame_damage(&window_surface, active_tab, row_damaged, 1, 1);
+        record_render_stats(paint_start_us, BUFFER_ROWS - 1);
+        return;
+    }
 
-                    // Format and display the output with proper formatting
-                    add_separator_line(tab);
+    // Step 3: Work out which parts of the cached frame are out of date
+    char header_signature[FRAME_HEADER_SIGNATURE_SIZE];
+    build_frame_header_signature(active_tab, header_signature, sizeof(header_signature));
 
-                    // Create timestamped header for this command's output
-                    time_t current_time = time(NULL);
-                    struct tm *time_info = localtime(&current_time);
-                    char timestamp[64];
-                    strftime(timestamp, sizeof(timestamp), "[%H:%M:%S] ", time_info);
+    int header_damaged = created || strcmp(header_signature, active_tab->frame_header) != 0;
+    int cursor_moved = created ||
+                       active_tab->cursor_row != active_tab->frame_cursor_row ||
+                       active_tab->cursor_col != active_tab->frame_cursor_col;
 
-                    char output_header[128];
-                    snprintf(output_header, sizeof(output_header), "%sMultiWatch [%s]:", 
-                             timestamp, multiwatch_processes[process_index].command);
-                    add_text_to_buffer(tab, output_header);
+    unsigned char row_styles[BUFFER_ROWS][BUFFER_COLS];
+    for (int row = 0; row < BUFFER_ROWS - 1; row++)
+    {
+        compute_row_styles(active_tab, row, row_styles[row]);
+        row_damaged[row] = created ||
+                           memcmp(active_tab->text_buffer[row], active_tab->frame_grid[row],
+                                  sizeof(active_tab->text_buffer[row])) != 0 ||
+                           memcmp(row_styles[row], active_tab->frame_styles[row], BUFFER_COLS) != 0;
+    }
 
-                    // Split output into lines and display each one
-                    char *current_line = read_buffer;
-                    char *line_break;
+    if (cursor_moved)
+    {
+        // The old cursor must be erased and the new one drawn
+        if (active_tab->frame_cursor_row >= 0 && active_tab->frame_cursor_row < BUFFER_ROWS)
+            row_damaged[active_tab->frame_cursor_row] = 1;
+        if (active_tab->cursor_row >= 0 && active_tab->cursor_row < BUFFER_ROWS)
+            row_damaged[active_tab->cursor_row] = 1;
+    }
 
-                    do
-                    {
-                        line_break = strchr(current_line, '\n');
-                        if (line_break)
-                        {
-                            *line_break = '\0'; // Temporarily terminate at newline
-                        }
+    // Row 0 glyphs overlap the header band, so the two are always redrawn together
+    if (header_damaged)
+        row_damaged[0] = 1;
+    if (row_damaged[0])
+        header_damaged = 1;
 
-                        // Only display non-empty lines
-                        if (strlen(current_line) > 0)
-                        {
-                            char formatted_line[BUFFER_COLS];
-                            snprintf(formatted_line, sizeof(formatted_line), "  %s", current_line);
-                            add_text_to_buffer(tab, formatted_line);
-                        }
-
-                        if (line_break)
-                        {
-                            current_line = line_break + 1; // Move to next line
-                        }
-                    } while (line_break);
+    // Step 4: Repaint only the damaged bands of the cached frame with the active renderer
+    int damaged_rows = 0;
+    for (int row = 0; row < BUFFER_ROWS; row++)
+    {
+        damaged_rows += row_damaged[row];
+    }
 
-                    add_separator_line(tab);
-                    draw_text_buffer(display, window, gc); // Update display
-                }
-                else if (bytes_read == 0)
-                {
-                    // End of file reached - process has closed its output
-                    printf("Process %d reached EOF on output\n", multiwatch_processes[process_index].pid);
-                    close(multiwatch_processes[process_index].fd);
-                    multiwatch_processes[process_index].fd = -1;
-                }
-                else if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-                {
-                    // Read error (not just "would block")
-                    printf("Read error for process %d: %s\n", 
-                           multiwatch_processes[process_index].pid, strerror(errno));
-                    close(multiwatch_processes[process_index].fd);
-                    multiwatch_processes[process_index].fd = -1;
-                }
-            }
+    if (damaged_rows > 0 || header_damaged)
+    {
+        if (active_renderer == RENDERER_SHM)
+        {
+            shm_paint_frame(display, frame, gc, active_tab, row_damaged, header_damaged, created);
         }
-
-        // Step 3: Use poll() for efficient waiting when no immediate data available
-        if (pollable_count > 0 && !data_was_read)
+        else
         {
-            int poll_result = poll(file_descriptors, pollable_count, 100); // 100ms timeout
-
-            if (poll_result > 0)
-            {
-                // Process file descriptors that have data ready
-                int fd_tracker = 0;
-                for (int process_index = 0; process_index < multiwatch_count; process_index++)
-                {
-                    if (multiwatch_processes[process_index].active && 
-                        multiwatch_processes[process_index].fd != -1)
-                    {
-                        if (file_descriptors[fd_tracker].revents & POLLIN)
-                        {
-                            ssize_t bytes_read = read(multiwatch_processes[process_index].fd, 
-                                                     read_buffer, sizeof(read_buffer) - 1);
-                            if (bytes_read > 0)
-                            {
-                                read_buffer[bytes_read] = '\0';
-
-                                // Format output with timestamp and command name
-                                time_t current_time = time(NULL);
-                                struct tm *time_info = localtime(&current_time);
-                                char timestamp[64];
-                                strftime(timestamp, sizeof(timestamp), "%H:%M:%S", time_info);
-
-                                // Split and display each line
-                                char *current_line = read_buffer;
-                                char *line_break;
-
-                                do
-                                {
-                                    line_break = strchr(current_line, '\n');
-                                    if (line_break)
-                                    {
-                                        *line_break = '\0';
-                                    }
-
-                                    if (strlen(current_line) > 0)
-                                    {
-                                        char formatted_line[BUFFER_COLS];
-                                        snprintf(formatted_line, sizeof(formatted_line), 
-                                                 "[%s] %s: %s", timestamp, 
-                                                 multiwatch_processes[process_index].command, 
-                                                 current_line);
-                                        add_text_to_buffer(tab, formatted_line);
-                                        printf("Poll Output: %s\n", formatted_line);
-                                    }
-
-                                    if (line_break)
-                                    {
-                                        current_line = line_break + 1;
-                                    }
-                                } while (line_break);
-
-                                draw_text_buffer(display, window, gc);
-                            }
-                        }
-                        fd_tracker++;
-                    }
-                }
-            }
+            FrameSurface frame_surface = {display, frame, gc, NULL, 0};
+            paint_frame_damage(&frame_surface, active_tab, row_damaged, header_damaged, created);
         }
+    }
 
-        // Step 4: Check process status and update active count
-        active_process_count = 0;
-        for (int process_index = 0; process_index < multiwatch_count; process_index++)
+    // Step 5: Remember what the cached frame now shows
+    if (header_damaged)
+    {
+        snprintf(active_tab->frame_header, sizeof(active_tab->frame_header), "%s", header_signature);
+    }
+    for (int row = 0; row < BUFFER_ROWS - 1; row++)
+    {
+        if (row_damaged[row])
         {
-            if (multiwatch_processes[process_index].active)
-            {
-                int process_status;
-                pid_t wait_result = waitpid(multiwatch_processes[process_index].pid, 
-                                           &process_status, WNOHANG);
-                
-                if (wait_result == multiwatch_processes[process_index].pid)
-                {
-                    // Process has terminated
-                    printf("Process %d finished with exit status %d\n", 
-                           multiwatch_processes[process_index].pid, WEXITSTATUS(process_status));
-                    multiwatch_processes[process_index].active = 0;
-                    
-                    // Clean up file descriptor
-                    if (multiwatch_processes[process_index].fd != -1)
-                    {
-                        close(multiwatch_processes[process_index].fd);
-                        multiwatch_processes[process_index].fd = -1;
-                    }
+            memcpy(active_tab->frame_grid[row], active_tab->text_buffer[row], sizeof(active_tab->text_buffer[row]));
+            memcpy(active_tab->frame_styles[row], row_styles[row], BUFFER_COLS);
+        }
+    }
+    active_tab->frame_cursor_row = active_tab->cursor_row;
+    active_tab->frame_cursor_col = active_tab->cursor_col;
 
-                    // Read any remaining output from temporary file
-                    char final_buffer[1024];
-                    int temp_fd = open(multiwatch_processes[process_index].temp_file, O_RDONLY);
-                    if (temp_fd != -1)
-                    {
-                        ssize_t remaining_bytes = read(temp_fd, final_buffer, sizeof(final_buffer) - 1);
-                        if (remaining_bytes > 0)
-                        {
-                            final_buffer[remaining_bytes] = '\0';
-                            time_t current_time = time(NULL);
-                            struct tm *time_info = localtime(&current_time);
-                            char timestamp[64];
-                            strftime(timestamp, sizeof(timestamp), "%H:%M:%S", time_info);
-
-                            // Display any final output that wasn't captured via pipe
-                            char *current_line = final_buffer;
-                            char *line_break;
-                            do
-                            {
-                                line_break = strchr(current_line, '\n');
-                                if (line_break)
-                                    *line_break = '\0';
-                                if (strlen(current_line) > 0)
-                                {
-                                    char final_line[BUFFER_COLS];
-                                    snprintf(final_line, sizeof(final_line), "[%s] %s: %s",
-                                             timestamp, multiwatch_processes[process_index].command, current_line);
-                                    add_text_to_buffer(tab, final_line);
-                                    printf("Final output: %s\n", final_line);
-                                }
-                                if (line_break)
-                                    current_line = line_break + 1;
-                            } while (line_break);
-                            draw_text_buffer(display, window, gc);
-                        }
-                        close(temp_fd);
-                    }
+    // Step 6: Present the whole frame with a single copy
+    XCopyArea(display, frame, window, gc, 0, 0, frame_width, frame_height, 0, 0);
+    record_render_stats(paint_start_us, damaged_rows);
+}
 
-                    // Notify user that command completed
-                    char completion_message[128];
-                    snprintf(completion_message, sizeof(completion_message),
-                             "Command '%s' finished", multiwatch_processes[process_index].command);
-                    add_text_to_buffer(tab, completion_message);
-                    draw_text_buffer(display, window, gc);
-                }
-                else if (wait_result == 0)
-                {
-                    // Process is still running
-                    active_process_count++;
-                }
-                else
-                {
-                    // Error checking process status
-                    printf("Error checking process %d: %s\n", 
-                           multiwatch_processes[process_index].pid, strerror(errno));
-                    multiwatch_processes[process_index].active = 0;
-                    if (multiwatch_processes[process_index].fd != -1)
-                    {
-                        close(multiwatch_processes[process_index].fd);
-                        multiwatch_processes[process_index].fd = -1;
-                    }
-                }
-            }
-        }
+// ============================================================================
+// SCROLLBACK STORE
+// ============================================================================
+//
+// Output is kept as the raw bytes commands wrote, with a '\n' after every
+// line, in segments of SCROLLBACK_SEGMENT_BYTES. Ingesting a line is a
+// memchr() and a memcpy(); cells are produced only when a line is drawn,
+// searched or selected. Each segment records the offset of every
+// SCROLLBACK_INDEX_STRIDE-th line, so any line is found with a binary search
+// over the segments plus a few memchr() calls, and a small LRU keeps the
+// decoded lines that are on screen. A full segment is sealed and never
+// changes again, so search snapshots share sealed segments by reference count
+// instead of copying them (reference counts are only touched by the UI thread).
+
+// Function to allocate an empty segment whose first line has an absolute number
+static ScrollbackSegment *new_scrollback_segment(size_t capacity, unsigned long first_line)
+{
+    ScrollbackSegment *segment = calloc(1, sizeof(ScrollbackSegment));
+    if (!segment)
+        return NULL;
+
+    segment->bytes = malloc(capacity);
+    segment->index_capacity = SCROLLBACK_SEGMENT_BYTES / 64 / SCROLLBACK_INDEX_STRIDE + 1;
+    segment->line_index = malloc(segment->index_capacity * sizeof(uint32_t));
+    if (!segment->bytes || !segment->line_index)
+    {
+        free(segment->bytes);
+        free(segment->line_index);
+        free(segment);
+        return NULL;
+    }
+    segment->capacity = capacity;
+    segment->first_line = first_line;
+    segment->references = 1;
+    segment->spill_offset = -1;
+    segment->last_used = ++scrollback_clock;
+    update_segment_accounting(segment);
+    return segment;
+}
 
-        current_attempt++;
+// Function to drop one reference to a segment, freeing it with the last one
+void release_scrollback_segment(ScrollbackSegment *segment)
+{
+    if (!segment || --segment->references > 0)
+        return;
+    if (!segment->bytes)
+        forget_decompressed_chunk(segment);
+    if (segment->spill_offset >= 0)
+        spill_release(segment->spill_offset, segment->compressed_length ? segment->compressed_length : segment->length);
+    scrollback_resident_bytes -= segment->resident_bytes;
+    if (!segment->mapped)
+    {
+        free(segment->bytes);
+        free(segment->compressed);
+        free(segment->line_index);
+    }
+    free(segment);
+}
 
-        // Step 5: Check for user interruption (Ctrl+C) via X11 events
-        int event_processed = 0;
-        while (XPending(display) > 0 && !event_processed)
-        {
-            XEvent x_event;
-            XNextEvent(display, &x_event);
+// Function to get the size a segment's bytes count towards its tab's limit (compressed size
+// once compressed, whether in memory or spilled)
+static size_t scrollback_segment_memory(const ScrollbackSegment *segment)
+{
+    if (segment->bytes)
+        return segment->capacity;
+    return segment->compressed_length ? segment->compressed_length : segment->length;
+}
 
-            if (x_event.type == KeyPress)
-            {
-                KeySym key_symbol;
-                char key_buffer[256];
-                XLookupString(&x_event.xkey, key_buffer, sizeof(key_buffer) - 1, &key_symbol, NULL);
+// Function to seal a segment: no more lines are added and unused space is returned
+static void seal_scrollback_segment(Tab *tab, ScrollbackSegment *segment)
+{
+    if (segment->sealed)
+        return;
+    segment->sealed = 1;
 
-                // Check for Ctrl+C interruption
-                if ((x_event.xkey.state & ControlMask) && key_symbol == XK_c)
-                {
-                    printf("Ctrl+C detected - stopping multiWatch monitoring\n");
-                    add_text_to_buffer(tab, "Ctrl+C received - stopping multiWatch");
-                    draw_text_buffer(display, window, gc);
-                    cleanup_multiwatch();
-                    multiwatch_mode = 0;
-                    return;
-                }
-            }
-            event_processed = 1;
-        }
+    char *shrunk = realloc(segment->bytes, segment->length > 0 ? segment->length : 1);
+    if (shrunk)
+    {
+        tab->scrollback_bytes -= segment->capacity - segment->length;
+        segment->bytes = shrunk;
+        segment->capacity = segment->length;
+        update_segment_accounting(segment);
+    }
+}
 
-        // Step 6: Check for SIGINT signal
-        if (signal_received && which_signal == SIGINT)
+// Function to find the segment holding an absolute line (binary search; -1 if none)
+static int locate_scrollback_segment(ScrollbackSegment *const *segments, int segment_count, unsigned long line)
+{
+    int low = 0, high = segment_count - 1, found = -1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        if (segments[middle]->first_line <= line)
         {
-            printf("SIGINT received - stopping multiWatch monitoring\n");
-            signal_received = 0;
-            which_signal = 0;
-            add_text_to_buffer(tab, "SIGINT received - stopping multiWatch");
-            draw_text_buffer(display, window, gc);
-            cleanup_multiwatch();
-            multiwatch_mode = 0;
-            return;
+            found = middle;
+            low = middle + 1;
         }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    if (found >= 0 && line - segments[found]->first_line >= (unsigned long)segments[found]->line_count)
+        return -1;
+    return found;
+}
+
+// Function to find where a line of a segment starts (nearest index entry, then memchr);
+// data is the segment's bytes, decompressed if need be
+static size_t scrollback_segment_line_offset(const ScrollbackSegment *segment, const char *data, int local_line)
+{
+    size_t offset = segment->line_index[local_line / SCROLLBACK_INDEX_STRIDE];
+    for (int skip = local_line % SCROLLBACK_INDEX_STRIDE; skip > 0; skip--)
+    {
+        const char *newline = memchr(data + offset, '\n', segment->length - offset);
+        offset = (size_t)(newline - data) + 1;
+    }
+    return offset;
+}
+
+// Function to get the raw bytes of a line given segments (UI thread: may decompress)
+int scrollback_segments_line(ScrollbackSegment *const *segments, int segment_count, unsigned long line,
+                             const char **bytes, size_t *length)
+{
+    int segment_index = locate_scrollback_segment(segments, segment_count, line);
+    if (segment_index < 0)
+        return 0;
+
+    ScrollbackSegment *segment = segments[segment_index];
+    segment->last_used = ++scrollback_clock;
+    const char *data = scrollback_segment_data(segment);
+    if (!data)
+        return 0;
+    size_t offset = scrollback_segment_line_offset(segment, data, (int)(line - segment->first_line));
+    const char *newline = memchr(data + offset, '\n', segment->length - offset);
+    *bytes = data + offset;
+    *length = (size_t)(newline - *bytes);
+    return 1;
+}
+
+// Function to get the raw bytes of a tab's scrollback line (index 0 = oldest kept)
+int scrollback_line_bytes(Tab *tab, int index, const char **bytes, size_t *length)
+{
+    if (index < 0 || index >= tab->scrollback_count)
+        return 0;
 
-        // Step 7: Adaptive delay based on current state
-        if (active_process_count == 0 && current_attempt < max_read_attempts)
+    // Sequential scans (find, selection, rebuilds) continue from the previous line
+    unsigned long line = tab->scrollback_first_line + index;
+    if (tab->scrollback_hint_valid && line == tab->scrollback_hint_line + 1 &&
+        tab->scrollback_hint_segment < tab->segment_count)
+    {
+        ScrollbackSegment *segment = tab->segments[tab->scrollback_hint_segment];
+        segment->last_used = ++scrollback_clock;
+        const char *data = scrollback_segment_data(segment);
+        size_t offset = tab->scrollback_hint_offset;
+        const char *newline = data ? memchr(data + offset, '\n', segment->length - offset) : NULL;
+        offset = newline ? (size_t)(newline - data) + 1 : segment->length;
+        if (offset < segment->length)
         {
-            // No active processes but still within timeout - brief delay
-            usleep(100000); // 100ms
+            newline = memchr(data + offset, '\n', segment->length - offset);
+            *bytes = data + offset;
+            *length = (size_t)(newline - *bytes);
+            tab->scrollback_hint_line = line;
+            tab->scrollback_hint_offset = offset;
+            return 1;
         }
-        else if (active_process_count == 0)
+    }
+
+    if (!scrollback_segments_line(tab->segments, tab->segment_count, line, bytes, length))
+        return 0;
+
+    int segment_index = locate_scrollback_segment(tab->segments, tab->segment_count, line);
+    tab->scrollback_hint_valid = 1;
+    tab->scrollback_hint_line = line;
+    tab->scrollback_hint_segment = segment_index;
+    tab->scrollback_hint_offset = (size_t)(*bytes - scrollback_segment_data(tab->segments[segment_index]));
+    return 1;
+}
+
+// Function to test whether raw line bytes contain a byte string (memchr on the first byte)
+int bytes_contain(const char *bytes, size_t length, const char *needle, size_t needle_length)
+{
+    const char *position = bytes;
+    const char *last = bytes + length - needle_length;
+    if (needle_length == 0 || needle_length > length)
+        return needle_length == 0;
+    while (position <= last)
+    {
+        position = memchr(position, needle[0], (size_t)(last - position) + 1);
+        if (!position)
+            return 0;
+        if (memcmp(position, needle, needle_length) == 0)
+            return 1;
+        position++;
+    }
+    return 0;
+}
+
+// Function to decode a line's bytes into a grid row (at most BUFFER_COLS - 1 cells, zero padded).
+// Bytes that are not valid in the locale show as their Latin-1 character. Returns the cells used.
+int decode_scrollback_bytes(const char *bytes, size_t length, wchar_t *row)
+{
+    mbstate_t conversion_state;
+    memset(&conversion_state, 0, sizeof(conversion_state));
+    size_t position = 0;
+    int col = 0;
+
+    while (position < length && col < BUFFER_COLS - 1)
+    {
+        unsigned char byte = (unsigned char)bytes[position];
+        if (byte < 0x80)
         {
-            break; // No active processes and timeout reached
+            // ASCII fast path - most output never reaches mbrtowc()
+            row[col++] = byte;
+            position++;
+            continue;
         }
-        else
+
+        wchar_t wide_character;
+        size_t consumed = mbrtowc(&wide_character, bytes + position, length - position, &conversion_state);
+        if (consumed == (size_t)-1 || consumed == (size_t)-2 || consumed == 0)
         {
-            // Processes still active - shorter delay for more responsive monitoring
-            usleep(50000); // 50ms
+            row[col++] = byte;
+            position++;
+            memset(&conversion_state, 0, sizeof(conversion_state));
+            continue;
         }
+        row[col++] = wide_character;
+        position += consumed;
     }
 
-    // Final cleanup and status update
-    printf("multiWatch monitoring completed after %d attempts\n", current_attempt);
-    cleanup_multiwatch();
-    multiwatch_mode = 0;
-    add_text_to_buffer(tab, "multiWatch completed");
-    draw_text_buffer(display, window, gc);
+    int used = col;
+    while (col < BUFFER_COLS)
+        row[col++] = L'\0';
+    return used;
 }
 
-// Function to handle multiWatch command - executes multiple commands in parallel and monitors their output
-void handle_multiwatch_command(Display *display, Window window, GC gc, Tab *tab, const char *command)
+// Function to decode a scrollback line without caching it (for scans over many lines)
+int scrollback_decode_line(Tab *tab, int index, wchar_t *row)
 {
-    // Step 1: Parse quoted commands from: multiWatch "cmd1" "cmd2" "cmd3"
-    char parsed_commands[MAX_MULTIWATCH_COMMANDS][MAX_COMMAND_LENGTH];
-    int command_count = 0;
-
-    // Create a safe working copy of the command string
-    char command_copy[MAX_COMMAND_LENGTH];
-    if (snprintf(command_copy, sizeof(command_copy), "%s", command) >= (int)sizeof(command_copy))
+    const char *bytes;
+    size_t length;
+    if (!scrollback_line_bytes(tab, index, &bytes, &length))
     {
-        add_text_to_buffer(tab, "Error: Command too long for processing");
-        draw_text_buffer(display, window, gc);
-        return;
+        wmemset(row, L'\0', BUFFER_COLS);
+        return 0;
     }
+    return decode_scrollback_bytes(bytes, length, row);
+}
 
-    // Skip past "multiWatch" to get to the command arguments
-    char *parse_ptr = command_copy + 10; // Length of "multiWatch"
+// Function to unlink a decoded line from the LRU list
+static void decoded_line_unlink(int entry)
+{
+    DecodedLine *line = &decoded_lines[entry];
+    if (line->lru_prev >= 0)
+        decoded_lines[line->lru_prev].lru_next = line->lru_next;
+    else
+        decoded_lru_head = line->lru_next;
+    if (line->lru_next >= 0)
+        decoded_lines[line->lru_next].lru_prev = line->lru_prev;
+    else
+        decoded_lru_tail = line->lru_prev;
+}
 
-    // Parse quoted commands from the argument string
-    while (*parse_ptr != '\0' && command_count < MAX_MULTIWATCH_COMMANDS)
+// Function to put a decoded line at the most recently used end
+static void decoded_line_push_front(int entry)
+{
+    DecodedLine *line = &decoded_lines[entry];
+    line->lru_prev = -1;
+    line->lru_next = decoded_lru_head;
+    if (decoded_lru_head >= 0)
+        decoded_lines[decoded_lru_head].lru_prev = entry;
+    decoded_lru_head = entry;
+    if (decoded_lru_tail < 0)
+        decoded_lru_tail = entry;
+}
+
+// Function to hash a (tab, line) key into a bucket
+static int decoded_line_bucket(int tab_id, unsigned long line)
+{
+    unsigned long key = line * 2654435761UL + (unsigned long)tab_id * 40503UL;
+    return (int)((key >> 7) & (DECODED_LINE_BUCKETS - 1));
+}
+
+// Function to remove a decoded line from its hash chain
+static void decoded_line_unhash(int entry)
+{
+    DecodedLine *line = &decoded_lines[entry];
+    if (line->tab_id == 0)
+        return;
+    int *link = &decoded_line_buckets[decoded_line_bucket(line->tab_id, line->line)];
+    while (*link != entry)
+        link = &decoded_lines[*link].hash_next;
+    *link = line->hash_next;
+    line->tab_id = 0;
+}
+
+// Function to set up the empty LRU on first use
+static void init_decoded_lines(void)
+{
+    for (int bucket = 0; bucket < DECODED_LINE_BUCKETS; bucket++)
+        decoded_line_buckets[bucket] = -1;
+    decoded_lru_head = decoded_lru_tail = -1;
+    for (int entry = 0; entry < DECODED_LINE_CACHE_SIZE; entry++)
     {
-        // Skip any leading whitespace
-        while (*parse_ptr == ' ')
-            parse_ptr++;
+        decoded_lines[entry].tab_id = 0;
+        decoded_line_push_front(entry);
+    }
+    decoded_lines_ready = 1;
+}
 
-        // Look for quoted commands
-        if (*parse_ptr == '"')
+// Function to get a scrollback line as cells through the decoded-line LRU. The row stays
+// valid until DECODED_LINE_CACHE_SIZE - 1 other lines have been decoded.
+const wchar_t *scrollback_line(Tab *tab, int index)
+{
+    static const wchar_t empty_row[BUFFER_COLS];
+    if (index < 0 || index >= tab->scrollback_count)
+        return empty_row;
+    if (!decoded_lines_ready)
+        init_decoded_lines();
+
+    // Step 1: Hit - move to the front
+    unsigned long line_number = tab->scrollback_first_line + index;
+    int bucket = decoded_line_bucket(tab->tab_id, line_number);
+    for (int entry = decoded_line_buckets[bucket]; entry >= 0; entry = decoded_lines[entry].hash_next)
+    {
+        if (decoded_lines[entry].tab_id == tab->tab_id && decoded_lines[entry].line == line_number)
         {
-            parse_ptr++; // Move past the opening quote
-            char *command_start = parse_ptr;
+            decoded_line_unlink(entry);
+            decoded_line_push_front(entry);
+            return decoded_lines[entry].text;
+        }
+    }
 
-            // Find the closing quote
-            while (*parse_ptr != '"' && *parse_ptr != '\0')
-                parse_ptr++;
+    // Step 2: Miss - reuse the least recently used entry
+    int entry = decoded_lru_tail;
+    decoded_line_unhash(entry);
+    decoded_line_unlink(entry);
+
+    DecodedLine *line = &decoded_lines[entry];
+    scrollback_decode_line(tab, index, line->text);
+    line->tab_id = tab->tab_id;
+    line->line = line_number;
+    line->hash_next = decoded_line_buckets[bucket];
+    decoded_line_buckets[bucket] = entry;
+    decoded_line_push_front(entry);
+    decoded_line_misses++;
+    return line->text;
+}
 
-            if (*parse_ptr == '"')
-            {
-                int command_length = parse_ptr - command_start;
-                if (command_length > 0 && command_length < MAX_COMMAND_LENGTH - 1)
-                {
-                    // Extract the command safely
-                    if (snprintf(parsed_commands[command_count], MAX_COMMAND_LENGTH, 
-                                "%.*s", command_length, command_start) >= MAX_COMMAND_LENGTH)
-                    {
-                        add_text_to_buffer(tab, "Error: Individual command too long");
-                        draw_text_buffer(display, window, gc);
-                        return;
-                    }
-                    command_count++;
-                }
-                parse_ptr++; // Move past the closing quote
-            }
-            else
-            {
-                add_text_to_buffer(tab, "Error: Unclosed quote in multiWatch command");
-                draw_text_buffer(display, window, gc);
-                return;
-            }
+// Function to forget decoded lines of a tab from an absolute line on (after lines were replaced)
+void invalidate_decoded_lines(int tab_id, unsigned long from_line)
+{
+    if (!decoded_lines_ready)
+        return;
+    for (int entry = 0; entry < DECODED_LINE_CACHE_SIZE; entry++)
+    {
+        if (decoded_lines[entry].tab_id == tab_id && decoded_lines[entry].line >= from_line)
+        {
+            decoded_line_unhash(entry);
+            decoded_line_unlink(entry);
+            // Move to the least recently used end so it is reused first
+            DecodedLine *line = &decoded_lines[entry];
+            line->lru_next = -1;
+            line->lru_prev = decoded_lru_tail;
+            if (decoded_lru_tail >= 0)
+                decoded_lines[decoded_lru_tail].lru_next = entry;
+            decoded_lru_tail = entry;
+            if (decoded_lru_head < 0)
+                decoded_lru_head = entry;
         }
-        else if (*parse_ptr != '\0')
+    }
+}
+
+// Function to append one line (without its newline) to a tab's scrollback
+static void scrollback_append_line(Tab *tab, const char *bytes, size_t length)
+{
+    // Step 1: Start a new segment when the open one is sealed or full
+    ScrollbackSegment *segment = tab->segment_count > 0 ? tab->segments[tab->segment_count - 1] : NULL;
+    if (segment && !segment->sealed && segment->length + length + 1 > segment->capacity)
+        seal_scrollback_segment(tab, segment);
+
+    if (!segment || segment->sealed)
+    {
+        if (tab->segment_count == tab->segment_capacity)
         {
-            // Invalid syntax - commands must be quoted
-            add_text_to_buffer(tab, "Error: Invalid multiWatch syntax - use: multiWatch \"cmd1\" \"cmd2\"");
-            draw_text_buffer(display, window, gc);
-            return;
+            int capacity = tab->segment_capacity ? tab->segment_capacity * 2 : 16;
+            ScrollbackSegment **grown = realloc(tab->segments, capacity * sizeof(ScrollbackSegment *));
+            if (!grown)
+                return;
+            tab->segments = grown;
+            tab->segment_capacity = capacity;
         }
+        size_t capacity = length + 1 > SCROLLBACK_SEGMENT_BYTES ? length + 1 : SCROLLBACK_SEGMENT_BYTES;
+        segment = new_scrollback_segment(capacity, tab->scrollback_first_line + tab->scrollback_count);
+        if (!segment)
+            return;
+        tab->segments[tab->segment_count++] = segment;
+        tab->scrollback_bytes += segment->capacity;
+
+        // Sealed segments that are no longer among the newest few get compressed
+        if (tab->segment_count > SCROLLBACK_HOT_SEGMENTS + 1)
+            queue_segment_compression(tab, tab->segments[tab->segment_count - 2 - SCROLLBACK_HOT_SEGMENTS]);
     }
 
-    // Step 2: Validate parsed commands
-    if (command_count == 0)
+    // Step 2: Index every SCROLLBACK_INDEX_STRIDE-th line
+    if (segment->line_count % SCROLLBACK_INDEX_STRIDE == 0)
     {
-        add_text_to_buffer(tab, "Usage: multiWatch \"command1\" \"command2\" ...");
-        draw_text_buffer(display, window, gc);
-        return;
+        int slot = segment->line_count / SCROLLBACK_INDEX_STRIDE;
+        if (slot == segment->index_capacity)
+        {
+            uint32_t *grown = realloc(segment->line_index, segment->index_capacity * 2 * sizeof(uint32_t));
+            if (!grown)
+                return;
+            segment->line_index = grown;
+            segment->index_capacity *= 2;
+            update_segment_accounting(segment);
+        }
+        segment->line_index[slot] = (uint32_t)segment->length;
     }
 
-    if (command_count > MAX_MULTIWATCH_COMMANDS)
+    // Step 3: Copy the bytes
+    memcpy(segment->bytes + segment->length, bytes, length);
+    segment->bytes[segment->length + length] = '\n';
+    segment->length += length + 1;
+    segment->line_count++;
+    tab->scrollback_count++;
+}
+
+// Function to drop the oldest lines until the line and byte limits hold
+static void scrollback_enforce_limits(Tab *tab)
+{
+    // Step 1: Whole segments go while the tab holds too many bytes (keeping the newest)
+    while (tab->scrollback_bytes > SCROLLBACK_MAX_BYTES && tab->segment_count > 1)
     {
-        char error_message[256];
-        snprintf(error_message, sizeof(error_message), 
-                "Error: Too many commands specified (maximum: %d)", MAX_MULTIWATCH_COMMANDS);
-        add_text_to_buffer(tab, error_message);
-        draw_text_buffer(display, window, gc);
-        return;
+        ScrollbackSegment *oldest = tab->segments[0];
+        unsigned long next_first = tab->segments[1]->first_line;
+        tab->scrollback_count -= (int)(next_first - tab->scrollback_first_line);
+        tab->scrollback_first_line = next_first;
+        tab->scrollback_bytes -= scrollback_segment_memory(oldest);
+        release_scrollback_segment(oldest);
+        memmove(tab->segments, tab->segments + 1, (tab->segment_count - 1) * sizeof(ScrollbackSegment *));
+        tab->segment_count--;
+        tab->scrollback_hint_valid = 0;
     }
 
-    // Step 3: Notify user and initialize multiwatch system
-    add_text_to_buffer(tab, "Starting multiWatch mode. Press Ctrl+C to stop.");
-    draw_text_buffer(display, window, gc);
+    // Step 2: Then single lines past SCROLLBACK_LINES (only the first line number moves)
+    if (tab->scrollback_count > SCROLLBACK_LINES)
+    {
+        int excess = tab->scrollback_count - SCROLLBACK_LINES;
+        tab->scrollback_first_line += excess;
+        tab->scrollback_count -= excess;
+    }
 
-    multiwatch_count = command_count;
-    multiwatch_mode = 1; // Enable multiwatch monitoring mode
+    // Step 3: Free segments whose every line is now before the first kept line
+    int released = 0;
+    while (released < tab->segment_count - 1 &&
+           tab->segments[released]->first_line + tab->segments[released]->line_count <= tab->scrollback_first_line)
+    {
+        tab->scrollback_bytes -= scrollback_segment_memory(tab->segments[released]);
+        release_scrollback_segment(tab->segments[released]);
+        released++;
+    }
+    if (released > 0)
+    {
+        memmove(tab->segments, tab->segments + released, (tab->segment_count - released) * sizeof(ScrollbackSegment *));
+        tab->segment_count -= released;
+        tab->scrollback_hint_valid = 0;
+    }
+}
 
-    int successful_process_starts = 0;
+// Function to append text to a tab's scrollback: every '\n' ends a line and the
+// text after the last one becomes a line of its own (so "" adds an empty line)
+void scrollback_append(Tab *tab, const char *text, size_t length)
+{
+    const char *line_start = text;
+    const char *text_end = text + length;
 
-    // Step 4: Create temporary files and fork processes for each command
-    for (int command_index = 0; command_index < command_count; command_index++)
+    for (;;)
     {
-        // Create a unique temporary filename for this command's output
-        if (snprintf(multiwatch_processes[command_index].temp_file,
-                     sizeof(multiwatch_processes[command_index].temp_file),
-                     ".temp.multiwatch.%d.%d.%d.txt",
-                     getpid(), command_index, (int)time(NULL)) >= 
-                    (int)sizeof(multiwatch_processes[command_index].temp_file))
-        {
-            printf("Warning: Temporary filename too long for command %d\n", command_index);
-            multiwatch_processes[command_index].active = 0;
-            continue;
-        }
+        const char *newline = memchr(line_start, '\n', (size_t)(text_end - line_start));
+        const char *line_end = newline ? newline : text_end;
+        scrollback_append_line(tab, line_start, (size_t)(line_end - line_start));
+        if (!newline)
+            break;
+        line_start = newline + 1;
+    }
+
+    scrollback_enforce_limits(tab);
+    if (memory_budget_bytes > 0 && scrollback_resident_bytes > memory_budget_bytes)
+        enforce_memory_budget();
+}
 
-        // Create and immediately close the temporary file (child process will write to it)
-        int temp_fd = open(multiwatch_processes[command_index].temp_file, 
-                          O_WRONLY | O_CREAT | O_TRUNC, 0600); // Secure permissions: owner read/write only
-        if (temp_fd == -1)
+// Function to replace count lines starting at index with one replacement line.
+// The store is rebuilt, so absolute numbers of later lines move up by count - 1.
+int scrollback_replace_lines(Tab *tab, int index, int count, const char *replacement)
+{
+    if (index < 0 || count < 1 || index + count > tab->scrollback_count)
+        return -1;
+
+    // Step 1: Detach the current segments and start an empty store at the same first line
+    ScrollbackSegment **old_segments = tab->segments;
+    int old_segment_count = tab->segment_count;
+    int old_line_count = tab->scrollback_count;
+    unsigned long first_line = tab->scrollback_first_line;
+
+    tab->segments = NULL;
+    tab->segment_count = 0;
+    tab->segment_capacity = 0;
+    tab->scrollback_count = 0;
+    tab->scrollback_bytes = 0;
+    tab->scrollback_hint_valid = 0;
+
+    // Step 2: Copy the kept lines' raw bytes across (no decoding)
+    for (int line_index = 0; line_index < old_line_count; line_index++)
+    {
+        if (line_index == index)
         {
-            printf("Error: Failed to create temporary file %s: %s\n", 
-                   multiwatch_processes[command_index].temp_file, strerror(errno));
-            multiwatch_processes[command_index].active = 0;
+            scrollback_append_line(tab, replacement, strlen(replacement));
+            line_index += count - 1;
             continue;
         }
-        close(temp_fd); // Close now, child will reopen
+        const char *bytes;
+        size_t length;
+        if (scrollback_segments_line(old_segments, old_segment_count, first_line + line_index, &bytes, &length))
+            scrollback_append_line(tab, bytes, length);
+    }
 
-        // Fork a new process for this command
-        pid_t child_pid = fork();
+    // Step 3: Release the old segments (snapshots may still hold some) and stale decoded rows
+    for (int segment_index = 0; segment_index < old_segment_count; segment_index++)
+        release_scrollback_segment(old_segments[segment_index]);
+    free(old_segments);
+    invalidate_decoded_lines(tab->tab_id, first_line + index);
+    return 0;
+}
 
-        if (child_pid == 0)
-        {
-            // CHILD PROCESS: Execute the command
-            // Reset signal handlers to default behavior
-            signal(SIGINT, SIG_DFL);
-            signal(SIGTERM, SIG_DFL);
+// Function to free all of a tab's scrollback
+void free_scrollback(Tab *tab)
+{
+    for (int segment_index = 0; segment_index < tab->segment_count; segment_index++)
+        release_scrollback_segment(tab->segments[segment_index]);
+    free(tab->segments);
+    tab->segments = NULL;
+    tab->segment_count = 0;
+    tab->segment_capacity = 0;
+    tab->scrollback_count = 0;
+    tab->scrollback_bytes = 0;
+    tab->scrollback_hint_valid = 0;
+    invalidate_decoded_lines(tab->tab_id, 0);
+}
 
-            // Redirect stdout and stderr to the temporary file
-            int output_fd = open(multiwatch_processes[command_index].temp_file, 
-                                O_WRONLY | O_CREAT | O_TRUNC, 0600);
-            if (output_fd == -1)
-            {
-                fprintf(stderr, "Failed to open output file: %s\n", strerror(errno));
-                exit(1);
-            }
+// ============================================================================
+// SCROLLBACK COMPRESSION
+// ============================================================================
+//
+// Sealed segments older than the newest SCROLLBACK_HOT_SEGMENTS are
+// compressed by a background thread into the LZ4 block format (the encoder
+// and decoder below are self-contained; no library is linked). The UI thread
+// allocates each job's output buffer and applies the result, so the
+// compressor never calls malloc(). Reading a compressed segment decompresses
+// it into one of DECOMPRESSED_CHUNK_CACHE buffers; search workers decompress
+// into their own stack instead.
+
+// Function to read 4 unaligned bytes
+static uint32_t lz4_read32(const unsigned char *bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+// Function to write an LZ4 length continuation (255, 255, ..., rest)
+static unsigned char *lz4_write_length(unsigned char *output, size_t length)
+{
+    while (length >= 255)
+    {
+        *output++ = 255;
+        length -= 255;
+    }
+    *output++ = (unsigned char)length;
+    return output;
+}
 
-            // Redirect standard output and error to the file
-            if (dup2(output_fd, STDOUT_FILENO) == -1)
+// Function to compress a block (at most 64 KB back-references) with a greedy single-probe
+// hash table match finder. Returns the compressed length, or 0 if it would not fit in capacity.
+size_t lz4_compress_block(const unsigned char *source, size_t length, unsigned char *output, size_t capacity)
+{
+    uint32_t table[1 << LZ4_HASH_BITS]; // Position + 1 of the last 4-byte sequence per hash (0 = none)
+    memset(table, 0, sizeof(table));
+    unsigned char *out = output;
+    unsigned char *out_end = output + capacity;
+    size_t anchor = 0;                  // First byte not yet emitted
+    size_t position = 0;
+
+    // Step 1: Emit a sequence (literals + match) for every match found
+    if (length > LZ4_MATCH_FIND_LIMIT)
+    {
+        size_t match_limit = length - LZ4_MATCH_FIND_LIMIT;
+        while (position < match_limit)
+        {
+            uint32_t sequence = lz4_read32(source + position);
+            uint32_t hash = (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+            size_t candidate = table[hash];
+            table[hash] = (uint32_t)position + 1;
+            if (candidate == 0 || position - (candidate - 1) > 65535 || lz4_read32(source + candidate - 1) != sequence)
             {
-                fprintf(stderr, "Failed to redirect stdout: %s\n", strerror(errno));
-                close(output_fd);
-                exit(1);
+                position++;
+                continue;
             }
-            if (dup2(output_fd, STDERR_FILENO) == -1)
+            candidate--;
+
+            // Grow the match backwards over pending literals, then forwards
+            while (position > anchor && candidate > 0 && source[position - 1] == source[candidate - 1])
             {
-                fprintf(stderr, "Failed to redirect stderr: %s\n", strerror(errno));
-                close(output_fd);
-                exit(1);
+                position--;
+                candidate--;
             }
-            close(output_fd); // File descriptor no longer needed
+            size_t match_end = position + LZ4_MIN_MATCH;
+            while (match_end < length - LZ4_LAST_LITERALS && source[match_end] == source[candidate + match_end - position])
+                match_end++;
+
+            size_t literal_length = position - anchor;
+            size_t match_length = match_end - position - LZ4_MIN_MATCH;
+            if ((size_t)(out_end - out) < 1 + literal_length + literal_length / 255 + 1 + 2 + match_length / 255 + 1)
+                return 0;
+
+            unsigned char *token = out++;
+            *token = (unsigned char)(((literal_length >= 15 ? 15 : literal_length) << 4) |
+                                     (match_length >= 15 ? 15 : match_length));
+            if (literal_length >= 15)
+                out = lz4_write_length(out, literal_length - 15);
+            memcpy(out, source + anchor, literal_length);
+            out += literal_length;
+            size_t offset = position - candidate;
+            *out++ = (unsigned char)(offset & 0xFF);
+            *out++ = (unsigned char)(offset >> 8);
+            if (match_length >= 15)
+                out = lz4_write_length(out, match_length - 15);
+
+            position = anchor = match_end;
+        }
+    }
 
-            // Execute the command based on whether it contains pipes
-            if (strstr(parsed_commands[command_index], "|") != NULL)
+    // Step 2: The rest goes out as the final literals-only sequence
+    size_t literal_length = length - anchor;
+    if ((size_t)(out_end - out) < 1 + literal_length + literal_length / 255 + 1)
+        return 0;
+    *out++ = (unsigned char)((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15)
+        out = lz4_write_length(out, literal_length - 15);
+    memcpy(out, source + anchor, literal_length);
+    out += literal_length;
+    return (size_t)(out - output);
+}
+
+// Function to decompress a block with full bounds checking; returns the decompressed
+// length or -1 if the input is malformed or does not fit in capacity
+long lz4_decompress_block(const unsigned char *source, size_t length, unsigned char *output, size_t capacity)
+{
+    const unsigned char *in = source;
+    const unsigned char *in_end = source + length;
+    unsigned char *out = output;
+    unsigned char *out_end = output + capacity;
+
+    while (in < in_end)
+    {
+        // Step 1: Literals
+        unsigned int token = *in++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15)
+        {
+            unsigned char extra;
+            do
             {
-                // Command contains pipes - execute through shell for proper pipe handling
-                execl("/bin/sh", "sh", "-c", parsed_commands[command_index], NULL);
-                fprintf(stderr, "Failed to execute command through shell: %s\n", strerror(errno));
-            }
-            else
+                if (in >= in_end)
+                    return -1;
+                extra = *in++;
+                literal_length += extra;
+            } while (extra == 255);
+        }
+        if ((size_t)(in_end - in) < literal_length || (size_t)(out_end - out) < literal_length)
+            return -1;
+        memcpy(out, in, literal_length);
+        out += literal_length;
+        in += literal_length;
+        if (in == in_end)
+            break;                      // The last sequence has no match
+
+        // Step 2: Match (may overlap its own output, so short offsets copy bytewise)
+        if (in_end - in < 2)
+            return -1;
+        size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - output))
+            return -1;
+        size_t match_length = token & 15;
+        if (match_length == 15)
+        {
+            unsigned char extra;
+            do
             {
-                // Simple command without pipes - tokenize and execute directly
-                char *arguments[64];
-                int argument_count = 0;
-                char command_buffer[MAX_COMMAND_LENGTH];
+                if (in >= in_end)
+                    return -1;
+                extra = *in++;
+                match_length += extra;
+            } while (extra == 255);
+        }
+        match_length += LZ4_MIN_MATCH;
+        if ((size_t)(out_end - out) < match_length)
+            return -1;
 
-                // Create a safe working copy for tokenization
-                if (snprintf(command_buffer, sizeof(command_buffer), "%s", 
-                            parsed_commands[command_index]) >= (int)sizeof(command_buffer))
-                {
-                    fprintf(stderr, "Error: Command too long for processing\n");
-                    exit(1);
-                }
+        const unsigned char *from = out - offset;
+        if (offset >= match_length)
+        {
+            memcpy(out, from, match_length);
+            out += match_length;
+        }
+        else
+        {
+            while (match_length-- > 0)
+                *out++ = *from++;
+        }
+    }
+    return (long)(out - output);
+}
 
-                // Tokenize the command into arguments
-                char *token = strtok(command_buffer, " ");
-                while (token != NULL && argument_count < 63)
-                {
-                    arguments[argument_count++] = token;
-                    token = strtok(NULL, " ");
-                }
-                arguments[argument_count] = NULL; // NULL-terminate the argument list
+// Function to load a segment that is not in memory as raw bytes: decompress it, reading it
+// from the spill file first if it was evicted. buffer holds SCROLLBACK_SEGMENT_BYTES and
+// scratch LZ4_BOUND(SCROLLBACK_SEGMENT_BYTES). No malloc, so workers may call it.
+int load_segment_bytes(const ScrollbackSegment *segment, char *buffer, unsigned char *scratch)
+{
+    const unsigned char *packed = segment->compressed;
+    if (segment->spill_offset >= 0)
+    {
+        size_t spill_length = segment->compressed_length ? segment->compressed_length : segment->length;
+        unsigned char *target = segment->compressed_length ? scratch : (unsigned char *)buffer;
+        if (pread(spill_fd, target, spill_length, segment->spill_offset) != (ssize_t)spill_length)
+            return -1;
+        if (!segment->compressed_length)
+            return 0;                    // Spilled uncompressed
+        packed = scratch;
+    }
+    long length = lz4_decompress_block(packed, segment->compressed_length, (unsigned char *)buffer,
+                                       SCROLLBACK_SEGMENT_BYTES);
+    return length == (long)segment->length ? 0 : -1;
+}
 
-                if (argument_count == 0)
-                {
-                    fprintf(stderr, "Error: Empty command\n");
-                    exit(1);
-                }
+// Function to get a segment's bytes on the UI thread, decompressing (or reading back) into the chunk
+// cache if needed. Valid until DECOMPRESSED_CHUNK_CACHE other segments have been read.
+const char *scrollback_segment_data(const ScrollbackSegment *segment)
+{
+    if (segment->bytes)
+        return segment->bytes;
 
-                // Execute the command directly
-                execvp(arguments[0], arguments);
-                fprintf(stderr, "Failed to execute %s: %s\n", arguments[0], strerror(errno));
-            }
-            exit(127); // Exit with error if exec fails
+    // Step 1: Hit
+    DecompressedChunk *victim = &decompressed_chunks[0];
+    for (int slot = 0; slot < DECOMPRESSED_CHUNK_CACHE; slot++)
+    {
+        DecompressedChunk *chunk = &decompressed_chunks[slot];
+        if (chunk->segment == segment)
+        {
+            chunk->last_used = ++decompressed_chunk_clock;
+            return chunk->bytes;
         }
-        else if (child_pid > 0)
+        if (chunk->last_used < victim->last_used)
+            victim = chunk;
+    }
+
+    // Step 2: Miss - decompress over the least recently used chunk
+    if (!victim->bytes)
+    {
+        victim->bytes = malloc(SCROLLBACK_SEGMENT_BYTES);
+        if (!victim->bytes)
+            return NULL;
+    }
+    victim->segment = NULL;
+    if (load_segment_bytes(segment, victim->bytes, spill_read_buffer) != 0)
+    {
+        printf("Warning: Scrollback segment at line %lu could not be read back\n", segment->first_line);
+        return NULL;
+    }
+    if (segment->spill_offset >= 0)
+        spill_reads++;
+    victim->segment = segment;
+    victim->last_used = ++decompressed_chunk_clock;
+    decompressed_chunk_misses++;
+    return victim->bytes;
+}
+
+// Function to drop a freed segment from the chunk cache (its address may be reused)
+void forget_decompressed_chunk(const ScrollbackSegment *segment)
+{
+    for (int slot = 0; slot < DECOMPRESSED_CHUNK_CACHE; slot++)
+    {
+        if (decompressed_chunks[slot].segment == segment)
         {
-            // PARENT PROCESS: Track the child process
-            multiwatch_processes[command_index].pid = child_pid;
-            
-            // Store the command string for display purposes
-            if (snprintf(multiwatch_processes[command_index].command, MAX_COMMAND_LENGTH, 
-                        "%s", parsed_commands[command_index]) >= MAX_COMMAND_LENGTH)
-            {
-                printf("Warning: Command name truncated for display\n");
-            }
-            multiwatch_processes[command_index].active = 1;
+            decompressed_chunks[slot].segment = NULL;
+            decompressed_chunks[slot].last_used = 0;
+        }
+    }
+}
 
-            // Open the temporary file for reading (non-blocking) to monitor output
-            multiwatch_processes[command_index].fd = 
-                open(multiwatch_processes[command_index].temp_file, O_RDONLY | O_NONBLOCK);
-            if (multiwatch_processes[command_index].fd == -1)
-            {
-                printf("Failed to open temp file for reading: %s: %s\n", 
-                       multiwatch_processes[command_index].temp_file, strerror(errno));
-                multiwatch_processes[command_index].active = 0;
-            }
-            else
-            {
-                successful_process_starts++;
-            }
+// Compressor thread entry point - compresses queued segments one at a time
+static void *scrollback_compressor_main(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&compressor_lock);
 
-            printf("Started process %d for command: %s\n", child_pid, parsed_commands[command_index]);
+    while (!compressor_shutdown)
+    {
+        CompressionJob *job = compressor_queue;
+        if (!job)
+        {
+            pthread_cond_wait(&compressor_wake, &compressor_lock);
+            continue;
         }
-        else
+        compressor_queue = job->next;
+        if (!compressor_queue)
+            compressor_queue_tail = NULL;
+        pthread_mutex_unlock(&compressor_lock);
+
+        // Sealed bytes never change and the job's reference keeps them alive
+        job->output_length = lz4_compress_block((const unsigned char *)job->segment->bytes, job->segment->length,
+                                                job->output, job->output_capacity);
+
+        pthread_mutex_lock(&compressor_lock);
+        job->next = compressor_finished;
+        compressor_finished = job;
+        io_notify_ui();
+    }
+
+    pthread_mutex_unlock(&compressor_lock);
+    return NULL;
+}
+
+// Function to hand a sealed segment to the compressor (UI thread)
+void queue_segment_compression(Tab *tab, ScrollbackSegment *segment)
+{
+    if (!segment->sealed || segment->compression_queued || !segment->bytes ||
+        segment->length < 1024 || segment->length > SCROLLBACK_SEGMENT_BYTES)
+        return;                         // Tiny segments gain nothing; huge lines skip the chunk cache
+
+    // Step 1: Start the thread on first use
+    if (!compressor_running)
+    {
+        compressor_shutdown = 0;
+        int create_result = pthread_create(&compressor_thread, NULL, scrollback_compressor_main, NULL);
+        if (create_result != 0)
         {
-            // Fork failed
-            printf("Fork failed for command '%s': %s\n", 
-                   parsed_commands[command_index], strerror(errno));
-            multiwatch_processes[command_index].active = 0;
+            printf("Warning: Failed to start scrollback compressor: %s\n", strerror(create_result));
+            return;
         }
+        compressor_running = 1;
     }
 
-    // Step 5: Check if we successfully started any processes
-    if (successful_process_starts == 0)
+    // Step 2: Queue the job with its output buffer already allocated
+    CompressionJob *job = calloc(1, sizeof(CompressionJob));
+    unsigned char *output = malloc(LZ4_BOUND(segment->length));
+    if (!job || !output)
     {
-        add_text_to_buffer(tab, "Error: Failed to start any multiWatch processes");
-        cleanup_multiwatch();
-        multiwatch_mode = 0;
-        draw_text_buffer(display, window, gc);
+        free(job);
+        free(output);
         return;
     }
+    job->segment = segment;
+    job->tab_id = tab->tab_id;
+    job->output = output;
+    job->output_capacity = LZ4_BOUND(segment->length);
+    segment->references++;
+    segment->compression_queued = 1;
 
-    // Step 6: Begin monitoring the running processes
-    printf("Starting monitoring for %d multiWatch processes\n", successful_process_starts);
-    monitor_multiwatch_processes(display, window, gc, tab);
+    pthread_mutex_lock(&compressor_lock);
+    if (compressor_queue_tail)
+        compressor_queue_tail->next = job;
+    else
+        compressor_queue = job;
+    compressor_queue_tail = job;
+    pthread_cond_signal(&compressor_wake);
+    pthread_mutex_unlock(&compressor_lock);
 }
 
-void handle_jobs_command(Tab *tab)
+// Function to replace a segment's bytes with its compressed form if that saves at least a
+// tenth (UI thread; nothing else may be reading the bytes). Takes ownership of output and
+// returns the bytes saved.
+size_t install_compressed_segment(Tab *tab, ScrollbackSegment *segment, unsigned char *output, size_t output_length)
 {
-    // Step 1: Check if there are any background jobs to display
-    if (bg_job_count == 0)
+    if (output_length == 0 || output_length >= segment->length - segment->length / 10)
     {
-        add_text_to_buffer(tab, "No background jobs running");
-        return;
+        free(output);
+        return 0;
     }
 
-    // Step 2: Clean up finished processes before displaying
-    // This ensures we only show currently active jobs
-    for (int job_index = 0; job_index < bg_job_count; job_index++)
+    unsigned char *shrunk = realloc(output, output_length);
+    segment->compressed = shrunk ? shrunk : output;
+    segment->compressed_length = output_length;
+
+    size_t saved = segment->capacity - output_length;
+    tab->scrollback_bytes -= saved;
+    compressed_input_bytes += segment->length;
+    compressed_output_bytes += output_length;
+    free(segment->bytes);
+    segment->bytes = NULL;
+    update_segment_accounting(segment);
+    return saved;
+}
+
+// Function to swap a finished job's output into its segment if the tab still holds it.
+// Returns 0 if a search snapshot may still be reading the raw bytes (try again later).
+static int apply_compression_job(CompressionJob *job)
+{
+    ScrollbackSegment *segment = job->segment;
+    Tab *tab = find_tab_by_id(job->tab_id);
+    int held = 0;
+    if (tab)
     {
-        int process_status;
-        pid_t wait_result = waitpid(bg_processes[job_index].pid, &process_status, WNOHANG);
-        
-        if (wait_result > 0)
+        int segment_index = locate_scrollback_segment(tab->segments, tab->segment_count, segment->first_line);
+        held = segment_index >= 0 && tab->segments[segment_index] == segment;
+    }
+
+    // Step 1: Only the tab and this job may reference the segment when its bytes are freed
+    if (held && segment->references > 2)
+        return 0;
+
+    // Step 2: Swap in the compressed form (install_compressed_segment() owns the output now)
+    if (held)
+        install_compressed_segment(tab, segment, job->output, job->output_length);
+    else
+        free(job->output);
+
+    release_scrollback_segment(segment);
+    free(job);
+    return 1;
+}
+
+// Function to apply finished compression jobs (UI thread); returns 1 if any was applied
+int service_scrollback_compression(void)
+{
+    if (!compressor_running)
+        return 0;
+
+    // Step 1: Take the finished list, plus jobs deferred earlier
+    pthread_mutex_lock(&compressor_lock);
+    CompressionJob *finished = compressor_finished;
+    compressor_finished = NULL;
+    pthread_mutex_unlock(&compressor_lock);
+
+    CompressionJob *pending = compressor_deferred;
+    compressor_deferred = NULL;
+    while (finished)
+    {
+        CompressionJob *next = finished->next;
+        finished->next = pending;
+        pending = finished;
+        finished = next;
+    }
+
+    // Step 2: Apply what can be applied, defer the rest
+    int applied = 0;
+    while (pending)
+    {
+        CompressionJob *next = pending->next;
+        if (apply_compression_job(pending))
         {
-            // Process has terminated - remove it from the jobs array
-            printf("Background job %d (PID: %d) has finished\n", 
-                   bg_processes[job_index].job_id, bg_processes[job_index].pid);
-            
-            // Shift remaining jobs left to fill the gap
-            for (int shift_index = job_index; shift_index < bg_job_count - 1; shift_index++)
-            {
-                bg_processes[shift_index] = bg_processes[shift_index + 1];
-            }
-            
-            bg_job_count--;  // Reduce job count
-            job_index--;     // Re-check current position since array was shifted
-            
-            printf("Removed finished job, now %d background jobs remaining\n", bg_job_count);
+            applied = 1;
         }
-        else if (wait_result == 0)
+        else
         {
-            // Process is still running - no action needed
+            pending->next = compressor_deferred;
+            compressor_deferred = pending;
+        }
+        pending = next;
+    }
+    return applied;
+}
+
+// Function to stop the compressor and drop unfinished jobs on shutdown
+void stop_scrollback_compressor(void)
+{
+    if (!compressor_running)
+        return;
+
+    pthread_mutex_lock(&compressor_lock);
+    compressor_shutdown = 1;
+    pthread_cond_broadcast(&compressor_wake);
+    pthread_mutex_unlock(&compressor_lock);
+    pthread_join(compressor_thread, NULL);
+    compressor_running = 0;
+
+    // Queued jobs were never started; finished ones are simply not applied
+    CompressionJob *lists[3] = {compressor_queue, compressor_finished, compressor_deferred};
+    for (int list = 0; list < 3; list++)
+    {
+        while (lists[list])
+        {
+            CompressionJob *next = lists[list]->next;
+            free(lists[list]->output);
+            release_scrollback_segment(lists[list]->segment);
+            free(lists[list]);
+            lists[list] = next;
+        }
+    }
+    compressor_queue = compressor_queue_tail = compressor_finished = compressor_deferred = NULL;
+    printf("Scrollback compressor stopped (%zu KB compressed to %zu KB)\n",
+           compressed_input_bytes / 1024, compressed_output_bytes / 1024);
+}
+
+// ============================================================================
+// TAB HIBERNATION
+// ============================================================================
+//
+// A tab that has not been shown for hibernate_idle_ms gives back what can be
+// rebuilt cheaply: its frame pixmap, the uncompressed newest scrollback
+// segments (compressed on the spot) and its history strings (packed into one
+// LZ4 blob of NUL-terminated UTF-8). Showing the tab again unpacks the
+// history; scrollback stays compressed and is decompressed as it is read.
+
+// Function to compress a sealed, unshared segment on the UI thread; returns bytes saved
+static size_t compress_segment_now(Tab *tab, ScrollbackSegment *segment)
+{
+    if (!segment->sealed || !segment->bytes || segment->compression_queued || segment->references > 1 ||
+        segment->length < 1024 || segment->length > SCROLLBACK_SEGMENT_BYTES)
+        return 0;
+
+    unsigned char *output = malloc(LZ4_BOUND(segment->length));
+    if (!output)
+        return 0;
+    segment->compression_queued = 1;     // Never queued for the background compressor later
+    size_t output_length = lz4_compress_block((const unsigned char *)segment->bytes, segment->length,
+                                              output, LZ4_BOUND(segment->length));
+    return install_compressed_segment(tab, segment, output, output_length);
+}
+
+// Function to encode history entries from first on as NUL-terminated UTF-8 (caller frees;
+// NULL if an entry is not representable in this locale). resident gets their wide-string size.
+char *encode_history_entries(const Tab *tab, int first, size_t *encoded_length, size_t *resident)
+{
+    size_t wide_bytes = 0, length = 0;
+    for (int history_index = first; history_index < tab->history_count; history_index++)
+    {
+        size_t entry_bytes = wcstombs(NULL, tab->command_history[history_index], 0);
+        if (entry_bytes == (size_t)-1)
+            return NULL;
+        length += entry_bytes + 1;
+        wide_bytes += (wcslen(tab->command_history[history_index]) + 1) * sizeof(wchar_t);
+    }
+
+    char *encoded = malloc(length > 0 ? length : 1);
+    if (!encoded)
+        return NULL;
+    size_t written = 0;
+    for (int history_index = first; history_index < tab->history_count; history_index++)
+        written += wcstombs(encoded + written, tab->command_history[history_index], length - written) + 1;
+    *encoded_length = length;
+    if (resident)
+        *resident = wide_bytes;
+    return encoded;
+}
+
+// Function to pack a tab's history into one compressed blob; returns bytes freed
+static size_t hibernate_history(Tab *tab)
+{
+    if (tab->history_blob || tab->history_count == 0)
+        return 0;
+
+    // Step 1: Encode every entry as NUL-terminated UTF-8 (entries the locale cannot encode stay resident)
+    size_t resident = 0, encoded_length = 0;
+    char *encoded = encode_history_entries(tab, 0, &encoded_length, &resident);
+    unsigned char *blob = malloc(LZ4_BOUND(encoded_length));
+    if (!encoded || !blob)
+    {
+        free(encoded);
+        free(blob);
+        return 0;
+    }
+
+    // Step 2: Compress, then free the wide strings
+    size_t blob_length = lz4_compress_block((const unsigned char *)encoded, encoded_length, blob,
+                                            LZ4_BOUND(encoded_length));
+    free(encoded);
+    if (blob_length == 0 || blob_length >= resident)
+    {
+        free(blob);
+        return 0;
+    }
+    unsigned char *shrunk = realloc(blob, blob_length);
+    tab->history_blob = shrunk ? shrunk : blob;
+    tab->history_blob_length = blob_length;
+    tab->history_blob_raw_length = encoded_length;
+
+    for (int history_index = 0; history_index < tab->history_count; history_index++)
+    {
+        free(tab->command_history[history_index]);
+        tab->command_history[history_index] = NULL;
+    }
+    return resident - blob_length;
+}
+
+// Function to decompress a tab's history blob into NUL-terminated UTF-8 entries (caller frees)
+char *inflate_history_blob(const Tab *tab)
+{
+    char *encoded = malloc(tab->history_blob_raw_length);
+    if (!encoded)
+        return NULL;
+    if (lz4_decompress_block(tab->history_blob, tab->history_blob_length, (unsigned char *)encoded,
+                             tab->history_blob_raw_length) != (long)tab->history_blob_raw_length)
+    {
+        free(encoded);
+        return NULL;
+    }
+    return encoded;
+}
+
+// Function to restore a tab's history strings from its blob; returns 0 on success
+int thaw_tab_history(Tab *tab)
+{
+    if (!tab->history_blob)
+        return 0;
+
+    char *encoded = inflate_history_blob(tab);
+    if (!encoded)
+    {
+        // The entries are gone either way; an empty history is safer than one full of NULLs
+        printf("Warning: Failed to restore history of %s\n", tab->tab_name);
+        free(tab->history_blob);
+        tab->history_blob = NULL;
+        tab->history_blob_length = 0;
+        tab->history_blob_raw_length = 0;
+        tab->history_count = 0;
+        tab->history_current = 0;
+        return -1;
+    }
+
+    const char *entry = encoded;
+    int restored = 0;
+    for (int history_index = 0; history_index < tab->history_count; history_index++)
+    {
+        size_t characters = mbstowcs(NULL, entry, 0);
+        wchar_t *text = characters == (size_t)-1 ? NULL : malloc((characters + 1) * sizeof(wchar_t));
+        if (!text)
+            break;
+        mbstowcs(text, entry, characters + 1);
+        tab->command_history[restored++] = text;
+        entry += strlen(entry) + 1;
+    }
+    free(encoded);
+
+    tab->history_count = restored;
+    if (tab->history_current > restored)
+        tab->history_current = restored;
+    free(tab->history_blob);
+    tab->history_blob = NULL;
+    tab->history_blob_length = 0;
+    tab->history_blob_raw_length = 0;
+    return 0;
+}
+
+// Function to hibernate a hidden tab; returns the bytes given back (including X pixmap memory)
+size_t hibernate_tab(Tab *tab)
+{
+    if (tab->hibernated || tab_is_visible(tab))
+        return 0;
+
+    // Step 1: The frame pixmap is redrawn from the grid when the tab is shown
+    size_t pixmap_bytes = 0;
+    if (tab->frame_pixmap != None)
+    {
+        pixmap_bytes = (size_t)BUFFER_COLS * CHAR_WIDTH * BUFFER_ROWS * CHAR_HEIGHT * 4;
+        release_frame_pixmap(tab);
+    }
+
+    // Step 2: Seal the open segment and compress the newest ones the compressor leaves alone
+    // (sealing alone gives back the open segment's unused capacity, so the drop is measured)
+    size_t scrollback_before = tab->scrollback_bytes;
+    if (tab->segment_count > 0)
+    {
+        seal_scrollback_segment(tab, tab->segments[tab->segment_count - 1]);
+        int first = tab->segment_count - 1 - SCROLLBACK_HOT_SEGMENTS;
+        for (int segment_index = first > 0 ? first : 0; segment_index < tab->segment_count; segment_index++)
+            compress_segment_now(tab, tab->segments[segment_index]);
+    }
+    size_t scrollback_bytes = scrollback_before > tab->scrollback_bytes ? scrollback_before - tab->scrollback_bytes : 0;
+
+    // Step 3: History strings
+    size_t history_bytes = hibernate_history(tab);
+
+    tab->hibernated = 1;
+    tab->reclaimed_bytes = pixmap_bytes + scrollback_bytes + history_bytes;
+    hibernation_reclaimed_total += tab->reclaimed_bytes;
+    printf("%s hibernated: reclaimed %zu KB (scrollback %zu KB, history %zu KB, X pixmap %zu KB)\n",
+           tab->tab_name, tab->reclaimed_bytes / 1024, scrollback_bytes / 1024, history_bytes / 1024,
+           pixmap_bytes / 1024);
+    return tab->reclaimed_bytes;
+}
+
+// Function to wake a tab that is about to be shown
+void wake_tab(Tab *tab)
+{
+    if (!tab->hibernated)
+        return;
+    thaw_tab_history(tab);
+    tab->hibernated = 0;
+    printf("%s woke up\n", tab->tab_name);
+}
+
+// Function to hibernate tabs hidden longer than hibernate_idle_ms (called from the event loop)
+void service_tab_hibernation(void)
+{
+    long long now = monotonic_ms();
+    if (hibernate_idle_ms <= 0 || now < next_hibernation_check_ms)
+        return;
+    next_hibernation_check_ms = now + HIBERNATE_CHECK_MS;
+
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+        if (!tab->hibernated && !tab_is_visible(tab) && tab->last_viewed_ms > 0 &&
+            now - tab->last_viewed_ms >= hibernate_idle_ms)
+            hibernate_tab(tab);
+    }
+}
+
+// Function to handle the "hibernate" builtin: hibernate every hidden tab now and report
+void handle_hibernate_command(Tab *tab)
+{
+    char line[160];
+    size_t reclaimed = 0;
+    int hibernated = 0;
+
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *other = &tabs[tab_index];
+        if (other == tab || other->hibernated)
+            continue;
+        size_t tab_reclaimed = hibernate_tab(other);
+        snprintf(line, sizeof(line), "  %-12s reclaimed %zu KB", other->tab_name, tab_reclaimed / 1024);
+        add_text_to_buffer(tab, line);
+        reclaimed += tab_reclaimed;
+        hibernated++;
+    }
+
+    snprintf(line, sizeof(line), "Hibernated %d tab(s): %zu KB reclaimed now, %zu KB since start", hibernated,
+             reclaimed / 1024, hibernation_reclaimed_total / 1024);
+    add_text_to_buffer(tab, line);
+}
+
+// ============================================================================
+// MEMORY BUDGET
+// ============================================================================
+//
+// Every segment keeps its resident size in resident_bytes and the sum over all
+// tabs is scrollback_resident_bytes, so checking the budget is one compare per
+// append. Over budget, the least recently read sealed segments of any tab are
+// written (compressed when it saves space) to an unlinked spill file and
+// their memory is freed; they are read back through the chunk cache like
+// compressed segments. Freed spill ranges are reused first fit.
+
+// Function to compute the memory a segment holds right now
+size_t segment_resident_size(const ScrollbackSegment *segment)
+{
+    if (segment->mapped)
+        return sizeof(ScrollbackSegment); // The page cache holds the rest
+    size_t size = sizeof(ScrollbackSegment) + (size_t)segment->index_capacity * sizeof(uint32_t);
+    if (segment->bytes)
+        size += segment->capacity;
+    else if (segment->spill_offset < 0)
+        size += segment->compressed_length;
+    return size;
+}
+
+// Function to bring a segment's share of scrollback_resident_bytes up to date
+void update_segment_accounting(ScrollbackSegment *segment)
+{
+    size_t size = segment_resident_size(segment);
+    scrollback_resident_bytes += size - segment->resident_bytes;
+    segment->resident_bytes = size;
+}
+
+// Function to create the spill file on first use; returns 0 on success
+static int open_spill_file(void)
+{
+    if (spill_fd >= 0)
+        return 0;
+    if (spill_failed)
+        return -1;
+
+    const char *directory = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/myterm-spill-XXXXXX", directory && *directory ? directory : "/tmp");
+    spill_fd = mkstemp(path);
+    if (spill_fd < 0)
+    {
+        printf("Warning: Cannot create scrollback spill file %s: %s\n", path, strerror(errno));
+        spill_failed = 1;
+        return -1;
+    }
+    unlink(path);                        // Space is returned when the file is closed
+    fcntl(spill_fd, F_SETFD, FD_CLOEXEC);
+    printf("Scrollback spill file opened (budget %zu MB)\n", memory_budget_bytes / (1024 * 1024));
+    return 0;
+}
+
+// Function to find room for length bytes in the spill file
+static long long spill_allocate(size_t length)
+{
+    for (int extent_index = 0; extent_index < spill_free_count; extent_index++)
+    {
+        SpillExtent *extent = &spill_free_extents[extent_index];
+        if (extent->length < length)
+            continue;
+        long long offset = extent->offset;
+        extent->offset += length;
+        extent->length -= length;
+        if (extent->length == 0)
+        {
+            memmove(extent, extent + 1, (spill_free_count - extent_index - 1) * sizeof(SpillExtent));
+            spill_free_count--;
+        }
+        return offset;
+    }
+
+    long long offset = spill_file_size;
+    spill_file_size += length;
+    return offset;
+}
+
+// Function to return a spilled range to the free list, merging it with its neighbours
+void spill_release(long long offset, size_t length)
+{
+    spill_live_bytes -= length;
+
+    // Step 1: Find the first free extent after the range
+    int position = 0;
+    while (position < spill_free_count && spill_free_extents[position].offset < offset)
+        position++;
+
+    // Step 2: Merge with the extent before and/or after it
+    int merged_before = position > 0 &&
+                        spill_free_extents[position - 1].offset + (long long)spill_free_extents[position - 1].length == offset;
+    int merged_after = position < spill_free_count && offset + (long long)length == spill_free_extents[position].offset;
+    if (merged_before && merged_after)
+    {
+        spill_free_extents[position - 1].length += length + spill_free_extents[position].length;
+        memmove(&spill_free_extents[position], &spill_free_extents[position + 1],
+                (spill_free_count - position - 1) * sizeof(SpillExtent));
+        spill_free_count--;
+        position--;
+    }
+    else if (merged_before)
+    {
+        spill_free_extents[--position].length += length;
+    }
+    else if (merged_after)
+    {
+        spill_free_extents[position].offset = offset;
+        spill_free_extents[position].length += length;
+    }
+    else
+    {
+        if (spill_free_count == spill_free_capacity)
+        {
+            int capacity = spill_free_capacity ? spill_free_capacity * 2 : 64;
+            SpillExtent *grown = realloc(spill_free_extents, capacity * sizeof(SpillExtent));
+            if (!grown)
+                return;                  // The range is leaked until the file is closed
+            spill_free_extents = grown;
+            spill_free_capacity = capacity;
+        }
+        memmove(&spill_free_extents[position + 1], &spill_free_extents[position],
+                (spill_free_count - position) * sizeof(SpillExtent));
+        spill_free_extents[position].offset = offset;
+        spill_free_extents[position].length = length;
+        spill_free_count++;
+    }
+
+    // Step 3: A free extent at the end of the file shrinks it
+    SpillExtent *last = &spill_free_extents[spill_free_count - 1];
+    if (position == spill_free_count - 1 && last->offset + (long long)last->length == spill_file_size)
+    {
+        spill_file_size = last->offset;
+        spill_free_count--;
+        if (ftruncate(spill_fd, spill_file_size) != 0)
+            printf("Warning: Failed to shrink the spill file\n");
+    }
+}
+
+// Function to write a sealed, unshared segment to the spill file and free its memory; returns bytes freed
+static size_t spill_segment(Tab *tab, ScrollbackSegment *segment)
+{
+    if (open_spill_file() != 0)
+        return 0;
+
+    // Step 1: Compress it first if that has not happened yet (it stays raw if that saves nothing)
+    if (segment->bytes && !segment->compression_queued)
+        compress_segment_now(tab, segment);
+
+    // Step 2: Write whichever form is in memory
+    const void *payload = segment->bytes ? (const void *)segment->bytes : (const void *)segment->compressed;
+    size_t length = segment->bytes ? segment->length : segment->compressed_length;
+    long long offset = spill_allocate(length);
+    if (pwrite(spill_fd, payload, length, offset) != (ssize_t)length)
+    {
+        printf("Warning: Scrollback spill write failed (%s); keeping scrollback in memory\n", strerror(errno));
+        spill_live_bytes += length;      // spill_release() takes it off again
+        spill_release(offset, length);
+        spill_failed = 1;
+        return 0;
+    }
+    spill_live_bytes += length;
+    spill_evictions++;
+
+    // Step 3: Drop the in-memory copy
+    size_t before = segment->resident_bytes;
+    if (segment->bytes)
+    {
+        free(segment->bytes);
+        segment->bytes = NULL;
+        segment->compressed_length = 0;  // Spilled uncompressed
+    }
+    else
+    {
+        free(segment->compressed);
+        segment->compressed = NULL;
+    }
+    segment->spill_offset = offset;
+    update_segment_accounting(segment);
+    return before - segment->resident_bytes;
+}
+
+// Function to order spill candidates by last use, oldest first
+static int compare_spill_candidates(const void *left, const void *right)
+{
+    const ScrollbackSegment *a = ((const SpillCandidate *)left)->segment;
+    const ScrollbackSegment *b = ((const SpillCandidate *)right)->segment;
+    return a->last_used < b->last_used ? -1 : a->last_used > b->last_used;
+}
+
+// Function to spill the least recently read segments of all tabs until usage is below the target
+void enforce_memory_budget(void)
+{
+    if (memory_budget_bytes == 0 || spill_failed)
+        return;
+    size_t target = memory_budget_bytes / 8 * SPILL_TARGET_EIGHTHS;
+
+    // Step 1: Collect segments that can go (sealed, in memory, not shared with a search or the compressor)
+    int candidate_count = 0;
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+        candidate_count += tabs[tab_index].segment_count;
+    SpillCandidate *candidates = malloc((candidate_count + 1) * sizeof(SpillCandidate));
+    if (!candidates)
+        return;
+    candidate_count = 0;
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+        for (int segment_index = 0; segment_index < tab->segment_count - 1; segment_index++)
+        {
+            ScrollbackSegment *segment = tab->segments[segment_index];
+            if (!segment->sealed || segment->mapped || segment->spill_offset >= 0 || segment->references > 1 ||
+                segment->length > SCROLLBACK_SEGMENT_BYTES)
+                continue;
+            candidates[candidate_count].tab = tab;
+            candidates[candidate_count].segment = segment;
+            candidate_count++;
+        }
+    }
+
+    // Step 2: Spill oldest first
+    qsort(candidates, candidate_count, sizeof(SpillCandidate), compare_spill_candidates);
+    size_t freed = 0;
+    int spilled = 0;
+    for (int candidate_index = 0; candidate_index < candidate_count && scrollback_resident_bytes > target; candidate_index++)
+    {
+        size_t segment_freed = spill_segment(candidates[candidate_index].tab, candidates[candidate_index].segment);
+        if (spill_failed)
+            break;
+        freed += segment_freed;
+        spilled++;
+    }
+    free(candidates);
+
+    if (spilled > 0)
+        printf("Memory budget: spilled %d scrollback segment(s), %zu KB freed, %zu KB resident\n", spilled,
+               freed / 1024, scrollback_resident_bytes / 1024);
+}
+
+// Function to add up a tab's history memory (wide strings, or the packed blob while hibernated)
+static size_t tab_history_memory(const Tab *tab)
+{
+    if (tab->history_blob)
+        return tab->history_blob_length;
+    size_t bytes = 0;
+    for (int history_index = 0; history_index < tab->history_count; history_index++)
+        if (tab->command_history[history_index])
+            bytes += (wcslen(tab->command_history[history_index]) + 1) * sizeof(wchar_t);
+    return bytes;
+}
+
+// Function to handle the "memstat" builtin: memory per tab and per subsystem
+void handle_memstat_command(Tab *tab)
+{
+    char line[200];
+    size_t grid_bytes = sizeof(tab->text_buffer) + sizeof(tab->frame_grid) + sizeof(tab->frame_styles);
+    size_t total_resident = 0, total_spilled = 0, total_history = 0;
+
+    add_text_to_buffer(tab, "Tab            Lines      Grid  Scrollback   Spilled   History    Blocks  Input");
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *other = &tabs[tab_index];
+        size_t resident = 0, spilled = 0;
+        for (int segment_index = 0; segment_index < other->segment_count; segment_index++)
+        {
+            const ScrollbackSegment *segment = other->segments[segment_index];
+            resident += segment->resident_bytes;
+            if (segment->spill_offset >= 0)
+                spilled += segment->compressed_length ? segment->compressed_length : segment->length;
+        }
+        size_t history = tab_history_memory(other);
+        size_t input = (other->editor.capacity + other->search_buffer.capacity) * sizeof(wchar_t);
+        snprintf(line, sizeof(line), "%-12s %7d %7zuK %10zuK %8zuK %8zuK %8zuK %5zuK", other->tab_name,
+                 other->scrollback_count, grid_bytes / 1024, resident / 1024, spilled / 1024, history / 1024,
+                 sizeof(other->command_blocks) / 1024, input / 1024);
+        add_text_to_buffer(tab, line);
+        total_resident += resident;
+        total_spilled += spilled;
+        total_history += history;
+    }
+
+    // One line per hibernated tab, so no list of names has to fit in a line
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        if (!tabs[tab_index].hibernated)
+            continue;
+        snprintf(line, sizeof(line), "Hibernated: %.*s (reclaimed %zu KB)", MAX_TAB_NAME, tabs[tab_index].tab_name,
+                 tabs[tab_index].reclaimed_bytes / 1024);
+        add_text_to_buffer(tab, line);
+    }
+
+    // Shared caches and buffers
+    size_t chunk_bytes = 0;
+    for (int chunk_index = 0; chunk_index < DECOMPRESSED_CHUNK_CACHE; chunk_index++)
+        if (decompressed_chunks[chunk_index].bytes)
+            chunk_bytes += SCROLLBACK_SEGMENT_BYTES;
+    size_t cache_bytes = sizeof(decoded_lines) + chunk_bytes + sizeof(glyph_atlas);
+
+    snprintf(line, sizeof(line), "Grids %zu KB, scrollback %zu KB resident + %zu KB spilled, history %zu KB",
+             grid_bytes * tab_count / 1024, total_resident / 1024, total_spilled / 1024, total_history / 1024);
+    add_text_to_buffer(tab, line);
+    snprintf(line, sizeof(line), "Caches %zu KB: decoded lines %zu KB, segment chunks %zu KB, glyphs %zu KB",
+             cache_bytes / 1024, sizeof(decoded_lines) / 1024, chunk_bytes / 1024, sizeof(glyph_atlas) / 1024);
+    add_text_to_buffer(tab, line);
+    if (memory_budget_bytes > 0)
+    {
+        snprintf(line, sizeof(line), "Budget %zu MB: %zu KB resident (%d%%), spill file %lld KB (%zu KB live)",
+                 memory_budget_bytes / (1024 * 1024), scrollback_resident_bytes / 1024,
+                 (int)(scrollback_resident_bytes * 100 / memory_budget_bytes), spill_file_size / 1024,
+                 spill_live_bytes / 1024);
+        add_text_to_buffer(tab, line);
+        snprintf(line, sizeof(line), "Spilled %lu segment(s), %lu read back%s", spill_evictions, spill_reads,
+                 spill_failed ? "; spilling disabled after an error" : "");
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "Budget off: %zu KB resident", scrollback_resident_bytes / 1024);
+    }
+    add_text_to_buffer(tab, line);
+    snprintf(line, sizeof(line), "Compressed %zu KB to %zu KB, pixmaps %zu KB, hibernation reclaimed %zu KB",
+             compressed_input_bytes / 1024, compressed_output_bytes / 1024, frame_cache_bytes / 1024,
+             hibernation_reclaimed_total / 1024);
+    add_text_to_buffer(tab, line);
+    size_t mapped_bytes = session_mapping_lengths[0] + session_mapping_lengths[1];
+    if (session_journal_fd >= 0)
+        snprintf(line, sizeof(line), "Session: checkpoint %lld KB, journal %lld KB, %zu KB mapped from startup",
+                 (long long)session_checkpoint_bytes / 1024, (long long)session_journal_bytes / 1024, mapped_bytes / 1024);
+    else
+        snprintf(line, sizeof(line), "Session: not saved");
+    add_text_to_buffer(tab, line);
+}
+
+// Function to close the spill file at exit (the workers must already be stopped)
+void close_spill_file(void)
+{
+    if (spill_fd >= 0)
+    {
+        close(spill_fd);
+        spill_fd = -1;
+    }
+    free(spill_free_extents);
+    spill_free_extents = NULL;
+    spill_free_count = spill_free_capacity = 0;
+}
+
+// ============================================================================
+// SESSION SNAPSHOT
+// ============================================================================
+//
+// Tabs, scrollback, history and the working directory survive a restart. The
+// session directory holds a checkpoint (everything, written in one go) and an
+// append-only journal the event loop extends every SESSION_JOURNAL_MS with
+// what changed: tab records, newly sealed segments exactly as they are held
+// (LZ4 or raw, with their line index), new history entries, closed tabs and
+// the active tab. Once the journal outgrows the checkpoint, a new checkpoint
+// of the next generation replaces both. At startup the two files are mapped
+// and their records walked once; restored segments point into the mapping,
+// so no output is read or decompressed until a line is shown or searched, and
+// hidden tabs keep their history packed until they are opened.
+
+// Function to round a record length up to the record alignment
+static size_t session_align(size_t length)
+{
+    return (length + SESSION_RECORD_ALIGN - 1) & ~(size_t)(SESSION_RECORD_ALIGN - 1);
+}
+
+// Function to build the path of a file in the session directory; returns 0, or -1 if it does not fit
+static int session_path(char *path, size_t size, const char *name)
+{
+    int length = snprintf(path, size, "%s/%s", session_directory, name);
+    return length >= 0 && (size_t)length < size ? 0 : -1;
+}
+
+// Function to stop writing the session after an error (what is on disk stays usable)
+static void session_write_failed(const char *what)
+{
+    printf("Warning: Session %s failed (%s); this session will not be saved further\n", what, strerror(errno));
+    if (session_journal_fd >= 0)
+        close(session_journal_fd);
+    session_journal_fd = -1;
+    session_enabled = 0;
+}
+
+// Function to write one record whose payload is gathered from parts; returns bytes written or -1
+static ssize_t write_session_record(int fd, uint32_t type, const struct iovec *parts, int part_count)
+{
+    static const char padding[SESSION_RECORD_ALIGN];
+    SessionRecordHeader header;
+    struct iovec vector[8];
+    size_t length = 0;
+
+    vector[0].iov_base = &header;
+    vector[0].iov_len = sizeof(header);
+    for (int part = 0; part < part_count; part++)
+    {
+        vector[part + 1] = parts[part];
+        length += parts[part].iov_len;
+    }
+    int vector_count = part_count + 1;
+    if (session_align(length) != length)
+    {
+        vector[vector_count].iov_base = (void *)padding;
+        vector[vector_count++].iov_len = session_align(length) - length;
+    }
+
+    header.type = type;
+    header.length = (uint32_t)length;
+    ssize_t total = (ssize_t)(sizeof(header) + session_align(length));
+    return writev(fd, vector, vector_count) == total ? total : -1;
+}
+
+// Function to write a tab record (name and first kept line)
+static ssize_t write_session_tab(int fd, const Tab *tab)
+{
+    SessionTabRecord record;
+    memset(&record, 0, sizeof(record));
+    record.tab_id = tab->tab_id;
+    record.first_line = tab->scrollback_first_line;
+    snprintf(record.name, sizeof(record.name), "%s", tab->tab_name);
+    struct iovec part = { &record, sizeof(record) };
+    return write_session_record(fd, SESSION_RECORD_TAB, &part, 1);
+}
+
+// Function to write a segment record in the form the segment is held (compressed stays compressed)
+static ssize_t write_session_segment(int fd, int tab_id, const ScrollbackSegment *segment)
+{
+    static const uint32_t index_padding = 0;
+    SessionSegmentRecord record;
+    memset(&record, 0, sizeof(record));
+    record.tab_id = tab_id;
+    record.line_count = (uint32_t)segment->line_count;
+    record.first_line = segment->first_line;
+    record.length = (uint32_t)segment->length;
+    record.index_count = (uint32_t)((segment->line_count + SCROLLBACK_INDEX_STRIDE - 1) / SCROLLBACK_INDEX_STRIDE);
+
+    // Step 1: Find the bytes (a spilled segment is read back in its stored form)
+    const void *payload;
+    size_t payload_length;
+    if (segment->bytes)
+    {
+        payload = segment->bytes;
+        payload_length = segment->length;
+    }
+    else if (segment->spill_offset >= 0)
+    {
+        payload_length = segment->compressed_length ? segment->compressed_length : segment->length;
+        if (pread(spill_fd, spill_read_buffer, payload_length, segment->spill_offset) != (ssize_t)payload_length)
+            return -1;
+        payload = spill_read_buffer;
+        record.compressed_length = (uint32_t)segment->compressed_length;
+    }
+    else
+    {
+        payload = segment->compressed;
+        payload_length = segment->compressed_length;
+        record.compressed_length = (uint32_t)segment->compressed_length;
+    }
+
+    // Step 2: Record, line index (padded to 8 bytes), bytes
+    struct iovec parts[4] = {
+        { &record, sizeof(record) },
+        { segment->line_index, record.index_count * sizeof(uint32_t) },
+        { (void *)&index_padding, (record.index_count % 2) * sizeof(uint32_t) },
+        { (void *)payload, payload_length },
+    };
+    return write_session_record(fd, SESSION_RECORD_SEGMENT, parts, 4);
+}
+
+// Function to write history entries from first on (packed into LZ4 when pack is set)
+static ssize_t write_session_history(int fd, const Tab *tab, int first, int pack)
+{
+    SessionHistoryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.tab_id = tab->tab_id;
+
+    // Step 1: A hibernated tab's blob is already in the packed format
+    if (tab->history_blob)
+    {
+        record.count = (uint32_t)tab->history_count;
+        record.raw_length = (uint32_t)tab->history_blob_raw_length;
+        record.packed_length = (uint32_t)tab->history_blob_length;
+        struct iovec parts[2] = { { &record, sizeof(record) }, { tab->history_blob, tab->history_blob_length } };
+        return write_session_record(fd, SESSION_RECORD_HISTORY, parts, 2);
+    }
+
+    // Step 2: Encode the entries, compressing them for a checkpoint
+    size_t encoded_length = 0;
+    char *encoded = encode_history_entries(tab, first, &encoded_length, NULL);
+    if (!encoded)
+        return 0;                        // Not representable in this locale - left out
+    record.count = (uint32_t)(tab->history_count - first);
+    record.raw_length = (uint32_t)encoded_length;
+    const void *payload = encoded;
+    size_t payload_length = encoded_length;
+    unsigned char *packed = pack ? malloc(LZ4_BOUND(encoded_length)) : NULL;
+    if (packed)
+    {
+        size_t packed_length = lz4_compress_block((const unsigned char *)encoded, encoded_length, packed,
+                                                  LZ4_BOUND(encoded_length));
+        if (packed_length > 0 && packed_length < encoded_length)
+        {
+            record.packed_length = (uint32_t)packed_length;
+            payload = packed;
+            payload_length = packed_length;
+        }
+    }
+    struct iovec parts[2] = { { &record, sizeof(record) }, { (void *)payload, payload_length } };
+    ssize_t written = write_session_record(fd, SESSION_RECORD_HISTORY, parts, 2);
+    free(packed);
+    free(encoded);
+    return written;
+}
+
+// Function to write the active tab and working directory
+static ssize_t write_session_state(int fd, int active_tab_id, const char *cwd)
+{
+    SessionStateRecord record;
+    memset(&record, 0, sizeof(record));
+    record.active_tab_id = active_tab_id;
+    struct iovec parts[2] = { { &record, sizeof(record) }, { (void *)cwd, strlen(cwd) + 1 } };
+    return write_session_record(fd, SESSION_RECORD_STATE, parts, 2);
+}
+
+// Function to start an empty journal for a generation (unlinked first: the old one may still be mapped)
+static int create_session_journal(uint64_t generation)
+{
+    char path[PATH_MAX];
+    if (session_path(path, sizeof(path), "journal") != 0)
+        return -1;
+    unlink(path);
+    session_journal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (session_journal_fd < 0)
+        return -1;
+
+    SessionFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MYTJRNL1", sizeof(header.magic));
+    header.generation = generation;
+    if (write(session_journal_fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+        return -1;
+    session_journal_bytes = sizeof(header);
+    return 0;
+}
+
+// Function to remember that the files on disk now describe every tab as it is
+static void mark_session_recorded(void)
+{
+    session_tab_id_count = 0;
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+        tab->session_recorded = 1;
+        tab->journaled_first_line = tab->scrollback_first_line;
+        if (!tab->history_blob)
+            tab->journaled_history_serial = tab->history_serial;
+        for (int segment_index = 0; segment_index < tab->segment_count; segment_index++)
+            if (tab->segments[segment_index]->sealed)
+                tab->segments[segment_index]->journaled = 1;
+        session_tab_ids[session_tab_id_count++] = tab->tab_id;
+    }
+}
+
+// Function to append everything that changed since the last pass to the journal
+// (with include_tail, the open segment of every tab too); returns 0 on success
+static int journal_session_changes(int include_tail)
+{
+    int fd = session_journal_fd;
+    ssize_t written;
+
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+
+        // Step 1: New tabs, and tabs whose oldest lines were dropped
+        if (!tab->session_recorded || tab->journaled_first_line != tab->scrollback_first_line)
+        {
+            if ((written = write_session_tab(fd, tab)) < 0)
+                return -1;
+            session_journal_bytes += written;
+            if (!tab->session_recorded && session_tab_id_count < MAX_TABS)
+                session_tab_ids[session_tab_id_count++] = tab->tab_id;
+            tab->session_recorded = 1;
+            tab->journaled_first_line = tab->scrollback_first_line;
+        }
+
+        // Step 2: Sealed segments not written yet (segments are sealed oldest first)
+        for (int segment_index = 0; segment_index < tab->segment_count; segment_index++)
+        {
+            ScrollbackSegment *segment = tab->segments[segment_index];
+            if (segment->journaled || segment->line_count == 0 || (!segment->sealed && !include_tail))
+                continue;
+            if ((written = write_session_segment(fd, tab->tab_id, segment)) < 0)
+                return -1;
+            session_journal_bytes += written;
+            segment->journaled = segment->sealed;
+        }
+
+        // Step 3: History entries added since the last pass (a hibernated tab adds none)
+        if (!tab->history_blob && tab->history_serial != tab->journaled_history_serial)
+        {
+            unsigned long fresh = tab->history_serial - tab->journaled_history_serial;
+            int first = fresh >= (unsigned long)tab->history_count ? 0 : tab->history_count - (int)fresh;
+            if ((written = write_session_history(fd, tab, first, 0)) < 0)
+                return -1;
+            session_journal_bytes += written;
+            tab->journaled_history_serial = tab->history_serial;
+        }
+    }
+
+    // Step 4: Tabs that were closed
+    for (int id_index = 0; id_index < session_tab_id_count; id_index++)
+    {
+        int open = 0;
+        for (int tab_index = 0; tab_index < tab_count && !open; tab_index++)
+            open = tabs[tab_index].tab_id == session_tab_ids[id_index];
+        if (open)
+            continue;
+
+        SessionCloseRecord record;
+        memset(&record, 0, sizeof(record));
+        record.tab_id = session_tab_ids[id_index];
+        struct iovec part = { &record, sizeof(record) };
+        if ((written = write_session_record(fd, SESSION_RECORD_CLOSE, &part, 1)) < 0)
+            return -1;
+        session_journal_bytes += written;
+        session_tab_ids[id_index--] = session_tab_ids[--session_tab_id_count];
+    }
+
+    // Step 5: The active tab and working directory
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        cwd[0] = '\0';
+    int active_tab_id = tabs[active_tab_index].tab_id;
+    if (active_tab_id != session_active_tab_id || strcmp(cwd, session_cwd) != 0)
+    {
+        if ((written = write_session_state(fd, active_tab_id, cwd)) < 0)
+            return -1;
+        session_journal_bytes += written;
+        session_active_tab_id = active_tab_id;
+        snprintf(session_cwd, sizeof(session_cwd), "%s", cwd);
+    }
+    return 0;
+}
+
+// Function to write a checkpoint of every tab and start a new journal generation; returns 0 on success
+static int write_session_checkpoint(void)
+{
+    long long started = monotonic_ms();
+    char temporary[PATH_MAX], path[PATH_MAX];
+    if (session_path(temporary, sizeof(temporary), "checkpoint.tmp") != 0 ||
+        session_path(path, sizeof(path), "checkpoint") != 0)
+        return -1;
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -1;
+
+    // Step 1: Header, then each tab's record, segments and history, then the state
+    SessionFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MYTCKPT1", sizeof(header.magic));
+    header.generation = session_generation + 1;
+    off_t size = sizeof(header);
+    int failed = write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header);
+
+    for (int tab_index = 0; tab_index < tab_count && !failed; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+        ssize_t written = write_session_tab(fd, tab);
+        size += written;
+        for (int segment_index = 0; segment_index < tab->segment_count && written >= 0; segment_index++)
+        {
+            if (tab->segments[segment_index]->line_count == 0)
+                continue;
+            written = write_session_segment(fd, tab->tab_id, tab->segments[segment_index]);
+            size += written;
+        }
+        if (written >= 0 && tab->history_count > 0)
+        {
+            written = write_session_history(fd, tab, 0, 1);
+            size += written;
+        }
+        failed = written < 0;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        cwd[0] = '\0';
+    ssize_t state_written = failed ? -1 : write_session_state(fd, tabs[active_tab_index].tab_id, cwd);
+    size += state_written;
+    if (close(fd) != 0 || state_written < 0 || rename(temporary, path) != 0)
+    {
+        unlink(temporary);
+        return -1;
+    }
+
+    // Step 2: The old journal is now covered by the checkpoint
+    close(session_journal_fd);
+    session_journal_fd = -1;
+    session_generation++;
+    session_checkpoint_bytes = size;
+    if (create_session_journal(session_generation) != 0)
+        return -1;
+    mark_session_recorded();
+    session_active_tab_id = tabs[active_tab_index].tab_id;
+    snprintf(session_cwd, sizeof(session_cwd), "%s", cwd);
+
+    printf("Session checkpoint %llu written: %lld KB in %lld ms\n", (unsigned long long)session_generation,
+           (long long)size / 1024, monotonic_ms() - started);
+    return 0;
+}
+
+// Function to append to the journal every SESSION_JOURNAL_MS (called from the event loop)
+void service_session_journal(void)
+{
+    long long now = monotonic_ms();
+    if (session_journal_fd < 0 || now < next_session_journal_ms)
+        return;
+    next_session_journal_ms = now + SESSION_JOURNAL_MS;
+
+    if (journal_session_changes(0) != 0)
+    {
+        session_write_failed("journal write");
+        return;
+    }
+    if (session_journal_bytes > SESSION_COMPACT_BYTES && session_journal_bytes > session_checkpoint_bytes &&
+        write_session_checkpoint() != 0)
+        session_write_failed("checkpoint");
+}
+
+// Function to write the rest of the session at exit (open segments included)
+void close_session(void)
+{
+    if (session_journal_fd >= 0)
+    {
+        if (journal_session_changes(1) != 0)
+            session_write_failed("journal write");
+        else if (session_journal_bytes > SESSION_COMPACT_BYTES && session_journal_bytes > session_checkpoint_bytes &&
+                 write_session_checkpoint() != 0)
+            session_write_failed("checkpoint");
+    }
+    if (session_journal_fd >= 0)
+    {
+        close(session_journal_fd);
+        session_journal_fd = -1;
+        printf("Session saved (journal %lld KB, checkpoint %lld KB)\n", (long long)session_journal_bytes / 1024,
+               (long long)session_checkpoint_bytes / 1024);
+    }
+    if (session_lock_fd >= 0)
+    {
+        close(session_lock_fd);          // Releases the flock()
+        session_lock_fd = -1;
+    }
+}
+
+// Function to unmap the session files once no segment points into them (at exit)
+void unmap_session_files(void)
+{
+    for (int slot = 0; slot < 2; slot++)
+    {
+        if (session_mappings[slot])
+            munmap(session_mappings[slot], session_mapping_lengths[slot]);
+        session_mappings[slot] = NULL;
+        session_mapping_lengths[slot] = 0;
+    }
+}
+
+// Function to add a mapped segment to a restored tab. A segment that starts at or before
+// lines the tab already has replaces them (the store was rebuilt, or it is a later copy).
+static void restore_session_segment(Tab *tab, const SessionSegmentRecord *record, const unsigned char *payload)
+{
+    // Step 1: Drop segments this one overlaps, or everything if it leaves a gap
+    while (tab->segment_count > 0)
+    {
+        ScrollbackSegment *last = tab->segments[tab->segment_count - 1];
+        unsigned long last_end = last->first_line + last->line_count;
+        if (last_end == record->first_line)
+            break;                       // Continues the tab's lines
+        if (last_end < record->first_line)
+        {
+            free_scrollback(tab);        // Lines are missing in between - keep only what follows
+            break;
+        }
+        tab->scrollback_bytes -= scrollback_segment_memory(last);
+        release_scrollback_segment(last);
+        tab->segment_count--;
+    }
+
+    // Step 2: Point a sealed segment at the mapped index and bytes
+    if (tab->segment_count == tab->segment_capacity)
+    {
+        int capacity = tab->segment_capacity ? tab->segment_capacity * 2 : 16;
+        ScrollbackSegment **grown = realloc(tab->segments, capacity * sizeof(ScrollbackSegment *));
+        if (!grown)
+            return;
+        tab->segments = grown;
+        tab->segment_capacity = capacity;
+    }
+    ScrollbackSegment *segment = calloc(1, sizeof(ScrollbackSegment));
+    if (!segment)
+        return;
+    segment->mapped = 1;
+    segment->sealed = 1;
+    segment->journaled = 1;
+    segment->compression_queued = 1;     // Never compressed (or freed) in place
+    segment->references = 1;
+    segment->spill_offset = -1;
+    segment->first_line = record->first_line;
+    segment->line_count = (int)record->line_count;
+    segment->length = record->length;
+    segment->capacity = record->length;
+    segment->line_index = (uint32_t *)payload;
+    segment->index_capacity = (int)record->index_count;
+    const unsigned char *bytes = payload + session_align(record->index_count * sizeof(uint32_t));
+    if (record->compressed_length > 0)
+    {
+        segment->compressed = (unsigned char *)bytes;
+        segment->compressed_length = record->compressed_length;
+    }
+    else
+    {
+        segment->bytes = (char *)bytes;
+    }
+    segment->last_used = ++scrollback_clock;
+    update_segment_accounting(segment);
+    tab->segments[tab->segment_count++] = segment;
+    tab->scrollback_bytes += scrollback_segment_memory(segment);
+    tab->scrollback_hint_valid = 0;
+}
+
+// Function to add restored history entries to a tab (a lone packed record stays packed)
+static void restore_session_history(Tab *tab, const SessionHistoryRecord *record, const unsigned char *payload)
+{
+    // Step 1: Keep the first packed history as the tab's blob, unpacked when the tab is shown
+    if (record->packed_length > 0 && tab->history_count == 0 && !tab->history_blob)
+    {
+        tab->history_blob = malloc(record->packed_length);
+        if (!tab->history_blob)
+            return;
+        memcpy(tab->history_blob, payload, record->packed_length);
+        tab->history_blob_length = record->packed_length;
+        tab->history_blob_raw_length = record->raw_length;
+        tab->history_count = (int)record->count;
+        tab->history_current = tab->history_count;
+        tab->hibernated = 1;
+        return;
+    }
+
+    // Step 2: Otherwise add the entries one by one
+    if (tab->history_blob)
+        thaw_tab_history(tab);
+    tab->hibernated = 0;
+    char *unpacked = NULL;
+    const char *entries = (const char *)payload;
+    if (record->packed_length > 0)
+    {
+        unpacked = malloc(record->raw_length);
+        if (!unpacked || lz4_decompress_block(payload, record->packed_length, (unsigned char *)unpacked,
+                                              record->raw_length) != (long)record->raw_length)
+        {
+            free(unpacked);
+            return;
+        }
+        entries = unpacked;
+    }
+    const char *end = entries + record->raw_length;
+    while (entries < end)
+    {
+        size_t entry_length = strnlen(entries, (size_t)(end - entries));
+        if (entry_length == (size_t)(end - entries))
+            break;                       // Unterminated
+        size_t characters = mbstowcs(NULL, entries, 0);
+        wchar_t *text = characters == (size_t)-1 ? NULL : malloc((characters + 1) * sizeof(wchar_t));
+        if (text)
+        {
+            mbstowcs(text, entries, characters + 1);
+            add_to_history(tab, text);
+            free(text);
+        }
+        entries += entry_length + 1;
+    }
+    free(unpacked);
+}
+
+// Function to apply the records of one mapped session file; returns the offset after the
+// last complete record (records past a torn or damaged one are ignored)
+static size_t apply_session_records(const unsigned char *data, size_t length, int *restored_tabs,
+                                    int *active_tab_id, const char **cwd)
+{
+    size_t offset = sizeof(SessionFileHeader);
+    while (offset + sizeof(SessionRecordHeader) <= length)
+    {
+        const SessionRecordHeader *header = (const SessionRecordHeader *)(data + offset);
+        size_t record_end = offset + sizeof(SessionRecordHeader) + session_align(header->length);
+        if (record_end > length || record_end < offset)
+            break;
+        const unsigned char *payload = data + offset + sizeof(SessionRecordHeader);
+        Tab *tab = NULL;
+
+        switch (header->type)
+        {
+        case SESSION_RECORD_TAB:
+        {
+            if (header->length < sizeof(SessionTabRecord))
+                return offset;
+            const SessionTabRecord *record = (const SessionTabRecord *)payload;
+            tab = *restored_tabs > 0 ? find_tab_by_id(record->tab_id) : NULL;
+            if (!tab)
+            {
+                if (*restored_tabs == 0)
+                {
+                    tab = &tabs[0];      // The fresh startup tab becomes the first restored one
+                }
+                else if (tab_count < MAX_TABS)
+                {
+                    create_new_tab();
+                    tab = &tabs[tab_count - 1];
+                }
+                else
+                {
+                    break;
+                }
+                (*restored_tabs)++;
+            }
+            tab->tab_id = record->tab_id;
+            if (next_tab_id <= record->tab_id)
+                next_tab_id = record->tab_id + 1;
+            snprintf(tab->tab_name, MAX_TAB_NAME, "%.*s", MAX_TAB_NAME - 1, record->name);
+            tab->scrollback_first_line = record->first_line;
+            break;
+        }
+        case SESSION_RECORD_SEGMENT:
+        {
+            if (header->length < sizeof(SessionSegmentRecord))
+                return offset;
+            const SessionSegmentRecord *record = (const SessionSegmentRecord *)payload;
+            size_t index_bytes = session_align((size_t)record->index_count * sizeof(uint32_t));
+            size_t stored = record->compressed_length ? record->compressed_length : record->length;
+            if (record->line_count == 0 || record->length > SCROLLBACK_MAX_BYTES ||
+                (record->compressed_length > 0 && record->length > SCROLLBACK_SEGMENT_BYTES) ||
+                record->index_count != (record->line_count + SCROLLBACK_INDEX_STRIDE - 1) / SCROLLBACK_INDEX_STRIDE ||
+                sizeof(SessionSegmentRecord) + index_bytes + stored > header->length)
+                return offset;
+            // The line index is small (one entry per SCROLLBACK_INDEX_STRIDE lines); the bytes are not touched
+            const uint32_t *line_index = (const uint32_t *)(payload + sizeof(SessionSegmentRecord));
+            for (uint32_t slot = 0; slot < record->index_count; slot++)
+                if (line_index[slot] >= record->length || (slot > 0 && line_index[slot] <= line_index[slot - 1]))
+                    return offset;
+            tab = find_tab_by_id(record->tab_id);
+            if (tab)
+                restore_session_segment(tab, record, payload + sizeof(SessionSegmentRecord));
+            break;
+        }
+        case SESSION_RECORD_HISTORY:
+        {
+            if (header->length < sizeof(SessionHistoryRecord))
+                return offset;
+            const SessionHistoryRecord *record = (const SessionHistoryRecord *)payload;
+            size_t stored = record->packed_length ? record->packed_length : record->raw_length;
+            if (sizeof(SessionHistoryRecord) + stored > header->length || record->count > MAX_HISTORY_SIZE)
+                return offset;
+            tab = find_tab_by_id(record->tab_id);
+            if (tab)
+                restore_session_history(tab, record, payload + sizeof(SessionHistoryRecord));
+            break;
+        }
+        case SESSION_RECORD_CLOSE:
+        {
+            if (header->length < sizeof(SessionCloseRecord))
+                return offset;
+            tab = find_tab_by_id(((const SessionCloseRecord *)payload)->tab_id);
+            if (!tab)
+                break;
+            free_tab_input(tab);
+            if (tab_count > 1)
+            {
+                for (Tab *next = tab + 1; next < &tabs[tab_count]; next++)
+                    next[-1] = *next;
+                tab_count--;
+            }
+            else
+            {
+                initialize_tab(tab, "Tab 1");
+                *restored_tabs = 0;
+            }
+            break;
+        }
+        case SESSION_RECORD_STATE:
+        {
+            if (header->length <= sizeof(SessionStateRecord) || payload[header->length - 1] != '\0')
+                return offset;
+            *active_tab_id = ((const SessionStateRecord *)payload)->active_tab_id;
+            *cwd = (const char *)payload + sizeof(SessionStateRecord);
+            break;
+        }
+        default:
+            break;                       // Written by a newer version - skipped
+        }
+        offset = record_end;
+    }
+    return offset;
+}
+
+// Function to map a session file if it starts with the expected magic; returns its length (0 if unusable)
+static size_t map_session_file(const char *name, const char *magic, int slot, uint64_t *generation)
+{
+    char path[PATH_MAX];
+    if (session_path(path, sizeof(path), name) != 0)
+        return 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    struct stat file_stat;
+    size_t length = 0;
+    if (fstat(fd, &file_stat) == 0 && (size_t)file_stat.st_size >= sizeof(SessionFileHeader))
+    {
+        void *data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            const SessionFileHeader *header = data;
+            if (memcmp(header->magic, magic, sizeof(header->magic)) == 0)
+            {
+                session_mappings[slot] = data;
+                session_mapping_lengths[slot] = length = (size_t)file_stat.st_size;
+                *generation = header->generation;
+            }
+            else
+            {
+                munmap(data, (size_t)file_stat.st_size);
+            }
+        }
+    }
+    close(fd);
+    return length;
+}
+
+// Function to create a directory and its missing parents
+static int make_session_directory(const char *path)
+{
+    char partial[PATH_MAX];
+    snprintf(partial, sizeof(partial), "%s", path);
+    for (char *slash = strchr(partial + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if (mkdir(partial, 0700) != 0 && errno != EEXIST)
+            return -1;
+        *slash = '/';
+    }
+    return mkdir(partial, 0700) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+// Function to open the session directory and reopen the previous session's tabs (at startup,
+// after the first tab exists)
+void restore_session(void)
+{
+    if (!session_enabled)
+        return;
+    long long started = monotonic_ms();
+
+    // Step 1: Pick the directory ($MYTERM_SESSION_DIR, $XDG_STATE_HOME/myterm, ~/.local/state/myterm)
+    const char *directory = getenv("MYTERM_SESSION_DIR");
+    const char *state_home = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    if (directory && *directory)
+        snprintf(session_directory, sizeof(session_directory), "%s", directory);
+    else if (state_home && *state_home)
+        snprintf(session_directory, sizeof(session_directory), "%s/myterm", state_home);
+    else if (home && *home)
+        snprintf(session_directory, sizeof(session_directory), "%s/.local/state/myterm", home);
+    else
+        session_enabled = 0;
+
+    // Step 2: Only one instance owns the session files (a directory too long for its longest file
+    // name, or cut short above, keeps no session rather than writing somewhere else)
+    char path[PATH_MAX];
+    if (session_enabled && session_path(path, sizeof(path), "checkpoint.tmp") != 0)
+    {
+        printf("Session: the session directory path is too long; this instance keeps no session\n");
+        session_enabled = 0;
+        return;
+    }
+    if (session_enabled && session_path(path, sizeof(path), "lock") == 0 &&
+        make_session_directory(session_directory) == 0)
+        session_lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (session_lock_fd < 0 || flock(session_lock_fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        if (session_enabled)
+            printf("Session: %s is unavailable or in use; this instance keeps no session\n", session_directory);
+        if (session_lock_fd >= 0)
+            close(session_lock_fd);
+        session_lock_fd = -1;
+        session_enabled = 0;
+        return;
+    }
+
+    // Step 3: Map the checkpoint and the journal of the same generation
+    uint64_t checkpoint_generation = 0, journal_generation = 0;
+    size_t checkpoint_length = map_session_file("checkpoint", "MYTCKPT1", 0, &checkpoint_generation);
+    size_t journal_length = map_session_file("journal", "MYTJRNL1", 1, &journal_generation);
+    if (journal_length > 0 && journal_generation != checkpoint_generation)
+    {
+        munmap(session_mappings[1], journal_length);
+        session_mappings[1] = NULL;
+        session_mapping_lengths[1] = journal_length = 0;
+    }
+    session_generation = checkpoint_generation;
+    session_checkpoint_bytes = (off_t)checkpoint_length;
+
+    // Step 4: Walk the records
+    int restored_tabs = 0, active_tab_id = 0;
+    const char *cwd = NULL;
+    if (checkpoint_length > 0)
+        apply_session_records(session_mappings[0], checkpoint_length, &restored_tabs, &active_tab_id, &cwd);
+    size_t journal_end = journal_length > 0 ? apply_session_records(session_mappings[1], journal_length, &restored_tabs,
+                                                                    &active_tab_id, &cwd)
+                                            : 0;
+
+    // Step 5: Settle each restored tab's line range; grids are rebuilt when tabs are shown
+    unsigned long restored_lines = 0;
+    for (int tab_index = 0; tab_index < tab_count && restored_tabs > 0; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+        if (tab->segment_count > 0)
+        {
+            ScrollbackSegment *first = tab->segments[0];
+            ScrollbackSegment *last = tab->segments[tab->segment_count - 1];
+            unsigned long end_line = last->first_line + last->line_count;
+            if (tab->scrollback_first_line < first->first_line || tab->scrollback_first_line > end_line)
+                tab->scrollback_first_line = first->first_line;
+            tab->scrollback_count = (int)(end_line - tab->scrollback_first_line);
+            scrollback_enforce_limits(tab);
+        }
+        else
+        {
+            tab->scrollback_count = 0;
+        }
+        tab->grid_stale = 1;
+        restored_lines += tab->scrollback_count;
+    }
+    if (restored_tabs > 0)
+        mark_session_recorded();
+
+    // Step 6: Keep appending to the journal (cut after its last complete record), or start one
+    if (session_path(path, sizeof(path), "journal") == 0 && journal_end > 0 &&
+        truncate(path, (off_t)journal_end) == 0)
+    {
+        session_journal_fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+        session_journal_bytes = (off_t)journal_end;
+    }
+    if (session_journal_fd < 0 && create_session_journal(session_generation) != 0)
+    {
+        session_write_failed("journal creation");
+        return;
+    }
+
+    if (restored_tabs == 0)
+        return;
+    if (cwd && *cwd && chdir(cwd) != 0)
+        printf("Warning: Cannot return to %s: %s\n", cwd, strerror(errno));
+    Tab *active = find_tab_by_id(active_tab_id);
+    activate_tab(active ? (int)(active - tabs) : 0);
+    session_active_tab_id = tabs[active_tab_index].tab_id;
+    if (!getcwd(session_cwd, sizeof(session_cwd)))
+        session_cwd[0] = '\0';
+
+    printf("Session restored: %d tab(s), %lu lines, %zu KB mapped in %lld ms\n", tab_count, restored_lines,
+           (checkpoint_length + journal_length) / 1024, monotonic_ms() - started);
+}
+
+// ============================================================================
+// DETACHED SERVER
+// ============================================================================
+//
+// `myterm --server` runs the tabs without a window: it restores the session,
+// runs commands and collects their output exactly as the windowed terminal
+// does, and listens on a UNIX socket. `myterm --attach` opens the window and
+// connects (starting a server first when none is running); it forwards keys,
+// clicks and pastes and draws what the server sends back. The server diffs
+// the active tab's rows, highlights, cursor and tab bar against what the
+// client last received and sends only what changed, so attaching transfers
+// one screen and scrolling transfers the rows that come into view - the
+// scrollback itself never crosses the socket. Closing the window detaches;
+// commands keep running and their output keeps accumulating in the server.
+
+// Function to pick the socket path ($MYTERM_SOCKET, $XDG_RUNTIME_DIR/myterm.sock, /tmp/myterm-UID.sock)
+static int attach_socket_address(struct sockaddr_un *address)
+{
+    const char *explicit_path = getenv("MYTERM_SOCKET");
+    const char *runtime_directory = getenv("XDG_RUNTIME_DIR");
+    if (explicit_path && *explicit_path)
+        snprintf(attach_socket_path, sizeof(attach_socket_path), "%s", explicit_path);
+    else if (runtime_directory && *runtime_directory)
+        snprintf(attach_socket_path, sizeof(attach_socket_path), "%s/myterm.sock", runtime_directory);
+    else
+        snprintf(attach_socket_path, sizeof(attach_socket_path), "/tmp/myterm-%d.sock", (int)getuid());
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(attach_socket_path) >= sizeof(address->sun_path))
+    {
+        fprintf(stderr, "Error: Socket path %s is too long\n", attach_socket_path);
+        return -1;
+    }
+    memcpy(address->sun_path, attach_socket_path, strlen(attach_socket_path) + 1);
+    return 0;
+}
+
+// Function to connect to the socket; returns a non-blocking fd or -1
+static int attach_connect(const struct sockaddr_un *address)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const struct sockaddr *)address, sizeof(*address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+// Function to grow a connection buffer to hold at least needed bytes; returns 0 or -1
+static int attach_reserve(unsigned char **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity)
+        return 0;
+    size_t new_capacity = *capacity ? *capacity : 4096;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    unsigned char *grown = realloc(*buffer, new_capacity);
+    if (!grown)
+        return -1;
+    *buffer = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// Function to queue bytes behind whatever is still unsent; returns 0 or -1
+static int attach_append(AttachConnection *connection, const void *data, size_t length)
+{
+    if (length == 0)
+        return 0;
+    if (attach_reserve(&connection->outbox, &connection->outbox_capacity, connection->outbox_length + length) != 0)
+        return -1;
+    memcpy(connection->outbox + connection->outbox_length, data, length);
+    connection->outbox_length += length;
+    return 0;
+}
+
+// Function to write queued bytes without blocking; returns -1 once the peer is gone
+static int attach_flush(AttachConnection *connection)
+{
+    size_t sent = 0;
+    while (sent < connection->outbox_length)
+    {
+        ssize_t written = send(connection->fd, connection->outbox + sent, connection->outbox_length - sent,
+                               MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (written <= 0)
+            return -1;
+        sent += (size_t)written;
+    }
+    if (sent > 0)
+    {
+        memmove(connection->outbox, connection->outbox + sent, connection->outbox_length - sent);
+        connection->outbox_length -= sent;
+    }
+    return 0;
+}
+
+// Function to queue one message (payload given in two parts) and start sending it; returns 0 or -1
+static int attach_send(AttachConnection *connection, AttachMessageType type, const void *payload, size_t length,
+                       const void *extra, size_t extra_length)
+{
+    if (connection->fd < 0)
+        return -1;
+    AttachMessageHeader header = {(uint16_t)type, 0, (uint32_t)(length + extra_length)};
+    if (attach_append(connection, &header, sizeof(header)) != 0 || attach_append(connection, payload, length) != 0 ||
+        attach_append(connection, extra, extra_length) != 0)
+        return -1;
+    return attach_flush(connection);
+}
+
+// Function to read what the peer sent so far; returns -1 once it is gone
+static int attach_receive(AttachConnection *connection)
+{
+    // Stop after one maximal message; poll() reports the rest on the next iteration
+    while (connection->inbox_length < sizeof(AttachMessageHeader) + ATTACH_MAX_MESSAGE)
+    {
+        if (attach_reserve(&connection->inbox, &connection->inbox_capacity, connection->inbox_length + 65536) != 0)
+            return -1;
+        ssize_t received = recv(connection->fd, connection->inbox + connection->inbox_length,
+                                connection->inbox_capacity - connection->inbox_length, 0);
+        if (received > 0)
+        {
+            connection->inbox_length += (size_t)received;
+            continue;
+        }
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        return -1;                        // End of stream or error
+    }
+    return 0;
+}
+
+// Function to find the next complete message at *offset; returns 1, 0 (incomplete) or -1 (malformed)
+static int attach_next_message(AttachConnection *connection, size_t *offset, AttachMessageHeader *header,
+                               const unsigned char **payload)
+{
+    size_t available = connection->inbox_length - *offset;
+    if (available < sizeof(*header))
+        return 0;
+    memcpy(header, connection->inbox + *offset, sizeof(*header));
+    if (header->length > ATTACH_MAX_MESSAGE)
+        return -1;
+    if (available < sizeof(*header) + header->length)
+        return 0;
+    *payload = connection->inbox + *offset + sizeof(*header);
+    *offset += sizeof(*header) + header->length;
+    return 1;
+}
+
+// Function to drop the messages handled so far from the inbox
+static void attach_consume(AttachConnection *connection, size_t offset)
+{
+    memmove(connection->inbox, connection->inbox + offset, connection->inbox_length - offset);
+    connection->inbox_length -= offset;
+}
+
+// Function to close a connection and free its buffers
+static void attach_close(AttachConnection *connection)
+{
+    if (connection->fd >= 0)
+        close(connection->fd);
+    free(connection->inbox);
+    free(connection->outbox);
+    memset(connection, 0, sizeof(*connection));
+    connection->fd = -1;
+}
+
+// Function to shut a server down cleanly on SIGTERM (the session is saved on the way out)
+static void handle_server_sigterm(int sig)
+{
+    (void)sig;
+    quit_requested = 1;
+}
+
+// Function to listen on the socket and continue as a background process; returns 0 in the
+// server, 1 if a server is already running, -1 on error (the calling process exits on success)
+int start_server(void)
+{
+    struct sockaddr_un address;
+    if (attach_socket_address(&address) != 0)
+        return -1;
+
+    // Step 1: A socket that still accepts connections belongs to a running server
+    int probe = attach_connect(&address);
+    if (probe >= 0)
+    {
+        close(probe);
+        return 1;
+    }
+    unlink(attach_socket_path);           // Left behind by a server that did not exit cleanly
+
+    // Step 2: Listen, reachable by this user only
+    server_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t previous_mask = umask(077);
+    int bound = server_listen_fd >= 0 && bind(server_listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    umask(previous_mask);
+    if (!bound || listen(server_listen_fd, 4) != 0)
+    {
+        fprintf(stderr, "Error: Cannot listen on %s: %s\n", attach_socket_path, strerror(errno));
+        if (server_listen_fd >= 0)
+            close(server_listen_fd);
+        server_listen_fd = -1;
+        return -1;
+    }
+    fcntl(server_listen_fd, F_SETFL, O_NONBLOCK);
+
+    // Step 3: Leave the terminal; the parent returns to the shell once the socket is ready
+    char log_path[PATH_MAX + 8];
+    snprintf(log_path, sizeof(log_path), "%s.log", attach_socket_path);
+    fflush(stdout);
+    pid_t server_pid = fork();
+    if (server_pid < 0)
+    {
+        fprintf(stderr, "Error: Cannot fork the server: %s\n", strerror(errno));
+        return -1;
+    }
+    if (server_pid > 0)
+    {
+        printf("Server %d listening on %s (log: %s)\n", (int)server_pid, attach_socket_path, log_path);
+        exit(0);
+    }
+    setsid();
+    int null_fd = open("/dev/null", O_RDONLY);
+    int log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (null_fd >= 0)
+    {
+        dup2(null_fd, STDIN_FILENO);
+        close(null_fd);
+    }
+    if (log_fd >= 0)
+    {
+        dup2(log_fd, STDOUT_FILENO);
+        dup2(log_fd, STDERR_FILENO);
+        close(log_fd);
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    signal(SIGTERM, handle_server_sigterm);
+    signal(SIGHUP, SIG_IGN);
+    server_mode = 1;
+    return 0;
+}
+
+// Function to let the attached client go (it closes its window); the tabs keep running
+void detach_attached_client(const char *reason)
+{
+    if (attached_client.fd < 0)
+        return;
+    attach_send(&attached_client, ATTACH_QUIT, NULL, 0, NULL, 0);
+    printf("Client detached (%s): %lu screen updates, %llu KB sent\n", reason, attach_updates_sent,
+           attach_bytes_sent / 1024);
+    attach_close(&attached_client);
+    attach_screen_sent = 0;
+}
+
+// Function to take a new client; one attached earlier is detached (one window at a time)
+static void accept_attached_client(void)
+{
+    int fd = accept(server_listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    detach_attached_client("another client attached");
+
+    attached_client.fd = fd;
+    attach_screen_sent = 0;
+    attach_updates_sent = 0;
+    attach_bytes_sent = 0;
+    redraw_pending = 1;
+    printf("Client attached\n");
+}
+
+// Function to apply one client message to the tabs
+static void handle_client_message(const AttachMessageHeader *header, const unsigned char *payload)
+{
+    Tab *active_tab = &tabs[active_tab_index];
+
+    switch (header->type)
+    {
+    case ATTACH_KEY:
+        if (header->length >= sizeof(AttachKeyMessage))
+        {
+            AttachKeyMessage key;
+            memcpy(&key, payload, sizeof(key));
+            char text[ATTACH_KEY_TEXT + 1];
+            int text_length = key.text_length < ATTACH_KEY_TEXT ? (int)key.text_length : ATTACH_KEY_TEXT;
+            memcpy(text, key.text, text_length);
+            text[text_length] = '\0';
+            handle_key_input(NULL, None, NULL, (KeySym)key.keysym, key.state, text, text_length, CurrentTime);
+        }
+        break;
+
+    case ATTACH_BUTTON:
+        if (header->length >= sizeof(AttachButtonMessage))
+        {
+            AttachButtonMessage button;
+            memcpy(&button, payload, sizeof(button));
+            handle_button_input(button.x, button.y, button.button);
+        }
+        break;
+
+    case ATTACH_PASTE:
+        if (header->length >= sizeof(AttachPasteMessage))
+        {
+            AttachPasteMessage paste;
+            memcpy(&paste, payload, sizeof(paste));
+            size_t inserted = insert_pasted_text(active_tab, (const char *)payload + sizeof(paste),
+                                                 header->length - sizeof(paste), paste.latin1 != 0);
+            printf("Paste from client: %u bytes -> %zu characters\n", header->length, inserted);
+        }
+        break;
+
+    default:
+        break;                            // Unknown messages are skipped
+    }
+    redraw_pending = 1;
+}
+
+// Function to send the client what changed on screen since its last update
+static void send_screen_damage(void)
+{
+    if (attached_client.fd < 0 || active_tab_index < 0 || active_tab_index >= tab_count)
+        return;
+    Tab *active_tab = &tabs[active_tab_index];
+    AttachConnection *client = &attached_client;
+    size_t message_start = client->outbox_length;
+
+    // Step 1: Reserve the headers; they are filled in once the rows are counted
+    AttachMessageHeader header = {ATTACH_SCREEN, 0, 0};
+    AttachScreenMessage screen;
+    memset(&screen, 0, sizeof(screen));
+    screen.active_tab_index = (uint8_t)active_tab_index;
+    screen.tab_count = (uint8_t)tab_count;
+    screen.cursor_row = (int16_t)active_tab->cursor_row;
+    screen.cursor_col = (int16_t)active_tab->cursor_col;
+    screen.scrollback_offset = active_tab->scrollback_offset;
+    screen.scrollback_count = scrollback_display_count(active_tab);
+    int failed = attach_append(client, &header, sizeof(header)) != 0 || attach_append(client, &screen, sizeof(screen)) != 0;
+
+    // Step 2: The tab bar, when a name, an activity mark or the number of tabs changed
+    AttachTabEntry entries[MAX_TABS];
+    memset(entries, 0, sizeof(entries));
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        entries[tab_index].has_activity = (uint8_t)tabs[tab_index].has_activity;
+        memcpy(entries[tab_index].name, tabs[tab_index].tab_name, MAX_TAB_NAME);
+    }
+    if (!attach_screen_sent || screen.tab_count != attach_sent_screen.tab_count ||
+        memcmp(entries, attach_sent_tabs, sizeof(entries)) != 0)
+    {
+        screen.tabs_included = 1;
+        failed |= attach_append(client, entries, tab_count * sizeof(AttachTabEntry)) != 0;
+    }
+
+    // Step 3: Each row whose text or highlighting differs from what the client holds
+    for (int row = 0; row < BUFFER_ROWS - 1 && !failed; row++)
+    {
+        unsigned char styles[BUFFER_COLS];
+        compute_row_styles(active_tab, row, styles);
+        if (attach_screen_sent &&
+            memcmp(active_tab->text_buffer[row], attach_sent_grid[row], sizeof(attach_sent_grid[row])) == 0 &&
+            memcmp(styles, attach_sent_styles[row], BUFFER_COLS) == 0)
+            continue;
+
+        wchar_t cells[BUFFER_COLS];
+        int used_columns = 0, styled = 0;
+        for (int col = 0; col < BUFFER_COLS; col++)
+        {
+            cells[col] = active_tab->text_buffer[row][col] ? active_tab->text_buffer[row][col] : L' ';
+            if (cells[col] != L' ')
+                used_columns = col + 1;
+            styled |= styles[col] != CELL_STYLE_NORMAL;
+        }
+        char *text = wide_to_utf8(cells, used_columns);
+        if (!text)
+        {
+            failed = 1;
+            break;
+        }
+        AttachRowHeader row_header = {(uint8_t)row, (uint8_t)styled, (uint16_t)strlen(text)};
+        failed |= attach_append(client, &row_header, sizeof(row_header)) != 0 ||
+                  attach_append(client, text, row_header.text_length) != 0 ||
+                  (styled && attach_append(client, styles, BUFFER_COLS) != 0);
+        free(text);
+
+        memcpy(attach_sent_grid[row], active_tab->text_buffer[row], sizeof(attach_sent_grid[row]));
+        memcpy(attach_sent_styles[row], styles, BUFFER_COLS);
+        screen.row_count++;
+    }
+    if (failed)
+    {
+        client->outbox_length = message_start;
+        attach_screen_sent = 0;           // Start over with a full screen next time
+        return;
+    }
+
+    // Step 4: Nothing moved - send nothing
+    if (attach_screen_sent && screen.row_count == 0 && !screen.tabs_included &&
+        screen.active_tab_index == attach_sent_screen.active_tab_index &&
+        screen.cursor_row == attach_sent_screen.cursor_row && screen.cursor_col == attach_sent_screen.cursor_col &&
+        screen.scrollback_offset == attach_sent_screen.scrollback_offset &&
+        screen.scrollback_count == attach_sent_screen.scrollback_count)
+    {
+        client->outbox_length = message_start;
+        return;
+    }
+
+    // Step 5: Fill in the headers and send
+    header.length = (uint32_t)(client->outbox_length - message_start - sizeof(header));
+    memcpy(client->outbox + message_start, &header, sizeof(header));
+    memcpy(client->outbox + message_start + sizeof(header), &screen, sizeof(screen));
+    attach_sent_screen = screen;
+    memcpy(attach_sent_tabs, entries, sizeof(entries));
+    attach_screen_sent = 1;
+    attach_updates_sent++;
+    attach_bytes_sent += sizeof(header) + header.length;
+
+    if (attach_flush(client) != 0)
+        detach_attached_client("connection lost");
+    else if (client->outbox_length > ATTACH_MAX_BACKLOG)
+        detach_attached_client("client stopped reading");
+}
+
+// Function to run the tabs without a window until `exit` or SIGTERM (`myterm --server`)
+void run_server(void)
+{
+    printf("Server ready on %s (hibernation %s, scrollback budget %s)\n", attach_socket_path,
+           hibernate_idle_ms > 0 ? "on" : "off", memory_budget_bytes > 0 ? "on" : "off");
+
+    while (!quit_requested)
+    {
+        // Step 1: Sleep until a client connects or writes, child output arrives, or the next tick
+        struct pollfd wait_fds[3 + 1 + MAX_CONTROL_CLIENTS];
+        int wait_count = 2;
+        wait_fds[0].fd = ui_notify_pipe[0];
+        wait_fds[0].events = POLLIN;
+        wait_fds[1].fd = server_listen_fd;
+        wait_fds[1].events = POLLIN;
+        if (attached_client.fd >= 0)
+        {
+            wait_fds[2].fd = attached_client.fd;
+            wait_fds[2].events = POLLIN | (attached_client.outbox_length > 0 ? POLLOUT : 0);
+            wait_count = 3;
+        }
+        int client_count = wait_count;
+        wait_count += control_poll_fds(wait_fds + wait_count);
+        int wait_timeout = IDLE_INTERVAL_MS;
+        if (io_backlog_pending())
+            wait_timeout = 0;
+        else if (jobs_pending())
+            wait_timeout = FRAME_INTERVAL_MS;
+        if (poll(wait_fds, wait_count, wait_timeout) < 0 && errno != EINTR)
+            break;
+
+        // Step 2: A new client replaces the attached one
+        if (wait_fds[1].revents & POLLIN)
+            accept_attached_client();
+
+        // Step 3: Apply the client's input in the order it was typed
+        else if (client_count == 3 && (wait_fds[2].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            int connected = attach_receive(&attached_client) == 0;
+            size_t offset = 0;
+            int status = 0;
+            AttachMessageHeader header;
+            const unsigned char *payload;
+            while (attached_client.fd >= 0 &&
+                   (status = attach_next_message(&attached_client, &offset, &header, &payload)) == 1)
+            {
+                handle_client_message(&header, payload);
+            }
+            if (attached_client.fd >= 0)
+            {
+                attach_consume(&attached_client, offset);
+                if (status < 0)
+                    detach_attached_client("malformed message");
+                else if (!connected)
+                    detach_attached_client("window closed");
+            }
+        }
+
+        // Step 4: The same background work as the windowed event loop
+        if (service_child_io())
+            redraw_pending = 1;
+        if (service_global_search())
+            redraw_pending = 1;
+        service_scrollback_compression();
+        service_tab_hibernation();
+        service_session_journal();
+        service_control_socket();
+
+        // Step 5: Send the damage of everything handled above as one update
+        if (redraw_pending)
+        {
+            redraw_pending = 0;
+            record_effect(RECORD_FRAME, NULL, 0);
+            send_screen_damage();
+        }
+        if (attached_client.fd >= 0 && attached_client.outbox_length > 0 && attach_flush(&attached_client) != 0)
+            detach_attached_client("connection lost");
+    }
+    printf("Server shutting down\n");
+}
+
+// Function to connect to the server, starting one when none is running; returns 0 or -1
+int connect_to_server(const char *program)
+{
+    struct sockaddr_un address;
+    if (attach_socket_address(&address) != 0)
+        return -1;
+
+    // Step 1: Start a server if nobody listens; its first process exits once the socket is ready
+    int fd = attach_connect(&address);
+    if (fd < 0)
+    {
+        printf("No server on %s - starting one\n", attach_socket_path);
+        fflush(stdout);
+        pid_t starter = fork();
+        if (starter == 0)
+        {
+            execl("/proc/self/exe", program, "--server", (char *)NULL);
+            execlp(program, program, "--server", (char *)NULL);
+            _exit(127);
+        }
+        if (starter > 0)
+            waitpid(starter, NULL, 0);
+
+        long long deadline = monotonic_ms() + ATTACH_CONNECT_TIMEOUT_MS;
+        while ((fd = attach_connect(&address)) < 0 && monotonic_ms() < deadline)
+            usleep(20000);
+    }
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot reach a server on %s\n", attach_socket_path);
+        return -1;
+    }
+
+    // Step 2: The server sends the whole screen first; it owns the tabs and the session
+    attach_server.fd = fd;
+    session_enabled = 0;
+    printf("Attached to %s\n", attach_socket_path);
+    return 0;
+}
+
+// Function to send pasted text to the server's command line in one message
+void forward_paste(const char *data, size_t length, int latin1)
+{
+    AttachPasteMessage paste = {(uint32_t)(latin1 != 0), 0};
+    if (length > ATTACH_MAX_MESSAGE - sizeof(paste))
+    {
+        printf("Paste truncated to %zu of %zu bytes for the server\n", ATTACH_MAX_MESSAGE - sizeof(paste), length);
+        length = ATTACH_MAX_MESSAGE - sizeof(paste);
+    }
+    attach_send(&attach_server, ATTACH_PASTE, &paste, sizeof(paste), data, length);
+}
+
+// Function to forward a key; paste keys are served here since the selections belong to this window
+static void forward_key_event(Display *display, Window window, XKeyEvent *key_event)
+{
+    AttachKeyMessage key;
+    memset(&key, 0, sizeof(key));
+    KeySym key_symbol;
+    int buffer_length = XLookupString(key_event, key.text, sizeof(key.text), &key_symbol, NULL);
+    int shift_pressed = (key_event->state & ShiftMask);
+    int control_pressed = (key_event->state & ControlMask);
+
+    if ((key_symbol == XK_v || key_symbol == XK_V) && control_pressed && shift_pressed)
+    {
+        request_paste(display, window, &tabs[active_tab_index], clipboard_atom, key_event->time);
+        return;
+    }
+    if (key_symbol == XK_Insert && shift_pressed)
+    {
+        request_paste(display, window, &tabs[active_tab_index], XA_PRIMARY, key_event->time);
+        return;
+    }
+
+    key.keysym = (uint32_t)key_symbol;
+    key.state = key_event->state;
+    key.text_length = (uint32_t)buffer_length;
+    attach_send(&attach_server, ATTACH_KEY, &key, sizeof(key), NULL, 0);
+}
+
+// Function to apply a screen update to the local copy of the active tab; returns 0 or -1 if malformed
+static int apply_screen_update(const unsigned char *payload, size_t length)
+{
+    AttachScreenMessage screen;
+    if (length < sizeof(screen))
+        return -1;
+    memcpy(&screen, payload, sizeof(screen));
+    size_t offset = sizeof(screen);
+    if (screen.tab_count < 1 || screen.tab_count > MAX_TABS || screen.active_tab_index >= screen.tab_count)
+        return -1;
+
+    // Step 1: Tab bar
+    if (screen.tabs_included)
+    {
+        if (length - offset < screen.tab_count * sizeof(AttachTabEntry))
+            return -1;
+        for (int tab_index = 0; tab_index < screen.tab_count; tab_index++)
+        {
+            AttachTabEntry entry;
+            memcpy(&entry, payload + offset, sizeof(entry));
+            offset += sizeof(entry);
+            tabs[tab_index].tab_id = tab_index + 1;
+            tabs[tab_index].has_activity = entry.has_activity;
+            memcpy(tabs[tab_index].tab_name, entry.name, MAX_TAB_NAME);
+            tabs[tab_index].tab_name[MAX_TAB_NAME - 1] = '\0';
+        }
+    }
+    tab_count = screen.tab_count;
+
+    // Step 2: The screen moves with the active tab; rows that differ follow below
+    Tab *tab = &tabs[screen.active_tab_index];
+    if (screen.active_tab_index != active_tab_index)
+    {
+        memcpy(tab->text_buffer, tabs[active_tab_index].text_buffer, sizeof(tab->text_buffer));
+        active_tab_index = screen.active_tab_index;
+    }
+    tab->cursor_row = screen.cursor_row;
+    tab->cursor_col = screen.cursor_col;
+    tab->scrollback_offset = screen.scrollback_offset;
+    tab->scrollback_count = screen.scrollback_count;
+
+    // Step 3: Damaged rows
+    for (int index = 0; index < screen.row_count; index++)
+    {
+        AttachRowHeader row_header;
+        if (length - offset < sizeof(row_header))
+            return -1;
+        memcpy(&row_header, payload + offset, sizeof(row_header));
+        offset += sizeof(row_header);
+        size_t style_bytes = row_header.styled ? BUFFER_COLS : 0;
+        if (row_header.row >= BUFFER_ROWS - 1 || length - offset < row_header.text_length + style_bytes)
+            return -1;
+
+        const char *text = (const char *)payload + offset;
+        mbstate_t conversion_state;
+        memset(&conversion_state, 0, sizeof(conversion_state));
+        size_t position = 0;
+        int col = 0;
+        while (position < row_header.text_length && col < BUFFER_COLS)
+        {
+            wchar_t wide_character;
+            size_t consumed = mbrtowc(&wide_character, text + position, row_header.text_length - position,
+                                      &conversion_state);
+            if (consumed == (size_t)-1 || consumed == (size_t)-2)
+            {
+                wide_character = L'?';
+                consumed = 1;
+                memset(&conversion_state, 0, sizeof(conversion_state));
+            }
+            else if (consumed == 0)
+            {
+                wide_character = L' ';
+                consumed = 1;
+            }
+            tab->text_buffer[row_header.row][col++] = wide_character;
+            position += consumed;
+        }
+        while (col < BUFFER_COLS)
+            tab->text_buffer[row_header.row][col++] = L' ';
+        offset += row_header.text_length;
+
+        if (row_header.styled)
+            memcpy(attach_row_styles[row_header.row], payload + offset, BUFFER_COLS);
+        else
+            memset(attach_row_styles[row_header.row], CELL_STYLE_NORMAL, BUFFER_COLS);
+        offset += style_bytes;
+    }
+
+    redraw_pending = 1;
+    return 0;
+}
+
+// Function to run the window as a client of the server until it is closed or the server quits
+void run_attached_client(Display *display, Window window, GC gc)
+{
+    XEvent event;
+
+    while (1)
+    {
+        // Step 1: Window events; input goes to the server, pastes are fetched here first
+        while (XPending(display) > 0)
+        {
+            XNextEvent(display, &event);
+
+            switch (event.type)
+            {
+            case Expose:
+                draw_text_buffer(display, window, gc);
+                break;
+
+            case KeyPress:
+                forward_key_event(display, window, &event.xkey);
+                break;
+
+            case FocusIn:
+                window_has_focus = 1;
+                break;
+
+            case FocusOut:
+                window_has_focus = 0;
+                break;
+
+            case ButtonPress:
+                if (event.xbutton.y >= CHAR_HEIGHT && event.xbutton.button == Button2)
+                {
+                    request_paste(display, window, &tabs[active_tab_index], XA_PRIMARY, event.xbutton.time);
+                }
+                else if (event.xbutton.y < CHAR_HEIGHT || event.xbutton.button == 4 || event.xbutton.button == 5)
+                {
+                    AttachButtonMessage button = {event.xbutton.x, event.xbutton.y, event.xbutton.button, 0};
+                    attach_send(&attach_server, ATTACH_BUTTON, &button, sizeof(button), NULL, 0);
+                }
+                else if (!window_has_focus)
+                {
+                    XSetInputFocus(display, window, RevertToParent, CurrentTime);
+                }
+                break;
+
+            case ClientMessage:
+                if (wm_delete_window_atom != None && event.xclient.message_type == wm_protocols_atom &&
+                    (Atom)event.xclient.data.l[0] == wm_delete_window_atom)
+                {
+                    printf("Window closed - detaching (the server keeps running)\n");
+                    return;
+                }
+                break;
+
+            case SelectionNotify:
+                handle_selection_notify(display, window, &event.xselection);
+                break;
+
+            case PropertyNotify:
+                handle_paste_property(display, window, &event.xproperty);
+                break;
+
+            default:
+                if (event.type == shm_completion_event_type)
+                {
+                    shm_put_pending = 0;
+                }
+                break;
+            }
+        }
+
+        // Step 2: Apply the server's updates; stop when it lets us go
+        int connected = attach_receive(&attach_server) == 0;
+        size_t offset = 0;
+        int status;
+        AttachMessageHeader header;
+        const unsigned char *payload;
+        while ((status = attach_next_message(&attach_server, &offset, &header, &payload)) == 1)
+        {
+            if (header.type == ATTACH_QUIT)
+            {
+                printf("Detached by the server\n");
+                return;
+            }
+            if (header.type == ATTACH_SCREEN && apply_screen_update(payload, header.length) != 0)
+                status = -1;
+            if (status < 0)
+                break;
+        }
+        attach_consume(&attach_server, offset);
+        if (status < 0 || !connected)
+        {
+            printf(status < 0 ? "Malformed update from the server - detaching\n" : "Server connection closed\n");
+            return;
+        }
+
+        // Step 3: Present the batch and send queued input
+        if (redraw_pending)
+        {
+            redraw_pending = 0;
+            present_frame(display, window, gc);
+        }
+        XFlush(display);
+        if (attach_flush(&attach_server) != 0)
+        {
+            printf("Server connection closed\n");
+            return;
+        }
+
+        // Step 4: Sleep until either side has something
+        struct pollfd wait_fds[2];
+        wait_fds[0].fd = ConnectionNumber(display);
+        wait_fds[0].events = POLLIN;
+        wait_fds[1].fd = attach_server.fd;
+        wait_fds[1].events = POLLIN | (attach_server.outbox_length > 0 ? POLLOUT : 0);
+        poll(wait_fds, 2, IDLE_INTERVAL_MS);
+    }
+}
+
+// Function to drop both ends of the server socket (at exit); a server also removes its socket
+void close_attach_connections(void)
+{
+    detach_attached_client("server exiting");
+    if (attach_server.fd >= 0)
+        attach_flush(&attach_server);
+    attach_close(&attach_server);
+    if (server_listen_fd >= 0)
+    {
+        close(server_listen_fd);
+        server_listen_fd = -1;
+        unlink(attach_socket_path);
+    }
+}
+
+// ============================================================================
+// CONTROL SOCKET
+// ============================================================================
+//
+// Scripts drive the tabs through a UNIX socket instead of simulated keys.
+// Each request is one JSON object on one line and gets one reply line
+// ({"ok":true,...} or {"ok":false,"error":...}, carrying the request's "id"
+// if it had one). Operations:
+//
+//   {"op":"list"}                                  tabs with line counts and state
+//   {"op":"new"}                                   open a tab (it is not activated)
+//   {"op":"open"}                                  open a tab, activate it and raise the window
+//   {"op":"send","tab":ID,"command":"make -j8"}    run a command as if typed
+//   {"op":"subscribe","tab":ID} / "unsubscribe"    stream the tab's output
+//   {"op":"jobs"}                                  running and background jobs
+//   {"op":"block","tab":ID,"block":N}              a command's status (default: the last one)
+//   {"op":"lines","tab":ID,"from":L,"count":C}     scrollback lines by absolute number
+//
+// "tab" is the stable ID from `list` and defaults to the active tab. Streamed
+// output arrives as {"event":"output","tab":ID,"line":L,"text":...} and a
+// finished command as {"event":"done",...}. Sockets are non-blocking and
+// served from the event loop, so a script costs no X traffic and any number
+// of them (up to MAX_CONTROL_CLIENTS) can subscribe at once.
+
+// Function to queue formatted text on a control connection
+static void control_printf(AttachConnection *connection, const char *format, ...)
+{
+    char text[512];
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(text, sizeof(text), format, arguments);
+    va_end(arguments);
+    if (length > 0)
+        attach_append(connection, text, (size_t)length < sizeof(text) ? (size_t)length : sizeof(text) - 1);
+}
+
+// Function to measure the valid UTF-8 sequence at text (0 if the byte starts none)
+static size_t utf8_sequence_length(const unsigned char *text, size_t available)
+{
+    size_t length;
+    if (text[0] >= 0xC2 && text[0] <= 0xDF)
+        length = 2;
+    else if (text[0] >= 0xE0 && text[0] <= 0xEF)
+        length = 3;
+    else if (text[0] >= 0xF0 && text[0] <= 0xF4)
+        length = 4;
+    else
+        return 0;
+    if (length > available)
+        return 0;
+    for (size_t index = 1; index < length; index++)
+    {
+        if ((text[index] & 0xC0) != 0x80)
+            return 0;
+    }
+    return length;
+}
+
+// Function to queue text as a JSON string (invalid UTF-8 becomes U+FFFD)
+static void control_append_string(AttachConnection *connection, const char *text, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *)text;
+    size_t run_start = 0, position = 0;
+
+    attach_append(connection, "\"", 1);
+    while (position < length)
+    {
+        unsigned char byte = bytes[position];
+        size_t sequence = byte < 0x80 ? 1 : utf8_sequence_length(bytes + position, length - position);
+        if (sequence > 0 && byte >= 0x20 && byte != '"' && byte != '\\')
+        {
+            position += sequence;
+            continue;
+        }
+
+        // Flush the plain run, then write the escape
+        attach_append(connection, text + run_start, position - run_start);
+        if (sequence == 0)
+            attach_append(connection, "\\ufffd", 6);
+        else if (byte == '"' || byte == '\\')
+            control_printf(connection, "\\%c", byte);
+        else if (byte == '\n')
+            attach_append(connection, "\\n", 2);
+        else if (byte == '\t')
+            attach_append(connection, "\\t", 2);
+        else
+            control_printf(connection, "\\u%04x", byte);
+        position++;
+        run_start = position;
+    }
+    attach_append(connection, text + run_start, position - run_start);
+    attach_append(connection, "\"", 1);
+}
+
+// Function to read the four hex digits of a \u escape; returns 0 or -1
+static int json_hex4(const char *digits, unsigned long *value)
+{
+    *value = 0;
+    for (int digit = 0; digit < 4; digit++)
+    {
+        char c = digits[digit];
+        if (!isxdigit((unsigned char)c))
+            return -1;
+        *value = *value * 16 + (unsigned long)(isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10);
+    }
+    return 0;
+}
+
+// Function to skip JSON whitespace
+static char *json_skip_space(char *cursor)
+{
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+        cursor++;
+    return cursor;
+}
+
+// Function to decode the JSON string at cursor (on its opening quote) in place;
+// returns the position after the closing quote, or NULL if malformed
+static char *json_parse_string(char *cursor, char **value)
+{
+    char *read = cursor + 1;
+    char *write = read;
+    *value = read;
+
+    while (*read != '"')
+    {
+        if (*read == '\0')
+            return NULL;
+        if (*read != '\\')
+        {
+            *write++ = *read++;
+            continue;
+        }
+
+        read++;
+        switch (*read)
+        {
+        case '"': case '\\': case '/': *write++ = *read; break;
+        case 'b': *write++ = '\b'; break;
+        case 'f': *write++ = '\f'; break;
+        case 'n': *write++ = '\n'; break;
+        case 'r': *write++ = '\r'; break;
+        case 't': *write++ = '\t'; break;
+        case 'u':
+        {
+            // \uXXXX (a surrogate pair takes two) is re-encoded as UTF-8
+            unsigned long code_point, low;
+            if (json_hex4(read + 1, &code_point) != 0)
+                return NULL;
+            read += 4;
+            if (code_point >= 0xD800 && code_point < 0xDC00 && read[1] == '\\' && read[2] == 'u' &&
+                json_hex4(read + 3, &low) == 0 && low >= 0xDC00 && low < 0xE000)
+            {
+                code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                read += 6;
+            }
+            if (code_point >= 0xD800 && code_point < 0xE000)
+                code_point = 0xFFFD;
+            if (code_point < 0x80)
+                *write++ = (char)code_point;
+            else if (code_point < 0x800)
+            {
+                *write++ = (char)(0xC0 | (code_point >> 6));
+                *write++ = (char)(0x80 | (code_point & 0x3F));
+            }
+            else if (code_point < 0x10000)
+            {
+                *write++ = (char)(0xE0 | (code_point >> 12));
+                *write++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+                *write++ = (char)(0x80 | (code_point & 0x3F));
+            }
+            else
+            {
+                *write++ = (char)(0xF0 | (code_point >> 18));
+                *write++ = (char)(0x80 | ((code_point >> 12) & 0x3F));
+                *write++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+                *write++ = (char)(0x80 | (code_point & 0x3F));
+            }
+            break;
+        }
+        default:
+            return NULL;
+        }
+        read++;
+    }
+    *write = '\0';                        // At or before the closing quote
+    return read + 1;
+}
+
+// Function to parse one request line (a flat JSON object); returns 0 or -1
+static int parse_control_request(char *line, ControlRequest *request)
+{
+    memset(request, 0, sizeof(*request));
+    char *cursor = json_skip_space(line);
+    if (*cursor++ != '{')
+        return -1;
+
+    cursor = json_skip_space(cursor);
+    while (*cursor != '}')
+    {
+        // Step 1: "key":
+        char *key;
+        if (*cursor != '"' || !(cursor = json_parse_string(cursor, &key)))
+            return -1;
+        cursor = json_skip_space(cursor);
+        if (*cursor++ != ':')
+            return -1;
+        cursor = json_skip_space(cursor);
+
+        // Step 2: A string, a number, or a literal (nested values are not part of the protocol)
+        if (*cursor == '"')
+        {
+            char *value;
+            if (!(cursor = json_parse_string(cursor, &value)))
+                return -1;
+            if (strcmp(key, "op") == 0)
+                request->op = value;
+            else if (strcmp(key, "command") == 0)
+                request->command = value;
+        }
+        else if (*cursor == '-' || isdigit((unsigned char)*cursor))
+        {
+            char *number_end;
+            long long value = strtoll(cursor, &number_end, 10);
+            if (*number_end == '.' || *number_end == 'e' || *number_end == 'E')
+                strtod(cursor, &number_end);  // Fractions are accepted and truncated
+            cursor = number_end;
+            if (strcmp(key, "id") == 0) { request->id = value; request->has_id = 1; }
+            else if (strcmp(key, "tab") == 0) { request->tab = value; request->has_tab = 1; }
+            else if (strcmp(key, "from") == 0) { request->from = value; request->has_from = 1; }
+            else if (strcmp(key, "count") == 0) { request->count = value; request->has_count = 1; }
+            else if (strcmp(key, "block") == 0) { request->block = value; request->has_block = 1; }
+        }
+        else if (strncmp(cursor, "true", 4) == 0 || strncmp(cursor, "null", 4) == 0)
+            cursor += 4;
+        else if (strncmp(cursor, "false", 5) == 0)
+            cursor += 5;
+        else
+            return -1;
+
+        // Step 3: Next member
+        cursor = json_skip_space(cursor);
+        if (*cursor == ',')
+            cursor = json_skip_space(cursor + 1);
+        else if (*cursor != '}')
+            return -1;
+    }
+    return request->op ? 0 : -1;
+}
+
+// Function to open a reply line ({"ok":..., "id":...); the caller adds fields and closes it
+static void control_reply_start(AttachConnection *connection, const ControlRequest *request, int ok)
+{
+    control_printf(connection, "{\"ok\":%s", ok ? "true" : "false");
+    if (request && request->has_id)
+        control_printf(connection, ",\"id\":%lld", request->id);
+}
+
+// Function to send a failed reply
+static void control_reply_error(AttachConnection *connection, const ControlRequest *request, const char *message)
+{
+    control_reply_start(connection, request, 0);
+    attach_append(connection, ",\"error\":", 9);
+    control_append_string(connection, message, strlen(message));
+    attach_append(connection, "}\n", 2);
+}
+
+// Function to describe a command block as a JSON object
+static void control_append_block(AttachConnection *connection, const CommandBlock *block)
+{
+    long long duration_ms = block->running ? monotonic_ms() - block->start_ms : block->duration_ms;
+    control_printf(connection, "{\"serial\":%lu,\"running\":%s,\"exit_status\":%d,\"duration_ms\":%lld,"
+                               "\"start_line\":%lu,\"end_line\":%lu,\"folded\":%s,\"command\":",
+                   block->serial, block->running ? "true" : "false", block->exit_status, duration_ms,
+                   block->start_line, block->running ? 0 : block->end_line, block->folded ? "true" : "false");
+    control_append_string(connection, block->command, strlen(block->command));
+    attach_append(connection, "}", 1);
+}
+
+// Function to run a command in a tab exactly as if it had been typed there; returns 0 (with the
+// command's block serial, 0 for built-ins that open none) or -1 if the text is not valid in the locale
+static int control_run_command(Tab *tab, const char *command, unsigned long *serial)
+{
+    // Step 1: Set the typed line aside; the command goes through handle_enter_key() like Enter
+    LineEditor *editor = &tab->editor;
+    wchar_t *typed = wcsdup(line_editor_contents(editor));
+    size_t typed_cursor = editor->cursor;
+
+    size_t wide_length = mbstowcs(NULL, command, 0);
+    wchar_t *wide_command = wide_length != (size_t)-1 ? malloc((wide_length + 1) * sizeof(wchar_t)) : NULL;
+    if (!wide_command || !typed)
+    {
+        free(wide_command);
+        free(typed);
+        return -1;
+    }
+    mbstowcs(wide_command, command, wide_length + 1);
+
+    // Step 2: Run it (history, echo, command block and job as usual)
+    unsigned long serial_before = tab->next_block_serial;
+    line_editor_set_text(editor, wide_command);
+    handle_enter_key(NULL, None, NULL, tab);
+    free(wide_command);
+
+    // Step 3: Give the user back whatever they were typing
+    line_editor_set_text(editor, typed);
+    line_editor_set_cursor(editor, typed_cursor);
+    free(typed);
+    if (tab_is_visible(tab))
+        update_command_display(tab);
+    redraw_pending = 1;
+
+    *serial = tab->next_block_serial != serial_before ? tab->next_block_serial - 1 : 0;
+    return 0;
+}
+
+// Function to add or remove a subscription; returns 0, or -1 if the client holds MAX_TABS already
+static int control_subscribe(ControlClient *client, int tab_id, int subscribe)
+{
+    int free_slot = -1;
+    for (int slot = 0; slot < MAX_TABS; slot++)
+    {
+        if (client->subscribed_tabs[slot] == tab_id)
+        {
+            if (!subscribe)
+            {
+                client->subscribed_tabs[slot] = 0;
+                control_subscription_count--;
+            }
+            return 0;
+        }
+        if (client->subscribed_tabs[slot] == 0 && free_slot < 0)
+            free_slot = slot;
+    }
+    if (!subscribe)
+        return 0;
+    if (free_slot < 0)
+        return -1;
+    client->subscribed_tabs[free_slot] = tab_id;
+    control_subscription_count++;
+    return 0;
+}
+
+// Function to answer one request
+static void handle_control_request(ControlClient *client, const ControlRequest *request)
+{
+    AttachConnection *connection = &client->connection;
+    const char *op = request->op;
+
+    // Step 1: Every operation but list, new and jobs addresses a tab (the active one by default)
+    Tab *tab = request->has_tab ? find_tab_by_id((int)request->tab) : &tabs[active_tab_index];
+    if (!tab)
+    {
+        control_reply_error(connection, request, "no such tab");
+        return;
+    }
+
+    // Step 2: Wake a hibernated tab before a request runs commands in it or reads its history or scrollback
+    if (strcmp(op, "send") == 0 || strcmp(op, "block") == 0 || strcmp(op, "lines") == 0)
+        wake_tab(tab);
+
+    if (strcmp(op, "list") == 0)
+    {
+        control_reply_start(connection, request, 1);
+        attach_append(connection, ",\"tabs\":[", 9);
+        for (int tab_index = 0; tab_index < tab_count; tab_index++)
+        {
+            Tab *listed = &tabs[tab_index];
+            control_printf(connection, "%s{\"tab\":%d,\"index\":%d,\"active\":%s,\"activity\":%s,\"hibernated\":%s,"
+                                       "\"running\":%s,\"first_line\":%lu,\"lines\":%d,\"last_block\":%lu,\"name\":",
+                           tab_index ? "," : "", listed->tab_id, tab_index, tab_index == active_tab_index ? "true" : "false",
+                           listed->has_activity ? "true" : "false", listed->hibernated ? "true" : "false",
+                           find_foreground_job(listed) ? "true" : "false", listed->scrollback_first_line,
+                           listed->scrollback_count, listed->next_block_serial - 1);
+            control_append_string(connection, listed->tab_name, strlen(listed->tab_name));
+            attach_append(connection, "}", 1);
+        }
+        attach_append(connection, "]}\n", 3);
+    }
+    else if (strcmp(op, "new") == 0 || strcmp(op, "open") == 0)
+    {
+        int count_before = tab_count;
+        create_new_tab();
+        if (tab_count == count_before)
+        {
+            control_reply_error(connection, request, "tab limit reached");
+            return;
+        }
+        // "open" is what a single-instance launch sends: show the tab as a new window would be
+        if (op[0] == 'o')
+        {
+            activate_tab(tab_count - 1);
+            raise_window_requested = 1;
+        }
+        tab_bar_dirty = 1;
+        redraw_pending = 1;
+        control_reply_start(connection, request, 1);
+        control_printf(connection, ",\"tab\":%d,\"index\":%d}\n", tabs[tab_count - 1].tab_id, tab_count - 1);
+    }
+    else if (strcmp(op, "send") == 0)
+    {
+        if (!request->command || !*request->command)
+        {
+            control_reply_error(connection, request, "send needs a command");
+            return;
+        }
+        if (find_foreground_job(tab) != NULL || (multiwatch_mode && multiwatch_tab_id == tab->tab_id))
+        {
+            control_reply_error(connection, request, "a command is still running in this tab");
+            return;
+        }
+        int tab_id = tab->tab_id;
+        unsigned long serial;
+        if (control_run_command(tab, request->command, &serial) != 0)
+        {
+            control_reply_error(connection, request, "command is not valid text in the terminal's locale");
+            return;
+        }
+        control_reply_start(connection, request, 1);
+        control_printf(connection, ",\"tab\":%d,\"block\":%lu}\n", tab_id, serial);
+    }
+    else if (strcmp(op, "subscribe") == 0 || strcmp(op, "unsubscribe") == 0)
+    {
+        int subscribe = op[0] == 's';
+        if (control_subscribe(client, tab->tab_id, subscribe) != 0)
+        {
+            control_reply_error(connection, request, "too many subscriptions");
+            return;
+        }
+        // The next line number lets a subscriber fetch what came before without a gap
+        control_reply_start(connection, request, 1);
+        control_printf(connection, ",\"tab\":%d,\"line\":%lu}\n", tab->tab_id,
+                       tab->scrollback_first_line + tab->scrollback_count);
+    }
+    else if (strcmp(op, "jobs") == 0)
+    {
+        control_reply_start(connection, request, 1);
+        attach_append(connection, ",\"jobs\":[", 9);
+        int listed = 0;
+        for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
+        {
+            CommandJob *job = &running_jobs[job_index];
+            if (!job->in_use || (request->has_tab && job->tab_id != tab->tab_id))
+                continue;
+            control_printf(connection, "%s{\"tab\":%d,\"pid\":%d,\"stages\":%d,\"stopped\":%s,\"output_bytes\":%zu,"
+                                       "\"block\":%lu,\"command\":",
+                           listed++ ? "," : "", job->tab_id, (int)job->pids[0], job->pid_count,
+                           job->stopped ? "true" : "false", job->output_bytes, job->block_serial);
+            control_append_string(connection, job->command, strlen(job->command));
+            attach_append(connection, "}", 1);
+        }
+        attach_append(connection, "],\"background\":[", 16);
+        for (int bg_index = 0; bg_index < bg_job_count; bg_index++)
+        {
+            BGProcess *process = &bg_processes[bg_index];
+            control_printf(connection, "%s{\"job\":%d,\"pid\":%d,\"status\":\"%s\",\"command\":", bg_index ? "," : "",
+                           process->job_id, (int)process->pid, process->status);
+            control_append_string(connection, process->command, strlen(process->command));
+            attach_append(connection, "}", 1);
+        }
+        attach_append(connection, "]}\n", 3);
+    }
+    else if (strcmp(op, "block") == 0)
+    {
+        unsigned long serial = request->has_block ? (unsigned long)request->block : tab->next_block_serial - 1;
+        CommandBlock *block = find_command_block(tab, serial);
+        if (!block)
+        {
+            control_reply_error(connection, request, "no such block (never run or scrolled out)");
+            return;
+        }
+        control_reply_start(connection, request, 1);
+        control_printf(connection, ",\"tab\":%d,\"block\":", tab->tab_id);
+        control_append_block(connection, block);
+        attach_append(connection, "}\n", 2);
+    }
+    else if (strcmp(op, "lines") == 0)
+    {
+        // Absolute line numbers; lines already dropped from the buffer are skipped
+        unsigned long first = tab->scrollback_first_line;
+        unsigned long end = first + tab->scrollback_count;
+        unsigned long from = request->has_from && request->from > 0 ? (unsigned long)request->from : 0;
+        long long count = request->has_count ? request->count : CONTROL_DEFAULT_LINES;
+        if (from < first)
+            from = first;
+        if (count < 0)
+            count = 0;
+        if (count > CONTROL_MAX_LINES)
+            count = CONTROL_MAX_LINES;
+        if (from > end)
+            from = end;
+        unsigned long until = end - from < (unsigned long)count ? end : from + (unsigned long)count;
+
+        control_reply_start(connection, request, 1);
+        control_printf(connection, ",\"tab\":%d,\"first_line\":%lu,\"from\":%lu,\"next\":%lu,\"lines\":[",
+                       tab->tab_id, first, from, until);
+        for (unsigned long line = from; line < until; line++)
+        {
+            const char *bytes = "";
+            size_t length = 0;
+            scrollback_line_bytes(tab, (int)(line - first), &bytes, &length);
+            if (line > from)
+                attach_append(connection, ",", 1);
+            control_append_string(connection, bytes, length);
+        }
+        attach_append(connection, "]}\n", 3);
+    }
+    else
+    {
+        control_reply_error(connection, request, "unknown op");
+    }
+}
+
+// Function to let a control client go and forget its subscriptions
+static void drop_control_client(ControlClient *client, const char *reason)
+{
+    for (int slot = 0; slot < MAX_TABS; slot++)
+    {
+        if (client->subscribed_tabs[slot] != 0)
+            control_subscription_count--;
+    }
+    printf("Control client %d disconnected (%s)\n", (int)(client - control_clients), reason);
+    attach_close(&client->connection);
+    memset(client->subscribed_tabs, 0, sizeof(client->subscribed_tabs));
+    client->overflowed = 0;
+}
+
+// Function to listen on the control socket and export its path to children; returns 0 or -1
+int start_control_socket(void)
+{
+    for (int slot = 0; slot < MAX_CONTROL_CLIENTS; slot++)
+        control_clients[slot].connection.fd = -1;
+
+    // Step 1: $MYTERM_CONTROL_SOCKET, else one socket per process ($XDG_RUNTIME_DIR or /tmp)
+    const char *explicit_path = getenv("MYTERM_CONTROL_SOCKET");
+    const char *runtime_directory = getenv("XDG_RUNTIME_DIR");
+    if (explicit_path && *explicit_path)
+        snprintf(control_socket_path, sizeof(control_socket_path), "%s", explicit_path);
+    else if (runtime_directory && *runtime_directory)
+        snprintf(control_socket_path, sizeof(control_socket_path), "%s/myterm-control-%d.sock", runtime_directory,
+                 (int)getpid());
+    else
+        snprintf(control_socket_path, sizeof(control_socket_path), "/tmp/myterm-%d-control-%d.sock", (int)getuid(),
+                 (int)getpid());
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(control_socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Warning: Control socket path %s is too long - automation disabled\n", control_socket_path);
+        return -1;
+    }
+    memcpy(address.sun_path, control_socket_path, strlen(control_socket_path) + 1);
+
+    // Step 2: Leave a live socket alone (another myterm owns it); replace a stale one
+    int probe = attach_connect(&address);
+    if (probe >= 0)
+    {
+        close(probe);
+        fprintf(stderr, "Warning: Control socket %s is in use - automation disabled\n", control_socket_path);
+        return -1;
+    }
+    unlink(control_socket_path);
+
+    // Step 3: Listen, reachable by this user only
+    control_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t previous_mask = umask(077);
+    int bound = control_listen_fd >= 0 && bind(control_listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    umask(previous_mask);
+    if (!bound || listen(control_listen_fd, MAX_CONTROL_CLIENTS) != 0)
+    {
+        fprintf(stderr, "Warning: Cannot listen on %s: %s - automation disabled\n", control_socket_path,
+                strerror(errno));
+        if (control_listen_fd >= 0)
+            close(control_listen_fd);
+        control_listen_fd = -1;
+        return -1;
+    }
+    fcntl(control_listen_fd, F_SETFL, O_NONBLOCK);
+
+    // Step 4: Scripts started from a tab find the socket without being told
+    setenv("MYTERM_CONTROL_SOCKET", control_socket_path, 1);
+    printf("Control socket: %s\n", control_socket_path);
+    return 0;
+}
+
+// Function to add the control socket's descriptors to a poll() set; returns how many were added
+int control_poll_fds(struct pollfd *fds)
+{
+    if (control_listen_fd < 0)
+        return 0;
+
+    int count = 0;
+    fds[count].fd = control_listen_fd;
+    fds[count++].events = POLLIN;
+    for (int slot = 0; slot < MAX_CONTROL_CLIENTS; slot++)
+    {
+        AttachConnection *connection = &control_clients[slot].connection;
+        if (connection->fd < 0)
+            continue;
+        fds[count].fd = connection->fd;
+        fds[count++].events = POLLIN | (connection->outbox_length > 0 ? POLLOUT : 0);
+    }
+    return count;
+}
+
+// Function to answer one request line (a recording keeps the line; a replay answers it again)
+static void apply_control_line(ControlClient *client, char *line)
+{
+    record_input(RECORD_CONTROL, line, strlen(line), NULL, 0);
+    recording_input_depth++;
+
+    ControlRequest request;
+    if (parse_control_request(line, &request) != 0)
+        control_reply_error(&client->connection, NULL, "malformed request");
+    else
+        handle_control_request(client, &request);
+
+    recording_input_depth--;
+}
+
+// Function to accept scripts, answer their requests and send what is queued (event loop, never blocks)
+void service_control_socket(void)
+{
+    if (control_listen_fd < 0)
+        return;
+
+    // Step 1: New connections
+    int fd;
+    while ((fd = accept(control_listen_fd, NULL, NULL)) >= 0)
+    {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        ControlClient *client = NULL;
+        for (int slot = 0; slot < MAX_CONTROL_CLIENTS && !client; slot++)
+        {
+            if (control_clients[slot].connection.fd < 0)
+                client = &control_clients[slot];
+        }
+        if (!client)
+        {
+            static const char refusal[] = "{\"ok\":false,\"error\":\"too many control clients\"}\n";
+            send(fd, refusal, sizeof(refusal) - 1, MSG_NOSIGNAL);
+            close(fd);
+            continue;
+        }
+        client->connection.fd = fd;
+        printf("Control client %d connected\n", (int)(client - control_clients));
+    }
+
+    for (int slot = 0; slot < MAX_CONTROL_CLIENTS; slot++)
+    {
+        ControlClient *client = &control_clients[slot];
+        AttachConnection *connection = &client->connection;
+        if (connection->fd < 0)
+            continue;
+
+        // Step 2: Answer every complete line, in order
+        int connected = attach_receive(connection) == 0;
+        size_t offset = 0;
+        unsigned char *newline;
+        while ((newline = memchr(connection->inbox + offset, '\n', connection->inbox_length - offset)) != NULL)
+        {
+            char *line = (char *)connection->inbox + offset;
+            *newline = '\0';
+            offset = (size_t)(newline - connection->inbox) + 1;
+
+            if (*json_skip_space(line) == '\0')
+                continue;
+            apply_control_line(client, line);
+        }
+        attach_consume(connection, offset);
+
+        // Step 3: Send; drop clients that left, sent an oversized line or stopped reading
+        if (connection->inbox_length > CONTROL_MAX_REQUEST)
+        {
+            control_reply_error(connection, NULL, "request too long");
+            attach_flush(connection);
+            drop_control_client(client, "request too long");
+        }
+        else if (attach_flush(connection) != 0 || !connected)
+            drop_control_client(client, "connection closed");
+        else if (client->overflowed)
+            drop_control_client(client, "stopped reading");
+    }
+}
+
+// Function to find whether a client subscribed to a tab
+static int control_client_subscribed(const ControlClient *client, int tab_id)
+{
+    if (client->connection.fd < 0 || client->overflowed)
+        return 0;
+    for (int slot = 0; slot < MAX_TABS; slot++)
+    {
+        if (client->subscribed_tabs[slot] == tab_id)
+            return 1;
+    }
+    return 0;
+}
+
+// Function to mark a subscriber whose unsent events passed the limit (dropped by the next service)
+static void control_check_backlog(ControlClient *client)
+{
+    if (client->connection.outbox_length > CONTROL_MAX_BACKLOG)
+        client->overflowed = 1;
+}
+
+// Function to stream text just added to a tab's scrollback to its subscribers
+void publish_tab_output(Tab *tab, unsigned long first_line, const char *text)
+{
+    if (control_subscription_count == 0)
+        return;
+
+    for (int slot = 0; slot < MAX_CONTROL_CLIENTS; slot++)
+    {
+        ControlClient *client = &control_clients[slot];
+        if (!control_client_subscribed(client, tab->tab_id))
+            continue;
+        control_printf(&client->connection, "{\"event\":\"output\",\"tab\":%d,\"line\":%lu,\"text\":", tab->tab_id,
+                       first_line);
+        control_append_string(&client->connection, text, strlen(text));
+        attach_append(&client->connection, "}\n", 2);
+        control_check_backlog(client);
+    }
+}
+
+// Function to tell a tab's subscribers that a command finished
+void publish_block_end(Tab *tab, const CommandBlock *block)
+{
+    if (control_subscription_count == 0)
+        return;
+
+    for (int slot = 0; slot < MAX_CONTROL_CLIENTS; slot++)
+    {
+        ControlClient *client = &control_clients[slot];
+        if (!control_client_subscribed(client, tab->tab_id))
+            continue;
+        control_printf(&client->connection, "{\"event\":\"done\",\"tab\":%d,\"block\":", tab->tab_id);
+        control_append_block(&client->connection, block);
+        attach_append(&client->connection, "}\n", 2);
+        control_check_backlog(client);
+    }
+}
+
+// Function to disconnect every script and remove the socket (at exit)
+void close_control_socket(void)
+{
+    if (control_listen_fd < 0)
+        return;
+    for (int slot = 0; slot < MAX_CONTROL_CLIENTS; slot++)
+    {
+        if (control_clients[slot].connection.fd >= 0)
+        {
+            attach_flush(&control_clients[slot].connection);
+            drop_control_client(&control_clients[slot], "terminal exiting");
+        }
+    }
+    close(control_listen_fd);
+    control_listen_fd = -1;
+    unlink(control_socket_path);
+}
+
+// Function to build the socket path shared by single-instance launches
+// ($MYTERM_INSTANCE_SOCKET, $XDG_RUNTIME_DIR/myterm-instance.sock or /tmp/myterm-UID-instance.sock)
+void single_instance_socket_path(char *path, size_t size)
+{
+    const char *explicit_path = getenv("MYTERM_INSTANCE_SOCKET");
+    const char *runtime_directory = getenv("XDG_RUNTIME_DIR");
+    if (explicit_path && *explicit_path)
+        snprintf(path, size, "%s", explicit_path);
+    else if (runtime_directory && *runtime_directory)
+        snprintf(path, size, "%s/myterm-instance.sock", runtime_directory);
+    else
+        snprintf(path, size, "/tmp/myterm-%d-instance.sock", (int)getuid());
+}
+
+// Function to ask a running instance to open a tab for this launch; returns 0 if it did,
+// -1 if none answers or it has no room (the launch then starts on its own)
+int open_in_running_instance(const char *path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    memcpy(address.sun_path, path, strlen(path) + 1);
+
+    // Step 1: Nobody listening means this launch becomes the instance
+    int fd = attach_connect(&address);
+    if (fd < 0)
+        return -1;
+
+    // Step 2: One request, one reply line
+    static const char request[] = "{\"op\":\"open\"}\n";
+    char reply[512] = {0};
+    size_t reply_length = 0;
+    long long deadline = monotonic_ms() + SINGLE_INSTANCE_TIMEOUT_MS;
+    int sent = send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) == (ssize_t)(sizeof(request) - 1);
+    while (sent && reply_length < sizeof(reply) - 1 && !memchr(reply, '\n', reply_length))
+    {
+        long long remaining = deadline - monotonic_ms();
+        struct pollfd wait_fd = {fd, POLLIN, 0};
+        if (remaining <= 0 || poll(&wait_fd, 1, (int)remaining) <= 0)
+            break;
+        ssize_t received = recv(fd, reply + reply_length, sizeof(reply) - 1 - reply_length, 0);
+        if (received <= 0)
+            break;
+        reply_length += (size_t)received;
+    }
+    close(fd);
+    reply[reply_length] = '\0';
+
+    // Step 3: Report where the tab went (a reply too short to say ok is a refusal)
+    static const char accepted[] = "{\"ok\":true";
+    if (reply_length < sizeof(accepted) - 1 || memcmp(reply, accepted, sizeof(accepted) - 1) != 0)
+    {
+        printf("Running instance on %s did not open a tab (%s) - starting a new one\n", path,
+               reply_length ? strtok(reply, "\n") : "no reply");
+        return -1;
+    }
+    printf("Opened a tab in the running instance: %s\n", strtok(reply, "\n"));
+    return 0;
+}
+
+// ============================================================================
+// SESSION RECORDING AND REPLAY
+// ============================================================================
+//
+// MYTERM_RECORD=file writes a compact log of a session: every key, click,
+// paste, control request and expose as it arrived, and what the event loop
+// did on its own - text added to a tab, separators, finished commands,
+// presented frames - stamped in microseconds. `--replay file` starts from
+// the same fresh state, applies the input again (commands are never run;
+// their jobs wait for the recorded ending) and feeds in the recorded
+// output, so every screen is rebuilt in order. Frames come from the
+// recorded RECORD_FRAME marks, which makes frame counts comparable between
+// the recording and the replay, and the final checksum of all tabs shows
+// whether the replay reached the same screens.
+
+// Function to give the time shown in command headers: the recorded time of the input being
+// applied while recording or replaying (both sides print the same seconds), the wall clock otherwise
+time_t terminal_time(void)
+{
+    if (replay_active || (recording_fd >= 0 && recording_input_depth > 0))
+        return (time_t)((recording_wall_start_us + recording_event_us) / 1000000);
+    return time(NULL);
+}
+
+// Function to stop recording after a write error
+static void abandon_recording(void)
+{
+    fprintf(stderr, "Recording stopped: %s\n", strerror(errno));
+    close(recording_fd);
+    recording_fd = -1;
+    free(recording_buffer);
+    recording_buffer = NULL;
+    recording_buffered = 0;
+}
+
+// Function to write buffered events to the recording file; returns 0 or -1
+static int flush_recording(void)
+{
+    size_t written = 0;
+    while (written < recording_buffered)
+    {
+        ssize_t result = write(recording_fd, recording_buffer + written, recording_buffered - written);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+        {
+            abandon_recording();
+            return -1;
+        }
+        written += (size_t)result;
+    }
+    recording_buffered = 0;
+    return 0;
+}
+
+// Function to add bytes to the recording (large payloads bypass the buffer)
+static int append_recording(const void *data, size_t length)
+{
+    if (recording_buffered + length > RECORDING_BUFFER_SIZE && flush_recording() != 0)
+        return -1;
+    if (length > RECORDING_BUFFER_SIZE)
+    {
+        const unsigned char *bytes = data;
+        while (length > 0)
+        {
+            ssize_t result = write(recording_fd, bytes, length);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+            {
+                abandon_recording();
+                return -1;
+            }
+            bytes += result;
+            length -= (size_t)result;
+        }
+        return 0;
+    }
+    memcpy(recording_buffer + recording_buffered, data, length);
+    recording_buffered += length;
+    return 0;
+}
+
+// Function to append one event to the recording
+static void write_recording_event(int type, const void *head, size_t head_length,
+                                  const void *data, size_t data_length, long long time_us)
+{
+    RecordingEventHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = (uint16_t)type;
+    header.length = (uint32_t)(head_length + data_length);
+    header.time_us = time_us;
+
+    if (append_recording(&header, sizeof(header)) == 0 &&
+        (head_length == 0 || append_recording(head, head_length) == 0) && data_length > 0)
+    {
+        append_recording(data, data_length);
+    }
+}
+
+// Function to start recording to a file (the session starts fresh); returns 0 or -1
+int start_recording(const char *path)
+{
+    recording_buffer = malloc(RECORDING_BUFFER_SIZE);
+    recording_fd = recording_buffer ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    if (recording_fd < 0)
+    {
+        fprintf(stderr, "Cannot record to %s: %s\n", path, strerror(errno));
+        free(recording_buffer);
+        recording_buffer = NULL;
+        return -1;
+    }
+    recording_pid = getpid();
+
+    // Step 1: The header carries the wall clock that replayed command headers print
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    recording_start_us = monotonic_us();
+    recording_wall_start_us = (long long)wall.tv_sec * 1000000 + wall.tv_nsec / 1000;
+
+    RecordingFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.wall_start_us = recording_wall_start_us;
+    header.server = (uint32_t)server_mode;
+    if (append_recording(&header, sizeof(header)) != 0)
+        return -1;
+
+    // Step 2: Hibernation would change tabs behind the recording's back
+    hibernate_idle_ms = 0;
+
+    // Step 3: ESC exits without the event loop's cleanup; the log is still finished
+    // (children forked for commands inherit the handler, so it checks the process)
+    atexit(finish_recording);
+    printf("Recording session to %s\n", path);
+    return 0;
+}
+
+// Function to record input as it arrives (nested input, e.g. a key that pastes, is recorded once)
+void record_input(int type, const void *head, size_t head_length, const void *data, size_t data_length)
+{
+    if (recording_fd < 0 || recording_input_depth > 0)
+        return;
+    recording_event_us = monotonic_us() - recording_start_us;
+    write_recording_event(type, head, head_length, data, data_length, recording_event_us);
+}
+
+// Function to record what the event loop did on its own (nothing while input is applied)
+void record_effect(int type, const void *payload, size_t length)
+{
+    if (recording_fd < 0 || recording_input_depth > 0)
+        return;
+    if (type == RECORD_FRAME)
+        recording_frames++;
+    write_recording_event(type, payload, length, NULL, 0, monotonic_us() - recording_start_us);
+}
+
+// Function to record text or a separator the event loop added to a tab
+void record_tab_effect(int type, Tab *tab, const char *text, size_t length)
+{
+    if (recording_fd < 0 || recording_input_depth > 0)
+        return;
+    RecordTabPayload payload = {tab->tab_id, 0};
+    write_recording_event(type, &payload, sizeof(payload), text, length, monotonic_us() - recording_start_us);
+}
+
+// Function to record a finished command (a replayed job ends here)
+void record_block_end(Tab *tab, const CommandBlock *block)
+{
+    if (recording_fd < 0 || recording_input_depth > 0)
+        return;
+    RecordJobEnd end;
+    memset(&end, 0, sizeof(end));
+    end.tab_id = tab->tab_id;
+    end.exit_status = block->exit_status;
+    end.block_serial = block->serial;
+    end.duration_ms = block->duration_ms;
+    record_effect(RECORD_JOB_END, &end, sizeof(end));
+}
+
+// Function to fold bytes into an FNV-1a 64 hash
+static uint64_t checksum_bytes(uint64_t hash, const void *data, size_t length)
+{
+    for (size_t byte_index = 0; byte_index < length; byte_index++)
+    {
+        hash ^= ((const unsigned char *)data)[byte_index];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Function to checksum what every tab shows (grids of hidden tabs are brought up to date first)
+uint64_t terminal_state_checksum(void)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    hash = checksum_bytes(hash, &tab_count, sizeof(tab_count));
+    hash = checksum_bytes(hash, &active_tab_index, sizeof(active_tab_index));
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+        if (tab->grid_stale)
+        {
+            render_scrollback(tab);
+            tab->grid_stale = 0;
+        }
+        hash = checksum_bytes(hash, &tab->tab_id, sizeof(tab->tab_id));
+        hash = checksum_bytes(hash, tab->tab_name, strlen(tab->tab_name));
+        hash = checksum_bytes(hash, tab->text_buffer, sizeof(tab->text_buffer));
+        hash = checksum_bytes(hash, &tab->cursor_row, sizeof(tab->cursor_row));
+        hash = checksum_bytes(hash, &tab->cursor_col, sizeof(tab->cursor_col));
+        hash = checksum_bytes(hash, &tab->scrollback_count, sizeof(tab->scrollback_count));
+        hash = checksum_bytes(hash, &tab->scrollback_first_line, sizeof(tab->scrollback_first_line));
+    }
+    return hash;
+}
+
+// Function to close the recording with the final checksum (cleanup and atexit; runs once)
+void finish_recording(void)
+{
+    if (recording_fd < 0 || getpid() != recording_pid)
+        return;
+    RecordEnd end;
+    memset(&end, 0, sizeof(end));
+    end.checksum = terminal_state_checksum();
+    end.frames = recording_frames;
+    recording_input_depth = 0;
+    write_recording_event(RECORD_END, &end, sizeof(end), NULL, 0, monotonic_us() - recording_start_us);
+    if (recording_fd >= 0 && flush_recording() == 0)
+    {
+        close(recording_fd);
+        recording_fd = -1;
+        free(recording_buffer);
+        recording_buffer = NULL;
+    }
+    printf("Recording finished: %llu frames, final checksum %016llx\n",
+           recording_frames, (unsigned long long)end.checksum);
+}
+
+// Function to order frame times for the percentiles
+static int compare_frame_times(const void *left, const void *right)
+{
+    long long a = *(const long long *)left, b = *(const long long *)right;
+    return (a > b) - (a < b);
+}
+
+// Function to do a frame's painting: onto the window, or headless everything but the drawing
+static void present_replay_frame(Display *display, Window window, GC gc)
+{
+    redraw_pending = 0;
+    if (display)
+    {
+        present_frame(display, window, gc);
+        XSync(display, False);           // Count the server's work in the frame time
+        while (XPending(display) > 0)
+        {
+            XEvent ignored;
+            XNextEvent(display, &ignored); // The recording is the only input
+        }
+        return;
+    }
+
+    Tab *tab = &tabs[active_tab_index];
+    unsigned char styles[BUFFER_COLS];
+    for (int row = 0; row < BUFFER_ROWS - 1; row++)
+    {
+        compute_row_styles(tab, row, styles);
+    }
+}
+
+// Function to apply one recorded event; returns the bytes of output it fed in
+static size_t apply_recorded_event(const RecordingEventHeader *header, const unsigned char *payload,
+                                   char **text, size_t *text_capacity)
+{
+    // Step 1: Payloads that carry text are copied out and NUL-terminated
+    RecordTabPayload target = {0, 0};
+    const unsigned char *data = payload;
+    size_t data_length = header->length;
+    if (header->type == RECORD_PASTE || header->type == RECORD_OUTPUT || header->type == RECORD_SEPARATOR)
+    {
+        if (data_length < sizeof(target))
+            return 0;
+        memcpy(&target, payload, sizeof(target));
+        data += sizeof(target);
+        data_length -= sizeof(target);
+    }
+    if (data_length + 1 > *text_capacity)
+    {
+        char *grown = realloc(*text, data_length + 1);
+        if (!grown)
+            return 0;
+        *text = grown;
+        *text_capacity = data_length + 1;
+    }
+    memcpy(*text, data, data_length);
+    (*text)[data_length] = '\0';
+    Tab *tab = find_tab_by_id(target.tab_id);
+
+    // Step 2: Input goes through the same paths as live input; effects are applied directly
+    switch (header->type)
+    {
+    case RECORD_KEY:
+        if (header->length >= sizeof(AttachKeyMessage))
+        {
+            AttachKeyMessage key;
+            memcpy(&key, payload, sizeof(key));
+            char key_text[ATTACH_KEY_TEXT + 1];
+            int text_length = key.text_length < ATTACH_KEY_TEXT ? (int)key.text_length : ATTACH_KEY_TEXT;
+            memcpy(key_text, key.text, text_length);
+            key_text[text_length] = '\0';
+            handle_key_input(NULL, None, NULL, (KeySym)key.keysym, key.state, key_text, text_length, CurrentTime);
+        }
+        break;
+
+    case RECORD_BUTTON:
+        if (header->length >= sizeof(AttachButtonMessage))
+        {
+            AttachButtonMessage button;
+            memcpy(&button, payload, sizeof(button));
+            handle_button_input(button.x, button.y, button.button);
+        }
+        break;
+
+    case RECORD_PASTE:
+        if (tab)
+            insert_pasted_text(tab, *text, data_length, target.flags != 0);
+        break;
+
+    case RECORD_CONTROL:
+    {
+        // Answered into a scratch client that is thrown away
+        ControlClient scratch;
+        memset(&scratch, 0, sizeof(scratch));
+        scratch.connection.fd = -1;
+        apply_control_line(&scratch, *text);
+        for (int slot = 0; slot < MAX_TABS; slot++)
+        {
+            if (scratch.subscribed_tabs[slot] != 0)
+                control_subscription_count--;
+        }
+        attach_close(&scratch.connection);
+        break;
+    }
+
+    case RECORD_EXPOSE:
+        redraw_pending = 1;
+        break;
+
+    case RECORD_OUTPUT:
+        if (tab)
+        {
+            add_text_to_buffer(tab, *text);
+            redraw_pending = 1;
+            return data_length;
+        }
+        break;
+
+    case RECORD_SEPARATOR:
+        if (tab)
+            add_separator_line(tab);
+        break;
+
+    case RECORD_JOB_END:
+        if (header->length >= sizeof(RecordJobEnd))
+        {
+            RecordJobEnd end;
+            memcpy(&end, payload, sizeof(end));
+            Tab *job_tab = find_tab_by_id(end.tab_id);
+            if (job_tab)
+            {
+                end_command_block(job_tab, (unsigned long)end.block_serial, end.exit_status);
+                CommandBlock *block = find_command_block(job_tab, (unsigned long)end.block_serial);
+                if (block)
+                    block->duration_ms = end.duration_ms;
+                if (job_tab->foreground_pid == 0)
+                    job_tab->foreground_pid = -1;
+            }
+            for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
+            {
+                CommandJob *job = &running_jobs[job_index];
+                if (job->in_use && job->channel < 0 && job->tab_id == end.tab_id &&
+                    job->block_serial == end.block_serial)
+                    job->in_use = 0;
+            }
+        }
+        break;
+
+    case RECORD_MULTIWATCH_END:
+        multiwatch_mode = 0;
+        multiwatch_count = 0;
+        multiwatch_stop_deadline = 0;
+        multiwatch_tab_id = 0;
+        break;
+
+    default:
+        break;                            // Frame and end marks are handled by run_replay()
+    }
+    return 0;
+}
+
+// Function to replay a recording headlessly (display NULL) or onto a window, as fast as
+// possible or at the recorded pacing; reports frame times and returns 0 if the final
+// screens match the recording
+int run_replay(const char *path, int paced, Display *display, Window window, GC gc)
+{
+    // Step 1: Map the recording and check its header
+    int fd = open(path, O_RDONLY);
+    struct stat file_status;
+    if (fd < 0 || fstat(fd, &file_status) != 0 || (size_t)file_status.st_size < sizeof(RecordingFileHeader))
+    {
+        fprintf(stderr, "Cannot read recording %s: %s\n", path, fd < 0 ? strerror(errno) : "too short");
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    size_t file_size = (size_t)file_status.st_size;
+    const unsigned char *contents = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    RecordingFileHeader file_header;
+    if (contents == MAP_FAILED ||
+        (memcpy(&file_header, contents, sizeof(file_header)), memcmp(file_header.magic, RECORDING_MAGIC, 8) != 0))
+    {
+        fprintf(stderr, "%s is not a recording\n", path);
+        if (contents != MAP_FAILED)
+            munmap((void *)contents, file_size);
+        return 1;
+    }
+    replay_active = 1;
+    recording_wall_start_us = file_header.wall_start_us;
+    server_mode = (int)file_header.server; // Built-ins answer the way the recorded terminal did
+
+    // Step 2: Apply events in order; a frame is everything up to the next RECORD_FRAME
+    unsigned long events = 0, input_events = 0;
+    unsigned long long output_bytes = 0;
+    uint64_t recorded_checksum = 0, recorded_frames = 0;
+    int has_end = 0;
+    long long *frame_times = NULL;
+    size_t frame_count = 0, frame_capacity = 0;
+    long long frame_work_us = 0;
+    char *text = NULL;
+    size_t text_capacity = 0;
+    long long replay_start_us = monotonic_us();
+    size_t offset = sizeof(RecordingFileHeader);
+
+    while (offset + sizeof(RecordingEventHeader) <= file_size)
+    {
+        RecordingEventHeader header;
+        memcpy(&header, contents + offset, sizeof(header));
+        const unsigned char *payload = contents + offset + sizeof(header);
+        if (header.length > file_size - offset - sizeof(header))
+        {
+            fprintf(stderr, "Recording %s is truncated after %lu events\n", path, events);
+            break;
+        }
+        offset += sizeof(header) + header.length;
+        events++;
+
+        // At the original pacing, wait until the event's moment (waiting is not frame time)
+        if (paced)
+        {
+            long long wait_us = replay_start_us + header.time_us - monotonic_us();
+            if (wait_us > 0)
+                usleep((useconds_t)wait_us);
+        }
+
+        long long event_start_us = monotonic_us();
+        if (header.type == RECORD_END)
+        {
+            if (header.length >= sizeof(RecordEnd))
+            {
+                RecordEnd end;
+                memcpy(&end, payload, sizeof(end));
+                recorded_checksum = end.checksum;
+                recorded_frames = end.frames;
+                has_end = 1;
+            }
+            break;
+        }
+        if (header.type == RECORD_FRAME)
+        {
+            present_replay_frame(display, window, gc);
+            frame_work_us += monotonic_us() - event_start_us;
+            if (frame_count == frame_capacity)
+            {
+                size_t capacity = frame_capacity ? frame_capacity * 2 : 1024;
+                long long *grown = realloc(frame_times, capacity * sizeof(long long));
+                if (!grown)
+                    break;
+                frame_times = grown;
+                frame_capacity = capacity;
+            }
+            frame_times[frame_count++] = frame_work_us;
+            frame_work_us = 0;
+            continue;
+        }
+
+        if (header.type <= RECORD_EXPOSE)
+            input_events++;
+        recording_event_us = header.time_us;
+        output_bytes += apply_recorded_event(&header, payload, &text, &text_capacity);
+        frame_work_us += monotonic_us() - event_start_us;
+    }
+    long long replay_us = monotonic_us() - replay_start_us;
+    uint64_t checksum = terminal_state_checksum();
+    munmap((void *)contents, file_size);
+    free(text);
+
+    // Step 3: Report
+    long long frame_total_us = 0;
+    for (size_t frame_index = 0; frame_index < frame_count; frame_index++)
+        frame_total_us += frame_times[frame_index];
+    qsort(frame_times, frame_count, sizeof(long long), compare_frame_times);
+
+    printf("\nReplay of %s (%s, %s)\n", path, paced ? "original pacing" : "as fast as possible",
+           display ? "on the display" : "headless");
+    printf("  events:      %lu (%lu input), %.1f KB of output\n", events, input_events, output_bytes / 1024.0);
+    printf("  frames:      %zu in %.1f ms", frame_count, replay_us / 1000.0);
+    if (has_end)
+        printf(" (recording presented %llu)", (unsigned long long)recorded_frames);
+    printf("\n");
+    if (frame_count > 0)
+    {
+        printf("  frame time:  mean %.1f us, p50 %lld us, p99 %lld us, max %lld us\n",
+               (double)frame_total_us / frame_count, frame_times[frame_count / 2],
+               frame_times[(frame_count * 99) / 100], frame_times[frame_count - 1]);
+    }
+    printf("  checksum:    %016llx", (unsigned long long)checksum);
+    int status = 0;
+    if (has_end)
+    {
+        status = checksum == recorded_checksum ? 0 : 1;
+        printf(" (recorded %016llx: %s)", (unsigned long long)recorded_checksum,
+               status == 0 ? "match" : "MISMATCH");
+    }
+    else
+    {
+        printf(" (recording has no final checksum)");
+    }
+    printf("\n");
+    free(frame_times);
+    return status;
+}
+
+// ============================================================================
+// TRACE EXPORT
+// ============================================================================
+//
+// With MYTERM_TRACE=FILE every frame, command lifecycle step, pipe read and
+// history, find or completion query is written to a ring of fixed-size
+// events in shared anonymous memory. A writer claims a slot with one atomic
+// increment and publishes it by storing its sequence number last, so the I/O
+// reader thread records its reads without locks, and a forked child records
+// its exec() in the same ring just before calling execvp(). When the ring is
+// full the oldest events are overwritten. `trace dump [FILE]` and exit write
+// the ring as Chrome trace JSON, which chrome://tracing and Perfetto load.
+
+static __thread int trace_thread_cache = 0; // This thread's kernel ID (0 until first used)
+
+// Function to map the trace ring; returns 0 or -1
+int start_trace(const char *path)
+{
+    trace_ring = mmap(NULL, sizeof(TraceRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (trace_ring == MAP_FAILED)
+    {
+        trace_ring = NULL;
+        fprintf(stderr, "Error: Cannot map the trace ring: %s\n", strerror(errno));
+        return -1;
+    }
+    snprintf(trace_path, sizeof(trace_path), "%s", path);
+    trace_pid = getpid();
+    trace_ui_thread = (int)syscall(SYS_gettid);
+    printf("Tracing to %s (ring of %d events, written on exit or by `trace dump`)\n", trace_path, TRACE_RING_EVENTS);
+    return 0;
+}
+
+// Function to store one event in the ring (any thread, or a forked child before exec)
+void trace_write(int kind, int thread_id, long long start_us, long long duration_us, long long arg0, long long arg1)
+{
+    if (!trace_ring)
+        return;
+    uint64_t index = atomic_fetch_add_explicit(&trace_ring->next, 1, memory_order_relaxed);
+    TraceEvent *event = &trace_ring->events[index % TRACE_RING_EVENTS];
+
+    // Step 1: Mark the slot as being rewritten, then fill it
+    atomic_store_explicit(&event->sequence, 0, memory_order_release);
+    event->start_us = start_us;
+    event->duration_us = duration_us;
+    event->args[0] = arg0;
+    event->args[1] = arg1;
+    event->thread_id = thread_id;
+    event->kind = (uint16_t)kind;
+
+    // Step 2: Publish it
+    atomic_store_explicit(&event->sequence, index + 1, memory_order_release);
+}
+
+// Function to return the calling thread's kernel ID for trace events
+static int trace_thread_id(void)
+{
+    if (trace_thread_cache == 0)
+        trace_thread_cache = (int)syscall(SYS_gettid);
+    return trace_thread_cache;
+}
+
+// Function to record a point in time
+void trace_instant(int kind, long long arg0, long long arg1)
+{
+    if (trace_ring)
+        trace_write(kind, trace_thread_id(), monotonic_us(), 0, arg0, arg1);
+}
+
+// Function to record a span that began at start_us and ends now
+void trace_complete(int kind, long long start_us, long long arg0, long long arg1)
+{
+    if (!trace_ring)
+        return;
+    long long now = monotonic_us();
+    trace_write(kind, trace_thread_id(), start_us, now - start_us, arg0, arg1);
+}
+
+// Function to record a forked child's exec (the child's thread ID is its PID)
+void trace_exec(void)
+{
+    if (trace_ring)
+        trace_write(TRACE_EXEC, (int)getpid(), monotonic_us(), 0, (long long)getpid(), 0);
+}
+
+// Function to write the ring as Chrome trace JSON; returns the number of events written or -1
+int dump_trace(const char *path)
+{
+    if (!trace_ring)
+        return -1;
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return -1;
+
+    // Step 1: Name the process and the threads the terminal owns
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"myterm\"}}", (int)trace_pid);
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"UI\"}}",
+            (int)trace_pid, trace_ui_thread);
+    int reader_thread = atomic_load(&trace_reader_thread);
+    if (reader_thread)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"I/O reader\"}}",
+                (int)trace_pid, reader_thread);
+
+    // Step 2: Events oldest first; a slot that is rewritten while it is copied is skipped
+    uint64_t next = atomic_load_explicit(&trace_ring->next, memory_order_acquire);
+    uint64_t first = next > TRACE_RING_EVENTS ? next - TRACE_RING_EVENTS : 0;
+    int written = 0;
+    for (uint64_t index = first; index < next; index++)
+    {
+        TraceEvent *slot = &trace_ring->events[index % TRACE_RING_EVENTS];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != index + 1)
+            continue;
+        TraceEvent event;
+        memcpy(&event, slot, sizeof(event));
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != index + 1 || event.kind >= TRACE_KIND_COUNT)
+            continue;
+
+        const TraceKind *kind = &trace_kinds[event.kind];
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,", kind->name,
+                kind->category, (long long)event.start_us, (int)trace_pid, event.thread_id);
+        if (kind->span)
+            fprintf(file, "\"ph\":\"X\",\"dur\":%lld,", (long long)event.duration_us);
+        else
+            fprintf(file, "\"ph\":\"i\",\"s\":\"t\",");
+        fprintf(file, "\"args\":{\"%s\":%lld", kind->arg_names[0], (long long)event.args[0]);
+        if (kind->arg_names[1])
+            fprintf(file, ",\"%s\":%lld", kind->arg_names[1], (long long)event.args[1]);
+        fprintf(file, "}}");
+        written++;
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0)
+        return -1;
+    return written;
+}
+
+// Function to write the trace on exit (forked children never do)
+void finish_trace(void)
+{
+    if (!trace_ring || getpid() != trace_pid)
+        return;
+    int written = dump_trace(trace_path);
+    if (written < 0)
+        printf("Warning: Cannot write trace %s: %s\n", trace_path, strerror(errno));
+    else
+        printf("Trace written to %s (%d events)\n", trace_path, written);
+    munmap(trace_ring, sizeof(TraceRing));
+    trace_ring = NULL;
+}
+
+// Function to handle the 'trace' built-in: show the ring's state or dump it now
+void handle_trace_command(Tab *tab, const char *argument, const char *path)
+{
+    char line[PATH_MAX + 128];
+    if (!trace_ring)
+    {
+        add_text_to_buffer(tab, "trace: tracing is off (start with MYTERM_TRACE=FILE)");
+        return;
+    }
+    if (argument && strcmp(argument, "dump") == 0)
+    {
+        const char *target = path ? path : trace_path;
+        int written = dump_trace(target);
+        if (written < 0)
+            snprintf(line, sizeof(line), "trace: cannot write %s: %s", target, strerror(errno));
+        else
+            snprintf(line, sizeof(line), "Trace written to %s (%d events)", target, written);
+        add_text_to_buffer(tab, line);
+        return;
+    }
+    if (argument)
+    {
+        add_text_to_buffer(tab, "Usage: trace [dump [FILE]]");
+        return;
+    }
+
+    uint64_t recorded = atomic_load(&trace_ring->next);
+    snprintf(line, sizeof(line), "Trace: %llu events recorded, the newest %llu kept; written to %s on exit",
+             (unsigned long long)recorded,
+             (unsigned long long)(recorded < TRACE_RING_EVENTS ? recorded : TRACE_RING_EVENTS), trace_path);
+    add_text_to_buffer(tab, line);
+}
+
+// ============================================================================
+// HARDWARE PERFORMANCE COUNTERS
+// ============================================================================
+//
+// With MYTERM_PERF=1 (or `stats on`) the UI thread opens one perf_event group
+// counting cycles, instructions, cache misses and branch misses in user space.
+// The group runs all the time; each phase (render, parse, search, completion)
+// reads it when it starts and when it ends and adds the difference to its
+// totals, so a phase costs two read() calls and nothing when counting is off.
+// Phases do not nest: work done inside a running phase is charged to it.
+// Counters follow the UI thread only; search workers are not included.
+
+// Function to read the counter group; returns 0 or -1
+static int read_perf_group(unsigned long long *values)
+{
+    struct
+    {
+        uint64_t count;
+        uint64_t values[PERF_COUNTER_COUNT];
+    } group;
+    if (read(perf_group_fd, &group, sizeof(group)) != (ssize_t)sizeof(group) || group.count != PERF_COUNTER_COUNT)
+        return -1;
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+        values[counter] = group.values[counter];
+    return 0;
+}
+
+// Function to open the counter group (no-op if open); returns 0, or -1 with perf_unavailable_reason set
+int start_perf_counters(void)
+{
+    static const uint64_t configs[PERF_COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                         PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    if (perf_group_fd >= 0)
+        return 0;
+
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+    {
+        // Step 1: Count this thread in user space; the first counter leads the group
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = configs[counter];
+        attributes.read_format = PERF_FORMAT_GROUP;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        int fd = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, counter == 0 ? -1 : perf_counter_fds[0],
+                              PERF_FLAG_FD_CLOEXEC);
+
+        // Step 2: Without all four the numbers would not add up; give up on the group
+        if (fd < 0)
+        {
+            snprintf(perf_unavailable_reason, sizeof(perf_unavailable_reason), "%s counter: %s%s",
+                     perf_counter_names[counter], strerror(errno),
+                     errno == EACCES || errno == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" :
+                     errno == ENOENT || errno == EOPNOTSUPP ? " (no hardware PMU, e.g. in a VM)" : "");
+            for (int opened = 0; opened < counter; opened++)
+                close(perf_counter_fds[opened]);
+            return -1;
+        }
+        perf_counter_fds[counter] = fd;
+    }
+
+    perf_group_fd = perf_counter_fds[0];
+    perf_phase_depth = 0;
+    perf_unavailable_reason[0] = '\0';
+    return 0;
+}
+
+// Function to close the counter group (totals are kept)
+void stop_perf_counters(void)
+{
+    if (perf_group_fd < 0)
+        return;
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+        close(perf_counter_fds[counter]);
+    perf_group_fd = -1;
+}
+
+// Function to start charging counter deltas to a phase
+void perf_phase_begin(int phase)
+{
+    if (perf_group_fd < 0 || perf_phase_depth++ > 0)
+        return;
+    perf_current_phase = phase;
+    perf_phase_start_us = monotonic_us();
+    if (read_perf_group(perf_phase_start) != 0)
+        perf_current_phase = -1;
+}
+
+// Function to end the outermost running phase and add its deltas to the totals
+void perf_phase_end(void)
+{
+    if (perf_group_fd < 0 || perf_phase_depth == 0 || --perf_phase_depth > 0 || perf_current_phase < 0)
+        return;
+
+    unsigned long long now[PERF_COUNTER_COUNT];
+    if (read_perf_group(now) != 0)
+        return;
+    PhaseCounters *totals = &phase_counters[perf_current_phase];
+    totals->calls++;
+    totals->wall_us += (unsigned long long)(monotonic_us() - perf_phase_start_us);
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+        totals->counts[counter] += now[counter] - perf_phase_start[counter];
+    perf_current_phase = -1;
+}
+
+// Function to format a phase's totals divided by `divisor` (calls, frames or runs) as one report line
+void format_phase_counters(const PhaseCounters *totals, unsigned long long divisor, char *line, size_t size)
+{
+    if (divisor == 0)
+        divisor = 1;
+    const unsigned long long *counts = totals->counts;
+    snprintf(line, size, "%12.0f %12.0f %5.2f %10.1f %10.1f %9.1f", (double)counts[PERF_CYCLES] / divisor,
+             (double)counts[PERF_INSTRUCTIONS] / divisor,
+             counts[PERF_CYCLES] ? (double)counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES] : 0.0,
+             (double)counts[PERF_CACHE_MISSES] / divisor, (double)counts[PERF_BRANCH_MISSES] / divisor,
+             (double)totals->wall_us / divisor);
+}
+
+// Function to handle the 'stats' built-in: show, start, stop or reset the phase counters
+void handle_stats_command(Tab *tab, const char *argument)
+{
+    char line[256];
+
+    // Step 1: Switch counting on or off, or clear the totals
+    if (argument && strcmp(argument, "on") == 0)
+    {
+        if (start_perf_counters() != 0)
+        {
+            snprintf(line, sizeof(line), "stats: hardware counters unavailable: %s", perf_unavailable_reason);
+            add_text_to_buffer(tab, line);
+            return;
+        }
+    }
+    else if (argument && strcmp(argument, "off") == 0)
+    {
+        stop_perf_counters();
+    }
+    else if (argument && strcmp(argument, "reset") == 0)
+    {
+        memset(phase_counters, 0, sizeof(phase_counters));
+    }
+    else if (argument)
+    {
+        add_text_to_buffer(tab, "Usage: stats [on|off|reset]");
+        return;
+    }
+
+    // Step 2: Per-phase averages (per call)
+    snprintf(line, sizeof(line), "Hardware counters: %s",
+             perf_group_fd >= 0 ? "on (UI thread, user space)" :
+             perf_unavailable_reason[0] ? perf_unavailable_reason : "off (`stats on` or MYTERM_PERF=1)");
+    add_text_to_buffer(tab, line);
+    add_text_to_buffer(tab, "Phase          calls       cycles instructions   IPC cache-miss branch-miss   wall us");
+    for (int phase = 0; phase < PERF_PHASE_COUNT; phase++)
+    {
+        char averages[160];
+        format_phase_counters(&phase_counters[phase], phase_counters[phase].calls, averages, sizeof(averages));
+        snprintf(line, sizeof(line), "%-10s %9llu %s", perf_phase_names[phase], phase_counters[phase].calls,
+                 averages);
+        add_text_to_buffer(tab, line);
+    }
+}
+
+// ============================================================================
+// BENCHMARKS
+// ============================================================================
+//
+// `myterm --bench render` drives fixed workloads through the real frame path
+// (model update, present_frame(), XSync) on whatever display $DISPLAY names -
+// normally a private Xvfb or Xephyr - and reports frames per second, frame
+// time, X requests and bytes per frame, and rows repainted per frame. Each
+// workload runs in a tab of its own, after a warm-up that fills the glyph
+// atlas and frame pixmaps, so the numbers describe steady state.
+
+static char bench_lines[BUFFER_ROWS * (BUFFER_COLS * 4 + 1) + 1]; // One screen of workload text
+static int bench_first_tab = 0;          // Index of the workload's first tab
+
+// Function to count the bytes Xlib hands to the X connection (XESetBeforeFlush hook)
+static void count_sent_bytes(Display *display, XExtCodes *codes, const char *data, long length)
+{
+    (void)display;
+    (void)codes;
+    (void)data;
+    x_bytes_sent += (unsigned long long)length;
+}
+
+// Function to fill bench_lines with one screen of lines cut from a repeating UTF-8 pattern
+static void build_bench_lines(const char *pattern, int line_bytes, int frame)
+{
+    const unsigned char *bytes = (const unsigned char *)pattern;
+    size_t pattern_length = strlen(pattern);
+    size_t length = 0;
+    for (int line = 0; line < BUFFER_ROWS - 2; line++)
+    {
+        // Each line starts elsewhere in the pattern so every row changes every frame
+        size_t position = (size_t)(frame * 7 + line * 13) % pattern_length;
+        while ((bytes[position] & 0xC0) == 0x80)
+            position = (position + 1) % pattern_length;
+
+        // Whole characters only, up to line_bytes per line
+        int line_length = 0;
+        while (1)
+        {
+            size_t sequence = bytes[position] < 0x80 ? 1 : utf8_sequence_length(bytes + position, pattern_length - position);
+            if (sequence == 0 || line_length + (int)sequence > line_bytes)
+                break;
+            memcpy(bench_lines + length, pattern + position, sequence);
+            length += sequence;
+            line_length += (int)sequence;
+            position = (position + sequence) % pattern_length;
+        }
+        bench_lines[length++] = '\n';
+    }
+    bench_lines[length - 1] = '\0';
+}
+
+// Workload: dense printable ASCII, a full screen of new lines per frame
+static void bench_ascii_step(Tab *tab, int frame)
+{
+    build_bench_lines("The quick brown fox jumps over the lazy dog 0123456789 !\"#$%&'()*+,-./:;<=>?@[]^_{|}~",
+                      BUFFER_COLS, frame);
+    add_text_to_buffer(tab, bench_lines);
+}
+
+// Workload: SGR-colored lines (as `ls --color` prints them) with find highlights on every row
+static void bench_color_setup(Tab *tab)
+{
+    enter_find_mode(tab);
+    handle_find_keypress(tab, XK_e, L'e', 0, 0);
+}
+
+static void bench_color_step(Tab *tab, int frame)
+{
+    build_bench_lines("\033[01;34mdirectory\033[0m \033[01;32mexecutable\033[0m \033[31merror: line\033[0m "
+                      "\033[33mwarning\033[0m plain text ",
+                      BUFFER_COLS + 24, frame);
+    add_text_to_buffer(tab, bench_lines);
+}
+
+// Workload: wide and multi-byte characters (CJK, Hangul, accented Latin, symbols)
+static void bench_wide_step(Tab *tab, int frame)
+{
+    build_bench_lines("漢字かなカナ한국어 ÄÖÜäöüßéèêñ ✓✗→←↑↓ 中文输入法 ", BUFFER_COLS * 2, frame);
+    add_text_to_buffer(tab, bench_lines);
+}
+
+// Workload: scrolling up and down through 20,000 lines of scrollback
+static void bench_scroll_setup(Tab *tab)
+{
+    for (int batch = 0; batch < 20000 / (BUFFER_ROWS - 2); batch++)
+    {
+        build_bench_lines("scrollback line with some ordinary log text in it - ", BUFFER_COLS - 8, batch);
+        add_text_to_buffer(tab, bench_lines);
+    }
+}
+
+static void bench_scroll_step(Tab *tab, int frame)
+{
+    if (frame % 200 < 100)
+        scroll_up(tab);
+    else
+        scroll_down(tab);
+}
+
+// Workload: switching between four tabs with different contents every frame
+static void bench_tabs_setup(Tab *tab)
+{
+    bench_ascii_step(tab, 0);
+    for (int extra = 1; extra < 4 && tab_count < MAX_TABS; extra++)
+    {
+        create_new_tab();
+        activate_tab(tab_count - 1);
+        bench_ascii_step(&tabs[tab_count - 1], extra * 31);
+    }
+    activate_tab(bench_first_tab);
+}
+
+static void bench_tabs_step(Tab *tab, int frame)
+{
+    (void)tab;
+    int workload_tabs = tab_count - bench_first_tab;
+    activate_tab(bench_first_tab + (frame + 1) % workload_tabs);
+}
+
+// Workload: full-screen repaints of an unchanged screen (the frame cache is dropped every frame)
+static void bench_repaint_setup(Tab *tab)
+{
+    bench_ascii_step(tab, 0);
+}
+
+static void bench_repaint_step(Tab *tab, int frame)
+{
+    (void)frame;
+    release_frame_pixmap(tab);
+}
+
+static const RenderWorkload render_workloads[] = {
+    {"ascii", "dense ASCII flood", NULL, bench_ascii_step},
+    {"color", "SGR-colored lines, every row highlighted", bench_color_setup, bench_color_step},
+    {"wide", "CJK and other multi-byte text", NULL, bench_wide_step},
+    {"scroll", "scrolling 20,000 lines of scrollback", bench_scroll_setup, bench_scroll_step},
+    {"tabs", "switching between 4 tabs", bench_tabs_setup, bench_tabs_step},
+    {"repaint", "full-screen repaints", bench_repaint_setup, bench_repaint_step},
+};
+#define RENDER_WORKLOAD_COUNT ((int)(sizeof(render_workloads) / sizeof(render_workloads[0])))
+
+// Function to compare frame times for the percentiles
+static int compare_bench_times(const void *left, const void *right)
+{
+    long long a = *(const long long *)left, b = *(const long long *)right;
+    return (a > b) - (a < b);
+}
+
+// Function to format a workload's hardware counters for one phase (empty when not counting)
+static void format_bench_counters(const char *name, int phase, unsigned long long divisor, char *line, size_t size)
+{
+    line[0] = '\0';
+    if (perf_group_fd < 0)
+        return;
+    char averages[160];
+    format_phase_counters(&phase_counters[phase], divisor, averages, sizeof(averages));
+    snprintf(line, size, "%-9s %s", name, averages);
+}
+
+// Function to print the hardware counter table of a benchmark, or why there is none
+static void print_bench_counters(const char *title, char lines[][192], int line_count)
+{
+    if (perf_group_fd < 0)
+    {
+        printf("Hardware counters: unavailable (%s)\n", perf_unavailable_reason);
+        return;
+    }
+    printf("%s\n", title);
+    printf("%-9s %12s %12s %5s %10s %10s %9s\n", "workload", "cycles", "instructions", "IPC", "cache-miss",
+           "branch-miss", "wall us");
+    for (int line = 0; line < line_count; line++)
+        printf("%s\n", lines[line]);
+}
+
+// Function to present one benchmark frame and wait until the server has executed it
+static void present_bench_frame(Display *display, Window window, GC gc)
+{
+    redraw_pending = 0;
+    present_frame(display, window, gc);
+    XSync(display, False);
+    while (XPending(display) > 0)
+    {
+        XEvent event;
+        XNextEvent(display, &event);
+        if (event.type == shm_completion_event_type)
+            shm_put_pending = 0;
+    }
+}
+
+// Function to run one render workload in a fresh tab and format its line of the report
+static void run_render_workload(Display *display, Window window, GC gc, const RenderWorkload *workload,
+                                char *report_line, size_t report_size, char *counter_line, size_t counter_size)
+{
+    static long long frame_times[BENCH_RENDER_FRAMES];
+
+    // Step 1: A tab of its own, set up and warmed up
+    create_new_tab();
+    bench_first_tab = tab_count - 1;
+    activate_tab(bench_first_tab);
+    Tab *tab = &tabs[bench_first_tab];
+    if (workload->setup)
+        workload->setup(tab);
+    for (int frame = 0; frame < BENCH_WARMUP_FRAMES; frame++)
+    {
+        workload->step(&tabs[bench_first_tab], frame);
+        present_bench_frame(display, window, gc);
+    }
+
+    // Step 2: Measured frames (each XSync adds one 4-byte GetInputFocus, subtracted below)
+    unsigned long request_start = XNextRequest(display);
+    unsigned long long bytes_start = x_bytes_sent;
+    unsigned long rows_start = render_stats[active_renderer].damaged_rows;
+    memset(phase_counters, 0, sizeof(phase_counters));
+    long long start_us = monotonic_us();
+    for (int frame = 0; frame < BENCH_RENDER_FRAMES; frame++)
+    {
+        long long frame_start_us = monotonic_us();
+        workload->step(&tabs[active_tab_index], BENCH_WARMUP_FRAMES + frame);
+        present_bench_frame(display, window, gc);
+        frame_times[frame] = monotonic_us() - frame_start_us;
+    }
+    long long elapsed_us = monotonic_us() - start_us;
+    double requests = (double)(XNextRequest(display) - request_start) / BENCH_RENDER_FRAMES - 1.0;
+    unsigned long long bytes = x_bytes_sent - bytes_start;
+    bytes = bytes > 4ULL * BENCH_RENDER_FRAMES ? bytes - 4ULL * BENCH_RENDER_FRAMES : 0;
+    double kilobytes = (double)bytes / BENCH_RENDER_FRAMES / 1024.0;
+    double rows = (double)(render_stats[active_renderer].damaged_rows - rows_start) / BENCH_RENDER_FRAMES;
+
+    qsort(frame_times, BENCH_RENDER_FRAMES, sizeof(long long), compare_bench_times);
+    snprintf(report_line, report_size, "%-8s %10.1f %8.2f %8.2f %10.1f %9.2f %7.1f   %s", workload->name,
+           BENCH_RENDER_FRAMES * 1000000.0 / (elapsed_us > 0 ? elapsed_us : 1),
+           frame_times[BENCH_RENDER_FRAMES / 2] / 1000.0, frame_times[BENCH_RENDER_FRAMES * 99 / 100] / 1000.0,
+           requests, kilobytes, rows, workload->description);
+    format_bench_counters(workload->name, PERF_PHASE_RENDER, BENCH_RENDER_FRAMES, counter_line, counter_size);
+
+    // Step 3: Close the workload's tabs again
+    if (tab->find.active)
+        exit_find_mode(tab);
+    while (tab_count > bench_first_tab)
+    {
+        activate_tab(tab_count - 1);
+        close_current_tab();
+    }
+}
+
+// Function to run the render benchmark (all workloads, or the named ones); returns 0 or 1
+int run_render_benchmark(Display *display, Window window, GC gc, char **names, int name_count)
+{
+    // Step 1: Check the requested workloads before touching the display
+    for (int name_index = 0; name_index < name_count; name_index++)
+    {
+        int known = 0;
+        for (int workload = 0; workload < RENDER_WORKLOAD_COUNT; workload++)
+            known |= strcmp(names[name_index], render_workloads[workload].name) == 0;
+        if (!known)
+        {
+            fprintf(stderr, "Unknown render workload '%s' (available:", names[name_index]);
+            for (int workload = 0; workload < RENDER_WORKLOAD_COUNT; workload++)
+                fprintf(stderr, " %s", render_workloads[workload].name);
+            fprintf(stderr, ")\n");
+            return 1;
+        }
+    }
+    if (MB_CUR_MAX == 1)
+    {
+        printf("Warning: the locale is not UTF-8; the wide workload draws replacement characters\n");
+    }
+
+    // Step 2: Count bytes to the server and wait until the window is mapped
+    XExtCodes *codes = XAddExtension(display);
+    if (codes)
+        XESetBeforeFlush(display, codes->extension, count_sent_bytes);
+    start_perf_counters();
+    long long map_deadline = monotonic_ms() + 2000;
+    XEvent event;
+    while (!XCheckTypedWindowEvent(display, window, Expose, &event) && monotonic_ms() < map_deadline)
+    {
+        usleep(10000);
+    }
+
+    // Step 3: Run the workloads (tab creation logs its own messages, so the report comes last)
+    static char report[RENDER_WORKLOAD_COUNT][192];
+    static char counters[RENDER_WORKLOAD_COUNT][192];
+    int report_count = 0;
+    for (int workload = 0; workload < RENDER_WORKLOAD_COUNT; workload++)
+    {
+        int selected = name_count == 0;
+        for (int name_index = 0; name_index < name_count; name_index++)
+            selected |= strcmp(names[name_index], render_workloads[workload].name) == 0;
+        if (selected)
+        {
+            run_render_workload(display, window, gc, &render_workloads[workload], report[report_count],
+                                sizeof(report[report_count]), counters[report_count], sizeof(counters[report_count]));
+            report_count++;
+        }
+    }
+
+    // Step 4: One line per workload
+    printf("\nRender benchmark: %s renderer, %d frames per workload (after %d warm-up frames), display %s\n",
+           renderer_names[active_renderer], BENCH_RENDER_FRAMES, BENCH_WARMUP_FRAMES, DisplayString(display));
+    printf("%-8s %10s %8s %8s %10s %9s %7s\n", "workload", "frames/s", "p50 ms", "p99 ms", "requests", "KB sent",
+           "rows");
+    for (int line = 0; line < report_count; line++)
+        printf("%s\n", report[line]);
+    printf("(requests, KB sent and rows are per frame)\n");
+    print_bench_counters("Hardware counters per frame (render phase):", counters, report_count);
+    return 0;
+}
+
+// `myterm --bench commands` needs no display: each command goes through
+// handle_enter_key() as if typed, and the UI side of the event loop (poll on
+// the reader's notifications, service_child_io()) runs until the command's
+// block has ended and the prompt is back. That covers fork/exec, the I/O
+// reader, draining into the scrollback and reaping, so a floor on command
+// latency or a drop in ingest throughput shows up in the numbers.
+
+static char bench_cat_path[PATH_MAX];    // File the cat workload prints (removed afterwards)
+
+// Function to write the file the cat workload prints; returns 0 or -1
+static int bench_cat_setup(void)
+{
+    const char *directory = getenv("TMPDIR");
+    snprintf(bench_cat_path, sizeof(bench_cat_path), "%s/myterm-bench-XXXXXX",
+             directory && *directory ? directory : "/tmp");
+    int fd = mkstemp(bench_cat_path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot create %s: %s\n", bench_cat_path, strerror(errno));
+        return -1;
+    }
+
+    // Log-like lines of 100 bytes, written about 1 MB at a time
+    static char chunk[10486 * 100];
+    for (size_t offset = 0; offset < sizeof(chunk); offset += 100)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "%08zu INFO bench: the quick brown fox jumps over the lazy dog, "
+                 "again and again ......................", offset / 100);
+        memcpy(chunk + offset, line, 99);
+        chunk[offset + 99] = '\n';
+    }
+    for (int megabyte = 0; megabyte < BENCH_CAT_MB; megabyte++)
+    {
+        if (write(fd, chunk, sizeof(chunk)) != (ssize_t)sizeof(chunk))
+        {
+            fprintf(stderr, "Error: Cannot write %s: %s\n", bench_cat_path, strerror(errno));
+            close(fd);
+            unlink(bench_cat_path);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static const CommandWorkload command_workloads[] = {
+    {"spawn", "`true`", "true", BENCH_SPAWN_RUNS},
+    {"pipeline", "5-stage pipeline", "echo bench | cat | tr a-z A-Z | cat | wc -c", BENCH_PIPELINE_RUNS},
+    {"cat", "cat of a large log file", NULL, BENCH_CAT_RUNS},
+};
+#define COMMAND_WORKLOAD_COUNT ((int)(sizeof(command_workloads) / sizeof(command_workloads[0])))
+
+// Function to run one command as typed and wait until its block has ended
+static void run_bench_command(Tab *tab, const wchar_t *command)
+{
+    line_editor_set_text(&tab->editor, command);
+    handle_enter_key(NULL, None, NULL, tab);
+
+    // The event loop's wait: reader notifications, or a frame tick while jobs run
+    while (jobs_pending())
+    {
+        struct pollfd wait_fd = {ui_notify_pipe[0], POLLIN, 0};
+        poll(&wait_fd, 1, io_backlog_pending() ? 0 : FRAME_INTERVAL_MS);
+        service_child_io();
+    }
+}
+
+// Function to run one command workload in a fresh tab and format its line of the report
+static void run_command_workload(const CommandWorkload *workload, char *report_line, size_t report_size,
+                                 char *counter_line, size_t counter_size)
+{
+    // Step 1: The command as the line editor holds it
+    char command[PATH_MAX + 8];
+    if (workload->command)
+        snprintf(command, sizeof(command), "%s", workload->command);
+    else
+        snprintf(command, sizeof(command), "cat %s", bench_cat_path);
+    wchar_t wide_command[PATH_MAX + 8];
+    mbstowcs(wide_command, command, PATH_MAX + 8);
+
+    long long *run_times = malloc(sizeof(long long) * (size_t)workload->runs);
+    if (!run_times)
+    {
+        snprintf(report_line, report_size, "%-9s (out of memory)", workload->name);
+        return;
+    }
+
+    // Step 2: A tab of its own; the first runs warm up the page cache and the scrollback
+    create_new_tab();
+    int tab_index = tab_count - 1;
+    activate_tab(tab_index);
+    for (int run = 0; run < BENCH_COMMAND_WARMUP_RUNS; run++)
+        run_bench_command(&tabs[tab_index], wide_command);
+
+    // Step 3: Timed runs, Enter to prompt
+    unsigned long long bytes_start = output_bytes_ingested;
+    memset(phase_counters, 0, sizeof(phase_counters));
+    long long start_us = monotonic_us();
+    for (int run = 0; run < workload->runs; run++)
+    {
+        long long run_start_us = monotonic_us();
+        run_bench_command(&tabs[tab_index], wide_command);
+        run_times[run] = monotonic_us() - run_start_us;
+    }
+    long long elapsed_us = monotonic_us() - start_us;
+    if (elapsed_us <= 0)
+        elapsed_us = 1;
+
+    qsort(run_times, (size_t)workload->runs, sizeof(long long), compare_bench_times);
+    snprintf(report_line, report_size, "%-9s %6d %11.1f %8.2f %8.2f %9.1f   %s", workload->name, workload->runs,
+             workload->runs * 1000000.0 / elapsed_us, run_times[workload->runs / 2] / 1000.0,
+             run_times[workload->runs * 99 / 100] / 1000.0,
+             (output_bytes_ingested - bytes_start) / (elapsed_us / 1000000.0) / (1024.0 * 1024.0),
+             workload->description);
+    format_bench_counters(workload->name, PERF_PHASE_PARSE, (unsigned long long)workload->runs, counter_line,
+                          counter_size);
+    free(run_times);
+
+    // Step 4: Close the workload's tab again
+    activate_tab(tab_index);
+    close_current_tab();
+}
+
+// Function to run the command benchmark (all workloads, or the named ones); returns 0 or 1
+int run_command_benchmark(char **names, int name_count)
+{
+    // Step 1: Check the requested workloads and prepare the cat workload's file
+    int cat_selected = name_count == 0;
+    for (int name_index = 0; name_index < name_count; name_index++)
+    {
+        int known = 0;
+        for (int workload = 0; workload < COMMAND_WORKLOAD_COUNT; workload++)
+            known |= strcmp(names[name_index], command_workloads[workload].name) == 0;
+        if (!known)
+        {
+            fprintf(stderr, "Unknown command workload '%s' (available:", names[name_index]);
+            for (int workload = 0; workload < COMMAND_WORKLOAD_COUNT; workload++)
+                fprintf(stderr, " %s", command_workloads[workload].name);
+            fprintf(stderr, ")\n");
+            return 1;
+        }
+        cat_selected |= strcmp(names[name_index], "cat") == 0;
+    }
+    if (cat_selected && bench_cat_setup() != 0)
+        return 1;
+    start_perf_counters();
+
+    // Step 2: Run the workloads with the per-command log lines sent to /dev/null
+    static char report[COMMAND_WORKLOAD_COUNT][192];
+    static char counters[COMMAND_WORKLOAD_COUNT][192];
+    int report_count = 0;
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (saved_stdout >= 0 && null_fd >= 0)
+        dup2(null_fd, STDOUT_FILENO);
+    for (int workload = 0; workload < COMMAND_WORKLOAD_COUNT; workload++)
+    {
+        int selected = name_count == 0;
+        for (int name_index = 0; name_index < name_count; name_index++)
+            selected |= strcmp(names[name_index], command_workloads[workload].name) == 0;
+        if (selected)
+        {
+            run_command_workload(&command_workloads[workload], report[report_count], sizeof(report[report_count]),
+                                 counters[report_count], sizeof(counters[report_count]));
+            report_count++;
+        }
+    }
+    fflush(stdout);
+    if (saved_stdout >= 0 && null_fd >= 0)
+        dup2(saved_stdout, STDOUT_FILENO);
+    if (null_fd >= 0)
+        close(null_fd);
+    if (saved_stdout >= 0)
+        close(saved_stdout);
+    if (cat_selected)
+        unlink(bench_cat_path);
+
+    // Step 3: One line per workload
+    printf("\nCommand benchmark: %d warm-up runs per workload, time from Enter until the prompt is back, "
+           "cat file %d MB\n", BENCH_COMMAND_WARMUP_RUNS, BENCH_CAT_MB);
+    printf("%-9s %6s %11s %8s %8s %9s\n", "workload", "runs", "commands/s", "p50 ms", "p99 ms", "MB/s in");
+    for (int line = 0; line < report_count; line++)
+        printf("%s\n", report[line]);
+    print_bench_counters("Hardware counters per run (parse phase: output split into lines and stored):", counters,
+                         report_count);
+    return 0;
+}
+
+// ============================================================================
+// GAP-BUFFER LINE EDITOR
+// ============================================================================
+
+// Function to compute the number of characters stored in the editor
+size_t line_editor_length(const LineEditor *editor)
+{
+    return editor->capacity - (editor->gap_end - editor->gap_start);
+}
+
+// Function to read the character at a logical position (ignoring the gap)
+wchar_t line_editor_char_at(const LineEditor *editor, size_t index)
+{
+    if (index < editor->gap_start)
+        return editor->text[index];
+    return editor->text[index + (editor->gap_end - editor->gap_start)];
+}
+
+// Function to move the gap so it starts at a logical position
+static void line_editor_move_gap(LineEditor *editor, size_t position)
+{
+    size_t gap_length = editor->gap_end - editor->gap_start;
+
+    if (position < editor->gap_start)
+    {
+        // Shift the characters between position and the gap to the far side of the gap
+        size_t count = editor->gap_start - position;
+        memmove(editor->text + position + gap_length, editor->text + position, count * sizeof(wchar_t));
+    }
+    else if (position > editor->gap_start)
+    {
+        // Pull the characters after the gap back in front of it
+        size_t count = position - editor->gap_start;
+        memmove(editor->text + editor->gap_start, editor->text + editor->gap_end, count * sizeof(wchar_t));
+    }
+
+    editor->gap_start = position;
+    editor->gap_end = position + gap_length;
+}
+
+// Function to make sure the gap can take 'needed' more characters; returns -1 on failure
+static int line_editor_reserve(LineEditor *editor, size_t needed)
+{
+    size_t gap_length = editor->gap_end - editor->gap_start;
+    if (gap_length >= needed)
+        return 0;
+
+    // Step 1: Double the capacity until the request fits (amortized O(1) insertion)
+    size_t length = line_editor_length(editor);
+    size_t new_capacity = editor->capacity ? editor->capacity : LINE_EDITOR_INITIAL_CAPACITY;
+    while (new_capacity - length < needed)
+    {
+        new_capacity *= 2;
+    }
+
+    wchar_t *new_text = realloc(editor->text, new_capacity * sizeof(wchar_t));
+    if (!new_text)
+    {
+        printf("Error: Out of memory growing the line editor to %zu characters\n", new_capacity);
+        return -1;
+    }
+
+    // Step 2: Move the text after the gap to the end of the larger buffer
+    size_t tail_length = editor->capacity - editor->gap_end;
+    memmove(new_text + new_capacity - tail_length, new_text + editor->gap_end, tail_length * sizeof(wchar_t));
+
+    editor->text = new_text;
+    editor->gap_end = new_capacity - tail_length;
+    editor->capacity = new_capacity;
+    return 0;
+}
+
+// Function to release the editor's storage (a zeroed editor is a valid empty one)
+void line_editor_free(LineEditor *editor)
+{
+    free(editor->text);
+    memset(editor, 0, sizeof(*editor));
+}
+
+// Function to empty the editor while keeping its storage for the next line
+void line_editor_clear(LineEditor *editor)
+{
+    editor->gap_start = 0;
+    editor->gap_end = editor->capacity;
+    editor->cursor = 0;
+}
+
+// Function to insert text at the cursor and advance the cursor past it
+int line_editor_insert(LineEditor *editor, const wchar_t *text, size_t count)
+{
+    if (count == 0)
+        return 0;
+    if (line_editor_reserve(editor, count) != 0)
+        return -1;
+
+    // The gap only moves when the cursor moved since the last edit
+    line_editor_move_gap(editor, editor->cursor);
+    memcpy(editor->text + editor->gap_start, text, count * sizeof(wchar_t));
+    editor->gap_start += count;
+    editor->cursor += count;
+    return 0;
+}
+
+// Function to delete 'count' characters starting at a logical position
+void line_editor_delete(LineEditor *editor, size_t start, size_t count)
+{
+    size_t length = line_editor_length(editor);
+    if (start >= length || count == 0)
+        return;
+    if (count > length - start)
+        count = length - start;
+
+    // Deleting is just widening the gap over the removed characters
+    line_editor_move_gap(editor, start);
+    editor->gap_end += count;
+
+    if (editor->cursor > start + count)
+        editor->cursor -= count;
+    else if (editor->cursor > start)
+        editor->cursor = start;
+}
+
+// Function to delete the character before the cursor; returns 1 if one was deleted
+int line_editor_backspace(LineEditor *editor)
+{
+    if (editor->cursor == 0)
+        return 0;
+    line_editor_delete(editor, editor->cursor - 1, 1);
+    return 1;
+}
+
+// Function to place the cursor (clamped to the text); O(1), the gap follows lazily
+void line_editor_set_cursor(LineEditor *editor, size_t position)
+{
+    size_t length = line_editor_length(editor);
+    editor->cursor = position > length ? length : position;
+}
+
+// Function to replace the whole text (history recall, search results)
+int line_editor_set_text(LineEditor *editor, const wchar_t *text)
+{
+    line_editor_clear(editor);
+    if (!text)
+        return 0;
+    return line_editor_insert(editor, text, wcslen(text));
+}
+
+// Function to get the text as one NUL-terminated string (valid until the next edit)
+const wchar_t *line_editor_contents(LineEditor *editor)
+{
+    // Step 1: Make sure there is room for the terminator inside the gap
+    if (line_editor_reserve(editor, 1) != 0)
+        return L"";
+
+    // Step 2: Close the gap at the end of the text and terminate it there
+    size_t length = line_editor_length(editor);
+    line_editor_move_gap(editor, length);
+    editor->text[length] = L'\0';
+    return editor->text;
+}
+
+// Function to find the start of the logical line (after the previous newline) containing a position
+size_t line_editor_line_start(const LineEditor *editor, size_t position)
+{
+    while (position > 0 && line_editor_char_at(editor, position - 1) != L'\n')
+    {
+        position--;
+    }
+    return position;
+}
+
+// Function to find the end of the logical line (at the next newline) containing a position
+size_t line_editor_line_end(const LineEditor *editor, size_t position)
+{
+    size_t length = line_editor_length(editor);
+    while (position < length && line_editor_char_at(editor, position) != L'\n')
+    {
+        position++;
+    }
+    return position;
+}
+
+// Function to find the start of the word before the cursor (Ctrl+Left / Alt+B)
+size_t line_editor_word_left(const LineEditor *editor)
+{
+    size_t position = editor->cursor;
+
+    // Skip separators, then the word itself
+    while (position > 0 && !iswalnum(line_editor_char_at(editor, position - 1)))
+        position--;
+    while (position > 0 && iswalnum(line_editor_char_at(editor, position - 1)))
+        position--;
+    return position;
+}
+
+// Function to find the end of the word after the cursor (Ctrl+Right / Alt+F)
+size_t line_editor_word_right(const LineEditor *editor)
+{
+    size_t length = line_editor_length(editor);
+    size_t position = editor->cursor;
+
+    while (position < length && !iswalnum(line_editor_char_at(editor, position)))
+        position++;
+    while (position < length && iswalnum(line_editor_char_at(editor, position)))
+        position++;
+    return position;
+}
+
+// Function to convert wide text to a newly allocated UTF-8 string (caller frees)
+char *wide_to_utf8(const wchar_t *text, size_t length)
+{
+    char *utf8_text = malloc(length * MB_CUR_MAX + 1);
+    if (!utf8_text)
+        return NULL;
+
+    mbstate_t conversion_state;
+    memset(&conversion_state, 0, sizeof(conversion_state));
+    size_t written = 0;
+
+    for (size_t index = 0; index < length; index++)
+    {
+        size_t bytes = wcrtomb(utf8_text + written, text[index], &conversion_state);
+        if (bytes == (size_t)-1)
+        {
+            // Character has no encoding in this locale - keep a placeholder
+            utf8_text[written++] = '?';
+            memset(&conversion_state, 0, sizeof(conversion_state));
+            continue;
+        }
+        written += bytes;
+    }
+    utf8_text[written] = '\0';
+    return utf8_text;
+}
+
+// Function to convert the whole line to UTF-8 exactly once (at Enter); newlines of
+// multi-line input become spaces when join_lines is set. Caller frees.
+char *line_editor_to_utf8(LineEditor *editor, int join_lines)
+{
+    size_t length = line_editor_length(editor);
+    char *utf8_text = wide_to_utf8(line_editor_contents(editor), length);
+    if (utf8_text && join_lines)
+    {
+        for (char *character = utf8_text; *character; character++)
+        {
+            if (*character == '\n')
+                *character = ' ';
+        }
+    }
+    return utf8_text;
+}
+
+// ============================================================================
+// X SELECTION PASTE
+// ============================================================================
+
+// Function to ask the selection owner for its contents; the data arrives later as
+// SelectionNotify (and PropertyNotify chunks for INCR transfers) in the event loop
+void request_paste(Display *display, Window window, Tab *tab, Atom selection, Time request_time)
+{
+    if (selection == None || paste_property_atom == None)
+    {
+        add_text_to_buffer(tab, "Error: Paste is not available (selection atoms missing)");
+        return;
+    }
+
+    // Step 1: A new paste replaces any transfer that never completed
+    if (paste_transfer.active)
+    {
+        printf("Paste: abandoning unfinished transfer of %zu bytes\n", paste_transfer.length);
+    }
+    paste_transfer.active = 1;
+    paste_transfer.incr = 0;
+    paste_transfer.selection = selection;
+    paste_transfer.target = utf8_string_atom != None ? utf8_string_atom : XA_STRING;
+    paste_transfer.tab_id = tab->tab_id;
+    paste_transfer.length = 0;
+    paste_transfer.start_us = monotonic_us();
+
+    // Step 2: Listen for property changes before the owner can start an INCR transfer
+    XSelectInput(display, window, WINDOW_EVENT_MASK | PropertyChangeMask);
+
+    // Step 3: Ask for UTF-8 text delivered into our paste property
+    XConvertSelection(display, selection, paste_transfer.target, paste_property_atom, window, request_time);
+}
+
+// Function to append received selection bytes to the transfer buffer
+static int append_paste_data(const unsigned char *data, size_t length)
+{
+    if (paste_transfer.length + length > PASTE_MAX_BYTES)
+    {
+        return -1;
+    }
+
+    if (paste_transfer.length + length > paste_transfer.capacity)
+    {
+        // Grow geometrically so an INCR transfer of many chunks stays linear
+        size_t new_capacity = paste_transfer.capacity ? paste_transfer.capacity : PASTE_CHUNK_BYTES;
+        while (new_capacity < paste_transfer.length + length)
+        {
+            new_capacity *= 2;
+        }
+        char *new_data = realloc(paste_transfer.data, new_capacity);
+        if (!new_data)
+        {
+            return -1;
+        }
+        paste_transfer.data = new_data;
+        paste_transfer.capacity = new_capacity;
+    }
+
+    memcpy(paste_transfer.data + paste_transfer.length, data, length);
+    paste_transfer.length += length;
+    return 0;
+}
+
+// Function to read and delete the whole paste property in one request.
+// Returns the property type (None if missing) and the number of bytes read.
+static Atom read_paste_property(Display *display, Window window, size_t *bytes_read, int *failed)
+{
+    Atom actual_type = None;
+    int actual_format = 0;
+    unsigned long item_count = 0;
+    unsigned long bytes_after = 0;
+    unsigned char *property_data = NULL;
+
+    *bytes_read = 0;
+    *failed = 0;
+
+    // Ask for everything at once (replies are not bound by the request size limit);
+    // deleting the property tells an INCR owner to send the next chunk
+    int status = XGetWindowProperty(display, window, paste_property_atom, 0, PASTE_MAX_BYTES / 4, True,
+                                    AnyPropertyType, &actual_type, &actual_format, &item_count,
+                                    &bytes_after, &property_data);
+    x_round_trips++;
+    if (status != Success)
+    {
+        *failed = 1;
+        return None;
+    }
+
+    if (actual_type != None && actual_type != incr_atom && actual_format == 8 && item_count > 0)
+    {
+        if (bytes_after > 0 || append_paste_data(property_data, item_count) != 0)
+        {
+            *failed = 1;
+        }
+        *bytes_read = item_count;
+    }
+
+    if (property_data)
+    {
+        XFree(property_data);
+    }
+    return actual_type;
+}
+
+// Function to check whether an outgoing INCR transfer other than except still writes to a window
+static int selection_transfer_watches(Window window, const SelectionTransfer *except)
+{
+    for (int slot = 0; slot < MAX_SELECTION_TRANSFERS; slot++)
+    {
+        const SelectionTransfer *transfer = &selection_transfers[slot];
+        if (transfer != except && transfer->active && transfer->incr && transfer->requestor == window)
+            return 1;
+    }
+    return 0;
+}
+
+// Function to end the current transfer and stop listening for property changes
+static void end_paste_transfer(Display *display, Window window)
+{
+    paste_transfer.active = 0;
+    paste_transfer.incr = 0;
+    // A transfer we are serving to ourselves still needs the property deletions
+    XSelectInput(display, window,
+                 WINDOW_EVENT_MASK | (selection_transfer_watches(window, NULL) ? PropertyChangeMask : NoEventMask));
+
+    // Large buffers are not kept around between pastes
+    if (paste_transfer.capacity > PASTE_CHUNK_BYTES)
+    {
+        free(paste_transfer.data);
+        paste_transfer.data = NULL;
+        paste_transfer.capacity = 0;
+    }
+    paste_transfer.length = 0;
+}
+
+// Function to hand the completed transfer to its tab
+static void finish_paste(Display *display, Window window)
+{
+    Tab *tab = find_tab_by_id(paste_transfer.tab_id);
+    if (tab != NULL && attach_server.fd >= 0)
+    {
+        // The command line lives in the server; send the text there as one message
+        forward_paste(paste_transfer.data, paste_transfer.length, paste_transfer.target == XA_STRING);
+    }
+    else if (tab != NULL)
+    {
+        long long decode_start_us = monotonic_us();
+        size_t inserted = insert_pasted_text(tab, paste_transfer.data, paste_transfer.length,
+                                             paste_transfer.target == XA_STRING);
+        long long finish_us = monotonic_us();
+        printf("Paste: %zu bytes -> %zu characters (%s, transfer %.2f ms, insert %.2f ms)\n",
+               paste_transfer.length, inserted, paste_transfer.incr ? "INCR" : "single reply",
+               (decode_start_us - paste_transfer.start_us) / 1000.0,
+               (finish_us - decode_start_us) / 1000.0);
+    }
+    end_paste_transfer(display, window);
+}
+
+// Function to handle the owner's answer to XConvertSelection; returns 1 if the screen changed
+int handle_selection_notify(Display *display, Window window, XSelectionEvent *selection_event)
+{
+    if (!paste_transfer.active || selection_event->selection != paste_transfer.selection)
+    {
+        return 0;
+    }
+
+    // Step 1: Owner refused the conversion - retry once as Latin-1 STRING, else give up
+    if (selection_event->property == None)
+    {
+        if (paste_transfer.target != XA_STRING)
+        {
+            paste_transfer.target = XA_STRING;
+            XConvertSelection(display, paste_transfer.selection, XA_STRING, paste_property_atom,
+                              window, selection_event->time);
+            return 0;
+        }
+        printf("Paste: selection is empty or has no text\n");
+        end_paste_transfer(display, window);
+        return 0;
+    }
+
+    // Step 2: Read the property; a plain reply carries the whole selection
+    size_t bytes_read = 0;
+    int failed = 0;
+    Atom property_type = read_paste_property(display, window, &bytes_read, &failed);
+
+    if (!failed && property_type == incr_atom)
+    {
+        // Step 3: Large selection - the owner now streams chunks (deleting the INCR
+        // property above was the go-ahead); PropertyNotify delivers each one
+        paste_transfer.incr = 1;
+        printf("Paste: INCR transfer started\n");
+        return 0;
+    }
+
+    Tab *tab = find_tab_by_id(paste_transfer.tab_id);
+    if (failed)
+    {
+        if (tab)
+            add_text_to_buffer(tab, "Error: Paste failed (selection too large or unreadable)");
+        end_paste_transfer(display, window);
+        return 1;
+    }
+
+    finish_paste(display, window);
+    return 1;
+}
+
+// Function to collect one INCR chunk; returns 1 if the transfer completed
+int handle_paste_property(Display *display, Window window, XPropertyEvent *property_event)
+{
+    if (!paste_transfer.active || !paste_transfer.incr ||
+        property_event->atom != paste_property_atom || property_event->state != PropertyNewValue)
+    {
+        return 0;
+    }
+
+    size_t bytes_read = 0;
+    int failed = 0;
+    read_paste_property(display, window, &bytes_read, &failed);
+
+    if (failed)
+    {
+        Tab *tab = find_tab_by_id(paste_transfer.tab_id);
+        if (tab)
+            add_text_to_buffer(tab, "Error: Paste failed (selection too large or unreadable)");
+        end_paste_transfer(display, window);
+        return 1;
+    }
+
+    // A zero-length chunk marks the end of an INCR transfer
+    if (bytes_read == 0)
+    {
+        finish_paste(display, window);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to decode a paste and insert it into the tab's editor (see insert_pasted_text)
+static size_t apply_pasted_text(Tab *tab, const char *text, size_t length, int latin1)
+{
+    // Step 1: Decode the whole paste once into a temporary wide buffer
+    wchar_t *wide_text = malloc((length + 1) * sizeof(wchar_t));
+    if (!wide_text)
+    {
+        add_text_to_buffer(tab, "Error: Out of memory while pasting");
+        return 0;
+    }
+
+    mbstate_t conversion_state;
+    memset(&conversion_state, 0, sizeof(conversion_state));
+    size_t wide_length = 0;
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        wchar_t character;
+        size_t consumed = 1;
+
+        if (latin1 || (unsigned char)text[offset] < 0x80)
+        {
+            // Latin-1 and ASCII bytes map straight to characters (skips mbrtowc for most text)
+            character = (unsigned char)text[offset];
+        }
+        else
+        {
+            consumed = mbrtowc(&character, text + offset, length - offset, &conversion_state);
+            if (consumed == (size_t)-1 || consumed == (size_t)-2)
+            {
+                // Invalid or truncated sequence - substitute and resynchronize
+                character = L'?';
+                consumed = 1;
+                memset(&conversion_state, 0, sizeof(conversion_state));
+            }
+            else if (consumed == 0)
+            {
+                // Embedded NUL
+                consumed = 1;
+                continue;
+            }
+        }
+        offset += consumed;
+
+        // Step 2: Normalize line breaks and drop control characters (no escape injection)
+        if (character == L'\r')
+        {
+            if (offset < length && text[offset] == '\n')
+                continue;               // CRLF - the LF adds the newline
+            character = L'\n';
+        }
+        if (character == L'\t')
+            character = L' ';
+        if (character != L'\n' && (character < 0x20 || character == 0x7f))
+            continue;
+
+        wide_text[wide_length++] = character;
+    }
+
+    // A trailing line break would look like Enter - bracketed paste never executes
+    while (wide_length > 0 && wide_text[wide_length - 1] == L'\n')
+    {
+        wide_length--;
+    }
+
+    // Step 3: One batched insertion and one display update for the whole paste
+    if (tab->search_mode)
+    {
+        // The search term is a single line
+        for (size_t index = 0; index < wide_length; index++)
+        {
+            if (wide_text[index] == L'\n')
+                wide_text[index] = L' ';
+        }
+        line_editor_insert(&tab->search_buffer, wide_text, wide_length);
+        refresh_search_prompt(tab);
+    }
+    else if (line_editor_insert(&tab->editor, wide_text, wide_length) == 0)
+    {
+        update_command_display(tab);
+    }
+    else
+    {
+        add_text_to_buffer(tab, "Error: Out of memory while pasting");
+        wide_length = 0;
+    }
+
+    free(wide_text);
+    redraw_pending = 1;
+    return wide_length;
+}
+
+// Function to insert pasted bytes into the tab's editor as one edit (bracketed-paste
+// semantics: line breaks become editor newlines and never execute, control characters
+// are dropped). Returns the number of characters inserted.
+size_t insert_pasted_text(Tab *tab, const char *text, size_t length, int latin1)
+{
+    RecordTabPayload paste = {tab->tab_id, latin1 ? 1 : 0};
+    record_input(RECORD_PASTE, &paste, sizeof(paste), text, length);
+
+    recording_input_depth++;
+    size_t inserted = apply_pasted_text(tab, text, length, latin1);
+    recording_input_depth--;
+    return inserted;
+}
+
+// ============================================================================
+// MOUSE SELECTION AND COPY
+// ============================================================================
+
+// Function to find the scrollback line of a tab shown on grid row 0
+int scrollback_view_start(Tab *tab)
+{
+    int visible_content_lines = BUFFER_ROWS - 2; // Command prompt + empty bottom row
+    int display_count = scrollback_display_count(tab);
+    int start_display_line = display_count - visible_content_lines - tab->scrollback_offset;
+
+    // Ensure start line stays within valid bounds
+    if (start_display_line > display_count - visible_content_lines)
+        start_display_line = display_count - visible_content_lines;
+    if (start_display_line < 0)
+        start_display_line = 0;
+    return start_display_line;
+}
+
+// Function to get a scrollback line by absolute number (NULL once it has scrolled out)
+const wchar_t *scrollback_line_at(Tab *tab, unsigned long line)
+{
+    if (line < tab->scrollback_first_line)
+        return NULL;
+    unsigned long index = line - tab->scrollback_first_line;
+    if (index >= (unsigned long)tab->scrollback_count)
+        return NULL;
+    return scrollback_line(tab, (int)index);
+}
+
+// Function to map a pointer position to an absolute scrollback line and column.
+// Rows past the content are clamped to the last line; returns 0 if there is no content.
+static int pointer_to_cell(Tab *tab, int x, int y, unsigned long *line, int *col)
+{
+    if (tab->scrollback_count == 0)
+        return 0;
+
+    // Grid row r is drawn in the band starting at r * CHAR_HEIGHT + FRAME_ROW_TOP_PAD
+    int row = (y - FRAME_ROW_TOP_PAD) / CHAR_HEIGHT;
+    int column = x / CHAR_WIDTH;
+    int view_start = scrollback_view_start(tab);
+    int last_row = scrollback_display_count(tab) - view_start - 1;
+    if (last_row > BUFFER_ROWS - 3)
+        last_row = BUFFER_ROWS - 3;
+
+    if (row < 0)
+        row = 0;
+    if (row > last_row)
+    {
+        // Below the content - select through the end of the last line
+        row = last_row;
+        column = BUFFER_COLS - 1;
+    }
+    if (column < 0)
+        column = 0;
+    if (column > BUFFER_COLS - 1)
+        column = BUFFER_COLS - 1;
+
+    *line = tab->scrollback_first_line + scrollback_row_index(tab, row);
+    *col = column;
+    return 1;
+}
+
+// Function to decide which characters belong to a double-click word
+static int is_word_character(wchar_t character)
+{
+    return iswalnum(character) || (character != L'\0' && wcschr(L"-_./~:@+%", character) != NULL);
+}
+
+// Function to compute the normalized range covered by the mouse selection
+int get_selection_range(SelectionRange *range)
+{
+    range->tab_id = 0;
+    Tab *tab = find_tab_by_id(mouse_selection.tab_id);
+    if (!tab)
+        return 0;
+
+    // Step 1: Order the two ends
+    unsigned long start_line = mouse_selection.anchor_line;
+    int start_col = mouse_selection.anchor_col;
+    unsigned long end_line = mouse_selection.head_line;
+    int end_col = mouse_selection.head_col;
+    if (end_line < start_line || (end_line == start_line && end_col < start_col))
+    {
+        start_line = mouse_selection.head_line;
+        start_col = mouse_selection.head_col;
+        end_line = mouse_selection.anchor_line;
+        end_col = mouse_selection.anchor_col;
+    }
+
+    // Step 2: Expand to whole words or lines for double and triple clicks
+    if (mouse_selection.mode == SELECT_LINES)
+    {
+        start_col = 0;
+        end_col = BUFFER_COLS;
+    }
+    else
+    {
+        if (mouse_selection.mode == SELECT_WORDS)
+        {
+            const wchar_t *text = scrollback_line_at(tab, start_line);
+            if (text && is_word_character(text[start_col]))
+            {
+                while (start_col > 0 && is_word_character(text[start_col - 1]))
+                    start_col--;
+            }
+            text = scrollback_line_at(tab, end_line);
+            if (text && is_word_character(text[end_col]))
+            {
+                while (end_col < BUFFER_COLS - 1 && is_word_character(text[end_col + 1]))
+                    end_col++;
+            }
+        }
+        else if (start_line == end_line && start_col == end_col)
+        {
+            return 0; // A plain click selects nothing
+        }
+        end_col++; // Inclusive cell -> exclusive column
+    }
+
+    range->tab_id = tab->tab_id;
+    range->start_line = start_line;
+    range->start_col = start_col;
+    range->end_line = end_line;
+    range->end_col = end_col;
+    return 1;
+}
+
+// Function to find the selected columns [start_col, end_col) of a visible grid row
+void selection_row_span(Tab *tab, int row, int *start_col, int *end_col)
+{
+    *start_col = 0;
+    *end_col = 0;
+
+    SelectionRange range;
+    if (row >= BUFFER_ROWS - 2 || mouse_selection.tab_id != tab->tab_id || !get_selection_range(&range))
+        return;
+
+    int index = scrollback_row_index(tab, row);
+    if (index < 0)
+        return;
+
+    unsigned long line = tab->scrollback_first_line + index;
+    if (line < range.start_line || line > range.end_line)
+        return;
+
+    *start_col = (line == range.start_line) ? range.start_col : 0;
+    *end_col = (line == range.end_line) ? range.end_col : BUFFER_COLS;
+}
+
+// Function to drop the mouse selection (and PRIMARY ownership if we hold it)
+void clear_mouse_selection(Display *display, Time time)
+{
+    if (mouse_selection.tab_id != 0)
+        redraw_pending = 1;
+    mouse_selection.tab_id = 0;
+    mouse_selection.dragging = 0;
+
+    if (mouse_selection.owned && display)
+    {
+        XSetSelectionOwner(display, XA_PRIMARY, None, time);
+    }
+    mouse_selection.owned = 0;
+}
+
+// Function to start a selection on button 1 (click, double-click word, triple-click line)
+void handle_selection_press(Display *display, XButtonEvent *button_event)
+{
+    Tab *tab = &tabs[active_tab_index];
+    unsigned long line;
+    int col;
+
+    if (!pointer_to_cell(tab, button_event->x, button_event->y, &line, &col))
+    {
+        clear_mouse_selection(display, button_event->time);
+        return;
+    }
+
+    // Step 1: Count clicks on the same cell in quick succession
+    if (button_event->time - mouse_selection.last_click_time < MULTI_CLICK_MS &&
+        line == mouse_selection.last_click_line && col == mouse_selection.last_click_col)
+    {
+        mouse_selection.click_count = mouse_selection.click_count % 3 + 1;
+    }
+    else
+    {
+        mouse_selection.click_count = 1;
+    }
+    mouse_selection.last_click_time = button_event->time;
+    mouse_selection.last_click_line = line;
+    mouse_selection.last_click_col = col;
+
+    // Step 2: Anchor the selection; only its two ends are stored, never the text
+    mouse_selection.tab_id = tab->tab_id;
+    mouse_selection.anchor_line = mouse_selection.head_line = line;
+    mouse_selection.anchor_col = mouse_selection.head_col = col;
+    mouse_selection.mode = mouse_selection.click_count == 3 ? SELECT_LINES :
+                           mouse_selection.click_count == 2 ? SELECT_WORDS : SELECT_CHARS;
+    mouse_selection.dragging = 1;
+    redraw_pending = 1;
+}
+
+// Function to extend the selection while button 1 is held; scrolls at the edges
+void handle_selection_motion(XMotionEvent *motion_event)
+{
+    Tab *tab = &tabs[active_tab_index];
+    if (!mouse_selection.dragging || mouse_selection.tab_id != tab->tab_id)
+        return;
+
+    // Dragging past the top or bottom of the content scrolls by one line per event
+    int row = (motion_event->y - FRAME_ROW_TOP_PAD) / CHAR_HEIGHT;
+    if (motion_event->y < CHAR_HEIGHT)
+        scroll_up(tab);
+    else if (row >= BUFFER_ROWS - 2 && tab->scrollback_offset > 0)
+        scroll_down(tab);
+
+    unsigned long line;
+    int col;
+    if (pointer_to_cell(tab, motion_event->x, motion_event->y, &line, &col))
+    {
+        mouse_selection.head_line = line;
+        mouse_selection.head_col = col;
+        redraw_pending = 1;
+    }
+}
+
+// Function to finish a drag and claim PRIMARY - O(1), the text is produced on request
+void handle_selection_release(Display *display, Window window, XButtonEvent *button_event)
+{
+    if (!mouse_selection.dragging)
+        return;
+    mouse_selection.dragging = 0;
+
+    SelectionRange range;
+    if (!get_selection_range(&range))
+    {
+        clear_mouse_selection(display, button_event->time);
+        return;
+    }
+
+    XSetSelectionOwner(display, XA_PRIMARY, window, button_event->time);
+    mouse_selection.owned = 1;
+    printf("Selection: lines %lu-%lu owned as PRIMARY\n", range.start_line, range.end_line);
+}
+
+// Function to copy the current selection to CLIPBOARD (Ctrl+Shift+C) - only the range is kept
+void copy_selection_to_clipboard(Display *display, Window window, Tab *tab, Time time)
+{
+    if (!get_selection_range(&clipboard_range))
+    {
+        add_text_to_buffer(tab, "Nothing selected to copy");
+        return;
+    }
+    XSetSelectionOwner(display, clipboard_atom, window, time);
+}
+
+// Function to append the UTF-8 (or Latin-1) text of a range to a buffer, starting at
+// *next_line and stopping before a line that might not fit. Advances *next_line.
+size_t extract_selection_text(const SelectionRange *range, unsigned long *next_line,
+                              char *output, size_t capacity, int latin1)
+{
+    Tab *tab = find_tab_by_id(range->tab_id);
+    size_t written = 0;
+    size_t line_limit = BUFFER_COLS * MB_CUR_MAX + 1;
+
+    if (!tab)
+    {
+        *next_line = range->end_line + 1;
+        return 0;
+    }
+
+    // Lines that scrolled out of the scrollback since the selection was made are skipped
+    if (*next_line < tab->scrollback_first_line)
+        *next_line = tab->scrollback_first_line;
+
+    while (*next_line <= range->end_line && capacity - written >= line_limit)
+    {
+        unsigned long line = *next_line;
+        wchar_t text[BUFFER_COLS];       // Decoded here so a long selection does not flush the line cache
+        if (line - tab->scrollback_first_line >= (unsigned long)tab->scrollback_count)
+        {
+            *next_line = range->end_line + 1;
+            break;
+        }
+        scrollback_decode_line(tab, (int)(line - tab->scrollback_first_line), text);
+
+        // Step 1: Clip the line to the selected columns and drop trailing blanks
+        int first = (line == range->start_line) ? range->start_col : 0;
+        int last = (line == range->end_line) ? range->end_col : BUFFER_COLS;
+        int length = wcsnlen(text, BUFFER_COLS);
+        if (last > length)
+            last = length;
+        while (last > first && text[last - 1] == L' ')
+            last--;
+
+        // Step 2: Encode the characters straight into the output
+        mbstate_t conversion_state;
+        memset(&conversion_state, 0, sizeof(conversion_state));
+        for (int col = first; col < last; col++)
+        {
+            if (latin1)
+            {
+                output[written++] = text[col] < 256 ? (char)text[col] : '?';
+                continue;
+            }
+            size_t bytes = wcrtomb(output + written, text[col], &conversion_state);
+            if (bytes == (size_t)-1)
+            {
+                output[written++] = '?';
+                memset(&conversion_state, 0, sizeof(conversion_state));
+            }
+            else
+            {
+                written += bytes;
+            }
+        }
+
+        // Lines are separated, not terminated, by newlines
+        if (line != range->end_line)
+            output[written++] = '\n';
+        (*next_line)++;
+    }
+    return written;
+}
+
+// Function to fill the next chunk of an outgoing transfer
+static void refill_selection_transfer(SelectionTransfer *transfer)
+{
+    transfer->chunk_length = extract_selection_text(&transfer->range, &transfer->next_line,
+                                                    transfer->chunk, SELECTION_CHUNK_BYTES,
+                                                    transfer->latin1);
+}
+
+// Function to end an outgoing transfer and stop watching the requestor's window (our own
+// window keeps its normal events, and property changes while a paste or another transfer needs them)
+static void end_selection_transfer(Display *display, SelectionTransfer *transfer)
+{
+    if (transfer->incr)
+    {
+        long mask = selection_transfer_watches(transfer->requestor, transfer) ? PropertyChangeMask : NoEventMask;
+        if (transfer->requestor == transfer->owner)
+            mask |= WINDOW_EVENT_MASK | (paste_transfer.active ? PropertyChangeMask : NoEventMask);
+        XSelectInput(display, transfer->requestor, mask);
+    }
+    free(transfer->chunk);
+    memset(transfer, 0, sizeof(*transfer));
+}
+
+// Function to answer another client's request for PRIMARY or CLIPBOARD; the text is
+// extracted here, lazily, and streamed with INCR when it exceeds one chunk
+void handle_selection_request(Display *display, XSelectionRequestEvent *request)
+{
+    XSelectionEvent reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = SelectionNotify;
+    reply.display = request->display;
+    reply.requestor = request->requestor;
+    reply.selection = request->selection;
+    reply.target = request->target;
+    reply.time = request->time;
+    reply.property = None; // Refusal unless a conversion below succeeds
+
+    // Obsolete clients leave the property unset; ICCCM says to use the target
+    Atom property = request->property != None ? request->property : request->target;
+
+    // Step 1: Pick the range for the requested selection
+    SelectionRange range;
+    int have_range = 0;
+    if (request->selection == XA_PRIMARY && mouse_selection.owned)
+        have_range = get_selection_range(&range);
+    else if (request->selection == clipboard_atom && clipboard_range.tab_id != 0)
+    {
+        range = clipboard_range;
+        have_range = find_tab_by_id(range.tab_id) != NULL;
+    }
+
+    if (have_range && request->target == targets_atom)
+    {
+        // Step 2: Advertise the formats we can produce
+        Atom supported[3] = {targets_atom, utf8_string_atom, XA_STRING};
+        XChangeProperty(display, request->requestor, property, XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *)supported, 3);
+        reply.property = property;
+    }
+    else if (have_range && (request->target == utf8_string_atom || request->target == XA_STRING))
+    {
+        // Step 3: Take a transfer slot (the oldest is abandoned if all are busy)
+        SelectionTransfer *transfer = &selection_transfers[0];
+        for (int slot = 0; slot < MAX_SELECTION_TRANSFERS; slot++)
+        {
+            if (!selection_transfers[slot].active)
+            {
+                transfer = &selection_transfers[slot];
+                break;
+            }
+        }
+        if (transfer->active)
+            end_selection_transfer(display, transfer);
+
+        transfer->chunk = malloc(SELECTION_CHUNK_BYTES);
+        if (transfer->chunk)
+        {
+            transfer->range = range;
+            transfer->next_line = range.start_line;
+            transfer->latin1 = (request->target == XA_STRING);
+            transfer->requestor = request->requestor;
+            transfer->property = property;
+            transfer->type = request->target;
+            refill_selection_transfer(transfer);
+
+            if (transfer->next_line > range.end_line)
+            {
+                // Step 4a: Everything fit in one chunk - a single property write
+                XChangeProperty(display, request->requestor, property, transfer->type, 8, PropModeReplace,
+                                (unsigned char *)transfer->chunk, transfer->chunk_length);
+                free(transfer->chunk);
+                memset(transfer, 0, sizeof(*transfer));
+            }
+            else
+            {
+                // Step 4b: Large selection - announce INCR; each time the requestor deletes
+                // the property the next chunk is extracted and written
+                long lower_bound = (long)(range.end_line - range.start_line + 1);
+                transfer->active = 1;
+                transfer->incr = 1;
+                transfer->owner = request->owner;
+                XSelectInput(display, request->requestor,
+                             request->requestor == request->owner ? WINDOW_EVENT_MASK | PropertyChangeMask
+                                                                  : PropertyChangeMask);
+                XChangeProperty(display, request->requestor, property, incr_atom, 32, PropModeReplace,
+                                (unsigned char *)&lower_bound, 1);
+                printf("Selection: serving lines %lu-%lu with INCR\n", range.start_line, range.end_line);
+            }
+            reply.property = property;
+        }
+    }
+
+    XSendEvent(display, request->requestor, False, NoEventMask, (XEvent *)&reply);
+}
+
+// Function to advance an INCR transfer when the requestor deleted the last chunk;
+// returns 1 if the event belonged to a transfer
+int handle_selection_transfer_property(Display *display, XPropertyEvent *property_event)
+{
+    if (property_event->state != PropertyDelete)
+        return 0;
+
+    for (int slot = 0; slot < MAX_SELECTION_TRANSFERS; slot++)
+    {
+        SelectionTransfer *transfer = &selection_transfers[slot];
+        if (!transfer->active || transfer->requestor != property_event->window ||
+            transfer->property != property_event->atom)
+            continue;
+
+        // Write the pending chunk; an empty write tells the requestor the data is complete
+        XChangeProperty(display, transfer->requestor, transfer->property, transfer->type, 8, PropModeReplace,
+                        (unsigned char *)transfer->chunk, transfer->chunk_length);
+
+        if (transfer->chunk_length == 0)
+            end_selection_transfer(display, transfer);
+        else
+            refill_selection_transfer(transfer);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to react to another client taking one of our selections
+void handle_selection_clear(XSelectionClearEvent *clear_event)
+{
+    if (clear_event->selection == XA_PRIMARY)
+    {
+        // Someone else selected text - drop our highlight
+        mouse_selection.owned = 0;
+        clear_mouse_selection(NULL, clear_event->time);
+    }
+    else if (clear_event->selection == clipboard_atom)
+    {
+        clipboard_range.tab_id = 0;
+    }
+}
+
+// ============================================================================
+// SCROLLBACK FIND
+// ============================================================================
+
+// Function to find the first occurrence of a literal at or after 'from' in a line.
+// Candidates for the first character are located four cells at a time with SSE2
+// and then verified with wmemcmp.
+int find_literal_in_line(const wchar_t *text, int length, int from, const wchar_t *needle, int needle_length)
+{
+    int last_start = length - needle_length;
+    int index = from;
+    wchar_t first = needle[0];
+
+#ifdef __SSE2__
+    const __m128i first_wide = _mm_set1_epi32((int)first);
+    for (; index + 4 <= last_start + 1; index += 4)
+    {
+        __m128i cells = _mm_loadu_si128((const __m128i *)(text + index));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(cells, first_wide)));
+        while (mask)
+        {
+            int lane = __builtin_ctz(mask);
+            if (wmemcmp(text + index + lane, needle, needle_length) == 0)
+                return index + lane;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Remaining cells (and the whole line without SSE2)
+    for (; index <= last_start; index++)
+    {
+        if (text[index] == first && wmemcmp(text + index, needle, needle_length) == 0)
+            return index;
+    }
+    return -1;
+}
+
+// Function to map a character to its DFA input symbol (equivalence class)
+static int regex_symbol_search(const RegexDfa *dfa, wchar_t character)
+{
+    // Symbol = number of class boundaries <= character
+    int low = 0, high = dfa->boundary_count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (dfa->boundaries[middle] <= character)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+static inline int regex_symbol(const RegexDfa *dfa, wchar_t character)
+{
+    if (character >= 0 && character < 128)
+        return dfa->ascii_symbols[character];
+    return regex_symbol_search(dfa, character);
+}
+
+/**
+ * Regex Compiler State
+ * Thompson NFA built while parsing; every fragment has one start state and
+ * one epsilon end state that is patched when the fragment is connected.
+ */
+typedef struct
+{
+    const wchar_t *pattern;              // Pattern being parsed
+    int position;                        // Next pattern character
+    int length;                          // Pattern length
+    struct
+    {
+        int type;                        // REGEX_NFA_EPSILON / _SPLIT / _CLASS / _MATCH
+        int class_index;                 // Character class (REGEX_NFA_CLASS)
+        int out;                         // Next state
+        int out1;                        // Second branch (REGEX_NFA_SPLIT)
+    } states[REGEX_MAX_NFA_STATES];
+    int state_count;
+    struct
+    {
+        int negated;                     // [^...] or '.'
+        int range_start;                 // First range in ranges[]
+        int range_count;
+    } classes[REGEX_MAX_CLASSES];
+    int class_count;
+    wchar_t ranges[REGEX_MAX_RANGES][2]; // Inclusive character ranges
+    int range_count;
+    const char *error;                   // First error found (NULL if none)
+} RegexCompiler;
+
+enum
+{
+    REGEX_NFA_EPSILON = 0,
+    REGEX_NFA_SPLIT,
+    REGEX_NFA_CLASS,
+    REGEX_NFA_MATCH
+};
+
+typedef struct
+{
+    int start;
+    int end;
+} RegexFragment;
+
+// Function to allocate an NFA state
+static int regex_new_state(RegexCompiler *compiler, int type, int class_index)
+{
+    if (compiler->state_count >= REGEX_MAX_NFA_STATES)
+    {
+        compiler->error = "pattern too long";
+        return 0;
+    }
+    int state = compiler->state_count++;
+    compiler->states[state].type = type;
+    compiler->states[state].class_index = class_index;
+    compiler->states[state].out = -1;
+    compiler->states[state].out1 = -1;
+    return state;
+}
+
+// Function to add a range to the class being built
+static void regex_add_range(RegexCompiler *compiler, wchar_t low, wchar_t high)
+{
+    if (compiler->range_count >= REGEX_MAX_RANGES)
+    {
+        compiler->error = "too many character ranges";
+        return;
+    }
+    compiler->ranges[compiler->range_count][0] = low;
+    compiler->ranges[compiler->range_count][1] = high;
+    compiler->range_count++;
+    compiler->classes[compiler->class_count].range_count++;
+}
+
+// Function to add the ranges of a \d, \w or \s shorthand; returns 0 if not a shorthand
+static int regex_add_shorthand(RegexCompiler *compiler, wchar_t letter)
+{
+    switch (letter)
+    {
+    case L'd':
+        regex_add_range(compiler, L'0', L'9');
+        return 1;
+    case L'w':
+        regex_add_range(compiler, L'0', L'9');
+        regex_add_range(compiler, L'A', L'Z');
+        regex_add_range(compiler, L'a', L'z');
+        regex_add_range(compiler, L'_', L'_');
+        return 1;
+    case L's':
+        regex_add_range(compiler, L' ', L' ');
+        regex_add_range(compiler, L'\t', L'\t');
+        return 1;
+    }
+    return 0;
+}
+
+// Function to build a one-class fragment
+static RegexFragment regex_class_fragment(RegexCompiler *compiler, int class_index)
+{
+    RegexFragment fragment;
+    fragment.start = regex_new_state(compiler, REGEX_NFA_CLASS, class_index);
+    fragment.end = regex_new_state(compiler, REGEX_NFA_EPSILON, 0);
+    compiler->states[fragment.start].out = fragment.end;
+    return fragment;
+}
+
+// Function to open a new character class
+static int regex_begin_class(RegexCompiler *compiler, int negated)
+{
+    if (compiler->class_count >= REGEX_MAX_CLASSES)
+    {
+        compiler->error = "too many character classes";
+        return 0;
+    }
+    int class_index = compiler->class_count;
+    compiler->classes[class_index].negated = negated;
+    compiler->classes[class_index].range_start = compiler->range_count;
+    compiler->classes[class_index].range_count = 0;
+    return class_index;
+}
+
+static RegexFragment regex_parse_alternation(RegexCompiler *compiler);
+
+// Function to parse one atom: literal, '.', escape, [class] or (group)
+static RegexFragment regex_parse_atom(RegexCompiler *compiler)
+{
+    wchar_t character = compiler->pattern[compiler->position++];
+
+    if (character == L'(')
+    {
+        RegexFragment group = regex_parse_alternation(compiler);
+        if (compiler->position >= compiler->length || compiler->pattern[compiler->position] != L')')
+            compiler->error = "missing )";
+        else
+            compiler->position++;
+        return group;
+    }
+
+    int class_index = regex_begin_class(compiler, character == L'.');
+    if (compiler->error)
+        return (RegexFragment){0, 0};
+
+    if (character == L'.')
+    {
+        // Negated empty class: any character
+    }
+    else if (character == L'[')
+    {
+        // Bracket expression: [abc], [a-z], [^...], with \d \w \s inside
+        if (compiler->position < compiler->length && compiler->pattern[compiler->position] == L'^')
+        {
+            compiler->classes[class_index].negated = 1;
+            compiler->position++;
+        }
+        int first = 1;
+        while (compiler->position < compiler->length &&
+               (first || compiler->pattern[compiler->position] != L']'))
+        {
+            first = 0;
+            wchar_t low = compiler->pattern[compiler->position++];
+            if (low == L'\\' && compiler->position < compiler->length)
+            {
+                low = compiler->pattern[compiler->position++];
+                if (regex_add_shorthand(compiler, low))
+                    continue;
+            }
+            wchar_t high = low;
+            if (compiler->position + 1 < compiler->length && compiler->pattern[compiler->position] == L'-' &&
+                compiler->pattern[compiler->position + 1] != L']')
+            {
+                high = compiler->pattern[compiler->position + 1];
+                compiler->position += 2;
+            }
+            if (high < low)
+            {
+                compiler->error = "bad range";
+                break;
+            }
+            regex_add_range(compiler, low, high);
+        }
+        if (compiler->position >= compiler->length)
+            compiler->error = "missing ]";
+        else
+            compiler->position++;
+    }
+    else if (character == L'\\' && compiler->position < compiler->length)
+    {
+        wchar_t escaped = compiler->pattern[compiler->position++];
+        if (!regex_add_shorthand(compiler, escaped))
+            regex_add_range(compiler, escaped, escaped);
+    }
+    else if (character == L')' || character == L'*' || character == L'+' || character == L'?' ||
+             character == L'|')
+    {
+        compiler->error = "unexpected operator";
+    }
+    else
+    {
+        regex_add_range(compiler, character, character);
+    }
+
+    compiler->class_count++;
+    return regex_class_fragment(compiler, class_index);
+}
+
+// Function to parse an atom followed by any number of *, + and ?
+static RegexFragment regex_parse_repeat(RegexCompiler *compiler)
+{
+    RegexFragment fragment = regex_parse_atom(compiler);
+
+    while (!compiler->error && compiler->position < compiler->length)
+    {
+        wchar_t operator_character = compiler->pattern[compiler->position];
+        if (operator_character != L'*' && operator_character != L'+' && operator_character != L'?')
+            break;
+        compiler->position++;
+
+        int split = regex_new_state(compiler, REGEX_NFA_SPLIT, 0);
+        int end = regex_new_state(compiler, REGEX_NFA_EPSILON, 0);
+        if (compiler->error)
+            break;
+        compiler->states[split].out = fragment.start;
+        compiler->states[split].out1 = end;
+
+        // '*' and '+' loop back through the split; '?' falls through to the end
+        compiler->states[fragment.end].out = (operator_character == L'?') ? end : split;
+        fragment.start = (operator_character == L'+') ? fragment.start : split;
+        fragment.end = end;
+    }
+    return fragment;
+}
+
+// Function to parse a sequence of repeats
+static RegexFragment regex_parse_concatenation(RegexCompiler *compiler)
+{
+    RegexFragment fragment;
+    fragment.start = regex_new_state(compiler, REGEX_NFA_EPSILON, 0);
+    fragment.end = fragment.start;
+
+    while (!compiler->error && compiler->position < compiler->length &&
+           compiler->pattern[compiler->position] != L'|' && compiler->pattern[compiler->position] != L')')
+    {
+        RegexFragment next = regex_parse_repeat(compiler);
+        if (compiler->error)
+            break;
+        compiler->states[fragment.end].out = next.start;
+        fragment.end = next.end;
+    }
+    return fragment;
+}
+
+// Function to parse alternatives separated by '|'
+static RegexFragment regex_parse_alternation(RegexCompiler *compiler)
+{
+    RegexFragment fragment = regex_parse_concatenation(compiler);
+
+    while (!compiler->error && compiler->position < compiler->length &&
+           compiler->pattern[compiler->position] == L'|')
+    {
+        compiler->position++;
+        RegexFragment alternative = regex_parse_concatenation(compiler);
+        int split = regex_new_state(compiler, REGEX_NFA_SPLIT, 0);
+        int end = regex_new_state(compiler, REGEX_NFA_EPSILON, 0);
+        if (compiler->error)
+            break;
+        compiler->states[split].out = fragment.start;
+        compiler->states[split].out1 = alternative.start;
+        compiler->states[fragment.end].out = end;
+        compiler->states[alternative.end].out = end;
+        fragment.start = split;
+        fragment.end = end;
+    }
+    return fragment;
+}
+
+// Function to add a state and everything reachable through epsilon moves to a set
+static void regex_closure(const RegexCompiler *compiler, int state, uint64_t *set)
+{
+    while (state >= 0)
+    {
+        if (set[state / 64] & (1ULL << (state % 64)))
+            return;
+        set[state / 64] |= 1ULL << (state % 64);
+
+        if (compiler->states[state].type == REGEX_NFA_SPLIT)
+        {
+            regex_closure(compiler, compiler->states[state].out1, set);
+            state = compiler->states[state].out;
+        }
+        else if (compiler->states[state].type == REGEX_NFA_EPSILON)
+        {
+            state = compiler->states[state].out;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+// Function to test whether a character class contains a character
+static int regex_class_contains(const RegexCompiler *compiler, int class_index, wchar_t character)
+{
+    int inside = 0;
+    for (int range = 0; range < compiler->classes[class_index].range_count; range++)
+    {
+        const wchar_t *bounds = compiler->ranges[compiler->classes[class_index].range_start + range];
+        if (character >= bounds[0] && character <= bounds[1])
+        {
+            inside = 1;
+            break;
+        }
+    }
+    return compiler->classes[class_index].negated ? !inside : inside;
+}
+
+// Function to release a compiled DFA
+void regex_free(RegexDfa *dfa)
+{
+    free(dfa->transitions);
+    free(dfa->accepting);
+    free(dfa->boundaries);
+    memset(dfa, 0, sizeof(*dfa));
+}
+
+// Function to compile a pattern once into a DFA (subset construction over character
+// equivalence classes). '^' and '$' are supported at the ends of the pattern.
+// Returns NULL on success or a short error message.
+const char *regex_compile(RegexDfa *dfa, const wchar_t *pattern, int pattern_length)
+{
+    regex_free(dfa);
+
+    // Step 1: Strip the anchors, then parse the rest into a Thompson NFA
+    if (pattern_length > 0 && pattern[0] == L'^')
+    {
+        dfa->anchored_start = 1;
+        pattern++;
+        pattern_length--;
+    }
+    if (pattern_length > 0 && pattern[pattern_length - 1] == L'$' &&
+        (pattern_length < 2 || pattern[pattern_length - 2] != L'\\'))
+    {
+        dfa->anchored_end = 1;
+        pattern_length--;
+    }
+
+    RegexCompiler *compiler = calloc(1, sizeof(RegexCompiler));
+    if (!compiler)
+        return "out of memory";
+    compiler->pattern = pattern;
+    compiler->length = pattern_length;
+
+    RegexFragment whole = regex_parse_alternation(compiler);
+    if (!compiler->error && compiler->position < compiler->length)
+        compiler->error = "unexpected )";
+    int match_state = regex_new_state(compiler, REGEX_NFA_MATCH, 0);
+    if (compiler->error)
+    {
+        const char *error = compiler->error;
+        free(compiler);
+        return error;
+    }
+    compiler->states[whole.end].out = match_state;
+
+    // Step 2: Split the character space into classes that no range boundary crosses
+    wchar_t *boundaries = malloc((compiler->range_count * 2 + 1) * sizeof(wchar_t));
+    int boundary_count = 0;
+    for (int range = 0; boundaries && range < compiler->range_count; range++)
+    {
+        boundaries[boundary_count++] = compiler->ranges[range][0];
+        boundaries[boundary_count++] = compiler->ranges[range][1] + 1;
+    }
+    // Sort (insertion sort - a few hundred entries at most) and drop duplicates
+    for (int outer = 1; outer < boundary_count; outer++)
+    {
+        wchar_t value = boundaries[outer];
+        int inner = outer - 1;
+        while (inner >= 0 && boundaries[inner] > value)
+        {
+            boundaries[inner + 1] = boundaries[inner];
+            inner--;
+        }
+        boundaries[inner + 1] = value;
+    }
+    int unique_count = 0;
+    for (int index = 0; index < boundary_count; index++)
+    {
+        if (unique_count == 0 || boundaries[unique_count - 1] != boundaries[index])
+            boundaries[unique_count++] = boundaries[index];
+    }
+    dfa->boundaries = boundaries;
+    dfa->boundary_count = unique_count;
+    dfa->symbol_count = unique_count + 1;
+    for (int character = 0; character < 128; character++)
+    {
+        dfa->ascii_symbols[character] = regex_symbol_search(dfa, character);
+    }
+
+    // Step 3: Subset construction, eagerly, with a state cap
+    int words = (compiler->state_count + 63) / 64;
+    uint64_t *sets = calloc((size_t)REGEX_MAX_DFA_STATES * words, sizeof(uint64_t));
+    dfa->transitions = malloc((size_t)REGEX_MAX_DFA_STATES * dfa->symbol_count * sizeof(short));
+    dfa->accepting = calloc(REGEX_MAX_DFA_STATES, 1);
+    uint64_t *next_set = malloc(words * sizeof(uint64_t));
+    const char *error = NULL;
+
+    if (!boundaries || !sets || !dfa->transitions || !dfa->accepting || !next_set)
+    {
+        error = "out of memory";
+    }
+    else
+    {
+        regex_closure(compiler, whole.start, sets);
+        dfa->state_count = 1;
+
+        for (int state = 0; state < dfa->state_count && !error; state++)
+        {
+            uint64_t *set = sets + (size_t)state * words;
+            dfa->accepting[state] = (set[match_state / 64] >> (match_state % 64)) & 1;
+
+            for (int symbol = 0; symbol < dfa->symbol_count; symbol++)
+            {
+                // Representative character of this symbol's class
+                wchar_t representative = symbol == 0 ? 0 : boundaries[symbol - 1];
+                memset(next_set, 0, words * sizeof(uint64_t));
+                int any = 0;
+
+                for (int nfa_state = 0; nfa_state < compiler->state_count; nfa_state++)
+                {
+                    if (!((set[nfa_state / 64] >> (nfa_state % 64)) & 1) ||
+                        compiler->states[nfa_state].type != REGEX_NFA_CLASS)
+                        continue;
+                    if (regex_class_contains(compiler, compiler->states[nfa_state].class_index, representative))
+                    {
+                        regex_closure(compiler, compiler->states[nfa_state].out, next_set);
+                        any = 1;
+                    }
+                }
+
+                int target = -1; // Dead state
+                if (any)
+                {
+                    for (int existing = 0; existing < dfa->state_count; existing++)
+                    {
+                        if (memcmp(sets + (size_t)existing * words, next_set, words * sizeof(uint64_t)) == 0)
+                        {
+                            target = existing;
+                            break;
+                        }
+                    }
+                    if (target < 0)
+                    {
+                        if (dfa->state_count >= REGEX_MAX_DFA_STATES)
+                        {
+                            error = "pattern too complex";
+                            break;
+                        }
+                        target = dfa->state_count++;
+                        memcpy(sets + (size_t)target * words, next_set, words * sizeof(uint64_t));
+                    }
+                }
+                dfa->transitions[state * dfa->symbol_count + symbol] = (short)target;
+            }
+        }
+    }
+
+    free(next_set);
+    free(sets);
+    free(compiler);
+    if (error)
+    {
+        regex_free(dfa);
+        return error;
+    }
+    dfa->valid = 1;
+    return NULL;
+}
+
+// Function to find the leftmost-longest non-empty regex match starting at or after 'from'
+int regex_find_in_line(const RegexDfa *dfa, const wchar_t *text, int length, int from, int *match_length)
+{
+    int last_start = dfa->anchored_start ? 0 : length - 1;
+    if (dfa->anchored_start && from > 0)
+        return -1;
+
+    for (int start = from; start <= last_start; start++)
+    {
+        int state = 0;
+        int best_end = -1;
+        for (int index = start; index < length && state >= 0; index++)
+        {
+            state = dfa->transitions[state * dfa->symbol_count + regex_symbol(dfa, text[index])];
+            if (state >= 0 && dfa->accepting[state] && (!dfa->anchored_end || index + 1 == length))
+                best_end = index + 1;
+        }
+        if (best_end > start)
+        {
+            *match_length = best_end - start;
+            return start;
+        }
+    }
+    return -1;
+}
+
+// Function to find the first match at or after 'from' in a line with the tab's find settings
+static int find_in_line(FindState *find, const wchar_t *text, int from, int *match_length)
+{
+    int length = wcsnlen(text, BUFFER_COLS);
+
+    // Trailing blanks are never part of the searched text
+    while (length > 0 && text[length - 1] == L' ')
+        length--;
+
+    if (find->regex)
+    {
+        if (!find->dfa.valid)
+            return -1;
+        return regex_find_in_line(&find->dfa, text, length, from, match_length);
+    }
+
+    *match_length = find->term_length;
+    if (find->term_length == 0 || find->term_length > length)
+        return -1;
+    if (find->fold_case)
+    {
+        wchar_t folded_text[BUFFER_COLS], folded_term[FIND_MAX_TERM];
+        for (int col = 0; col < length; col++)
+            folded_text[col] = towlower(text[col]);
+        for (int index = 0; index < find->term_length; index++)
+            folded_term[index] = towlower(find->term[index]);
+        return find_literal_in_line(folded_text, length, from, folded_term, find->term_length);
+    }
+    return find_literal_in_line(text, length, from, find->term, find->term_length);
+}
+
+// Function to scroll the view so an absolute scrollback line is visible (centered if it was off-screen)
+static void scroll_to_line(Tab *tab, unsigned long line)
+{
+    int visible_content_lines = BUFFER_ROWS - 2;
+    int index = (int)(line - tab->scrollback_first_line);
+
+    // A line inside folded command output is shown by unfolding that command
+    reveal_scrollback_line(tab, index);
+    int display_row = scrollback_display_row(tab, index);
+    int display_count = scrollback_display_count(tab);
+    int view_start = scrollback_view_start(tab);
+
+    if (display_row < view_start || display_row >= view_start + visible_content_lines)
+    {
+        view_start = display_row - visible_content_lines / 2;
+        if (view_start > display_count - visible_content_lines)
+            view_start = display_count - visible_content_lines;
+        if (view_start < 0)
+            view_start = 0;
+        tab->scrollback_offset = display_count - visible_content_lines - view_start;
+        if (tab->scrollback_offset < 0)
+            tab->scrollback_offset = 0;
+        if (tab->scrollback_offset > tab->max_scrollback_offset)
+            tab->max_scrollback_offset = tab->scrollback_offset;
+    }
+    render_scrollback(tab);
+}
+
+// Function to move to the next match in a direction (-1 older, +1 newer); when 'restart'
+// is set the search begins again at the newest line. Returns 1 if a match was found.
+static int scan_for_match(Tab *tab, int direction, int restart)
+{
+    FindState *find = &tab->find;
+    long long search_start_us = monotonic_us();
+    int match_length = 0;
+
+    if (tab->scrollback_count == 0 || (!find->regex && find->term_length == 0) ||
+        (find->regex && !find->dfa.valid))
+    {
+        find->has_match = 0;
+        return 0;
+    }
+
+    // Step 1: Pick where to continue from (the current match may have scrolled out)
+    long index;
+    int column;
+    if (restart || !find->has_match || find->match_line < tab->scrollback_first_line)
+    {
+        index = tab->scrollback_count - 1;
+        column = BUFFER_COLS;            // Whole newest line is a candidate
+        direction = -1;
+        restart = 1;
+    }
+    else
+    {
+        index = (long)(find->match_line - tab->scrollback_first_line);
+        column = find->match_col;
+    }
+
+    // Step 2: An ASCII literal can be looked for in the raw bytes before decoding a line
+    // (only when the case must match, the byte scan is exact)
+    char ascii_term[FIND_MAX_TERM];
+    int ascii_length = 0;
+    if (!find->regex && !find->fold_case)
+    {
+        while (ascii_length < find->term_length && find->term[ascii_length] > 0 && find->term[ascii_length] < 0x80)
+        {
+            ascii_term[ascii_length] = (char)find->term[ascii_length];
+            ascii_length++;
+        }
+        if (ascii_length < find->term_length)
+            ascii_length = 0;
+    }
+
+    // Step 3: Walk lines in the requested direction
+    for (long scanned = 0; scanned <= tab->scrollback_count; scanned++)
+    {
+        wchar_t text[BUFFER_COLS];       // Decoded here; scans must not flush the line cache
+        int found = -1;
+        const char *bytes;
+        size_t byte_length;
+
+        if (ascii_length > 0 && scrollback_line_bytes(tab, (int)index, &bytes, &byte_length) &&
+            !bytes_contain(bytes, byte_length, ascii_term, ascii_length))
+        {
+            goto next_line;
+        }
+        scrollback_decode_line(tab, (int)index, text);
+
+        if (direction < 0)
+        {
+            // Last match that starts before 'column' on this line
+            int position = find_in_line(find, text, 0, &match_length);
+            int limit = (scanned == 0 && !restart) ? column : BUFFER_COLS;
+            int length = match_length;
+            while (position >= 0 && position < limit)
+            {
+                found = position;
+                match_length = length;
+                position = find_in_line(find, text, position + 1, &length);
+            }
+        }
+        else
+        {
+            // First match that starts after 'column' on this line
+            int from = (scanned == 0) ? column + 1 : 0;
+            found = find_in_line(find, text, from, &match_length);
+        }
+
+        if (found >= 0)
+        {
+            find->has_match = 1;
+            find->match_line = tab->scrollback_first_line + index;
+            find->match_col = found;
+            find->match_length = match_length;
+            scroll_to_line(tab, find->match_line);
+            printf("Find: match at line %lu col %d (%lld us, %ld lines scanned)\n",
+                   find->match_line, found, monotonic_us() - search_start_us, scanned + 1);
+            return 1;
+        }
+
+    next_line:
+        index += direction;
+        if (index < 0 || index >= tab->scrollback_count)
+            break;                       // No wrap-around; the status line says so
+    }
+
+    if (restart)
+        find->has_match = 0;
+    return 0;
+}
+
+// Function to move to the next find match (a search phase for the hardware counters)
+int find_next_match(Tab *tab, int direction, int restart)
+{
+    long long query_start_us = monotonic_us();
+    perf_phase_begin(PERF_PHASE_SEARCH);
+    int found = scan_for_match(tab, direction, restart);
+    perf_phase_end();
+    trace_complete(TRACE_FIND_QUERY, query_start_us, found, 0);
+    return found;
+}
+
+// Function to compute per-cell decorations of a grid row: selection and the current
+// find match in reverse video, other visible find matches underlined
+void compute_row_styles(Tab *tab, int row, unsigned char *styles)
+{
+    // An attached client draws the highlights the server computed
+    if (attach_server.fd >= 0)
+    {
+        memcpy(styles, attach_row_styles[row], BUFFER_COLS);
+        return;
+    }
+
+    memset(styles, CELL_STYLE_NORMAL, BUFFER_COLS);
+
+    if (global_search.active && tab_is_visible(tab))
+    {
+        global_search_row_styles(row, styles);
+        return;
+    }
+
+    // Step 1: Other find matches on the row
+    FindState *find = &tab->find;
+    int content_index = scrollback_row_index(tab, row);
+    int is_content = content_index >= 0;
+    if (find->active && is_content)
+    {
+        const wchar_t *text = scrollback_line(tab, content_index);
+        int match_length = 0;
+        int position = find_in_line(find, text, 0, &match_length);
+        while (position >= 0)
+        {
+            for (int col = position; col < position + match_length && col < BUFFER_COLS; col++)
+                styles[col] = CELL_STYLE_UNDERLINE;
+            position = find_in_line(find, text, position + 1, &match_length);
+        }
+
+        // Step 2: The current match
+        if (find->has_match && find->match_line == tab->scrollback_first_line + content_index)
+        {
+            for (int col = find->match_col; col < find->match_col + find->match_length && col < BUFFER_COLS; col++)
+                styles[col] = CELL_STYLE_REVERSE;
+        }
+    }
+
+    // Step 3: Mouse selection
+    int selection_start, selection_end;
+    selection_row_span(tab, row, &selection_start, &selection_end);
+    for (int col = selection_start; col < selection_end && col < BUFFER_COLS; col++)
+        styles[col] = CELL_STYLE_REVERSE;
+}
+
+// Function to draw the find prompt and status on the command row
+void update_find_display(Tab *tab)
+{
+    FindState *find = &tab->find;
+    int command_row = BUFFER_ROWS - 2;
+
+    // Step 1: Build the prompt and status around the term
+    char status[96] = "";
+    if (find->regex && find->error)
+        snprintf(status, sizeof(status), "  [%s]", find->error);
+    else if (find->has_match)
+        snprintf(status, sizeof(status), "  [line %lu]",
+                 find->match_line - tab->scrollback_first_line + 1);
+    else if ((find->regex && find->dfa.valid) || (!find->regex && find->term_length > 0))
+        snprintf(status, sizeof(status), "  [no match]");
+
+    const wchar_t *prompt = find->regex ? L"(find regex)`" : find->fold_case ? L"(find any case)`" : L"(find)`";
+    int prompt_length = wcslen(prompt);
+
+    // Step 2: Write prompt, term and status into the command row
+    for (int col = 0; col < BUFFER_COLS; col++)
+        tab->text_buffer[command_row][col] = L' ';
+
+    int col = 0;
+    for (int index = 0; index < prompt_length && col < BUFFER_COLS; index++)
+        tab->text_buffer[command_row][col++] = prompt[index];
+    for (int index = 0; index < find->term_length && col < BUFFER_COLS; index++)
+        tab->text_buffer[command_row][col++] = find->term[index];
+    tab->cursor_row = command_row;
+    tab->cursor_col = col < BUFFER_COLS ? col : BUFFER_COLS - 1;
+    if (col < BUFFER_COLS)
+        tab->text_buffer[command_row][col++] = L'\'';
+    for (int index = 0; status[index] && col < BUFFER_COLS; index++)
+        tab->text_buffer[command_row][col++] = (wchar_t)(unsigned char)status[index];
+}
+
+// Function to recompile (regex mode) and restart the search after the term changed
+static void refresh_find(Tab *tab)
+{
+    FindState *find = &tab->find;
+    find->error = NULL;
+    find->has_match = 0;
+
+    if (find->regex)
+    {
+        // The pattern is compiled once per edit, never per line
+        find->error = find->term_length > 0 ? regex_compile(&find->dfa, find->term, find->term_length) : NULL;
+        if (find->term_length == 0)
+            regex_free(&find->dfa);
+    }
+
+    find_next_match(tab, -1, 1);
+    if (!find->has_match)
+        render_scrollback(tab);          // Keep the view, but drop stale highlights
+    update_find_display(tab);
+}
+
+// Function to enter find mode (Ctrl+F)
+void enter_find_mode(Tab *tab)
+{
+    tab->find.active = 1;
+    tab->find.fold_case = 0;
+    tab->find.term_length = 0;
+    tab->find.has_match = 0;
+    tab->find.error = NULL;
+    regex_free(&tab->find.dfa);
+    update_find_display(tab);
+}
+
+// Function to leave find mode, keeping the scroll position
+void exit_find_mode(Tab *tab)
+{
+    tab->find.active = 0;
+    tab->find.has_match = 0;
+    regex_free(&tab->find.dfa);
+    render_scrollback(tab);              // Restores the normal command line
+}
+
+// Function to handle a key while find mode is active
+void handle_find_keypress(Tab *tab, KeySym key_symbol, wchar_t wide_character, int shift_pressed, int control_pressed)
+{
+    FindState *find = &tab->find;
+
+    switch (key_symbol)
+    {
+    case XK_Escape:
+        exit_find_mode(tab);
+        return;
+
+    case XK_Return:
+    case XK_KP_Enter:
+        // Enter: next older match (Shift+Enter: newer)
+        find_next_match(tab, shift_pressed ? 1 : -1, 0);
+        break;
+
+    case XK_Up:
+        find_next_match(tab, -1, 0);
+        break;
+
+    case XK_Down:
+        find_next_match(tab, 1, 0);
+        break;
+
+    case XK_Tab:
+        // Toggle between literal and regex search
+        find->regex = !find->regex;
+        refresh_find(tab);
+        return;
+
+    case XK_BackSpace:
+    case XK_Delete:
+        if (find->term_length > 0)
+        {
+            find->term_length--;
+            refresh_find(tab);
+        }
+        return;
+
+    case XK_Page_Up:
+        scroll_up(tab);
+        break;
+
+    case XK_Page_Down:
+        scroll_down(tab);
+        break;
+
+    default:
+        if (control_pressed && (key_symbol == XK_f || key_symbol == XK_F))
+        {
+            // Ctrl+F again: next older match
+            find_next_match(tab, -1, 0);
+            break;
+        }
+        if (!control_pressed && wide_character != L'\0' && iswprint(wide_character) &&
+            find->term_length < FIND_MAX_TERM)
+        {
+            find->term[find->term_length++] = wide_character;
+            refresh_find(tab);
+            return;
+        }
+        break;
+    }
+
+    update_find_display(tab);
+}
+
+// ============================================================================
+// CROSS-TAB SEARCH WORKER POOL
+// ============================================================================
+//
+// Ctrl+Shift+F searches every tab's scrollback and command history at once.
+// The UI thread copies the tabs into a snapshot, splits it into chunks of
+// GLOBAL_SEARCH_CHUNK_LINES and hands the job to a small worker pool; it never
+// waits for the workers. Workers keep the best results ranked inside the job
+// and wake the UI through the same coalesced pipe the I/O reader uses, so the
+// results view fills in while the search runs. A new query cancels the old job;
+// cancelled jobs are freed by the UI thread once no worker is inside them.
+//
+// Like the I/O reader, workers must not call malloc() or stdio (fork safety).
+
+// Function to check whether a character continues a word for ranking purposes
+static int global_search_word_character(wchar_t character)
+{
+    return iswalnum(character) || character == L'_';
+}
+
+// Function to rank a match: exact case and whole-word matches first, newer lines next
+static long global_search_score(const wchar_t *text, int length, int position, const GlobalSearchJob *job,
+                                int recency)
+{
+    int quality = 0;
+    if (wmemcmp(text + position, job->query, job->query_length) == 0)
+        quality += 2;
+    int end = position + job->query_length;
+    if ((position == 0 || !global_search_word_character(text[position - 1])) &&
+        (end >= length || !global_search_word_character(text[end])))
+        quality += 1;
+    return (long)quality * GLOBAL_SEARCH_RECENCY_SPAN + recency;
+}
+
+// Function to insert a result into a job's ranked list (worker side, job->lock held)
+static void global_search_add_result(GlobalSearchJob *job, const GlobalSearchResult *result)
+{
+    job->total_matches++;
+
+    // Step 1: Find the insertion point (descending score, earlier finds first on ties)
+    int position = job->result_count;
+    while (position > 0 && job->results[position - 1].score < result->score)
+        position--;
+    if (position >= MAX_GLOBAL_SEARCH_RESULTS)
+        return;                          // Ranks below everything kept
+
+    // Step 2: Shift the lower-ranked results down, dropping the last one when full
+    int last = job->result_count < MAX_GLOBAL_SEARCH_RESULTS ? job->result_count : MAX_GLOBAL_SEARCH_RESULTS - 1;
+    memmove(&job->results[position + 1], &job->results[position], (size_t)(last - position) * sizeof(job->results[0]));
+    job->results[position] = *result;
+    if (job->result_count < MAX_GLOBAL_SEARCH_RESULTS)
+        job->result_count++;
+    job->results_version++;
+}
+
+// Function to find the lower-cased query in a line, folding at most GLOBAL_SEARCH_FOLD_CHARS at a
+// time; windows overlap by the query length so no match falls between two (worker side)
+static int global_search_find_folded(const wchar_t *text, int length, const GlobalSearchJob *job, wchar_t *folded)
+{
+    int step = GLOBAL_SEARCH_FOLD_CHARS - job->query_length + 1;
+    for (int window = 0; window < length; window += step)
+    {
+        int window_length = length - window < GLOBAL_SEARCH_FOLD_CHARS ? length - window : GLOBAL_SEARCH_FOLD_CHARS;
+        for (int col = 0; col < window_length; col++)
+            folded[col] = towlower(text[window + col]);
+        int position = find_literal_in_line(folded, window_length, 0, job->folded_query, job->query_length);
+        if (position >= 0)
+            return window + position;
+        if (window + window_length >= length)
+            break;
+    }
+    return -1;
+}
+
+// Function to search one chunk of a source (worker side)
+static void global_search_run_task(GlobalSearchJob *job, const GlobalSearchTask *task)
+{
+    const GlobalSearchSource *source = &job->sources[task->source];
+    wchar_t folded[GLOBAL_SEARCH_FOLD_CHARS];
+    wchar_t decoded[BUFFER_COLS];
+    char segment_scratch[SCROLLBACK_SEGMENT_BYTES]; // A compressed or spilled segment's bytes
+    unsigned char spill_scratch[LZ4_BOUND(SCROLLBACK_SEGMENT_BYTES)]; // Its compressed form read from disk
+    const char *line_bytes = NULL;       // Scrollback line walked to last
+    size_t line_length = 0;
+    const char *segment_end = NULL;
+    int found_any = 0;
+
+    for (int index = task->begin; index < task->end; index++)
+    {
+        // Cancellation is checked every few lines so a new query takes over quickly
+        if ((index & 63) == 0 && atomic_load_explicit(&job->cancelled, memory_order_relaxed))
+            return;
+
+        // Step 1: Locate the text of this line or history entry
+        const wchar_t *text;
+        int length;
+        if (source->from_history)
+        {
+            text = source->history_text + source->history_offsets[index];
+            length = source->history_offsets[index + 1] - source->history_offsets[index] - 1;
+        }
+        else
+        {
+            // Scrollback lines are walked within a segment and decoded here
+            if (line_bytes && line_bytes + line_length + 1 < segment_end)
+            {
+                line_bytes += line_length + 1;
+            }
+            else
+            {
+                int segment_index = locate_scrollback_segment(source->segments, source->segment_count,
+                                                              source->first_line + index);
+                line_bytes = NULL;
+                if (segment_index < 0)
+                    continue;
+                const ScrollbackSegment *segment = source->segments[segment_index];
+                const char *data = segment->bytes;
+                if (!data)
+                {
+                    // Compressed or spilled: load into this worker's stack (no malloc on workers)
+                    if (load_segment_bytes(segment, segment_scratch, spill_scratch) != 0)
+                        continue;
+                    data = segment_scratch;
+                }
+                line_bytes = data +
+                             scrollback_segment_line_offset(segment, data, (int)(source->first_line + index - segment->first_line));
+                segment_end = data + segment->length;
+            }
+            line_length = (size_t)((const char *)memchr(line_bytes, '\n', (size_t)(segment_end - line_bytes)) - line_bytes);
+            length = decode_scrollback_bytes(line_bytes, line_length, decoded);
+            text = decoded;
+        }
+        if (length < job->query_length)
+            continue;
+
+        // Step 2: Case-folded scan (skipped when the query itself has capitals)
+        int position;
+        if (job->case_sensitive)
+            position = find_literal_in_line(text, length, 0, job->query, job->query_length);
+        else
+            position = global_search_find_folded(text, length, job, folded);
+        if (position < 0)
+            continue;
+
+        // Step 3: Keep a snippet that shows the match even on long history entries
+        GlobalSearchResult result;
+        result.tab_id = source->tab_id;
+        result.from_history = source->from_history;
+        result.line = source->first_line + index;
+        result.score = global_search_score(text, length, position, job, index);
+        int snippet_start = position > BUFFER_COLS / 2 ? position - BUFFER_COLS / 4 : 0;
+        int snippet_length = length - snippet_start < BUFFER_COLS ? length - snippet_start : BUFFER_COLS;
+        wmemcpy(result.text, text + snippet_start, snippet_length);
+        result.text[snippet_length] = L'\0';
+        result.match_col = position - snippet_start;
+
+        pthread_mutex_lock(&job->lock);
+        global_search_add_result(job, &result);
+        pthread_mutex_unlock(&job->lock);
+        found_any = 1;
+    }
+
+    if (found_any)
+        io_notify_ui();
+}
+
+// Worker thread entry point - runs chunks of whichever job is current
+static void *global_search_worker_main(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&global_search_pool_lock);
+
+    while (!global_search_shutdown)
+    {
+        GlobalSearchJob *job = global_search_current_job;
+        if (job == NULL || atomic_load(&job->next_task) >= job->task_count)
+        {
+            pthread_cond_wait(&global_search_pool_wake, &global_search_pool_lock);
+            continue;
+        }
+
+        // Entering the job under the pool lock keeps it alive until we leave it
+        atomic_fetch_add(&job->workers_inside, 1);
+        pthread_mutex_unlock(&global_search_pool_lock);
+
+        int task_index;
+        while ((task_index = atomic_fetch_add(&job->next_task, 1)) < job->task_count)
+        {
+            if (!atomic_load_explicit(&job->cancelled, memory_order_relaxed))
+                global_search_run_task(job, &job->tasks[task_index]);
+            if (atomic_fetch_add(&job->tasks_done, 1) + 1 == job->task_count)
+                io_notify_ui();          // Last chunk: the view shows "done"
+        }
+
+        atomic_fetch_sub(&job->workers_inside, 1);
+        pthread_mutex_lock(&global_search_pool_lock);
+    }
+
+    pthread_mutex_unlock(&global_search_pool_lock);
+    return NULL;
+}
+
+// Function to start the worker pool on first use
+static int start_global_search_workers(void)
+{
+    if (global_search_worker_count > 0)
+        return 0;
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = processors > 0 && processors < GLOBAL_SEARCH_WORKERS ? (int)processors : GLOBAL_SEARCH_WORKERS;
+
+    global_search_shutdown = 0;
+    for (int worker = 0; worker < wanted; worker++)
+    {
+        int create_result = pthread_create(&global_search_workers[worker], NULL, global_search_worker_main, NULL);
+        if (create_result != 0)
+        {
+            printf("Warning: Failed to start search worker: %s\n", strerror(create_result));
+            break;
+        }
+        global_search_worker_count++;
+    }
+
+    printf("Global search: %d worker thread(s) started\n", global_search_worker_count);
+    return global_search_worker_count > 0 ? 0 : -1;
+}
+
+// Function to free a job's memory (UI thread, no worker inside)
+static void free_global_search_job(GlobalSearchJob *job)
+{
+    pthread_mutex_destroy(&job->lock);
+    for (int source_index = 0; source_index < job->source_count; source_index++)
+    {
+        GlobalSearchSource *source = &job->sources[source_index];
+        for (int segment_index = 0; !source->from_history && segment_index < source->segment_count; segment_index++)
+            release_scrollback_segment(source->segments[segment_index]);
+    }
+    free(job->snapshot);
+    free(job);
+}
+
+// Function to free cancelled jobs that every worker has left
+static void reap_global_search_jobs(void)
+{
+    GlobalSearchJob **link = &global_search.retired;
+    while (*link)
+    {
+        GlobalSearchJob *job = *link;
+        if (atomic_load(&job->workers_inside) == 0)
+        {
+            *link = job->next_retired;
+            free_global_search_job(job);
+        }
+        else
+        {
+            link = &job->next_retired;
+        }
+    }
+}
+
+// Function to cancel the running job (if any); it is freed later by reap_global_search_jobs
+static void cancel_global_search_job(void)
+{
+    GlobalSearchJob *job = global_search.job;
+    if (!job)
+        return;
+
+    atomic_store(&job->cancelled, 1);
+    pthread_mutex_lock(&global_search_pool_lock);
+    if (global_search_current_job == job)
+        global_search_current_job = NULL;
+    pthread_mutex_unlock(&global_search_pool_lock);
+
+    job->next_retired = global_search.retired;
+    global_search.retired = job;
+    global_search.job = NULL;
+    reap_global_search_jobs();
+}
+
+// Function to copy every tab into a new job and hand it to the workers
+static GlobalSearchJob *create_global_search_job(const wchar_t *query, int query_length)
+{
+    // Step 1: Size the snapshot - segment lists, then history text and offsets.
+    // Scrollback bytes are not copied: the open segment is sealed and all are shared.
+    size_t line_bytes = 0, history_characters = 0, offset_count = 0;
+    char *packed_history[MAX_TABS] = {NULL}; // Hibernated tabs' history, unpacked for the copy only
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+        line_bytes += (size_t)tab->segment_count * sizeof(ScrollbackSegment *);
+        if (tab->history_blob)
+        {
+            packed_history[tab_index] = inflate_history_blob(tab);
+            const char *entry = packed_history[tab_index];
+            for (int history_index = 0; entry && history_index < tab->history_count; history_index++)
+            {
+                size_t characters = mbstowcs(NULL, entry, 0);
+                history_characters += (characters == (size_t)-1 ? 0 : characters) + 1;
+                entry += strlen(entry) + 1;
+            }
+        }
+        else
+        {
+            for (int history_index = 0; history_index < tab->history_count; history_index++)
+                history_characters += wcslen(tab->command_history[history_index]) + 1;
+        }
+        offset_count += tab->history_count + 1;
+    }
+
+    GlobalSearchJob *job = calloc(1, sizeof(GlobalSearchJob));
+    char *snapshot = malloc(line_bytes + offset_count * sizeof(size_t) + history_characters * sizeof(wchar_t) + 1);
+    if (!job || !snapshot)
+    {
+        free(job);
+        free(snapshot);
+        for (int tab_index = 0; tab_index < tab_count; tab_index++)
+            free(packed_history[tab_index]);
+        return NULL;
+    }
+    job->snapshot = snapshot;
+    pthread_mutex_init(&job->lock, NULL);
+
+    // Step 2: Query in both its typed and folded forms (smart case: capitals force exact case)
+    job->query_length = query_length;
+    wmemcpy(job->query, query, query_length);
+    for (int index = 0; index < query_length; index++)
+    {
+        job->folded_query[index] = towlower(query[index]);
+        if (iswupper(query[index]))
+            job->case_sensitive = 1;
+    }
+
+    // Step 3: Copy (or share) each tab and cut it into chunks
+    ScrollbackSegment **segment_area = (ScrollbackSegment **)snapshot;
+    size_t *offset_area = (size_t *)(snapshot + line_bytes);
+    wchar_t *history_area = (wchar_t *)(offset_area + offset_count);
+
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        Tab *tab = &tabs[tab_index];
+
+        GlobalSearchSource *lines_source = &job->sources[job->source_count++];
+        lines_source->tab_id = tab->tab_id;
+        lines_source->from_history = 0;
+        lines_source->first_line = tab->scrollback_first_line;
+        lines_source->count = tab->scrollback_count;
+        lines_source->segments = segment_area;
+        lines_source->segment_count = tab->segment_count;
+        if (tab->segment_count > 0)
+            seal_scrollback_segment(tab, tab->segments[tab->segment_count - 1]);
+        for (int segment_index = 0; segment_index < tab->segment_count; segment_index++)
+        {
+            segment_area[segment_index] = tab->segments[segment_index];
+            tab->segments[segment_index]->references++;
+        }
+        segment_area += tab->segment_count;
+
+        GlobalSearchSource *history_source = &job->sources[job->source_count++];
+        history_source->tab_id = tab->tab_id;
+        history_source->from_history = 1;
+        history_source->first_line = 0;
+        history_source->count = tab->history_count;
+        history_source->history_text = history_area;
+        history_source->history_offsets = offset_area;
+        size_t written = 0;
+        const char *packed_entry = packed_history[tab_index];
+        for (int history_index = 0; history_index < tab->history_count; history_index++)
+        {
+            offset_area[history_index] = written;
+            if (tab->history_blob)
+            {
+                // Hibernated: convert straight from the unpacked UTF-8 (empty if unreadable)
+                size_t characters = packed_entry ? mbstowcs(NULL, packed_entry, 0) : (size_t)-1;
+                if (characters == (size_t)-1)
+                    characters = 0;
+                else
+                    mbstowcs(history_area + written, packed_entry, characters);
+                history_area[written + characters] = L'\0';
+                written += characters + 1;
+                if (packed_entry)
+                    packed_entry += strlen(packed_entry) + 1;
+                continue;
+            }
+            size_t entry_length = wcslen(tab->command_history[history_index]) + 1;
+            wmemcpy(history_area + written, tab->command_history[history_index], entry_length);
+            written += entry_length;
+        }
+        free(packed_history[tab_index]);
+        offset_area[tab->history_count] = written;
+        offset_area += tab->history_count + 1;
+        history_area += written;
+    }
+
+    for (int source_index = 0; source_index < job->source_count; source_index++)
+    {
+        // Newest lines are split first so the likeliest hits arrive early
+        for (int end = job->sources[source_index].count; end > 0; end -= GLOBAL_SEARCH_CHUNK_LINES)
+        {
+            GlobalSearchTask *task = &job->tasks[job->task_count++];
+            task->source = source_index;
+            task->end = end;
+            task->begin = end > GLOBAL_SEARCH_CHUNK_LINES ? end - GLOBAL_SEARCH_CHUNK_LINES : 0;
+        }
+    }
+
+    return job;
+}
+
+// Function to start searching for the current query (cancels the previous search)
+void restart_global_search(void)
+{
+    cancel_global_search_job();
+    global_search.result_count = 0;
+    global_search.total_matches = 0;
+    global_search.results_version = 0;
+    global_search.selected = 0;
+    global_search.view_top = 0;
+    global_search.done = 1;
+
+    if (global_search.query_length == 0)
+        return;
+
+    if (start_global_search_workers() == -1)
+        return;
+
+    GlobalSearchJob *job = create_global_search_job(global_search.query, global_search.query_length);
+    if (!job)
+    {
+        printf("Warning: Not enough memory for a global search snapshot\n");
+        return;
+    }
+    global_search.job = job;
+    global_search.done = 0;
+    global_search.start_us = monotonic_us();
+    printf("Global search: %d chunks queued (snapshot %.2f ms)\n", job->task_count,
+           (monotonic_us() - global_search.start_us) / 1000.0);
+
+    pthread_mutex_lock(&global_search_pool_lock);
+    global_search_current_job = job;
+    pthread_cond_broadcast(&global_search_pool_wake);
+    pthread_mutex_unlock(&global_search_pool_lock);
+}
+
+// Function to pick up results the workers produced since the last frame; returns 1 if the view changed
+int service_global_search(void)
+{
+    reap_global_search_jobs();
+
+    GlobalSearchJob *job = global_search.job;
+    if (!global_search.active || !job || global_search.done)
+        return 0;
+
+    // Step 1: Copy the ranked list only when workers changed it (completion is read
+    // first so results merged just before the last task finished are not missed)
+    int finished = atomic_load(&job->tasks_done) >= job->task_count;
+    int changed = 0;
+    pthread_mutex_lock(&job->lock);
+    if (job->results_version != global_search.results_version)
+    {
+        memcpy(global_search.results, job->results, (size_t)job->result_count * sizeof(job->results[0]));
+        global_search.result_count = job->result_count;
+        global_search.total_matches = job->total_matches;
+        global_search.results_version = job->results_version;
+        changed = 1;
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    // Step 2: Note completion (the job is kept until the query changes)
+    if (finished)
+    {
+        global_search.done = 1;
+        global_search.elapsed_us = monotonic_us() - global_search.start_us;
+        printf("Global search: %ld matches in %.2f ms\n", global_search.total_matches,
+               global_search.elapsed_us / 1000.0);
+        changed = 1;
+    }
+
+    if (changed && active_tab_index >= 0 && active_tab_index < tab_count)
+        render_scrollback(&tabs[active_tab_index]);
+    return changed;
+}
+
+// Function to find a tab's array index from its stable id (-1 if it was closed)
+static int tab_index_for_id(int tab_id)
+{
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        if (tabs[tab_index].tab_id == tab_id)
+            return tab_index;
+    }
+    return -1;
+}
+
+// Function to draw the results view into a tab's content rows
+void render_global_search_view(Tab *tab)
+{
+    int visible_results = BUFFER_ROWS - 3;   // Row 0 is the summary line
+
+    for (int row = 0; row < BUFFER_ROWS; row++)
+    {
+        for (int col = 0; col < BUFFER_COLS; col++)
+            tab->text_buffer[row][col] = L' ';
+    }
+
+    // Step 1: Summary line
+    char summary[BUFFER_COLS + 1];
+    if (global_search.query_length == 0)
+        snprintf(summary, sizeof(summary), "Search all tabs: type to search scrollback and history");
+    else if (!global_search.done)
+        snprintf(summary, sizeof(summary), "Search all tabs: %ld matches so far, searching...",
+                 global_search.total_matches);
+    else
+        snprintf(summary, sizeof(summary), "Search all tabs: %ld matches (%.1f ms)%s",
+                 global_search.total_matches, global_search.elapsed_us / 1000.0,
+                 global_search.total_matches > global_search.result_count ? ", best shown" : "");
+    for (int col = 0; summary[col] && col < BUFFER_COLS; col++)
+        tab->text_buffer[0][col] = (wchar_t)(unsigned char)summary[col];
+
+    // Step 2: Keep the selected result inside the window
+    if (global_search.selected < global_search.view_top)
+        global_search.view_top = global_search.selected;
+    if (global_search.selected >= global_search.view_top + visible_results)
+        global_search.view_top = global_search.selected - visible_results + 1;
+
+    // Step 3: One row per result: "tab:line  text" or "tab:hist  command"
+    for (int row = 0; row < visible_results; row++)
+    {
+        int result_index = global_search.view_top + row;
+        if (result_index >= global_search.result_count)
+            break;
+        GlobalSearchResult *result = &global_search.results[result_index];
+
+        int tab_index = tab_index_for_id(result->tab_id);
+        char label[GLOBAL_SEARCH_LABEL_WIDTH + 1];
+        if (result->from_history)
+            snprintf(label, sizeof(label), "%.8s:hist", tab_index >= 0 ? tabs[tab_index].tab_name : "closed");
+        else
+            snprintf(label, sizeof(label), "%.8s:%lu", tab_index >= 0 ? tabs[tab_index].tab_name : "closed",
+                     result->line + 1);
+
+        wchar_t *destination = tab->text_buffer[row + 1];
+        int col = 0;
+        for (; label[col] && col < GLOBAL_SEARCH_LABEL_WIDTH; col++)
+            destination[col] = (wchar_t)(unsigned char)label[col];
+        col = GLOBAL_SEARCH_LABEL_WIDTH + 1;
+        for (int index = 0; result->text[index] && col < BUFFER_COLS; index++)
+            destination[col++] = result->text[index];
+    }
+
+    update_command_display(tab);
+}
+
+// Function to decorate the results view: selected result reversed, matches underlined
+void global_search_row_styles(int row, unsigned char *styles)
+{
+    int result_index = global_search.view_top + row - 1;
+    if (row < 1 || row >= BUFFER_ROWS - 2 || result_index >= global_search.result_count)
+        return;
+
+    if (result_index == global_search.selected)
+    {
+        memset(styles, CELL_STYLE_REVERSE, BUFFER_COLS);
+        return;
+    }
+
+    int start = GLOBAL_SEARCH_LABEL_WIDTH + 1 + global_search.results[result_index].match_col;
+    for (int col = start; col < start + global_search.query_length && col < BUFFER_COLS; col++)
+        styles[col] = CELL_STYLE_UNDERLINE;
+}
+
+// Function to draw the query prompt on the command row
+void update_global_search_display(Tab *tab)
+{
+    int command_row = BUFFER_ROWS - 2;
+    const wchar_t *prompt = L"(search all tabs)`";
+    int col = 0;
+
+    for (int index = 0; index < BUFFER_COLS; index++)
+        tab->text_buffer[command_row][index] = L' ';
+    for (int index = 0; prompt[index] && col < BUFFER_COLS; index++)
+        tab->text_buffer[command_row][col++] = prompt[index];
+    for (int index = 0; index < global_search.query_length && col < BUFFER_COLS; index++)
+        tab->text_buffer[command_row][col++] = global_search.query[index];
+
+    tab->cursor_row = command_row;
+    tab->cursor_col = col < BUFFER_COLS ? col : BUFFER_COLS - 1;
+    if (col < BUFFER_COLS)
+        tab->text_buffer[command_row][col] = L'\'';
+}
+
+// Function to enter the cross-tab search view (Ctrl+Shift+F)
+void enter_global_search(Tab *tab)
+{
+    if (tab->find.active)
+        exit_find_mode(tab);
+
+    global_search.active = 1;
+    global_search.query_length = 0;
+    restart_global_search();
+    render_scrollback(tab);
+}
+
+// Function to leave the results view, optionally opening the selected result
+void exit_global_search(int open_selected)
+{
+    GlobalSearchResult selected_result;
+    int have_result = open_selected && global_search.selected < global_search.result_count;
+    if (have_result)
+        selected_result = global_search.results[global_search.selected];
+
+    global_search.active = 0;
+    cancel_global_search_job();
+
+    // Every tab that showed the view while it was active must rebuild its grid
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+        tabs[tab_index].grid_stale = 1;
+
+    int tab_index = have_result ? tab_index_for_id(selected_result.tab_id) : -1;
+    if (tab_index < 0)
+    {
+        activate_tab(active_tab_index);
+        return;
+    }
+
+    activate_tab(tab_index);
+    Tab *tab = &tabs[tab_index];
+
+    if (selected_result.from_history)
+    {
+        // History hit: the command goes on the command line, ready to edit or run
+        unsigned long history_index = selected_result.line;
+        if (history_index < (unsigned long)tab->history_count &&
+            wcsstr(tab->command_history[history_index], selected_result.text) != NULL)
+            line_editor_set_text(&tab->editor, tab->command_history[history_index]);
+        else
+            line_editor_set_text(&tab->editor, selected_result.text);
+        update_command_display(tab);
+        return;
+    }
+
+    // Scrollback hit: continue in that tab's find mode, positioned on the match
+    FindState *find = &tab->find;
+    enter_find_mode(tab);
+    find->regex = 0;
+    find->fold_case = 1;                 // Smart case, as the global search matched it
+    for (int index = 0; index < global_search.query_length; index++)
+        if (iswupper(global_search.query[index]))
+            find->fold_case = 0;
+    find->term_length = global_search.query_length;
+    wmemcpy(find->term, global_search.query, global_search.query_length);
+    if (selected_result.line >= tab->scrollback_first_line)
+    {
+        const wchar_t *text = scrollback_line(tab, (int)(selected_result.line - tab->scrollback_first_line));
+        int length = wcsnlen(text, BUFFER_COLS);
+        wchar_t *snippet_start = wcsstr(text, selected_result.text);
+        int snippet_offset = snippet_start ? (int)(snippet_start - text) : 0;
+
+        find->has_match = 1;
+        find->match_line = selected_result.line;
+        find->match_col = snippet_offset + selected_result.match_col;
+        find->match_length = global_search.query_length;
+        if (find->match_col + find->match_length > length)
+            find->match_length = length - find->match_col;
+        scroll_to_line(tab, find->match_line);
+    }
+    update_find_display(tab);
+}
+
+// Function to handle a key while the results view is open
+void handle_global_search_keypress(KeySym key_symbol, wchar_t wide_character, int control_pressed)
+{
+    int page = BUFFER_ROWS - 3;
+
+    switch (key_symbol)
+    {
+    case XK_Escape:
+        exit_global_search(0);
+        return;
+
+    case XK_Return:
+    case XK_KP_Enter:
+        exit_global_search(1);
+        return;
+
+    case XK_Up:
+        if (global_search.selected > 0)
+            global_search.selected--;
+        break;
+
+    case XK_Down:
+        if (global_search.selected < global_search.result_count - 1)
+            global_search.selected++;
+        break;
+
+    case XK_Page_Up:
+        global_search.selected = global_search.selected > page ? global_search.selected - page : 0;
+        break;
+
+    case XK_Page_Down:
+        global_search.selected += page;
+        if (global_search.selected > global_search.result_count - 1)
+            global_search.selected = global_search.result_count > 0 ? global_search.result_count - 1 : 0;
+        break;
+
+    case XK_BackSpace:
+        if (global_search.query_length == 0)
+            return;
+        global_search.query_length--;
+        restart_global_search();
+        break;
+
+    default:
+        if (!control_pressed && wide_character != L'\0' && iswprint(wide_character) &&
+            global_search.query_length < FIND_MAX_TERM)
+        {
+            global_search.query[global_search.query_length++] = wide_character;
+            restart_global_search();
+        }
+        break;
+    }
+
+    render_scrollback(&tabs[active_tab_index]);
+}
+
+// Function to stop the worker pool and free every job on shutdown
+void stop_global_search_workers(void)
+{
+    cancel_global_search_job();
+
+    pthread_mutex_lock(&global_search_pool_lock);
+    global_search_shutdown = 1;
+    pthread_cond_broadcast(&global_search_pool_wake);
+    pthread_mutex_unlock(&global_search_pool_lock);
+
+    for (int worker = 0; worker < global_search_worker_count; worker++)
+        pthread_join(global_search_workers[worker], NULL);
+    if (global_search_worker_count > 0)
+        printf("Global search workers stopped\n");
+    global_search_worker_count = 0;
+
+    reap_global_search_jobs();
+}
+
+// ============================================================================
+// COMMAND BLOCKS
+// ============================================================================
+//
+// Every command started by execute_command() is recorded as a block: its
+// "Executing:" header line through the last line printed before it finished.
+// Blocks live in a per-tab ring in scrollback order and are numbered with
+// consecutive serials, so a block is found from its serial in O(1). A folded
+// block shows only its header; the rows it hides are skipped when the view
+// maps display rows to scrollback lines.
+
+// Function to get the block at a position of the tab's ring (0 = oldest)
+static CommandBlock *command_block_at(Tab *tab, int position)
+{
+    return &tab->command_blocks[(tab->block_first + position) % MAX_COMMAND_BLOCKS];
+}
+
+// Function to find a block by serial (NULL once it has left the ring)
+CommandBlock *find_command_block(Tab *tab, unsigned long serial)
+{
+    if (tab->block_count == 0 || serial == 0)
+        return NULL;
+    unsigned long oldest = command_block_at(tab, 0)->serial;
+    if (serial < oldest || serial - oldest >= (unsigned long)tab->block_count)
+        return NULL;
+    return command_block_at(tab, (int)(serial - oldest));
+}
+
+// Function to get the absolute line after a block's last line (running blocks grow with the scrollback)
+static unsigned long command_block_end(Tab *tab, const CommandBlock *block)
+{
+    return block->running ? tab->scrollback_first_line + tab->scrollback_count : block->end_line;
+}
+
+// Function to count the scrollback lines a folded block hides (everything after its header)
+static int command_block_hidden_lines(Tab *tab, const CommandBlock *block)
+{
+    if (!block->folded)
+        return 0;
+    long hidden = (long)(command_block_end(tab, block) - block->start_line) - 1;
+    return hidden > 0 ? (int)hidden : 0;
+}
+
+// Function to count the rows the scrollback occupies on screen (folded output excluded)
+int scrollback_display_count(Tab *tab)
+{
+    int display_count = tab->scrollback_count;
+    for (int position = 0; position < tab->block_count && tab->folded_block_count > 0; position++)
+        display_count -= command_block_hidden_lines(tab, command_block_at(tab, position));
+    return display_count;
+}
+
+// Function to map a content row of the view to a scrollback index (-1 below the content)
+int scrollback_row_index(Tab *tab, int row)
+{
+    if (row < 0 || row >= BUFFER_ROWS - 2)
+        return -1;
+
+    // Display row -> line: every folded block whose header is above pushes the line down
+    int index = scrollback_view_start(tab) + row;
+    for (int position = 0; position < tab->block_count && tab->folded_block_count > 0; position++)
+    {
+        CommandBlock *block = command_block_at(tab, position);
+        long header_index = (long)(block->start_line - tab->scrollback_first_line);
+        if (header_index >= index)
+            break;
+        index += command_block_hidden_lines(tab, block);
+    }
+    return index < tab->scrollback_count ? index : -1;
+}
+
+// Function to map a scrollback index to its display row (a hidden line maps to its block's header)
+int scrollback_display_row(Tab *tab, int index)
+{
+    int display_row = index;
+    for (int position = 0; position < tab->block_count && tab->folded_block_count > 0; position++)
+    {
+        CommandBlock *block = command_block_at(tab, position);
+        long header_index = (long)(block->start_line - tab->scrollback_first_line);
+        if (header_index >= index)
+            break;
+        int hidden = command_block_hidden_lines(tab, block);
+        if (index <= header_index + hidden)
+            return display_row - (index - header_index);
+        display_row -= hidden;
+    }
+    return display_row;
+}
+
+// Function to find the folded block whose header sits on a scrollback index (NULL if none)
+CommandBlock *folded_block_at(Tab *tab, int index)
+{
+    if (tab->folded_block_count == 0)
+        return NULL;
+    for (int position = 0; position < tab->block_count; position++)
+    {
+        CommandBlock *block = command_block_at(tab, position);
+        if (block->folded && block->start_line == tab->scrollback_first_line + index)
+            return block;
+    }
+    return NULL;
+}
+
+// Function to fold or unfold a block; returns 1 if its state changed
+int set_command_block_folded(Tab *tab, CommandBlock *block, int folded)
+{
+    if (block->folded == folded)
+        return 0;
+    if (folded && block->start_line < tab->scrollback_first_line)
+        return 0;                        // The header already scrolled out of the buffer
+
+    block->folded = folded;
+    tab->folded_block_count += folded ? 1 : -1;
+    return 1;
+}
+
+// Function to record the start of a command whose header line was just added
+void begin_command_block(Tab *tab, const char *command)
+{
+    // Step 1: Make room by forgetting the oldest block
+    if (tab->block_count == MAX_COMMAND_BLOCKS)
+    {
+        set_command_block_folded(tab, command_block_at(tab, 0), 0);
+        tab->block_first = (tab->block_first + 1) % MAX_COMMAND_BLOCKS;
+        tab->block_count--;
+    }
+
+    // Step 2: The header is the newest scrollback line
+    CommandBlock *block = command_block_at(tab, tab->block_count);
+    memset(block, 0, sizeof(*block));
+    block->serial = tab->next_block_serial++;
+    block->start_line = tab->scrollback_first_line + tab->scrollback_count - 1;
+    block->running = 1;
+    block->exit_status = -1;
+    block->start_ms = monotonic_ms();
+    snprintf(block->command, sizeof(block->command), "%s", command);
+    tab->block_count++;
+
+    // execute_command() either hands this to a job or closes it when it returns
+    tab->pending_block_serial = block->serial;
+}
+
+// Function to close a block once its command finished (exit code, 128+signal, or -1 if it never ran)
+void end_command_block(Tab *tab, unsigned long serial, int exit_status)
+{
+    CommandBlock *block = find_command_block(tab, serial);
+    if (!block || !block->running)
+        return;
+
+    block->end_line = tab->scrollback_first_line + tab->scrollback_count;
+    block->running = 0;
+    block->exit_status = exit_status;
+    block->duration_ms = monotonic_ms() - block->start_ms;
+    record_block_end(tab, block);
+    publish_block_end(tab, block);
+}
+
+// Function to forget blocks that scrolled out of the buffer (called after the scrollback shifted)
+void trim_command_blocks(Tab *tab)
+{
+    while (tab->block_count > 0)
+    {
+        CommandBlock *block = command_block_at(tab, 0);
+        if (block->running || command_block_end(tab, block) > tab->scrollback_first_line)
+            break;
+        set_command_block_folded(tab, block, 0);
+        tab->block_first = (tab->block_first + 1) % MAX_COMMAND_BLOCKS;
+        tab->block_count--;
+    }
+
+    // A block whose header is gone can no longer be shown folded
+    for (int position = 0; position < tab->block_count && tab->folded_block_count > 0; position++)
+    {
+        CommandBlock *block = command_block_at(tab, position);
+        if (block->start_line >= tab->scrollback_first_line)
+            break;
+        set_command_block_folded(tab, block, 0);
+    }
+}
+
+// Function to unfold whichever block hides a scrollback index (so find can show a match inside it)
+void reveal_scrollback_line(Tab *tab, int index)
+{
+    for (int position = 0; position < tab->block_count && tab->folded_block_count > 0; position++)
+    {
+        CommandBlock *block = command_block_at(tab, position);
+        long header_index = (long)(block->start_line - tab->scrollback_first_line);
+        if (header_index >= index)
+            break;
+        if (index <= header_index + command_block_hidden_lines(tab, block))
+            set_command_block_folded(tab, block, 0);
+    }
+}
+
+// Function to scroll so a display row is the top row of the view (as far as the content allows)
+static void scroll_display_row_to_top(Tab *tab, int display_row)
+{
+    int visible_content_lines = BUFFER_ROWS - 2;
+    int offset = scrollback_display_count(tab) - visible_content_lines - display_row;
+    tab->scrollback_offset = offset > 0 ? offset : 0;
+    if (tab->scrollback_offset > tab->max_scrollback_offset)
+        tab->max_scrollback_offset = tab->scrollback_offset;
+}
+
+// Function to jump to the previous (-1) or next (+1) command's header; returns 1 if the view moved
+int jump_to_command_block(Tab *tab, int direction)
+{
+    if (tab->block_count == 0)
+        return 0;
+
+    // Step 1: Continue from the block jumped to last if the view has not moved since (O(1))
+    CommandBlock *target = NULL;
+    if (tab->block_cursor != 0 && tab->block_cursor_view == scrollback_view_start(tab) &&
+        find_command_block(tab, tab->block_cursor) != NULL)
+    {
+        target = find_command_block(tab, tab->block_cursor + direction);
+    }
+    else
+    {
+        // Otherwise locate the view's top line among the blocks (binary search over the ring)
+        int top_index = scrollback_row_index(tab, 0);
+        unsigned long top_line = tab->scrollback_first_line + (top_index >= 0 ? top_index : 0);
+        int low = 0, high = tab->block_count;
+        while (low < high)
+        {
+            int middle = (low + high) / 2;
+            if (command_block_at(tab, middle)->start_line < top_line)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        // low = first block whose header is at or below the top line
+        int position = direction < 0 ? low - 1 : low;
+        if (direction > 0 && position < tab->block_count && command_block_at(tab, position)->start_line == top_line)
+            position++;
+        if (position >= 0 && position < tab->block_count)
+            target = command_block_at(tab, position);
+    }
+
+    if (!target || target->start_line < tab->scrollback_first_line)
+        return 0;
+
+    // Step 2: Put its header on the top row
+    scroll_display_row_to_top(tab, scrollback_display_row(tab, (int)(target->start_line - tab->scrollback_first_line)));
+    render_scrollback(tab);
+    tab->block_cursor = target->serial;
+    tab->block_cursor_view = scrollback_view_start(tab);
+    return 1;
+}
+
+// Function to replace a finished block's output with one marker line, freeing its scrollback bytes
+int drop_command_block_output(Tab *tab, CommandBlock *block)
+{
+    if (block->running || block->start_line < tab->scrollback_first_line)
+        return -1;
+
+    int header_index = (int)(block->start_line - tab->scrollback_first_line);
+    int output_lines = (int)(block->end_line - block->start_line) - 1;
+    if (output_lines <= 1)
+        return 0;                        // Nothing worth dropping
+
+    // Step 1: Keep one marker line after the header and close the gap behind it
+    set_command_block_folded(tab, block, 0);
+    int marker_index = header_index + 1;
+    int removed = output_lines - 1;
+    char marker[64];
+    snprintf(marker, sizeof(marker), "[output dropped: %d lines]", output_lines + block->dropped_lines);
+    if (scrollback_replace_lines(tab, marker_index, output_lines, marker) < 0)
+        return -1;
+    block->dropped_lines += removed;
+    block->end_line -= removed;
+
+    // Step 2: Later lines moved up - fix everything that refers to them by absolute number
+    for (int position = 0; position < tab->block_count; position++)
+    {
+        CommandBlock *later = command_block_at(tab, position);
+        if (later->start_line > block->start_line)
+        {
+            later->start_line -= removed;
+            if (!later->running)
+                later->end_line -= removed;
+        }
+    }
+    if (tab->find.has_match && tab->find.match_line > block->start_line)
+    {
+        if (tab->find.match_line <= block->start_line + removed + 1)
+            tab->find.has_match = 0;
+        else
+            tab->find.match_line -= removed;
+    }
+    if (mouse_selection.tab_id == tab->tab_id)
+        clear_mouse_selection(NULL, CurrentTime); // Requests for it are refused from now on
+
+    return removed;
+}
+
+// Function to describe a block's exit status for listings and fold summaries
+static void format_command_block_status(const CommandBlock *block, char *text, size_t size)
+{
+    if (block->running)
+        snprintf(text, size, "running");
+    else if (block->exit_status < 0)
+        snprintf(text, size, "not run");
+    else if (block->exit_status > 128)
+        snprintf(text, size, "signal %d", block->exit_status - 128);
+    else
+        snprintf(text, size, "exit %d", block->exit_status);
+}
+
+// Function to write a folded block's summary after its header text in a grid row
+void append_fold_summary(Tab *tab, CommandBlock *block, wchar_t *row_text)
+{
+    char status[32];
+    format_command_block_status(block, status, sizeof(status));
+
+    char summary[96];
+    snprintf(summary, sizeof(summary), "  [+%d lines folded, %s, %.2fs]", command_block_hidden_lines(tab, block),
+             status, (block->running ? monotonic_ms() - block->start_ms : block->duration_ms) / 1000.0);
+
+    int col = wcsnlen(row_text, BUFFER_COLS);
+    while (col > 0 && row_text[col - 1] == L' ')
+        col--;
+    for (int index = 0; summary[index] && col < BUFFER_COLS; index++)
+        row_text[col++] = (wchar_t)(unsigned char)summary[index];
+}
+
+// Function to pick the block a fold/unfold/drop command without a number applies to
+static CommandBlock *default_command_block(Tab *tab)
+{
+    CommandBlock *block = find_command_block(tab, tab->block_cursor);
+    if (block)
+        return block;
+
+    // Newest finished block
+    for (int position = tab->block_count - 1; position >= 0; position--)
+    {
+        if (!command_block_at(tab, position)->running)
+            return command_block_at(tab, position);
+    }
+    return NULL;
+}
+
+// Function to handle the blocks / fold / unfold / drop builtins
+void handle_blocks_command(Tab *tab, const char *name, const char *argument)
+{
+    char message[256];
+
+    // Step 1: "blocks" lists the most recent blocks
+    if (strcmp(name, "blocks") == 0)
+    {
+        if (tab->block_count == 0)
+        {
+            add_text_to_buffer(tab, "No command blocks in this tab");
+            return;
+        }
+        int first = tab->block_count > 10 ? tab->block_count - 10 : 0;
+        for (int position = first; position < tab->block_count; position++)
+        {
+            CommandBlock *block = command_block_at(tab, position);
+            char status[32];
+            format_command_block_status(block, status, sizeof(status));
+            long lines = (long)(command_block_end(tab, block) - block->start_line) - 1 + block->dropped_lines;
+            snprintf(message, sizeof(message), "  #%-4lu %-9s %7.2fs %6ld lines%s  %.40s", block->serial, status,
+                     (block->running ? monotonic_ms() - block->start_ms : block->duration_ms) / 1000.0, lines,
+                     block->folded ? " [folded]" : (block->dropped_lines ? " [dropped]" : ""), block->command);
+            add_text_to_buffer(tab, message);
+        }
+        return;
+    }
+
+    // Step 2: "fold all" / "unfold all"
+    int folding = strcmp(name, "fold") == 0;
+    if (argument && strcmp(argument, "all") == 0 && strcmp(name, "drop") != 0)
+    {
+        int changed = 0;
+        for (int position = 0; position < tab->block_count; position++)
+            changed += set_command_block_folded(tab, command_block_at(tab, position), folding);
+        snprintf(message, sizeof(message), "%s %d block(s)", folding ? "Folded" : "Unfolded", changed);
+        add_text_to_buffer(tab, message);
+        return;
+    }
+
+    // Step 3: A single block, by number or the current one
+    CommandBlock *block = argument ? find_command_block(tab, strtoul(argument + (argument[0] == '#'), NULL, 10))
+                                   : default_command_block(tab);
+    if (!block)
+    {
+        snprintf(message, sizeof(message), "%s: no such block (see 'blocks')", name);
+        add_text_to_buffer(tab, message);
+        return;
+    }
+
+    if (strcmp(name, "drop") == 0)
+    {
+        int removed = drop_command_block_output(tab, block);
+        if (removed < 0)
+            snprintf(message, sizeof(message), "drop: block #%lu is still running or partly scrolled out", block->serial);
+        else if (removed == 0)
+            snprintf(message, sizeof(message), "drop: block #%lu has nothing to drop (one line of output at most)", block->serial);
+        else
+            snprintf(message, sizeof(message), "Dropped %d line(s) of block #%lu", removed, block->serial);
+    }
+    else if (set_command_block_folded(tab, block, folding))
+    {
+        snprintf(message, sizeof(message), "%s block #%lu", folding ? "Folded" : "Unfolded", block->serial);
+    }
+    else
+    {
+        snprintf(message, sizeof(message), "Block #%lu is already %s", block->serial, folding ? "folded" : "unfolded");
+    }
+    add_text_to_buffer(tab, message);
+}
+
+// ============================================================================
+// MIT-SHM SOFTWARE RASTERIZER
+// ============================================================================
+
+// Function to read the monotonic clock in microseconds
+long long monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// Function to account one draw_text_buffer() call to the active renderer
+void record_render_stats(long long paint_start_us, int damaged_rows)
+{
+    RenderStats *stats = &render_stats[active_renderer];
+    stats->frames++;
+    stats->damaged_rows += damaged_rows;
+    stats->total_us += monotonic_us() - paint_start_us;
+    perf_phase_end();
+    trace_complete(TRACE_FRAME, paint_start_us, damaged_rows, (long long)damaged_rows * BUFFER_COLS);
+}
+
+// Function to fill a rectangle of a 32bpp image with a pixel value
+void raster_fill(XImage *image, int x, int y, int width, int height, unsigned long pixel)
+{
+    // Step 1: Clip the rectangle to the image
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (x + width > image->width)
+        width = image->width - x;
+    if (y + height > image->height)
+        height = image->height - y;
+    if (width <= 0 || height <= 0)
+        return;
+
+    // Step 2: Store whole pixels row by row
+    for (int row = y; row < y + height; row++)
+    {
+        uint32_t *destination = (uint32_t *)(image->data + (size_t)row * image->bytes_per_line) + x;
+        for (int col = 0; col < width; col++)
+        {
+            destination[col] = (uint32_t)pixel;
+        }
+    }
+}
+
+// Function to blend a colour into a run of pixels using 8-bit coverage values
+static void blend_span(uint32_t *destination, const unsigned char *coverage, int count, uint32_t color)
+{
+    int index = 0;
+
+#ifdef __SSE2__
+    // Four pixels per iteration: dst = (dst * (255 - a) + color * a) / 255 per channel
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i all_255 = _mm_set1_epi16(255);
+    const __m128i rounding = _mm_set1_epi16(128);
+    const __m128i color_wide = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+
+    for (; index + 4 <= count; index += 4)
+    {
+        uint32_t coverage_quad;
+        memcpy(&coverage_quad, coverage + index, sizeof(coverage_quad));
+        if (coverage_quad == 0)
+            continue; // No ink in these four pixels
+        if (coverage_quad == 0xFFFFFFFFu)
+        {
+            // Fully covered - plain store
+            _mm_storeu_si128((__m128i *)(destination + index), _mm_set1_epi32((int)color));
+            continue;
+        }
+
+        // Replicate each coverage byte across its pixel's four channels
+        __m128i alpha = _mm_cvtsi32_si128((int)coverage_quad);
+        alpha = _mm_unpacklo_epi8(alpha, alpha);
+        alpha = _mm_unpacklo_epi16(alpha, alpha);
+        __m128i alpha_low = _mm_unpacklo_epi8(alpha, zero);
+        __m128i alpha_high = _mm_unpackhi_epi8(alpha, zero);
+
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(destination + index));
+        __m128i pixels_low = _mm_unpacklo_epi8(pixels, zero);
+        __m128i pixels_high = _mm_unpackhi_epi8(pixels, zero);
+
+        // Weighted sum fits in 16 bits (at most 255 * 255)
+        __m128i sum_low = _mm_add_epi16(_mm_mullo_epi16(pixels_low, _mm_sub_epi16(all_255, alpha_low)),
+                                        _mm_mullo_epi16(color_wide, alpha_low));
+        __m128i sum_high = _mm_add_epi16(_mm_mullo_epi16(pixels_high, _mm_sub_epi16(all_255, alpha_high)),
+                                         _mm_mullo_epi16(color_wide, alpha_high));
+
+        // Exact division by 255: t = x + 128; (t + (t >> 8)) >> 8
+        sum_low = _mm_add_epi16(sum_low, rounding);
+        sum_high = _mm_add_epi16(sum_high, rounding);
+        sum_low = _mm_srli_epi16(_mm_add_epi16(sum_low, _mm_srli_epi16(sum_low, 8)), 8);
+        sum_high = _mm_srli_epi16(_mm_add_epi16(sum_high, _mm_srli_epi16(sum_high, 8)), 8);
+
+        _mm_storeu_si128((__m128i *)(destination + index), _mm_packus_epi16(sum_low, sum_high));
+    }
+#endif
+
+    // Scalar tail (and the whole span on targets without SSE2)
+    for (; index < count; index++)
+    {
+        unsigned int alpha = coverage[index];
+        if (alpha == 0)
+            continue;
+        if (alpha == 255)
+        {
+            destination[index] = color;
+            continue;
+        }
+
+        uint32_t pixel = destination[index];
+        uint32_t blended = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            unsigned int value = ((pixel >> shift) & 0xFF) * (255 - alpha) + ((color >> shift) & 0xFF) * alpha + 128;
+            blended |= (uint32_t)(((value + (value >> 8)) >> 8) & 0xFF) << shift;
+        }
+        destination[index] = blended;
+    }
+}
+
+// Function to find a glyph's atlas slot (an empty slot if it is not cached yet)
+static GlyphEntry *find_glyph_slot(wchar_t character)
+{
+    unsigned int slot = ((unsigned int)character * 2654435761u) % GLYPH_ATLAS_SLOTS;
+    for (int probe = 0; probe < GLYPH_ATLAS_SLOTS; probe++)
+    {
+        GlyphEntry *entry = &glyph_atlas[(slot + probe) % GLYPH_ATLAS_SLOTS];
+        if (!entry->in_use || entry->character == character)
+            return entry;
+    }
+    return NULL; // Atlas is full
+}
+
+// Function to pre-render glyphs with the server's core font and read their
+// coverage back into the atlas (one round trip per batch)
+static int capture_glyphs(Display *display, Window window, const wchar_t *characters, int count)
+{
+    if (count <= 0)
+        return 0;
+
+    int strip_width = count * GLYPH_CELL_WIDTH;
+    int screen = DefaultScreen(display);
+
+    // Step 1: Draw every glyph into its own cell of a scratch strip
+    Pixmap strip = XCreatePixmap(display, window, strip_width, GLYPH_CELL_HEIGHT, DefaultDepth(display, screen));
+    GC strip_gc = XCreateGC(display, strip, 0, NULL); // Same default font as the window GC
+    XSetForeground(display, strip_gc, WhitePixel(display, screen));
+    XFillRectangle(display, strip, strip_gc, 0, 0, strip_width, GLYPH_CELL_HEIGHT);
+    XSetForeground(display, strip_gc, BlackPixel(display, screen));
+
+    for (int index = 0; index < count; index++)
+    {
+        char multibyte_char[MB_CUR_MAX + 1];
+        int char_length = wctomb(multibyte_char, characters[index]);
+        if (char_length <= 0)
+        {
+            multibyte_char[0] = '?'; // Same fallback as the XDrawString path
+            char_length = 1;
+        }
+        XDrawString(display, strip, strip_gc, index * GLYPH_CELL_WIDTH + GLYPH_ORIGIN_X, GLYPH_BASELINE,
+                    multibyte_char, char_length);
+    }
+
+    // Step 2: Read the strip back and convert inked pixels to coverage
+    XImage *strip_image = XGetImage(display, strip, 0, 0, strip_width, GLYPH_CELL_HEIGHT, AllPlanes, ZPixmap);
+    x_round_trips++; // XGetImage waits for the pixels
+    XFreeGC(display, strip_gc);
+    XFreePixmap(display, strip);
+    if (!strip_image)
+    {
+        printf("Warning: Failed to read back glyph strip\n");
+        return -1;
+    }
+
+    unsigned long background = WhitePixel(display, screen);
+    for (int index = 0; index < count; index++)
+    {
+        GlyphEntry *entry = find_glyph_slot(characters[index]);
+        if (!entry)
+            break;
+
+        entry->in_use = 1;
+        entry->character = characters[index];
+        entry->ink_left = GLYPH_CELL_WIDTH;
+        entry->ink_right = -1;
+
+        for (int row = 0; row < GLYPH_CELL_HEIGHT; row++)
+        {
+            for (int col = 0; col < GLYPH_CELL_WIDTH; col++)
+            {
+                int inked = XGetPixel(strip_image, index * GLYPH_CELL_WIDTH + col, row) != background;
+                entry->coverage[row][col] = inked ? 255 : 0;
+                if (inked)
+                {
+                    if (col < entry->ink_left)
+                        entry->ink_left = col;
+                    if (col > entry->ink_right)
+                        entry->ink_right = col;
+                }
+            }
+        }
+    }
+
+    XDestroyImage(strip_image);
+    return 0;
+}
+
+// Function to look up a glyph, rendering it on first use
+static GlyphEntry *lookup_glyph(wchar_t character)
+{
+    GlyphEntry *entry = find_glyph_slot(character);
+    if (entry && entry->in_use)
+        return entry;
+
+    // Not cached yet: capture it now (a single extra round trip per new character)
+    if (entry && glyph_display && capture_glyphs(glyph_display, glyph_window, &character, 1) == 0)
+    {
+        entry = find_glyph_slot(character);
+        if (entry && entry->in_use)
+            return entry;
+    }
+
+    // Atlas full or capture failed - fall back to the question mark
+    entry = find_glyph_slot(L'?');
+    return (entry && entry->in_use) ? entry : NULL;
+}
+
+// Function to blend a glyph into the image with its origin at (x, baseline_y)
+void raster_draw_glyph(XImage *image, int x, int baseline_y, wchar_t character, unsigned long pixel)
+{
+    GlyphEntry *glyph = lookup_glyph(character);
+    if (!glyph || glyph->ink_right < glyph->ink_left)
+        return; // Blank glyph (or no atlas)
+
+    int cell_left = x - GLYPH_ORIGIN_X;
+    int cell_top = baseline_y - GLYPH_BASELINE;
+
+    // Clip the inked columns to the image
+    int first_col = glyph->ink_left;
+    int last_col = glyph->ink_right;
+    if (cell_left + first_col < 0)
+        first_col = -cell_left;
+    if (cell_left + last_col >= image->width)
+        last_col = image->width - 1 - cell_left;
+    if (first_col > last_col)
+        return;
+
+    for (int row = 0; row < GLYPH_CELL_HEIGHT; row++)
+    {
+        int image_row = cell_top + row;
+        if (image_row < 0 || image_row >= image->height)
+            continue;
+
+        uint32_t *destination = (uint32_t *)(image->data + (size_t)image_row * image->bytes_per_line);
+        blend_span(destination + cell_left + first_col, &glyph->coverage[row][first_col],
+                   last_col - first_col + 1, (uint32_t)pixel);
+    }
+}
+
+// Function to draw a single-byte string, advancing by the core font's widths
+void raster_draw_string(XImage *image, int x, int baseline_y, const char *text, int length, unsigned long pixel)
+{
+    for (int index = 0; index < length; index++)
+    {
+        unsigned char byte = (unsigned char)text[index];
+        raster_draw_glyph(image, x, baseline_y, byte < 0x80 ? (wchar_t)byte : L'?', pixel);
+        x += font_advance[byte];
+    }
+}
+
+// Temporary error handler used while attaching the shared segment
+static int shm_attach_error_handler(Display *display, XErrorEvent *error_event)
+{
+    (void)display;
+    (void)error_event;
+    shm_attach_failed = 1;
+    return 0;
+}
+
+// Function to set up the shared-memory image and glyph atlas; returns 0 on success
+int init_shm_renderer(Display *display, Window window, GC gc)
+{
+    if (shm_image)
+        return 0; // Already initialized
+
+    int screen = DefaultScreen(display);
+    Visual *visual = DefaultVisual(display, screen);
+    int depth = DefaultDepth(display, screen);
+
+    // Step 1: The extension must exist (it never does on a remote display)
+    if (!XShmQueryExtension(display))
+    {
+        printf("MIT-SHM extension not available\n");
+        return -1;
+    }
+
+    // Step 2: The rasterizer writes 8-bit channels into 32-bit pixels
+    if (depth < 24 || visual->red_mask != 0xFF0000 || visual->green_mask != 0xFF00 || visual->blue_mask != 0xFF)
+    {
+        printf("MIT-SHM renderer needs a 24-bit TrueColor visual (depth %d)\n", depth);
+        return -1;
+    }
+
+    // Step 3: Create the image and its shared segment
+    int frame_width = BUFFER_COLS * CHAR_WIDTH;
+    int frame_height = BUFFER_ROWS * CHAR_HEIGHT;
+    XImage *image = XShmCreateImage(display, visual, depth, ZPixmap, NULL, &shm_segment, frame_width, frame_height);
+    if (!image || image->bits_per_pixel != 32)
+    {
+        printf("Failed to create a 32bpp shared image\n");
+        if (image)
+            XDestroyImage(image);
+        return -1;
+    }
+
+    shm_segment.shmid = shmget(IPC_PRIVATE, (size_t)image->bytes_per_line * image->height, IPC_CREAT | 0600);
+    if (shm_segment.shmid == -1)
+    {
+        perror("shmget");
+        XDestroyImage(image);
+        return -1;
+    }
+    shm_segment.shmaddr = image->data = shmat(shm_segment.shmid, NULL, 0);
+    shm_segment.readOnly = False;
+    if (shm_segment.shmaddr == (char *)-1)
+    {
+        perror("shmat");
+        shmctl(shm_segment.shmid, IPC_RMID, NULL);
+        image->data = NULL;
+        XDestroyImage(image);
+        return -1;
+    }
+
+    // Step 4: Attach on the server side, catching the error a remote server raises
+    shm_attach_failed = 0;
+    XSync(display, False);
+    XErrorHandler previous_handler = XSetErrorHandler(shm_attach_error_handler);
+    XShmAttach(display, &shm_segment);
+    XSync(display, False);
+    XSetErrorHandler(previous_handler);
+    x_round_trips += 2;
+
+    // The segment is released automatically once both sides detach
+    shmctl(shm_segment.shmid, IPC_RMID, NULL);
+
+    if (shm_attach_failed)
+    {
+        printf("X server could not attach the shared segment\n");
+        shmdt(shm_segment.shmaddr);
+        image->data = NULL;
+        XDestroyImage(image);
+        return -1;
+    }
+
+    shm_image = image;
+    shm_completion_event_type = XShmGetEventBase(display) + ShmCompletion;
+    shm_put_pending = 0;
+    shm_image_tab_id = 0;
+
+    // Step 5: Record the core font's advance widths for header strings
+    XFontStruct *font_info = XQueryFont(display, XGContextFromGC(gc));
+    x_round_trips++;
+    for (int byte = 0; byte < 256; byte++)
+    {
+        int advance = CHAR_WIDTH;
+        if (font_info)
+        {
+            advance = font_info->max_bounds.width;
+            if (font_info->per_char && byte >= (int)font_info->min_char_or_byte2 &&
+                byte <= (int)font_info->max_char_or_byte2)
+            {
+                advance = font_info->per_char[byte - font_info->min_char_or_byte2].width;
+            }
+        }
+        font_advance[byte] = (unsigned char)advance;
+    }
+    if (font_info)
+        XFreeFontInfo(NULL, font_info, 1);
+
+    // Step 6: Pre-render printable ASCII in one round trip
+    glyph_display = display;
+    glyph_window = window;
+    wchar_t ascii_glyphs[95];
+    for (int index = 0; index < 95; index++)
+    {
+        ascii_glyphs[index] = (wchar_t)(32 + index);
+    }
+    capture_glyphs(display, window, ascii_glyphs, 95);
+
+    printf("MIT-SHM renderer ready (%dx%d, %d bytes per line)\n", frame_width, frame_height, image->bytes_per_line);
+    return 0;
+}
+
+// Function to release the shared image (before switching back or closing the display)
+void shutdown_shm_renderer(Display *display)
+{
+    if (!shm_image)
+        return;
+
+    XShmDetach(display, &shm_segment);
+    XSync(display, False); // The server must be done with the segment before shmdt
+    x_round_trips++;
+    shmdt(shm_segment.shmaddr);
+    shm_image->data = NULL;
+    XDestroyImage(shm_image);
+    shm_image = NULL;
+    shm_put_pending = 0;
+
+    memset(glyph_atlas, 0, sizeof(glyph_atlas));
+    glyph_display = NULL;
+}
+
+// Predicate used to wait for the completion of our last XShmPutImage
+static Bool is_shm_completion(Display *display, XEvent *event, XPointer unused)
+{
+    (void)display;
+    (void)unused;
+    return event->type == shm_completion_event_type;
+}
+
+// Function to rasterize the damaged parts of a frame and upload them with one XShmPutImage
+void shm_paint_frame(Display *display, Drawable frame, GC gc, Tab *active_tab,
+                     int *row_damaged, int header_damaged, int full_frame)
+{
+    // Step 1: The server may still be reading the previous upload
+    if (shm_put_pending)
+    {
+        XEvent completion;
+        XIfEvent(display, &completion, is_shm_completion, NULL);
+        shm_put_pending = 0;
+        x_round_trips++; // Stalls just like a reply would
+    }
+
+    // Step 2: Find the vertical extent of the damage
+    int top = header_damaged ? 0 : BUFFER_ROWS * CHAR_HEIGHT;
+    int bottom = header_damaged ? CHAR_HEIGHT : 0;
+    for (int row = 0; row < BUFFER_ROWS; row++)
+    {
+        if (!row_damaged[row])
+            continue;
+        int band_top = row * CHAR_HEIGHT + FRAME_ROW_TOP_PAD;
+        if (band_top < top)
+            top = band_top;
+        if (band_top + CHAR_HEIGHT > bottom)
+            bottom = band_top + CHAR_HEIGHT;
+    }
+    if (full_frame)
+    {
+        top = 0;
+        bottom = BUFFER_ROWS * CHAR_HEIGHT;
+    }
+    if (bottom > shm_image->height)
+        bottom = shm_image->height;
+    if (top >= bottom)
+        return;
+
+    // Step 3: If the image last held another tab, every row inside the uploaded
+    // rectangle has to be rasterized, not just the damaged ones
+    int paint_rows[BUFFER_ROWS];
+    memcpy(paint_rows, row_damaged, sizeof(paint_rows));
+    if (shm_image_tab_id != active_tab->tab_id)
+    {
+        for (int row = 0; row < BUFFER_ROWS - 1; row++)
+        {
+            int band_top = row * CHAR_HEIGHT + FRAME_ROW_TOP_PAD;
+            if (band_top < bottom && band_top + CHAR_HEIGHT > top)
+                paint_rows[row] = 1;
+        }
+        if (paint_rows[0])
+            header_damaged = 1;
+        full_frame = 1;
+        shm_image_tab_id = active_tab->tab_id;
+    }
+
+    // Step 4: Rasterize client-side, then upload the rectangle in one request
+    FrameSurface raster_surface = {display, frame, gc, shm_image, 0};
+    paint_frame_damage(&raster_surface, active_tab, paint_rows, header_damaged, full_frame);
+
+    XShmPutImage(display, frame, gc, shm_image, 0, top, 0, top, shm_image->width, bottom - top, True);
+    shm_put_pending = 1;
+}
+
+// Function to switch renderers at runtime; returns 0 on success
+int set_renderer(Display *display, Window window, GC gc, int renderer)
+{
+    if (renderer == active_renderer)
+        return 0;
+
+    if (renderer == RENDERER_SHM && init_shm_renderer(display, window, gc) != 0)
+    {
+        printf("Falling back to the %s renderer\n", renderer_names[active_renderer]);
+        return -1;
+    }
+    if (renderer == RENDERER_XLIB)
+    {
+        shutdown_shm_renderer(display);
+    }
+
+    // Cached frames were drawn by the other renderer; repaint them from scratch
+    release_all_frame_pixmaps();
+    active_renderer = renderer;
+    printf("Renderer switched to %s\n", renderer_names[renderer]);
+    return 0;
+}
+
+// Function to handle the 'renderer' built-in: show stats or switch backend
+void handle_renderer_command(Display *display, Window window, GC gc, Tab *tab, const char *requested)
+{
+    char message[256];
+
+    // Step 1: Switch if a backend was named
+    if (requested && display == NULL)
+    {
+        add_text_to_buffer(tab, "renderer: no display to switch here (detached server or script)");
+        return;
+    }
+    if (requested)
+    {
+        int renderer = -1;
+        for (int index = 0; index < RENDERER_COUNT; index++)
+        {
+            if (strcmp(requested, renderer_names[index]) == 0)
+                renderer = index;
+        }
+        if (renderer == -1)
+        {
+            snprintf(message, sizeof(message), "renderer: unknown backend '%s' (use xlib or shm)", requested);
+            add_text_to_buffer(tab, message);
+            return;
+        }
+        if (set_renderer(display, window, gc, renderer) != 0)
+        {
+            snprintf(message, sizeof(message), "renderer: %s is not available on this display", requested);
+            add_text_to_buffer(tab, message);
+            return;
+        }
+    }
+
+    // Step 2: Report per-renderer frame statistics for benchmarking
+    snprintf(message, sizeof(message), "Active renderer: %s", renderer_names[active_renderer]);
+    add_text_to_buffer(tab, message);
+    for (int index = 0; index < RENDERER_COUNT; index++)
+    {
+        RenderStats *stats = &render_stats[index];
+        double average_us = stats->frames ? (double)stats->total_us / stats->frames : 0.0;
+        snprintf(message, sizeof(message), "  %-5s %8lu frames  %10lu rows  avg %.1f us/frame (client side)",
+                 renderer_names[index], stats->frames, stats->damaged_rows, average_us);
+        add_text_to_buffer(tab, message);
+    }
+
+    // Step 3: Report X protocol cost of typing (requests and blocking round trips)
+    if (keystroke_count > 0)
+    {
+        snprintf(message, sizeof(message), "X protocol: %.1f requests, %.2f round trips per keystroke (%lu keystrokes)",
+                 (double)keystroke_requests / keystroke_count, (double)keystroke_round_trips / keystroke_count,
+                 keystroke_count);
+        add_text_to_buffer(tab, message);
+    }
+}
+
+// Function to cleanup multiWatch processes (blocking - used on shutdown)
+void cleanup_multiwatch()
+{
+    printf("Cleaning up multiWatch processes and resources\n");
+
+    // Iterate through all registered multiwatch processes
+    for (int process_index = 0; process_index < multiwatch_count; process_index++)
+    {
+        MultiWatchProcess *process = &multiwatch_processes[process_index];
+
+        if (process->active && process->pid > 0)
+        {
+            int process_pid = process->pid;
+            printf("Terminating multiwatch process %d\n", process_pid);
+
+            // Step 1: Send SIGTERM to the entire process group
+            // This ensures all child processes created by the multiwatch command are also terminated
+            kill(-process_pid, SIGTERM);
+
+            // Step 2: Wait for graceful termination with timeout
+            int termination_status;
+            int wait_attempts = 0;
+            const int max_wait_attempts = 10; // 10 * 100ms = 1 second total timeout
+            
+            while (waitpid(process_pid, &termination_status, WNOHANG) == 0 && 
+                   wait_attempts < max_wait_attempts)
+            {
+                usleep(100000); // Wait 100ms between checks
+                wait_attempts++;
+            }
+
+            // Step 3: Force kill with SIGKILL if process still running after timeout
+            if (waitpid(process_pid, &termination_status, WNOHANG) == 0)
+            {
+                printf("Process %d still running after SIGTERM, forcing termination with SIGKILL\n", process_pid);
+                kill(-process_pid, SIGKILL); // Kill entire process group
+                waitpid(process_pid, &termination_status, 0); // Wait for confirmation
+            }
+
+            // Mark this process slot as inactive for reuse
+            process->active = 0;
+            printf("Completed cleanup for process %d\n", process_pid);
+        }
+
+        // Step 4: Hand the output pipe back to the reader thread for closing and freeing
+        if (process->channel != -1)
+        {
+            abandon_io_channel(process->channel);
+            process->channel = -1;
+        }
+    }
+
+    // Reset the multiwatch system state
+    multiwatch_count = 0;
+    multiwatch_tab_id = 0;
+    multiwatch_stop_deadline = 0;
+    printf("MultiWatch cleanup completed. All processes and resources cleaned up.\n");
+}
+
+// Function to request a non-blocking multiWatch stop (reaped later by service_multiwatch)
+void stop_multiwatch(Tab *tab, const char *reason)
+{
+    if (!multiwatch_mode)
+        return;
+
+    printf("Stopping multiWatch: %s\n", reason);
+    if (tab)
+    {
+        add_text_to_buffer(tab, reason);
+    }
+
+    // Step 1: Ask every still-running process group to terminate
+    for (int process_index = 0; process_index < multiwatch_count; process_index++)
+    {
+        if (multiwatch_processes[process_index].active && multiwatch_processes[process_index].pid > 0)
+        {
+            kill(-multiwatch_processes[process_index].pid, SIGTERM);
+        }
+    }
+
+    // Step 2: Give them a grace period before service_multiwatch() escalates to SIGKILL
+    multiwatch_stop_deadline = monotonic_ms() + MULTIWATCH_STOP_GRACE_MS;
+}
+
+// Function to service multiWatch processes at frame time - drains output and reaps finished commands
+int service_multiwatch(void)
+{
+    if (!multiwatch_mode)
+        return 0;
+
+    Tab *tab = find_tab_by_id(multiwatch_tab_id);
+    int display_changed = 0;
+    int still_alive = 0;
+
+    for (int process_index = 0; process_index < multiwatch_count; process_index++)
+    {
+        MultiWatchProcess *process = &multiwatch_processes[process_index];
+
+        // Step 1: Move any output the reader thread collected into the scrollback
+        if (process->channel != -1)
+        {
+            if (drain_io_channel(process->channel, process->command) > 0)
+            {
+                display_changed = 1;
+            }
+
+            // Release the channel once the pipe is closed and fully consumed
+            if (io_channel_finished(process->channel))
+            {
+                flush_io_channel(process->channel, process->command);
+                release_io_channel(process->channel);
+                process->channel = -1;
+                display_changed = 1;
+            }
+        }
+
+        // Step 2: Check process status without blocking
+        if (process->active)
+        {
+            int process_status;
+            pid_t wait_result = waitpid(process->pid, &process_status, WNOHANG);
+
+            if (wait_result == process->pid)
+            {
+                printf("Process %d finished with exit status %d\n", 
+                       process->pid, WEXITSTATUS(process_status));
+                process->active = 0;
+            }
+            else if (wait_result == -1)
+            {
+                printf("Error checking process %d: %s\n", process->pid, strerror(errno));
+                process->active = 0;
+            }
+        }
+
+        // Step 3: Notify user once the command has exited and all its output is shown
+        if (!process->active && process->channel == -1 && !process->finished_reported)
+        {
+            process->finished_reported = 1;
+            if (tab)
+            {
+                char completion_message[128];
+                snprintf(completion_message, sizeof(completion_message),
+                         "Command '%s' finished", process->command);
+                add_text_to_buffer(tab, completion_message);
+            }
+            display_changed = 1;
+        }
+
+        if (process->active || process->channel != -1)
+        {
+            still_alive++;
+        }
+    }
+
+    // Step 4: Escalate to SIGKILL when a requested stop exceeded its grace period
+    if (multiwatch_stop_deadline != 0 && monotonic_ms() >= multiwatch_stop_deadline)
+    {
+        for (int process_index = 0; process_index < multiwatch_count; process_index++)
+        {
+            if (multiwatch_processes[process_index].active && multiwatch_processes[process_index].pid > 0)
+            {
+                printf("Process %d still running after SIGTERM, forcing termination with SIGKILL\n",
+                       multiwatch_processes[process_index].pid);
+                kill(-multiwatch_processes[process_index].pid, SIGKILL);
+            }
+        }
+        multiwatch_stop_deadline = 0;
+    }
+
+    // Step 5: Leave multiWatch mode when every process is reaped and drained
+    if (still_alive == 0)
+    {
+        printf("multiWatch monitoring completed\n");
+        record_effect(RECORD_MULTIWATCH_END, NULL, 0);
+        multiwatch_mode = 0;
+        multiwatch_count = 0;
+        multiwatch_stop_deadline = 0;
+        if (tab)
+        {
+            add_text_to_buffer(tab, "multiWatch completed");
+        }
+        multiwatch_tab_id = 0;
+        display_changed = 1;
+    }
+
+    return display_changed && tab && tab == &tabs[active_tab_index];
+}
+
+// Function to handle multiWatch command - executes multiple commands in parallel and monitors their output
+void handle_multiwatch_command(Display *display, Window window, GC gc, Tab *tab, const char *command)
+{
+    // Only one multiWatch session can run at a time
+    if (multiwatch_mode)
+    {
+        add_text_to_buffer(tab, "Error: multiWatch is already running (Ctrl+C to stop it)");
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+
+    // Step 1: Parse quoted commands from: multiWatch "cmd1" "cmd2" "cmd3"
+    char parsed_commands[MAX_MULTIWATCH_COMMANDS][MAX_COMMAND_LENGTH];
+    int command_count = 0;
+
+    // Skip past "multiWatch" to get to the command arguments (the line is only read, each
+    // watched command is copied into parsed_commands)
+    const char *parse_ptr = command + 10; // Length of "multiWatch"
+
+    // Parse quoted commands from the argument string
+    while (*parse_ptr != '\0' && command_count < MAX_MULTIWATCH_COMMANDS)
+    {
+        // Skip any leading whitespace
+        while (*parse_ptr == ' ')
+            parse_ptr++;
+
+        // Look for quoted commands
+        if (*parse_ptr == '"')
+        {
+            parse_ptr++; // Move past the opening quote
+            const char *command_start = parse_ptr;
+
+            // Find the closing quote
+            while (*parse_ptr != '"' && *parse_ptr != '\0')
+                parse_ptr++;
+
+            if (*parse_ptr == '"')
+            {
+                int command_length = parse_ptr - command_start;
+                if (command_length > 0 && command_length < MAX_COMMAND_LENGTH - 1)
+                {
+                    // Extract the command safely
+                    if (snprintf(parsed_commands[command_count], MAX_COMMAND_LENGTH, 
+                                "%.*s", command_length, command_start) >= MAX_COMMAND_LENGTH)
+                    {
+                        add_text_to_buffer(tab, "Error: Individual command too long");
+                        draw_text_buffer(display, window, gc);
+                        return;
+                    }
+                    command_count++;
+                }
+                parse_ptr++; // Move past the closing quote
+            }
+            else
+            {
+                add_text_to_buffer(tab, "Error: Unclosed quote in multiWatch command");
+                draw_text_buffer(display, window, gc);
+                return;
+            }
+        }
+        else if (*parse_ptr != '\0')
+        {
+            // Invalid syntax - commands must be quoted
+            add_text_to_buffer(tab, "Error: Invalid multiWatch syntax - use: multiWatch \"cmd1\" \"cmd2\"");
+            draw_text_buffer(display, window, gc);
+            return;
+        }
+    }
+
+    // Step 2: Validate parsed commands
+    if (command_count == 0)
+    {
+        add_text_to_buffer(tab, "Usage: multiWatch \"command1\" \"command2\" ...");
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+
+    if (command_count > MAX_MULTIWATCH_COMMANDS)
+    {
+        char error_message[256];
+        snprintf(error_message, sizeof(error_message), 
+                "Error: Too many commands specified (maximum: %d)", MAX_MULTIWATCH_COMMANDS);
+        add_text_to_buffer(tab, error_message);
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+
+    // Step 3: Notify user and initialize multiwatch system
+    add_text_to_buffer(tab, "Starting multiWatch mode. Press Ctrl+C to stop.");
+    draw_text_buffer(display, window, gc);
+
+    multiwatch_count = 0;
+    multiwatch_mode = 1; // Enable multiwatch monitoring mode
+    multiwatch_tab_id = tab->tab_id;
+    multiwatch_stop_deadline = 0;
+
+    int successful_process_starts = 0;
+
+    // Step 4: Create an output pipe and fork a process for each command
+    for (int command_index = 0; command_index < command_count; command_index++)
+    {
+        MultiWatchProcess *process = &multiwatch_processes[multiwatch_count];
+        int output_pipe[2];
+
+        // A replay only tracks the command; its output comes from the recording
+        if (replay_active)
+        {
+            memset(process, 0, sizeof(*process));
+            if (snprintf(process->command, MAX_COMMAND_LENGTH, "%s", parsed_commands[command_index]) >=
+                MAX_COMMAND_LENGTH)
+            {
+                // The parser keeps commands shorter than this; never track a cut-down command
+                printf("Warning: Skipping replayed multiWatch command longer than %d bytes\n", MAX_COMMAND_LENGTH - 1);
+                continue;
+            }
+            process->active = 1;
+            process->channel = -1;
+            multiwatch_count++;
+            successful_process_starts++;
+            continue;
+        }
+
+        if (pipe(output_pipe) == -1)
+        {
+            printf("Error: Failed to create pipe for command '%s': %s\n", 
+                   parsed_commands[command_index], strerror(errno));
+            continue;
+        }
+
+        // Fork a new process for this command
+        pid_t child_pid = fork();
+
+        if (child_pid == 0)
+        {
+            // CHILD PROCESS: Execute the command
+            // Reset signal handlers to default behavior
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+
+            // Lead a new process group so a stop request reaches the whole command
+            setpgid(0, 0);
+
+            // Redirect standard output and error to the pipe
+            close(output_pipe[0]);
+            if (dup2(output_pipe[1], STDOUT_FILENO) == -1)
+            {
+                fprintf(stderr, "Failed to redirect stdout: %s\n", strerror(errno));
+                exit(1);
+            }
+            if (dup2(output_pipe[1], STDERR_FILENO) == -1)
+            {
+                fprintf(stderr, "Failed to redirect stderr: %s\n", strerror(errno));
+                exit(1);
+            }
+            close(output_pipe[1]); // File descriptor no longer needed
+
+            // Execute the command based on whether it contains pipes
+            if (strstr(parsed_commands[command_index], "|") != NULL)
+            {
+                // Command contains pipes - execute through shell for proper pipe handling
+                execl("/bin/sh", "sh", "-c", parsed_commands[command_index], NULL);
+                fprintf(stderr, "Failed to execute command through shell: %s\n", strerror(errno));
+            }
+            else
+            {
+                // Simple command without pipes - tokenize and execute directly
+                char *arguments[64];
+                int argument_count = 0;
+                char command_buffer[MAX_COMMAND_LENGTH];
+
+                // Create a safe working copy for tokenization
+                if (snprintf(command_buffer, sizeof(command_buffer), "%s", 
+                            parsed_commands[command_index]) >= (int)sizeof(command_buffer))
+                {
+                    fprintf(stderr, "Error: Command too long for processing\n");
+                    exit(1);
+                }
+
+                // Tokenize the command into arguments
+                char *token = strtok(command_buffer, " ");
+                while (token != NULL && argument_count < 63)
+                {
+                    arguments[argument_count++] = token;
+                    token = strtok(NULL, " ");
+                }
+                arguments[argument_count] = NULL; // NULL-terminate the argument list
+
+                if (argument_count == 0)
+                {
+                    fprintf(stderr, "Error: Empty command\n");
+                    exit(1);
+                }
+
+                // Execute the command directly
+                execvp(arguments[0], arguments);
+                fprintf(stderr, "Failed to execute %s: %s\n", arguments[0], strerror(errno));
+            }
+            exit(127); // Exit with error if exec fails
+        }
+        else if (child_pid > 0)
+        {
+            // PARENT PROCESS: Track the child process
+            close(output_pipe[1]);
+            setpgid(child_pid, child_pid); // Avoid racing the child's own setpgid()
+
+            memset(process, 0, sizeof(*process));
+            process->pid = child_pid;
+            
+            // Store the command string for display purposes
+            if (snprintf(process->command, MAX_COMMAND_LENGTH, 
+                        "%s", parsed_commands[command_index]) >= MAX_COMMAND_LENGTH)
+            {
+                printf("Warning: Command name truncated for display\n");
+            }
+            process->active = 1;
+
+            // Hand the read end to the I/O reader thread
+            process->channel = acquire_io_channel(output_pipe[0], tab->tab_id);
+            if (process->channel == -1)
+            {
+                printf("Warning: No free I/O channel for command '%s' - output discarded\n", process->command);
+                close(output_pipe[0]);
+            }
+
+            multiwatch_count++;
+            successful_process_starts++;
+            printf("Started process %d for command: %s\n", child_pid, parsed_commands[command_index]);
+        }
+        else
+        {
+            // Fork failed
+            printf("Fork failed for command '%s': %s\n", 
+                   parsed_commands[command_index], strerror(errno));
+            close(output_pipe[0]);
+            close(output_pipe[1]);
+        }
+    }
+
+    // Step 5: Check if we successfully started any processes
+    if (successful_process_starts == 0)
+    {
+        add_text_to_buffer(tab, "Error: Failed to start any multiWatch processes");
+        cleanup_multiwatch();
+        multiwatch_mode = 0;
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+
+    // Step 6: Return to the event loop - service_multiwatch() streams output each frame
+    printf("Started monitoring for %d multiWatch processes\n", successful_process_starts);
+}
+
+void handle_jobs_command(Tab *tab)
+{
+    // Step 1: Check if there are any background jobs to display
+    if (bg_job_count == 0)
+    {
+        add_text_to_buffer(tab, "No background jobs running");
+        return;
+    }
+
+    // Step 2: Clean up finished processes before displaying
+    // This ensures we only show currently active jobs
+    for (int job_index = 0; job_index < bg_job_count; job_index++)
+    {
+        // Jobs started by execute_command() are reaped by the event loop
+        if (find_job_by_pid(bg_processes[job_index].pid) != NULL)
+        {
+            continue;
+        }
+
+        int process_status;
+        pid_t wait_result = waitpid(bg_processes[job_index].pid, &process_status, WNOHANG);
+        
+        if (wait_result > 0)
+        {
+            // Process has terminated - remove it from the jobs array
+            printf("Background job %d (PID: %d) has finished\n", 
+                   bg_processes[job_index].job_id, bg_processes[job_index].pid);
+            
+            // Shift remaining jobs left to fill the gap
+            for (int shift_index = job_index; shift_index < bg_job_count - 1; shift_index++)
+            {
+                bg_processes[shift_index] = bg_processes[shift_index + 1];
+            }
+            
+            bg_job_count--;  // Reduce job count
+            job_index--;     // Re-check current position since array was shifted
+            
+            printf("Removed finished job, now %d background jobs remaining\n", bg_job_count);
+        }
+        else if (wait_result == 0)
+        {
+            // Process is still running - no action needed
+            continue;
+        }
+        else
+        {
+            // Error checking process status
+            printf("Error checking status of job %d (PID: %d): %s\n",
+                   bg_processes[job_index].job_id, bg_processes[job_index].pid, strerror(errno));
+        }
+    }
+
+    // Step 3: Check if all jobs finished during cleanup
+    if (bg_job_count == 0)
+    {
+        add_text_to_buffer(tab, "No background jobs running (all completed)");
+        return;
+    }
+
+    // Step 4: Display information for all active background jobs
+    add_text_to_buffer(tab, "Active background jobs:");
+    
+    for (int job_index = 0; job_index < bg_job_count; job_index++)
+    {
+        char job_display[256];
+        
+        // Format: "[1] Running    sleep 60"
+        //         "[2] Stopped    vim file.txt"
+        snprintf(job_display, sizeof(job_display), "[%d] %s    %s",
+                 bg_processes[job_index].job_id, 
+                 bg_processes[job_index].status, 
+                 bg_processes[job_index].command);
+        
+        add_text_to_buffer(tab, job_display);
+        
+        // Optional: Add PID information for advanced users
+        char pid_info[128];
+        snprintf(pid_info, sizeof(pid_info), "     PID: %d", bg_processes[job_index].pid);
+        add_text_to_buffer(tab, pid_info);
+    }
+    
+    // Step 5: Add usage hint for job management
+    add_text_to_buffer(tab, "Use 'fg <job_id>' to bring a job to foreground");
+    add_text_to_buffer(tab, "Use 'kill %<job_id>' to terminate a background job");
+}
+
+void handle_fg_command(Tab *tab, const char *command)
+{
+    // Step 1: Check if there are any background jobs available
+    if (bg_job_count == 0)
+    {
+        add_text_to_buffer(tab, "fg: no current job");
+        return;
+    }
+
+    // Step 2: Parse the job ID from the command
+    int target_job_id = -1;
+    if (sscanf(command, "fg %d", &target_job_id) != 1)
+    {
+        // No job ID specified - use the most recently created job
+        target_job_id = job_counter; // job_counter tracks the most recent job ID
+        printf("No job ID specified, using most recent job: %d\n", target_job_id);
+    }
+
+    // Step 3: Find the specified job in the background processes array
+    int found_job_index = -1;
+    for (int job_index = 0; job_index < bg_job_count; job_index++)
+    {
+        if (bg_processes[job_index].job_id == target_job_id)
+        {
+            found_job_index = job_index;
+            break;
+        }
+    }
+
+    if (found_job_index == -1)
+    {
+        char error_message[256];
+        snprintf(error_message, sizeof(error_message), "fg: job not found: %d", target_job_id);
+        add_text_to_buffer(tab, error_message);
+        
+        // Show available jobs to help the user
+        char available_jobs[256];
+        snprintf(available_jobs, sizeof(available_jobs), 
+                 "Available jobs: %d to %d", 
+                 bg_processes[0].job_id, 
+                 bg_processes[bg_job_count - 1].job_id);
+        add_text_to_buffer(tab, available_jobs);
+        return;
+    }
+
+    // Step 4: Prepare to bring the job to foreground
+    pid_t target_pid = bg_processes[found_job_index].pid;
+    char *target_command = bg_processes[found_job_index].command;
+
+    // Step 5: Resume the job if it's stopped
+    if (strcmp(bg_processes[found_job_index].status, "Stopped") == 0)
+    {
+        printf("Resuming stopped job %d (PID: %d)\n", target_job_id, target_pid);
+        
+        if (kill(target_pid, SIGCONT) == -1)
+        {
+            char error_message[256];
+            snprintf(error_message, sizeof(error_message), 
+                     "fg: failed to resume job %d: %s", target_job_id, strerror(errno));
+            add_text_to_buffer(tab, error_message);
+            return;
+        }
+        
+        // Update job status to reflect it's now running
+        strncpy(bg_processes[found_job_index].status, "Running", sizeof(bg_processes[found_job_index].status) - 1);
+    }
+
+    // Step 6: Jobs owned by the event loop are resumed asynchronously in this tab
+    CommandJob *job = find_job_by_pid(target_pid);
+    if (job != NULL)
+    {
+        signal_command_job(job, SIGCONT);
+        job->stopped = 0;
+        job->tab_id = tab->tab_id;
+        job->deadline_ms = monotonic_ms() + job->timeout_ms;
+        io_channels[job->channel].tab_id = tab->tab_id;
+        tab->foreground_pid = target_pid;
+
+        char status_message[256];
+        snprintf(status_message, sizeof(status_message), 
+                 "Resumed job [%d] in foreground: %s", target_job_id, target_command);
+        add_text_to_buffer(tab, status_message);
+
+        for (int shift_index = found_job_index; shift_index < bg_job_count - 1; shift_index++)
+        {
+            bg_processes[shift_index] = bg_processes[shift_index + 1];
+        }
+        bg_job_count--;
+        return;
+    }
+
+    // Step 7: Set the process as foreground process in the tab
+    tab->foreground_pid = target_pid;
+
+    char status_message[256];
+    snprintf(status_message, sizeof(status_message), 
+             "Resumed job [%d] in foreground: %s", target_job_id, target_command);
+    add_text_to_buffer(tab, status_message);
+    printf("Brought job %d (PID: %d) to foreground: %s\n", target_job_id, target_pid, target_command);
+
+    // Step 8: Wait for the process to complete
+    int process_status;
+    pid_t wait_result = waitpid(target_pid, &process_status, 0);
+
+    if (wait_result == -1)
+    {
+        char error_message[256];
+        snprintf(error_message, sizeof(error_message), 
+                 "fg: error waiting for job %d: %s", target_job_id, strerror(errno));
+        add_text_to_buffer(tab, error_message);
+    }
+    else
+    {
+        // Report how the process terminated
+        if (WIFEXITED(process_status))
+        {
+            char exit_message[256];
+            snprintf(exit_message, sizeof(exit_message), 
+                     "Job [%d] exited with status %d", target_job_id, WEXITSTATUS(process_status));
+            add_text_to_buffer(tab, exit_message);
+            printf("Job %d exited normally with status %d\n", target_job_id, WEXITSTATUS(process_status));
+        }
+        else if (WIFSIGNALED(process_status))
+        {
+            char signal_message[256];
+            snprintf(signal_message, sizeof(signal_message), 
+                     "Job [%d] terminated by signal %d", target_job_id, WTERMSIG(process_status));
+            add_text_to_buffer(tab, signal_message);
+            printf("Job %d terminated by signal %d\n", target_job_id, WTERMSIG(process_status));
+        }
+        else if (WIFSTOPPED(process_status))
+        {
+            char stopped_message[256];
+            snprintf(stopped_message, sizeof(stopped_message), 
+                     "Job [%d] stopped by signal %d", target_job_id, WSTOPSIG(process_status));
+            add_text_to_buffer(tab, stopped_message);
+            printf("Job %d stopped by signal %d\n", target_job_id, WSTOPSIG(process_status));
+        }
+    }
+
+    // Step 9: Remove the job from background processes array since it's now complete
+    for (int shift_index = found_job_index; shift_index < bg_job_count - 1; shift_index++)
+    {
+        bg_processes[shift_index] = bg_processes[shift_index + 1];
+    }
+    bg_job_count--;
+    
+    // Clear the foreground PID since the process has terminated
+    tab->foreground_pid = -1;
+    
+    printf("Removed job %d from background jobs list. %d jobs remaining.\n", 
+           target_job_id, bg_job_count);
+}
+
+// ============================================================================
+// ASYNCHRONOUS I/O READER THREAD AND COMMAND JOBS
+// ============================================================================
+//
+// Child output never touches the UI thread's blocking paths. A single reader
+// thread poll()s every active child pipe and copies bytes into that channel's
+// lock-free SPSC ring. The UI thread drains the rings once per frame, bounded
+// by IO_DRAIN_BUDGET, so a tab flooding output cannot delay keystrokes in any
+// other tab: when a ring is full the reader simply stops polling that pipe and
+// the producing child blocks in write() until the UI catches up.
+//
+// The reader thread must not call malloc() or stdio - the UI thread fork()s
+// children and those locks must never be held by another thread at that point.
+
+// Scratch space for draining rings (UI thread only)
+static unsigned char io_drain_scratch[IO_DRAIN_BUDGET];
+
+// Function to read a monotonic millisecond clock for deadlines and frame timing
+long long monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Function to wake the UI thread's poll() (reader thread side, coalesced)
+static void io_notify_ui(void)
+{
+    if (atomic_exchange(&ui_notify_pending, 1) == 0)
+    {
+        ssize_t ignored = write(ui_notify_pipe[1], "x", 1);
+        (void)ignored;
+    }
+}
+
+// Function to wake the UI thread when a child exits or stops (SIGCHLD handler), so a job is
+// reaped as soon as it ends rather than on the next frame tick after its EOF
+static void handle_sigchld(int sig)
+{
+    (void)sig;
+    int saved_errno = errno;
+    io_notify_ui();
+    errno = saved_errno;
+}
+
+// Function to wake the reader thread after the channel set or ring space changed
+void io_reader_wake(void)
+{
+    if (io_wake_pipe[1] != -1)
+    {
+        ssize_t ignored = write(io_wake_pipe[1], "x", 1);
+        (void)ignored; // A full pipe already guarantees a pending wakeup
+    }
+}
+
+// Function to copy up to max_bytes out of a ring (UI thread / consumer side)
+size_t byte_ring_read(ByteRing *ring, unsigned char *destination, size_t max_bytes)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t available = head - tail;
+
+    if (available > max_bytes)
+        available = max_bytes;
+    if (available == 0)
+        return 0;
+
+    // Copy in at most two pieces when the readable region wraps around
+    size_t offset = tail & (IO_RING_SIZE - 1);
+    size_t first_piece = IO_RING_SIZE - offset;
+    if (first_piece > available)
+        first_piece = available;
+
+    memcpy(destination, ring->data + offset, first_piece);
+    memcpy(destination + first_piece, ring->data, available - first_piece);
+
+    atomic_store_explicit(&ring->tail, tail + available, memory_order_release);
+    return available;
+}
+
+// Function to close a channel's pipe and publish EOF (reader thread only)
+static void io_reader_close_channel(IOChannel *channel)
+{
+    close(channel->fd);
+    channel->fd = -1;
+    atomic_store(&channel->state, IO_CHANNEL_EOF);
+
+    // Nobody will drain an abandoned channel; whichever side sees both flags frees it
+    int expected = IO_CHANNEL_EOF;
+    if (atomic_load(&channel->abandoned))
+        atomic_compare_exchange_strong(&channel->state, &expected, IO_CHANNEL_FREE);
+    io_notify_ui();
+}
+
+// Function to move bytes from a readable pipe into its ring (reader thread only)
+static void io_reader_fill_channel(IOChannel *channel)
+{
+    size_t head = atomic_load_explicit(&channel->ring.head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&channel->ring.tail, memory_order_acquire);
+    size_t free_space = IO_RING_SIZE - (head - tail);
+
+    if (free_space == 0)
+    {
+        atomic_store(&channel->stalled, 1);
+        return;
+    }
+
+    // Read straight into the ring's contiguous free region
+    size_t offset = head & (IO_RING_SIZE - 1);
+    size_t contiguous = IO_RING_SIZE - offset;
+    if (contiguous > free_space)
+        contiguous = free_space;
+
+    long long read_start_us = trace_ring ? monotonic_us() : 0;
+    ssize_t bytes_read = read(channel->fd, channel->ring.data + offset, contiguous);
+    if (bytes_read > 0)
+    {
+        trace_complete(TRACE_READ, read_start_us, bytes_read, channel->tab_id);
+        atomic_store_explicit(&channel->ring.head, head + bytes_read, memory_order_release);
+        io_notify_ui();
+    }
+    else if (bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        // End of output (all writers closed) or a hard read error
+        io_reader_close_channel(channel);
+    }
+}
+
+// Reader thread entry point - multiplexes all active child pipes
+static void *io_reader_main(void *unused)
+{
+    (void)unused;
+    atomic_store(&trace_reader_thread, (int)syscall(SYS_gettid));
+    struct pollfd poll_fds[MAX_IO_CHANNELS + 1];
+    int poll_channels[MAX_IO_CHANNELS + 1];
+
+    while (!atomic_load(&io_reader_shutdown))
+    {
+        // Step 1: Always listen for wakeups from the UI thread
+        int poll_count = 0;
+        poll_fds[poll_count].fd = io_wake_pipe[0];
+        poll_fds[poll_count].events = POLLIN;
+        poll_fds[poll_count].revents = 0;
+        poll_channels[poll_count] = -1;
+        poll_count++;
+
+        // Step 2: Watch every active channel that still has ring space
+        for (int channel_index = 0; channel_index < MAX_IO_CHANNELS; channel_index++)
+        {
+            IOChannel *channel = &io_channels[channel_index];
+            if (atomic_load_explicit(&channel->state, memory_order_acquire) != IO_CHANNEL_ACTIVE)
+                continue;
+
+            if (atomic_load(&channel->detach_requested))
+            {
+                io_reader_close_channel(channel);
+                continue;
+            }
+
+            size_t head = atomic_load_explicit(&channel->ring.head, memory_order_relaxed);
+            size_t tail = atomic_load_explicit(&channel->ring.tail, memory_order_acquire);
+            if (head - tail >= IO_RING_SIZE)
+            {
+                // Backpressure: leave the child blocked until the UI drains this ring. A drain
+                // that ran before the flag was set could not see it, so look at the ring again.
+                atomic_store(&channel->stalled, 1);
+                tail = atomic_load(&channel->ring.tail);
+                if (head - tail >= IO_RING_SIZE)
+                    continue;
+                atomic_store(&channel->stalled, 0);
+            }
+
+            poll_fds[poll_count].fd = channel->fd;
+            poll_fds[poll_count].events = POLLIN;
+            poll_fds[poll_count].revents = 0;
+            poll_channels[poll_count] = channel_index;
+            poll_count++;
+        }
+
+        // Step 3: Sleep until a child writes or the UI changes the channel set
+        int ready = poll(poll_fds, poll_count, -1);
+        if (ready <= 0)
+            continue;
+
+        if (poll_fds[0].revents & POLLIN)
+        {
+            char wake_bytes[64];
+            while (read(io_wake_pipe[0], wake_bytes, sizeof(wake_bytes)) > 0)
+            {
+                // Drain all coalesced wakeups
+            }
+        }
+
+        // Step 4: Copy whatever is readable into the rings
+        for (int poll_index = 1; poll_index < poll_count; poll_index++)
+        {
+            if (poll_fds[poll_index].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                io_reader_fill_channel(&io_channels[poll_channels[poll_index]]);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Function to create the wakeup pipes and start the reader thread
+int start_io_reader(void)
+{
+    // Step 1: Non-blocking, close-on-exec pipes so children never inherit them
+    if (pipe(io_wake_pipe) == -1 || pipe(ui_notify_pipe) == -1)
+    {
+        printf("Error: Failed to create I/O wakeup pipes: %s\n", strerror(errno));
+        return -1;
+    }
+    for (int end = 0; end < 2; end++)
+    {
+        fcntl(io_wake_pipe[end], F_SETFL, O_NONBLOCK);
+        fcntl(io_wake_pipe[end], F_SETFD, FD_CLOEXEC);
+        fcntl(ui_notify_pipe[end], F_SETFL, O_NONBLOCK);
+        fcntl(ui_notify_pipe[end], F_SETFD, FD_CLOEXEC);
+    }
+
+    // Child exits reach the UI through the same pipe (installed only now that it exists)
+    struct sigaction child_action;
+    memset(&child_action, 0, sizeof(child_action));
+    child_action.sa_handler = handle_sigchld;
+    sigemptyset(&child_action.sa_mask);
+    child_action.sa_flags = SA_RESTART;
+    if (sigaction(SIGCHLD, &child_action, NULL) == -1)
+        printf("Warning: Failed to set SIGCHLD handler; jobs are reaped on the frame tick\n");
+
+    // Step 2: Mark every channel free
+    for (int channel_index = 0; channel_index < MAX_IO_CHANNELS; channel_index++)
+    {
+        io_channels[channel_index].fd = -1;
+        atomic_store(&io_channels[channel_index].state, IO_CHANNEL_FREE);
+    }
+
+    // Step 3: Launch the reader
+    atomic_store(&io_reader_shutdown, 0);
+    int create_result = pthread_create(&io_reader_thread, NULL, io_reader_main, NULL);
+    if (create_result != 0)
+    {
+        printf("Error: Failed to start I/O reader thread: %s\n", strerror(create_result));
+        return -1;
+    }
+
+    io_reader_running = 1;
+    printf("I/O reader thread started (%d channels, %d KB ring each)\n", 
+           MAX_IO_CHANNELS, IO_RING_SIZE / 1024);
+    return 0;
+}
+
+// Function to stop the reader thread on shutdown
+void stop_io_reader(void)
+{
+    if (!io_reader_running)
+        return;
+
+    atomic_store(&io_reader_shutdown, 1);
+    io_reader_wake();
+    pthread_join(io_reader_thread, NULL);
+    io_reader_running = 0;
+    printf("I/O reader thread stopped\n");
+}
+
+// Function to hand a pipe's read end to the reader thread; returns channel index or -1
+int acquire_io_channel(int fd, int tab_id)
+{
+    for (int channel_index = 0; channel_index < MAX_IO_CHANNELS; channel_index++)
+    {
+        IOChannel *channel = &io_channels[channel_index];
+        if (atomic_load_explicit(&channel->state, memory_order_acquire) != IO_CHANNEL_FREE)
+            continue;
+
+        // Step 1: Reset UI-side and ring state while the reader ignores this slot
+        atomic_store(&channel->ring.head, 0);
+        atomic_store(&channel->ring.tail, 0);
+        atomic_store(&channel->detach_requested, 0);
+        atomic_store(&channel->stalled, 0);
+        atomic_store(&channel->abandoned, 0);
+        channel->tab_id = tab_id;
+        channel->partial_length = 0;
+
+        // Step 2: Children forked later must not inherit this read end
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        channel->fd = fd;
+
+        // Step 3: Publish the channel and let the reader start polling it
+        atomic_store_explicit(&channel->state, IO_CHANNEL_ACTIVE, memory_order_release);
+        io_reader_wake();
+        return channel_index;
+    }
+
+    return -1;
+}
+
+// Function to return a finished channel to the free pool (UI thread)
+void release_io_channel(int channel_index)
+{
+    if (channel_index < 0 || channel_index >= MAX_IO_CHANNELS)
+        return;
+    atomic_store_explicit(&io_channels[channel_index].state, IO_CHANNEL_FREE, memory_order_release);
+}
+
+// Function to ask the reader thread to stop reading a channel and close its pipe
+void request_channel_detach(int channel_index)
+{
+    if (channel_index < 0 || channel_index >= MAX_IO_CHANNELS)
+        return;
+    atomic_store(&io_channels[channel_index].detach_requested, 1);
+    io_reader_wake();
+}
+
+// Function to give up a channel whose output will never be drained (UI thread); it is freed
+// now if the reader already saw EOF, otherwise as soon as the reader closes it
+void abandon_io_channel(int channel_index)
+{
+    if (channel_index < 0 || channel_index >= MAX_IO_CHANNELS)
+        return;
+    IOChannel *channel = &io_channels[channel_index];
+    channel->tab_id = 0;
+    atomic_store(&channel->abandoned, 1);
+    int expected = IO_CHANNEL_EOF;
+    if (!atomic_compare_exchange_strong(&channel->state, &expected, IO_CHANNEL_FREE))
+        request_channel_detach(channel_index);
+}
+
+// Function to check whether a channel hit EOF and its ring is fully consumed
+int io_channel_finished(int channel_index)
+{
+    IOChannel *channel = &io_channels[channel_index];
+    if (atomic_load_explicit(&channel->state, memory_order_acquire) != IO_CHANNEL_EOF)
+        return 0;
+    return atomic_load(&channel->ring.head) == atomic_load(&channel->ring.tail);
+}
+
+// Function to emit one complete output line for a channel
+static void emit_channel_line(Tab *tab, const char *label, char *batch, int *batch_length,
+                              const char *line, int line_length)
+{
+    if (!tab)
+        return; // Owning tab was closed - discard
+
+    if (label)
+    {
+        // MultiWatch lines are indented under their command's header
+        char formatted_line[OUTPUT_BUFFER_SIZE];
+        snprintf(formatted_line, sizeof(formatted_line), "  %.*s", line_length, line);
+        add_text_to_buffer(tab, formatted_line);
+        return;
+    }
+
+    // Plain output is batched so add_text_to_buffer() runs once per batch, not per line
+    if (*batch_length > 0 && *batch_length + 1 + line_length >= OUTPUT_BUFFER_SIZE)
+    {
+        add_text_to_buffer(tab, batch);
+        *batch_length = 0;
+    }
+    if (*batch_length > 0)
+    {
+        batch[(*batch_length)++] = '\n';
+    }
+    memcpy(batch + *batch_length, line, line_length);
+    *batch_length += line_length;
+    batch[*batch_length] = '\0';
+}
+
+// Function to consume a channel's ring into its tab (UI thread); returns bytes consumed
+size_t drain_io_channel(int channel_index, const char *label)
+{
+    IOChannel *channel = &io_channels[channel_index];
+    size_t consumed = byte_ring_read(&channel->ring, io_drain_scratch, IO_DRAIN_BUDGET);
+
+    // Step 1: Resume a reader that stopped polling because the ring was full (even with nothing
+    // read now: the reader may have flagged the stall just after an earlier drain emptied the ring)
+    if (atomic_exchange(&channel->stalled, 0))
+    {
+        io_reader_wake();
+    }
+    if (consumed == 0)
+        return 0;
+    perf_phase_begin(PERF_PHASE_PARSE);
+
+    Tab *tab = find_tab_by_id(channel->tab_id);
+    char batch[OUTPUT_BUFFER_SIZE];
+    int batch_length = 0;
+    batch[0] = '\0';
+
+    // Step 2: Give labelled (multiWatch) output a timestamped header per batch
+    if (tab && label)
+    {
+        time_t current_time = terminal_time();
+        struct tm *time_info = localtime(&current_time);
+        char timestamp[64];
+        strftime(timestamp, sizeof(timestamp), "[%H:%M:%S] ", time_info);
+
+        char output_header[128];
+        add_separator_line(tab);
+        snprintf(output_header, sizeof(output_header), "%sMultiWatch [%s]:", timestamp, label);
+        add_text_to_buffer(tab, output_header);
+    }
+
+    // Step 3: Split into lines, carrying an unterminated tail to the next frame
+    for (size_t byte_index = 0; byte_index < consumed; byte_index++)
+    {
+        char byte = (char)io_drain_scratch[byte_index];
+
+        if (byte == '\n' || channel->partial_length >= OUTPUT_BUFFER_SIZE - 1)
+        {
+            emit_channel_line(tab, label, batch, &batch_length,
+                              channel->partial_line, channel->partial_length);
+            channel->partial_length = 0;
+            if (byte == '\n')
+                continue;
+        }
+        if (byte != '\0')
+        {
+            channel->partial_line[channel->partial_length++] = byte;
+        }
+    }
+
+    if (tab && batch_length > 0)
+    {
+        add_text_to_buffer(tab, batch);
+    }
+    if (tab && label)
+    {
+        add_separator_line(tab);
+    }
+
+    perf_phase_end();
+    return consumed;
+}
+
+// Function to emit an unterminated last line once a channel reaches EOF
+void flush_io_channel(int channel_index, const char *label)
+{
+    IOChannel *channel = &io_channels[channel_index];
+    if (channel->partial_length == 0)
+        return;
+
+    Tab *tab = find_tab_by_id(channel->tab_id);
+    char batch[OUTPUT_BUFFER_SIZE];
+    int batch_length = 0;
+
+    emit_channel_line(tab, label, batch, &batch_length, channel->partial_line, channel->partial_length);
+    if (tab && batch_length > 0)
+    {
+        add_text_to_buffer(tab, batch);
+    }
+    channel->partial_length = 0;
+}
+
+// Function to look up a tab by its stable identifier (NULL if it was closed)
+Tab *find_tab_by_id(int tab_id)
+{
+    if (tab_id <= 0)
+        return NULL;
+
+    for (int tab_index = 0; tab_index < tab_count; tab_index++)
+    {
+        if (tabs[tab_index].tab_id == tab_id)
+            return &tabs[tab_index];
+    }
+    return NULL;
+}
+
+// Function to register forked processes as a job; returns job index or -1
+int start_command_job(Tab *tab, const char *command, pid_t *pids, int pid_count, int output_fd, long timeout_ms)
+{
+    for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
+    {
+        CommandJob *job = &running_jobs[job_index];
+        if (job->in_use)
+            continue;
+
+        // Step 1: Attach the output pipe to the reader thread (a replayed job has none)
+        int channel_index = -1;
+        if (output_fd >= 0 && (channel_index = acquire_io_channel(output_fd, tab->tab_id)) == -1)
+            return -1;
+
+        // Step 2: Record the job so the event loop can reap it
+        memset(job, 0, sizeof(*job));
+        job->in_use = 1;
+        job->tab_id = tab->tab_id;
+        job->channel = channel_index;
+        job->pid_count = pid_count;
+        for (int pid_index = 0; pid_index < pid_count; pid_index++)
+        {
+            job->pids[pid_index] = pids[pid_index];
+            job->exited[pid_index] = pids[pid_index] <= 0; // Nothing to signal or reap
+        }
+        job->timeout_ms = timeout_ms;
+        job->deadline_ms = monotonic_ms() + timeout_ms;
+        job->started_us = monotonic_us();
+        snprintf(job->command, sizeof(job->command), "%s", command);
+        job->block_serial = tab->pending_block_serial;
+        tab->pending_block_serial = 0;
+
+        tab->foreground_pid = pids[pid_count - 1];
+        return job_index;
+    }
+
+    return -1;
+}
+
+// Function to find the job currently running in the foreground of a tab
+CommandJob *find_foreground_job(Tab *tab)
+{
+    for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
+    {
+        CommandJob *job = &running_jobs[job_index];
+        if (job->in_use && !job->stopped && job->tab_id == tab->tab_id)
+            return job;
+    }
+    return NULL;
+}
+
+// Function to find the job that owns a process
+CommandJob *find_job_by_pid(pid_t pid)
+{
+    for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
+    {
+        CommandJob *job = &running_jobs[job_index];
+        if (!job->in_use)
             continue;
+        for (int pid_index = 0; pid_index < job->pid_count; pid_index++)
+        {
+            if (job->pids[pid_index] == pid)
+                return job;
         }
-        else
+    }
+    return NULL;
+}
+
+// Function to send a signal to every stage of a job that has not been reaped
+void signal_command_job(CommandJob *job, int sig)
+{
+    for (int pid_index = 0; pid_index < job->pid_count; pid_index++)
+    {
+        if (!job->exited[pid_index] && kill(job->pids[pid_index], sig) == -1 && errno != ESRCH)
         {
-            // Error checking process status
-            printf("Error checking status of job %d (PID: %d): %s\n",
-                   bg_processes[job_index].job_id, bg_processes[job_index].pid, strerror(errno));
+            printf("Warning: Failed to send signal %d to process %d: %s\n",
+                   sig, job->pids[pid_index], strerror(errno));
         }
     }
+}
 
-    // Step 3: Check if all jobs finished during cleanup
-    if (bg_job_count == 0)
+// Function to terminate a closing tab's jobs without blocking (reaped later as orphans)
+void cancel_tab_jobs(Tab *tab)
+{
+    for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
     {
-        add_text_to_buffer(tab, "No background jobs running (all completed)");
-        return;
+        CommandJob *job = &running_jobs[job_index];
+        if (!job->in_use || job->tab_id != tab->tab_id)
+            continue;
+        if (job->channel < 0)
+        {
+            job->in_use = 0;              // Replayed: no process behind it
+            continue;
+        }
+
+        printf("Terminating job '%s' of closing tab %s\n", job->command, tab->tab_name);
+        signal_command_job(job, SIGTERM);
+        signal_command_job(job, SIGCONT); // Stopped jobs must run to see SIGTERM
+        job->tab_id = 0;
+        job->stopped = 0;
+        io_channels[job->channel].tab_id = 0;
+        request_channel_detach(job->channel);
     }
 
-    // Step 4: Display information for all active background jobs
-    add_text_to_buffer(tab, "Active background jobs:");
-    
-    for (int job_index = 0; job_index < bg_job_count; job_index++)
+    if (multiwatch_mode && multiwatch_tab_id == tab->tab_id)
     {
-        char job_display[256];
-        
-        // Format: "[1] Running    sleep 60"
-        //         "[2] Stopped    vim file.txt"
-        snprintf(job_display, sizeof(job_display), "[%d] %s    %s",
-                 bg_processes[job_index].job_id, 
-                 bg_processes[job_index].status, 
-                 bg_processes[job_index].command);
-        
-        add_text_to_buffer(tab, job_display);
-        
-        // Optional: Add PID information for advanced users
-        char pid_info[128];
-        snprintf(pid_info, sizeof(pid_info), "     PID: %d", bg_processes[job_index].pid);
-        add_text_to_buffer(tab, pid_info);
+        stop_multiwatch(NULL, "Tab closed - stopping multiWatch");
+        multiwatch_tab_id = 0;
     }
-    
-    // Step 5: Add usage hint for job management
-    add_text_to_buffer(tab, "Use 'fg <job_id>' to bring a job to foreground");
-    add_text_to_buffer(tab, "Use 'kill %<job_id>' to terminate a background job");
 }
 
-void handle_fg_command(Tab *tab, const char *command)
+// Function to terminate every remaining job (blocking - used on shutdown)
+void terminate_all_jobs(void)
 {
-    // Step 1: Check if there are any background jobs available
-    if (bg_job_count == 0)
+    for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
     {
-        add_text_to_buffer(tab, "fg: no current job");
-        return;
+        CommandJob *job = &running_jobs[job_index];
+        if (!job->in_use)
+            continue;
+        if (job->channel < 0)
+        {
+            job->in_use = 0;              // Replayed: no process behind it
+            continue;
+        }
+
+        printf("Terminating job: %s\n", job->command);
+        signal_command_job(job, SIGTERM);
+        signal_command_job(job, SIGCONT);
+        usleep(50000); // 50ms grace period
+
+        for (int pid_index = 0; pid_index < job->pid_count; pid_index++)
+        {
+            int process_status;
+            if (!job->exited[pid_index] && waitpid(job->pids[pid_index], &process_status, WNOHANG) == 0)
+            {
+                kill(job->pids[pid_index], SIGKILL);
+                waitpid(job->pids[pid_index], &process_status, 0);
+            }
+        }
+        job->in_use = 0;
     }
+}
 
-    // Step 2: Parse the job ID from the command
-    int target_job_id = -1;
-    if (sscanf(command, "fg %d", &target_job_id) != 1)
+// Function to register a job that was stopped (Ctrl+Z) in the background job list
+static void register_stopped_job(CommandJob *job, Tab *tab)
+{
+    pid_t leader_pid = job->pids[job->pid_count - 1];
+
+    job->stopped = 1;
+    if (tab && tab->foreground_pid == leader_pid)
     {
-        // No job ID specified - use the most recently created job
-        target_job_id = job_counter; // job_counter tracks the most recent job ID
-        printf("No job ID specified, using most recent job: %d\n", target_job_id);
+        tab->foreground_pid = -1;
     }
 
-    // Step 3: Find the specified job in the background processes array
-    int found_job_index = -1;
-    for (int job_index = 0; job_index < bg_job_count; job_index++)
+    // Step 1: A SIGTSTP handler may already have listed this process
+    for (int bg_index = 0; bg_index < bg_job_count; bg_index++)
     {
-        if (bg_processes[job_index].job_id == target_job_id)
+        if (bg_processes[bg_index].pid == leader_pid)
         {
-            found_job_index = job_index;
-            break;
+            strcpy(bg_processes[bg_index].status, "Stopped");
+            return;
         }
     }
 
-    if (found_job_index == -1)
+    if (bg_job_count >= MAX_BG_JOBS)
     {
-        char error_message[256];
-        snprintf(error_message, sizeof(error_message), "fg: job not found: %d", target_job_id);
-        add_text_to_buffer(tab, error_message);
-        
-        // Show available jobs to help the user
-        char available_jobs[256];
-        snprintf(available_jobs, sizeof(available_jobs), 
-                 "Available jobs: %d to %d", 
-                 bg_processes[0].job_id, 
-                 bg_processes[bg_job_count - 1].job_id);
-        add_text_to_buffer(tab, available_jobs);
+        printf("Warning: Cannot add process to background - maximum jobs (%d) reached\n", MAX_BG_JOBS);
         return;
     }
 
-    // Step 4: Prepare to bring the job to foreground
-    pid_t target_pid = bg_processes[found_job_index].pid;
-    char *target_command = bg_processes[found_job_index].command;
+    // Step 2: Add a new background entry and tell the user
+    bg_processes[bg_job_count].pid = leader_pid;
+    strcpy(bg_processes[bg_job_count].status, "Stopped");
+    snprintf(bg_processes[bg_job_count].command, MAX_COMMAND_LENGTH, "%s", job->command);
+    bg_processes[bg_job_count].job_id = ++job_counter;
+    bg_job_count++;
 
-    // Step 5: Resume the job if it's stopped
-    if (strcmp(bg_processes[found_job_index].status, "Stopped") == 0)
+    if (tab)
     {
-        printf("Resuming stopped job %d (PID: %d)\n", target_job_id, target_pid);
-        
-        if (kill(target_pid, SIGCONT) == -1)
+        char job_message[256];
+        snprintf(job_message, sizeof(job_message), "[%d] Stopped    %s", job_counter, job->command);
+        add_text_to_buffer(tab, job_message);
+    }
+}
+
+// Function to drop a background job list entry for a reaped job
+static void forget_background_job(pid_t pid)
+{
+    for (int bg_index = 0; bg_index < bg_job_count; bg_index++)
+    {
+        if (bg_processes[bg_index].pid == pid)
         {
-            char error_message[256];
-            snprintf(error_message, sizeof(error_message), 
-                     "fg: failed to resume job %d: %s", target_job_id, strerror(errno));
-            add_text_to_buffer(tab, error_message);
+            for (int shift_index = bg_index; shift_index < bg_job_count - 1; shift_index++)
+            {
+                bg_processes[shift_index] = bg_processes[shift_index + 1];
+            }
+            bg_job_count--;
             return;
         }
-        
-        // Update job status to reflect it's now running
-        strncpy(bg_processes[found_job_index].status, "Running", sizeof(bg_processes[found_job_index].status) - 1);
     }
+}
 
-    // Step 6: Set the process as foreground process in the tab
-    tab->foreground_pid = target_pid;
+// Function to service running jobs at frame time; returns 1 if the visible tab changed
+int service_command_jobs(void)
+{
+    int display_changed = 0;
+    long long now = monotonic_ms();
 
-    char status_message[256];
-    snprintf(status_message, sizeof(status_message), 
-             "Resumed job [%d] in foreground: %s", target_job_id, target_command);
-    add_text_to_buffer(tab, status_message);
-    printf("Brought job %d (PID: %d) to foreground: %s\n", target_job_id, target_pid, target_command);
+    for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
+    {
+        CommandJob *job = &running_jobs[job_index];
+        if (!job->in_use || job->channel < 0)
+            continue;                     // Replayed jobs end with their recorded RECORD_JOB_END
 
-    // Step 7: Wait for the process to complete
-    int process_status;
-    pid_t wait_result = waitpid(target_pid, &process_status, 0);
+        Tab *tab = find_tab_by_id(job->tab_id);
+        int tab_visible = (tab != NULL && tab == &tabs[active_tab_index]);
 
-    if (wait_result == -1)
-    {
-        char error_message[256];
-        snprintf(error_message, sizeof(error_message), 
-                 "fg: error waiting for job %d: %s", target_job_id, strerror(errno));
-        add_text_to_buffer(tab, error_message);
-    }
-    else
-    {
-        // Report how the process terminated
-        if (WIFEXITED(process_status))
+        // Step 1: Stream new output into the owning tab
+        size_t bytes_consumed = drain_io_channel(job->channel, NULL);
+        if (bytes_consumed > 0)
         {
-            char exit_message[256];
-            snprintf(exit_message, sizeof(exit_message), 
-                     "Job [%d] exited with status %d", target_job_id, WEXITSTATUS(process_status));
-            add_text_to_buffer(tab, exit_message);
-            printf("Job %d exited normally with status %d\n", target_job_id, WEXITSTATUS(process_status));
+            if (job->output_bytes == 0)
+                trace_instant(TRACE_FIRST_OUTPUT, job->pids[job->pid_count - 1], (long long)bytes_consumed);
+            job->output_bytes += bytes_consumed;
+            output_bytes_ingested += bytes_consumed;
+            display_changed |= tab_visible;
         }
-        else if (WIFSIGNALED(process_status))
+
+        // Step 2: Reap finished stages and notice stopped ones without blocking
+        int all_exited = 1;
+        int any_stopped = 0;
+        for (int pid_index = 0; pid_index < job->pid_count; pid_index++)
         {
-            char signal_message[256];
-            snprintf(signal_message, sizeof(signal_message), 
-                     "Job [%d] terminated by signal %d", target_job_id, WTERMSIG(process_status));
-            add_text_to_buffer(tab, signal_message);
-            printf("Job %d terminated by signal %d\n", target_job_id, WTERMSIG(process_status));
+            if (job->exited[pid_index])
+                continue;
+
+            int process_status;
+            pid_t wait_result = waitpid(job->pids[pid_index], &process_status, WNOHANG | WUNTRACED);
+            if (wait_result == job->pids[pid_index] && WIFSTOPPED(process_status))
+            {
+                any_stopped = 1;
+            }
+            else if (wait_result == job->pids[pid_index] || (wait_result == -1 && errno == ECHILD))
+            {
+                job->exited[pid_index] = 1;
+                trace_instant(TRACE_EXIT, job->pids[pid_index], wait_result != -1 ? process_status : -1);
+                if (pid_index == job->pid_count - 1 && wait_result != -1)
+                {
+                    job->last_status = process_status;
+                }
+                continue;
+            }
+            all_exited = 0;
         }
-        else if (WIFSTOPPED(process_status))
+
+        if (any_stopped && !job->stopped)
         {
-            char stopped_message[256];
-            snprintf(stopped_message, sizeof(stopped_message), 
-                     "Job [%d] stopped by signal %d", target_job_id, WSTOPSIG(process_status));
-            add_text_to_buffer(tab, stopped_message);
-            printf("Job %d stopped by signal %d\n", target_job_id, WSTOPSIG(process_status));
+            register_stopped_job(job, tab);
+            display_changed |= tab_visible;
+        }
+
+        // Step 3: Enforce the timeout for jobs that are actually running
+        if (!job->stopped && !job->timed_out && now >= job->deadline_ms && !all_exited)
+        {
+            job->timed_out = 1;
+            if (tab)
+            {
+                add_text_to_buffer(tab, job->pid_count > 1 ? "Error: Pipeline timed out" : "Error: Command timed out");
+            }
+            signal_command_job(job, SIGKILL);
+            request_channel_detach(job->channel);
+            display_changed |= tab_visible;
+        }
+
+        // Step 4: Finish the job once every stage is reaped and all output is shown
+        if (all_exited && io_channel_finished(job->channel))
+        {
+            flush_io_channel(job->channel, NULL);
+
+            if (tab && !job->timed_out)
+            {
+                int status = job->last_status;
+                if (job->output_bytes > 0)
+                {
+                    // Output already streamed into the scrollback
+                }
+                else if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+                {
+                    char error_msg[256];
+                    snprintf(error_msg, sizeof(error_msg), "Command failed with exit code %d", WEXITSTATUS(status));
+                    add_text_to_buffer(tab, error_msg);
+                }
+                else if (WIFSIGNALED(status))
+                {
+                    char error_msg[256];
+                    snprintf(error_msg, sizeof(error_msg), "Command terminated by signal %d", WTERMSIG(status));
+                    add_text_to_buffer(tab, error_msg);
+                }
+                else
+                {
+                    add_text_to_buffer(tab, "(Command executed successfully - no output)");
+                }
+            }
+            int status = job->last_status;
+            int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+            trace_instant(TRACE_REAP, job->pids[job->pid_count - 1], exit_code);
+            trace_complete(TRACE_COMMAND, job->started_us, job->pids[job->pid_count - 1], exit_code);
+            if (tab)
+            {
+                end_command_block(tab, job->block_serial, exit_code);
+                add_separator_line(tab);
+                if (tab->foreground_pid == job->pids[job->pid_count - 1])
+                {
+                    tab->foreground_pid = -1;
+                }
+            }
+
+            forget_background_job(job->pids[job->pid_count - 1]);
+            release_io_channel(job->channel);
+            job->in_use = 0;
+            display_changed |= tab_visible;
         }
     }
 
-    // Step 8: Remove the job from background processes array since it's now complete
-    for (int shift_index = found_job_index; shift_index < bg_job_count - 1; shift_index++)
+    return display_changed;
+}
+
+// Function to check whether any ring still holds unconsumed bytes
+int io_backlog_pending(void)
+{
+    for (int channel_index = 0; channel_index < MAX_IO_CHANNELS; channel_index++)
     {
-        bg_processes[shift_index] = bg_processes[shift_index + 1];
+        IOChannel *channel = &io_channels[channel_index];
+        if (atomic_load(&channel->state) != IO_CHANNEL_FREE &&
+            atomic_load(&channel->ring.head) != atomic_load(&channel->ring.tail))
+            return 1;
     }
-    bg_job_count--;
-    
-    // Clear the foreground PID since the process has terminated
-    tab->foreground_pid = -1;
-    
-    printf("Removed job %d from background jobs list. %d jobs remaining.\n", 
-           target_job_id, bg_job_count);
+    return 0;
+}
+
+// Function to check whether any job or multiWatch process is still alive
+int jobs_pending(void)
+{
+    if (multiwatch_mode)
+        return 1;
+    for (int job_index = 0; job_index < MAX_RUNNING_JOBS; job_index++)
+    {
+        if (running_jobs[job_index].in_use)
+            return 1;
+    }
+    return 0;
+}
+
+// Function to run one frame's worth of child I/O and reaping; returns 1 if a redraw is needed
+int service_child_io(void)
+{
+    // Step 1: Acknowledge the reader's notification before draining, so bytes
+    // arriving during the drain raise a fresh one
+    char notify_bytes[64];
+    atomic_store(&ui_notify_pending, 0);
+    while (read(ui_notify_pipe[0], notify_bytes, sizeof(notify_bytes)) > 0)
+    {
+        // Drain coalesced notifications
+    }
+
+    // Step 2: Service regular jobs and multiWatch processes
+    int display_changed = service_command_jobs();
+    display_changed |= service_multiwatch();
+
+    // Step 3: Hidden tabs only need a redraw when their activity marker appears
+    display_changed |= tab_bar_dirty;
+    tab_bar_dirty = 0;
+    return display_changed;
 }
 
 // Function to execute a command and capture its output
 void execute_command(Display *display, Window window, GC gc, Tab *tab, const char *command)
 {
     // Step 1: Parameter validation
-    if (!display || !window || !gc || !tab)
+    if (!tab)
     {
         printf("Error: Invalid parameters to execute_command\n");
         return;
@@ -2735,14 +14385,18 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
         return;
     }
 
-    // Step 3: Create safe working copy of command
-    char command_copy[MAX_COMMAND_LENGTH];
-    if (snprintf(command_copy, sizeof(command_copy), "%s", command) >= (int)sizeof(command_copy))
+    // Step 3: Create safe working copy of command (at most MAX_COMMAND_LINE bytes)
+    size_t command_bytes = strlen(command);
+    if (command_bytes > MAX_COMMAND_LINE)
     {
-        add_text_to_buffer(tab, "Error: Command too long");
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg), "Error: Command too long (%zu bytes, limit %d)",
+                 command_bytes, MAX_COMMAND_LINE);
+        add_text_to_buffer(tab, error_msg);
         return;
     }
-    command_copy[sizeof(command_copy) - 1] = '\0';
+    static char command_copy[MAX_COMMAND_LINE + 1]; // Not on the stack: up to 128 KB, and never re-entered
+    memcpy(command_copy, command, command_bytes + 1);
 
     // Step 4: Handle special built-in commands
     // Check for multiWatch command first
@@ -2753,10 +14407,10 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
     }
 
     // Tokenize command for built-in command checking
-    char *args[64] = {0};
+    char *args[MAX_COMMAND_ARGS] = {0};
     int arg_count = 0;
     char *token = strtok(command_copy, " ");
-    while (token != NULL && arg_count < 63)
+    while (token != NULL && arg_count < MAX_COMMAND_ARGS - 1)
     {
         args[arg_count++] = token;
         token = strtok(NULL, " ");
@@ -2795,49 +14449,96 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
         return;
     }
 
-    if (arg_count > 0 && strcmp(args[0], "history") == 0)
+    if (arg_count > 0 && strcmp(args[0], "history") == 0)
+    {
+        handle_history_command(tab);
+        return;
+    }
+
+    if (arg_count > 0 && strcmp(args[0], "jobs") == 0)
+    {
+        handle_jobs_command(tab);
+        return;
+    }
+
+    if (arg_count > 0 && strncmp(args[0], "fg", 2) == 0)
+    {
+        handle_fg_command(tab, command);
+        return;
+    }
+
+    if (arg_count > 0 && strcmp(args[0], "exit") == 0)
+    {
+        // Leave the terminal; a detached server shuts down with every tab
+        add_text_to_buffer(tab, server_mode ? "Shutting down the server..." : "Exiting...");
+        quit_requested = 1;
+        return;
+    }
+
+    if (arg_count > 0 && strcmp(args[0], "renderer") == 0)
+    {
+        handle_renderer_command(display, window, gc, tab, arg_count > 1 ? args[1] : NULL);
+        return;
+    }
+
+    if (arg_count > 0 && strcmp(args[0], "hibernate") == 0)
+    {
+        handle_hibernate_command(tab);
+        return;
+    }
+
+    if (arg_count > 0 && strcmp(args[0], "memstat") == 0)
+    {
+        handle_memstat_command(tab);
+        return;
+    }
+
+    if (arg_count > 0 && strcmp(args[0], "stats") == 0)
     {
-        handle_history_command(tab);
+        handle_stats_command(tab, arg_count > 1 ? args[1] : NULL);
         return;
     }
 
-    if (arg_count > 0 && strcmp(args[0], "jobs") == 0)
+    if (arg_count > 0 && strcmp(args[0], "trace") == 0)
     {
-        handle_jobs_command(tab);
+        handle_trace_command(tab, arg_count > 1 ? args[1] : NULL, arg_count > 2 ? args[2] : NULL);
         return;
     }
 
-    if (arg_count > 0 && strncmp(args[0], "fg", 2) == 0)
+    if (arg_count > 0 && (strcmp(args[0], "blocks") == 0 || strcmp(args[0], "fold") == 0 ||
+                          strcmp(args[0], "unfold") == 0 || strcmp(args[0], "drop") == 0))
     {
-        handle_fg_command(tab, command);
+        handle_blocks_command(tab, args[0], arg_count > 1 ? args[1] : NULL);
         return;
     }
 
     // Step 5: Prepare command execution with timestamp and visual formatting
     char command_header[512];
-    time_t start_time = time(NULL);
+    time_t start_time = terminal_time();
     struct tm *tm_info = localtime(&start_time);
     char timestamp[64];
     strftime(timestamp, sizeof(timestamp), "[%H:%M:%S]", tm_info);
     snprintf(command_header, sizeof(command_header), "%s Executing: %s", timestamp, command);
     add_text_to_buffer(tab, command_header);
+    begin_command_block(tab, command);
     add_separator_line(tab);
 
-    // Step 6: Parse command for pipes (single command vs pipeline)
-    int num_commands = 1;
-    char *commands[16];
-    char command_copy2[MAX_COMMAND_LENGTH];
-
-    if (snprintf(command_copy2, sizeof(command_copy2), "%s", command) >= (int)sizeof(command_copy2))
+    // A replay takes the command's output and exit from the recording instead of running it
+    if (replay_active)
     {
-        add_text_to_buffer(tab, "Error: Command too long");
-        add_separator_line(tab); // Close the section even on error
+        pid_t no_process = 0;
+        start_command_job(tab, command, &no_process, 1, -1, 0);
         return;
     }
-    command_copy2[sizeof(command_copy2) - 1] = '\0';
+
+    // Step 6: Parse command for pipes (single command vs pipeline)
+    int num_commands = 1;
+    char *commands[MAX_PIPELINE_COMMANDS];
+    static char command_copy2[MAX_COMMAND_LINE + 1];
+    memcpy(command_copy2, command, command_bytes + 1);
 
     commands[0] = strtok(command_copy2, "|");
-    while ((commands[num_commands] = strtok(NULL, "|")) != NULL && num_commands < 15)
+    while (num_commands < MAX_PIPELINE_COMMANDS && (commands[num_commands] = strtok(NULL, "|")) != NULL)
     {
         num_commands++;
     }
@@ -2899,21 +14600,15 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
             }
 
             // Parse command for I/O redirection and arguments
-            char *args[64];
+            char *args[MAX_COMMAND_ARGS];
             int arg_count = 0;
             char *input_file = NULL;
             char *output_file = NULL;
-            char cmd_copy[MAX_COMMAND_LENGTH];
-
-            if (snprintf(cmd_copy, sizeof(cmd_copy), "%s", command) >= (int)sizeof(cmd_copy))
-            {
-                fprintf(stderr, "Error: Command too long\n");
-                exit(1);
-            }
-            cmd_copy[sizeof(cmd_copy) - 1] = '\0';
+            char *cmd_copy = command_copy2; // The child's own copy of the buffer, free to reuse
+            memcpy(cmd_copy, command, command_bytes + 1);
 
             char *token = strtok(cmd_copy, " ");
-            while (token != NULL && arg_count < 63)
+            while (token != NULL && arg_count < MAX_COMMAND_ARGS - 1)
             {
                 if (strcmp(token, "<") == 0)
                 {
@@ -2978,210 +14673,36 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
             }
 
             // Execute the command
+            trace_exec();
             execvp(args[0], args);
             fprintf(stderr, "Error: Command not found: %s (%s)\n", args[0], strerror(errno));
             exit(127);
         }
         else
         {
-            // PARENT PROCESS: Monitor child and capture output
-            tab->foreground_pid = pid;
-
-            int status;
-            char buffer[1024];
-            ssize_t bytes_read;
-            char full_output[OUTPUT_BUFFER_SIZE] = {0};
-            int full_output_len = 0;
-
-            // Close unused write end of pipe
+            // PARENT PROCESS: Hand the output pipe to the reader thread and return
+            // to the event loop - the job is reaped and reported at frame time
+            trace_instant(TRACE_FORK, pid, tab->tab_id);
             if (close(pipefd[1]) == -1)
             {
                 printf("Warning: Failed to close pipe write end: %s\n", strerror(errno));
             }
 
-            // Set non-blocking mode for responsive UI
-            if (fcntl(pipefd[0], F_SETFL, O_NONBLOCK) == -1)
-            {
-                printf("Warning: Failed to set non-blocking mode: %s\n", strerror(errno));
-            }
-
-            int child_exited = 0;
-            int timeout_counter = 0;
-            const int MAX_TIMEOUT = 300; // 3 second timeout
-
-            // Main monitoring loop
-            while (!child_exited && timeout_counter < MAX_TIMEOUT)
-            {
-                // Check for user input (Ctrl+C, Ctrl+Z)
-                if (XPending(display) > 0)
-                {
-                    XEvent ev;
-                    XNextEvent(display, &ev);
-                    if (ev.type == KeyPress)
-                    {
-                        KeySym keysym;
-                        char keybuf[256];
-                        XLookupString(&ev.xkey, keybuf, sizeof(keybuf) - 1, &keysym, NULL);
-
-                        if ((ev.xkey.state & ControlMask) && keysym == XK_c)
-                        {
-                            printf("\nCtrl+C detected - interrupting process\n");
-                            if (kill(pid, SIGINT) == -1)
-                            {
-                                printf("Warning: Failed to send SIGINT: %s\n", strerror(errno));
-                            }
-                            break;
-                        }
-                        else if ((ev.xkey.state & ControlMask) && keysym == XK_z)
-                        {
-                            printf("\nCtrl+Z detected - stopping process\n");
-                            if (kill(pid, SIGTSTP) == -1)
-                            {
-                                printf("Warning: Failed to send SIGTSTP: %s\n", strerror(errno));
-                            }
-                            break;
-                        }
-                    }
-                }
-
-                // Check for signals received
-                if (signal_received)
-                {
-                    signal_received = 0;
-                    if (which_signal == SIGINT)
-                    {
-                        printf("\nCtrl+C received - interrupting process\n");
-                        if (kill(pid, SIGINT) == -1)
-                        {
-                            printf("Warning: Failed to send SIGINT: %s\n", strerror(errno));
-                        }
-                        break;
-                    }
-                    else if (which_signal == SIGTSTP)
-                    {
-                        printf("\nCtrl+Z received - stopping process\n");
-                        if (kill(pid, SIGTSTP) == -1)
-                        {
-                            printf("Warning: Failed to send SIGTSTP: %s\n", strerror(errno));
-                        }
-                        break;
-                    }
-                    which_signal = 0;
-                }
-
-                // Read available output from child
-                bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0)
-                {
-                    buffer[bytes_read] = '\0';
-                    if (full_output_len + bytes_read < OUTPUT_BUFFER_SIZE - 1)
-                    {
-                        strncpy(full_output + full_output_len, buffer, bytes_read);
-                        full_output_len += bytes_read;
-                        full_output[full_output_len] = '\0';
-                    }
-                    else
-                    {
-                        add_text_to_buffer(tab, "Warning: Output truncated (too large)");
-                        break;
-                    }
-                }
-                else if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-                {
-                    printf("Read error: %s\n", strerror(errno));
-                    break;
-                }
-
-                // Check if child has exited
-                int wait_result = waitpid(pid, &status, WNOHANG);
-                if (wait_result == pid)
-                {
-                    child_exited = 1;
-                }
-                else if (wait_result == -1)
-                {
-                    printf("Waitpid error: %s\n", strerror(errno));
-                    break;
-                }
-
-                usleep(10000); // 10ms delay to prevent busy waiting
-                timeout_counter++;
-            }
-
-            // Handle timeout
-            if (timeout_counter >= MAX_TIMEOUT)
-            {
-                add_text_to_buffer(tab, "Error: Command timed out");
-                if (kill(pid, SIGKILL) == -1)
-                {
-                    printf("Warning: Failed to kill timed out process: %s\n", strerror(errno));
-                }
-            }
-
-            // Read any remaining data after child exit
-            while ((bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0)
-            {
-                buffer[bytes_read] = '\0';
-                if (full_output_len + bytes_read < OUTPUT_BUFFER_SIZE - 1)
-                {
-                    strncpy(full_output + full_output_len, buffer, bytes_read);
-                    full_output_len += bytes_read;
-                    full_output[full_output_len] = '\0';
-                }
-            }
-
-            // Clean up pipe
-            if (close(pipefd[0]) == -1)
-            {
-                printf("Warning: Failed to close pipe read end: %s\n", strerror(errno));
-            }
-
-            // Ensure no zombie processes
-            if (!child_exited)
-            {
-                if (waitpid(pid, &status, WNOHANG) == 0)
-                {
-                    if (kill(pid, SIGKILL) == -1)
-                    {
-                        printf("Warning: Failed to kill process: %s\n", strerror(errno));
-                    }
-                    waitpid(pid, &status, 0);
-                }
-            }
-
-            tab->foreground_pid = -1;
-
-            // Step 8: Display results with appropriate formatting
-            if (full_output_len > 0)
-            {
-                add_text_to_buffer(tab, full_output);
-            }
-            else if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
-            {
-                char error_msg[256];
-                snprintf(error_msg, sizeof(error_msg), "Command failed with exit code %d", WEXITSTATUS(status));
-                add_text_to_buffer(tab, error_msg);
-            }
-            else if (WIFSIGNALED(status))
-            {
-                char error_msg[256];
-                snprintf(error_msg, sizeof(error_msg), "Command terminated by signal %d", WTERMSIG(status));
-                add_text_to_buffer(tab, error_msg);
-            }
-            else
+            if (start_command_job(tab, command, &pid, 1, pipefd[0], COMMAND_TIMEOUT_MS) == -1)
             {
-                add_text_to_buffer(tab, "(Command executed successfully - no output)");
+                add_text_to_buffer(tab, "Error: Too many running commands");
+                kill(pid, SIGKILL);
+                waitpid(pid, NULL, 0);
+                close(pipefd[0]);
+                add_separator_line(tab);
             }
-
-            // Add final separator to visually separate command output
-            add_separator_line(tab);
         }
     }
     else
     {
         // Step 9: Handle piped commands (multiple commands connected with |)
-        int pipefds[2][2]; // Alternating pipes for command chaining
-        pid_t pids[16];    // Process IDs for all commands in pipeline
+        int pipefds[MAX_PIPELINE_COMMANDS - 1][2]; // One pipe between each pair of stages
+        pid_t pids[MAX_PIPELINE_COMMANDS];         // Process IDs for all commands in pipeline
         int final_output_pipe[2]; // Final pipe to capture overall output
 
         if (pipe(final_output_pipe) == -1)
@@ -3195,11 +14716,16 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
         // Create pipes for all commands except the last one
         for (int i = 0; i < num_commands - 1; i++)
         {
-            if (pipe(pipefds[i % 2]) == -1)
+            if (pipe(pipefds[i]) == -1)
             {
                 char error_msg[256];
                 snprintf(error_msg, sizeof(error_msg), "Error: Failed to create pipe: %s", strerror(errno));
                 add_text_to_buffer(tab, error_msg);
+                for (int j = 0; j < i; j++)
+                {
+                    close(pipefds[j][0]);
+                    close(pipefds[j][1]);
+                }
                 close(final_output_pipe[0]);
                 close(final_output_pipe[1]);
                 return;
@@ -3217,16 +14743,17 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
                 snprintf(error_msg, sizeof(error_msg), "Error: Fork failed: %s", strerror(errno));
                 add_text_to_buffer(tab, error_msg);
 
-                // Clean up: kill already forked processes
+                // Clean up: kill and reap already forked processes
                 for (int j = 0; j < i; j++)
                 {
                     kill(pids[j], SIGKILL);
+                    waitpid(pids[j], NULL, 0);
                 }
                 // Close all pipes
                 for (int j = 0; j < num_commands - 1; j++)
                 {
-                    close(pipefds[j % 2][0]);
-                    close(pipefds[j % 2][1]);
+                    close(pipefds[j][0]);
+                    close(pipefds[j][1]);
                 }
                 close(final_output_pipe[0]);
                 close(final_output_pipe[1]);
@@ -3241,7 +14768,7 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
                 // Set up input redirection from previous command
                 if (i > 0)
                 {
-                    if (dup2(pipefds[(i - 1) % 2][0], STDIN_FILENO) == -1)
+                    if (dup2(pipefds[i - 1][0], STDIN_FILENO) == -1)
                     {
                         perror("dup2 stdin failed");
                         exit(1);
@@ -3251,12 +14778,12 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
                 // Set up output redirection to next command or final output
                 if (i < num_commands - 1)
                 {
-                    if (dup2(pipefds[i % 2][1], STDOUT_FILENO) == -1)
+                    if (dup2(pipefds[i][1], STDOUT_FILENO) == -1)
                     {
                         perror("dup2 stdout failed");
                         exit(1);
                     }
-                    if (dup2(pipefds[i % 2][1], STDERR_FILENO) == -1)
+                    if (dup2(pipefds[i][1], STDERR_FILENO) == -1)
                     {
                         perror("dup2 stderr failed");
                         exit(1);
@@ -3280,16 +14807,15 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
                 // Close all pipe file descriptors in child
                 for (int j = 0; j < num_commands - 1; j++)
                 {
-                    close(pipefds[j % 2][0]);
-                    close(pipefds[j % 2][1]);
+                    close(pipefds[j][0]);
+                    close(pipefds[j][1]);
                 }
                 close(final_output_pipe[0]);
                 close(final_output_pipe[1]);
 
                 // Parse and execute the individual command
-                char *args[64];
+                char *args[MAX_COMMAND_ARGS];
                 int arg_count = 0;
-                char cmd_copy[MAX_COMMAND_LENGTH];
 
                 char *cmd = commands[i];
                 // Trim leading and trailing whitespace
@@ -3303,15 +14829,10 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
                     end--;
                 }
 
-                if (snprintf(cmd_copy, sizeof(cmd_copy), "%s", cmd) >= (int)sizeof(cmd_copy))
-                {
-                    fprintf(stderr, "Error: Command too long\n");
-                    exit(1);
-                }
-                cmd_copy[sizeof(cmd_copy) - 1] = '\0';
+                char *cmd_copy = cmd; // Already the child's own copy, tokenized in place
 
                 char *token = strtok(cmd_copy, " ");
-                while (token != NULL && arg_count < 63)
+                while (token != NULL && arg_count < MAX_COMMAND_ARGS - 1)
                 {
                     args[arg_count++] = token;
                     token = strtok(NULL, " ");
@@ -3324,20 +14845,22 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
                     exit(1);
                 }
 
+                trace_exec();
                 execvp(args[0], args);
                 fprintf(stderr, "Error: Command not found: %s (%s)\n", args[0], strerror(errno));
                 exit(127);
             }
+            trace_instant(TRACE_FORK, pids[i], tab->tab_id);
         }
 
-        // PARENT PROCESS: Close unused pipe ends and monitor pipeline
+        // PARENT PROCESS: Close unused pipe ends and hand the output to the reader thread
         for (int i = 0; i < num_commands - 1; i++)
         {
-            if (close(pipefds[i % 2][0]) == -1)
+            if (close(pipefds[i][0]) == -1)
             {
                 printf("Warning: Failed to close pipe read end: %s\n", strerror(errno));
             }
-            if (close(pipefds[i % 2][1]) == -1)
+            if (close(pipefds[i][1]) == -1)
             {
                 printf("Warning: Failed to close pipe write end: %s\n", strerror(errno));
             }
@@ -3347,118 +14870,17 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
             printf("Warning: Failed to close final output pipe write end: %s\n", strerror(errno));
         }
 
-        tab->foreground_pid = pids[num_commands - 1];
-
-        // Capture output from the final pipe
-        int status;
-        char buffer[1024];
-        ssize_t bytes_read;
-        char full_output[OUTPUT_BUFFER_SIZE] = {0};
-        int full_output_len = 0;
-
-        if (fcntl(final_output_pipe[0], F_SETFL, O_NONBLOCK) == -1)
-        {
-            printf("Warning: Failed to set non-blocking mode: %s\n", strerror(errno));
-        }
-
-        int all_children_exited = 0;
-        int timeout_counter = 0;
-        const int MAX_TIMEOUT = 500; // 5 seconds max for pipeline
-
-        // Monitor pipeline execution
-        while (!all_children_exited && timeout_counter < MAX_TIMEOUT)
-        {
-            bytes_read = read(final_output_pipe[0], buffer, sizeof(buffer) - 1);
-            if (bytes_read > 0)
-            {
-                buffer[bytes_read] = '\0';
-                if (full_output_len + bytes_read < OUTPUT_BUFFER_SIZE - 1)
-                {
-                    strncpy(full_output + full_output_len, buffer, bytes_read);
-                    full_output_len += bytes_read;
-                    full_output[full_output_len] = '\0';
-                }
-                else
-                {
-                    add_text_to_buffer(tab, "Warning: Output truncated (too large)");
-                    break;
-                }
-            }
-            else if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-            {
-                printf("Read error: %s\n", strerror(errno));
-                break;
-            }
-
-            // Check if all children have exited
-            all_children_exited = 1;
-            for (int i = 0; i < num_commands; i++)
-            {
-                if (waitpid(pids[i], &status, WNOHANG) == 0)
-                {
-                    all_children_exited = 0;
-                }
-                else if (waitpid(pids[i], &status, WNOHANG) == -1)
-                {
-                    printf("Waitpid error for process %d: %s\n", pids[i], strerror(errno));
-                }
-            }
-
-            usleep(10000);
-            timeout_counter++;
-        }
-
-        // Handle pipeline timeout
-        if (timeout_counter >= MAX_TIMEOUT)
+        if (start_command_job(tab, command, pids, num_commands, final_output_pipe[0], PIPELINE_TIMEOUT_MS) == -1)
         {
-            add_text_to_buffer(tab, "Error: Pipeline timed out");
+            add_text_to_buffer(tab, "Error: Too many running commands");
             for (int i = 0; i < num_commands; i++)
             {
-                if (kill(pids[i], SIGKILL) == -1)
-                {
-                    printf("Warning: Failed to kill process %d: %s\n", pids[i], strerror(errno));
-                }
-            }
-        }
-
-        // Read any remaining data
-        while ((bytes_read = read(final_output_pipe[0], buffer, sizeof(buffer) - 1)) > 0)
-        {
-            buffer[bytes_read] = '\0';
-            if (full_output_len + bytes_read < OUTPUT_BUFFER_SIZE - 1)
-            {
-                strncpy(full_output + full_output_len, buffer, bytes_read);
-                full_output_len += bytes_read;
-                full_output[full_output_len] = '\0';
-            }
-        }
-
-        if (close(final_output_pipe[0]) == -1)
-        {
-            printf("Warning: Failed to close final output pipe read end: %s\n", strerror(errno));
-        }
-
-        // Wait for all children to prevent zombies
-        for (int i = 0; i < num_commands; i++)
-        {
-            if (waitpid(pids[i], NULL, 0) == -1)
-            {
-                printf("Warning: Failed to wait for process %d: %s\n", pids[i], strerror(errno));
+                kill(pids[i], SIGKILL);
+                waitpid(pids[i], NULL, 0);
             }
+            close(final_output_pipe[0]);
+            add_separator_line(tab);
         }
-
-        tab->foreground_pid = -1;
-
-        // Display pipeline output
-        if (full_output_len > 0)
-        {
-            add_text_to_buffer(tab, full_output);
-        }
-        else
-        {
-            add_text_to_buffer(tab, "");
-        }
-        add_separator_line(tab);
     }
 
     // Step 10: Update the display with the new content
@@ -3468,32 +14890,44 @@ void execute_command(Display *display, Window window, GC gc, Tab *tab, const cha
 // Function to handle Enter key - executes command and shows output
 void handle_enter_key(Display *display, Window window, GC gc, Tab *tab)
 {
-    // Step 1: Check if there's a command to execute
-    if (wcslen(tab->current_command) > 0)
+    LineEditor *editor = &tab->editor;
+    size_t command_length = line_editor_length(editor);
+
+    // Step 0: A trailing backslash continues the command on a new line instead of running it
+    if (command_length > 0 && editor->cursor == command_length &&
+        line_editor_char_at(editor, command_length - 1) == L'\\')
     {
-        // Convert wide character command back to multibyte for execution
-        char multibyte_command[MAX_COMMAND_LENGTH * 4];
-        size_t converted_chars = wcstombs(multibyte_command, tab->current_command, sizeof(multibyte_command) - 1);
-        
-        if (converted_chars == (size_t)-1)
-        {
-            // UTF-8 conversion failed, use simple ASCII fallback
-            for (int char_index = 0; 
-                 char_index < tab->command_length && char_index < sizeof(multibyte_command) - 1; 
-                 char_index++)
-            {
-                multibyte_command[char_index] = (char)tab->current_command[char_index];
-            }
-            multibyte_command[tab->command_length] = '\0';
-        }
-        else
+        line_editor_backspace(editor);
+        line_editor_insert(editor, L"\n", 1);
+        update_command_display(tab);
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+
+    // Only one foreground command per tab - keep the typed line for later
+    if (find_foreground_job(tab) != NULL || (multiwatch_mode && multiwatch_tab_id == tab->tab_id))
+    {
+        add_text_to_buffer(tab, "Error: A command is still running in this tab (Ctrl+C to interrupt)");
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+
+    // Step 1: Convert the line to UTF-8 once; the lines of multi-line input are joined with spaces
+    char *multibyte_command = NULL;
+    if (command_length > 0)
+    {
+        multibyte_command = line_editor_to_utf8(editor, 1);
+        if (!multibyte_command)
         {
-            multibyte_command[converted_chars] = '\0';
+            add_text_to_buffer(tab, "Error: Out of memory converting command");
+            draw_text_buffer(display, window, gc);
+            return;
         }
 
-        // Add command to history before execution
-        add_to_history(tab, multibyte_command);
-        printf("ENTER pressed in tab '%s' - executing command: '%s'\n", tab->tab_name, multibyte_command);
+        // Add command to history before execution (kept with its line breaks for recall)
+        add_to_history(tab, line_editor_contents(editor));
+        printf("ENTER pressed in tab '%s' - executing command (%zu bytes): '%.200s'\n",
+               tab->tab_name, strlen(multibyte_command), multibyte_command);
     }
     else
     {
@@ -3517,30 +14951,18 @@ void handle_enter_key(Display *display, Window window, GC gc, Tab *tab)
     tab->cursor_col = 0; // Reset to beginning of line
 
     // Step 4: Execute the command if one was entered
-    if (wcslen(tab->current_command) > 0)
+    if (multibyte_command)
     {
-        // Convert to multibyte for execution (repeating conversion for clarity)
-        char multibyte_command[MAX_COMMAND_LENGTH * 4];
-        size_t converted_chars = wcstombs(multibyte_command, tab->current_command, sizeof(multibyte_command) - 1);
-        
-        if (converted_chars == (size_t)-1)
-        {
-            // Fallback to ASCII conversion
-            for (int char_index = 0; 
-                 char_index < tab->command_length && char_index < sizeof(multibyte_command) - 1; 
-                 char_index++)
-            {
-                multibyte_command[char_index] = (char)tab->current_command[char_index];
-            }
-            multibyte_command[tab->command_length] = '\0';
-        }
-        else
-        {
-            multibyte_command[converted_chars] = '\0';
-        }
-
         // Execute the command - this will handle output display and separators
         execute_command(display, window, gc, tab, multibyte_command);
+        free(multibyte_command);
+
+        // A command that never became a job (e.g. fork failed) closes its block here
+        if (tab->pending_block_serial != 0)
+        {
+            end_command_block(tab, tab->pending_block_serial, -1);
+            tab->pending_block_serial = 0;
+        }
     }
     else
     {
@@ -3566,10 +14988,8 @@ void handle_enter_key(Display *display, Window window, GC gc, Tab *tab)
     tab->text_buffer[tab->cursor_row][1] = L' ';  // Space after prompt
     tab->cursor_col = 2; // Position cursor after "> " prompt
 
-    // Step 7: Reset command buffer for new input
-    memset(tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-    tab->command_length = 0;
-    tab->cursor_buffer_pos = 0;
+    // Step 7: Reset command buffer for new input (its storage is reused)
+    line_editor_clear(editor);
 
     // Step 8: Update the display to show the new state
     draw_text_buffer(display, window, gc);
@@ -3580,21 +15000,27 @@ void handle_enter_key(Display *display, Window window, GC gc, Tab *tab)
 // Function to handle keyboard input for the terminal
 void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_event)
 {
-    // Step 1: Get the currently active tab
-    Tab *active_tab = &tabs[active_tab_index];
-
-    // Step 2: Process the key event and convert to usable format
+    // Convert X11 key event to string representation
     char key_buffer[UTF8_BUFFER_SIZE];
     KeySym key_symbol;
-    int buffer_length;
-    int shift_pressed = (key_event->state & ShiftMask);
-    int control_pressed = (key_event->state & ControlMask);
-    int alt_pressed = (key_event->state & Mod1Mask);
-
-    // Convert X11 key event to string representation
-    buffer_length = XLookupString(key_event, key_buffer, sizeof(key_buffer) - 1, &key_symbol, NULL);
+    int buffer_length = XLookupString(key_event, key_buffer, sizeof(key_buffer) - 1, &key_symbol, NULL);
     key_buffer[buffer_length] = '\0';
 
+    handle_key_input(display, window, gc, key_symbol, key_event->state, key_buffer, buffer_length, key_event->time);
+}
+
+// Function to apply one key to the active tab (see handle_key_input)
+static void apply_key_input(Display *display, Window window, GC gc, KeySym key_symbol, unsigned int state,
+                            const char *key_buffer, int buffer_length, Time key_time)
+{
+    // Step 1: Get the currently active tab
+    Tab *active_tab = &tabs[active_tab_index];
+
+    // Step 2: Decode the modifiers
+    int shift_pressed = (state & ShiftMask);
+    int control_pressed = (state & ControlMask);
+    int alt_pressed = (state & Mod1Mask);
+
     // Convert input to wide character for consistent internal handling
     wchar_t wide_character = L'\0';
     if (buffer_length > 0)
@@ -3606,6 +15032,20 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
         }
     }
 
+    // The cross-tab search view (Ctrl+Shift+F) and find mode (Ctrl+F) take every key until Escape
+    if (global_search.active)
+    {
+        handle_global_search_keypress(key_symbol, wide_character, control_pressed);
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+    if (active_tab->find.active)
+    {
+        handle_find_keypress(active_tab, key_symbol, wide_character, shift_pressed, control_pressed);
+        draw_text_buffer(display, window, gc);
+        return;
+    }
+
     // Step 3: Handle different keys based on the key symbol
     switch (key_symbol)
     {
@@ -3614,16 +15054,21 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
         {
             // ESC in search mode: exit search and clear state
             active_tab->search_mode = 0;
-            memset(active_tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-            active_tab->command_length = 0;
-            active_tab->cursor_buffer_pos = 0;
-            active_tab->search_pos = 0;
-            memset(active_tab->search_buffer, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
+            line_editor_clear(&active_tab->editor);
+            line_editor_clear(&active_tab->search_buffer);
             update_command_display(active_tab);
         }
         else
         {
-            // ESC in normal mode: exit application
+            // ESC in normal mode: exit application (a detached server only lets the client go;
+            // a replay runs on to the end of the recording)
+            if (replay_active)
+                break;
+            if (server_mode)
+            {
+                detach_attached_client("ESC pressed");
+                break;
+            }
             printf("ESC pressed - exiting application\n");
             exit(0);
         }
@@ -3636,17 +15081,16 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
             // ENTER in search mode: execute search and exit search mode
             active_tab->search_mode = 0;
 
-            if (active_tab->search_pos > 0)
+            if (line_editor_length(&active_tab->search_buffer) > 0)
             {
-                wchar_t found_command[MAX_COMMAND_LENGTH] = {0};
-                int search_result = search_history(active_tab, active_tab->search_buffer, found_command, 1);
+                int found_index = -1;
+                int search_result = search_history(active_tab, line_editor_contents(&active_tab->search_buffer),
+                                                   &found_index, 1);
 
                 if (search_result == 1)
                 {
                     // Single match found - use it as current command
-                    wcscpy(active_tab->current_command, found_command);
-                    active_tab->command_length = wcslen(active_tab->current_command);
-                    active_tab->cursor_buffer_pos = active_tab->command_length;
+                    line_editor_set_text(&active_tab->editor, active_tab->command_history[found_index]);
                 }
                 else if (search_result > 1)
                 {
@@ -3659,41 +15103,39 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
                     add_text_to_buffer(active_tab, message);
 
                     // Clear command since we have multiple matches
-                    memset(active_tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-                    active_tab->command_length = 0;
-                    active_tab->cursor_buffer_pos = 0;
+                    line_editor_clear(&active_tab->editor);
                 }
                 else if (search_result == -1)
                 {
                     // No matches found
                     add_text_to_buffer(active_tab, "No match for search term in history");
-                    memset(active_tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-                    active_tab->command_length = 0;
-                    active_tab->cursor_buffer_pos = 0;
+                    line_editor_clear(&active_tab->editor);
                 }
                 else
                 {
                     // No match found (result == 0)
-                    memset(active_tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-                    active_tab->command_length = 0;
-                    active_tab->cursor_buffer_pos = 0;
+                    line_editor_clear(&active_tab->editor);
                 }
             }
             else
             {
                 // Empty search - clear command
-                memset(active_tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-                active_tab->command_length = 0;
-                active_tab->cursor_buffer_pos = 0;
+                line_editor_clear(&active_tab->editor);
             }
 
             // Reset search state
-            active_tab->search_pos = 0;
-            memset(active_tab->search_buffer, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
+            line_editor_clear(&active_tab->search_buffer);
 
             // Return to normal command display
             update_command_display(active_tab);
         }
+        else if (shift_pressed)
+        {
+            // Shift+ENTER: start a new line of a multi-line command
+            line_editor_insert(&active_tab->editor, L"\n", 1);
+            update_command_display(active_tab);
+            draw_text_buffer(display, window, gc);
+        }
         else
         {
             // ENTER in normal mode: execute the current command
@@ -3709,16 +15151,7 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
             create_new_tab();
             
             // Switch to the newly created tab
-            if (active_tab_index >= 0 && active_tab_index < MAX_TABS)
-            {
-                tabs[active_tab_index].active = 0;
-            }
-            active_tab_index = tab_count - 1;
-            if (active_tab_index >= 0 && active_tab_index < MAX_TABS)
-            {
-                tabs[active_tab_index].active = 1;
-                update_command_display(&tabs[active_tab_index]);
-            }
+            activate_tab(tab_count - 1);
             draw_text_buffer(display, window, gc);
             break;
         }
@@ -3730,19 +15163,8 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
             // Ctrl+Tab: Switch to next tab
             if (tab_count > 0 && tab_count <= MAX_TABS)
             {
-                // Deactivate current tab
-                if (active_tab_index >= 0 && active_tab_index < MAX_TABS)
-                {
-                    tabs[active_tab_index].active = 0;
-                }
                 // Move to next tab (wrap around)
-                active_tab_index = (active_tab_index + 1) % tab_count;
-                // Activate new tab
-                if (active_tab_index >= 0 && active_tab_index < MAX_TABS)
-                {
-                    tabs[active_tab_index].active = 1;
-                    update_command_display(&tabs[active_tab_index]);
-                }
+                activate_tab((active_tab_index + 1) % tab_count);
             }
         }
         else if (!active_tab->search_mode)
@@ -3762,130 +15184,142 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
         }
         goto default_case;
 
-    case XK_BackSpace:
-    case XK_Delete:
-        if (active_tab->search_mode)
-        {
-            // Backspace in search mode: remove last search character
-            if (active_tab->search_pos > 0)
-            {
-                active_tab->search_pos--;
-                active_tab->search_buffer[active_tab->search_pos] = L'\0';
-
-                // Update search display with current results
-                char search_prompt[256];
-                char multibyte_search[MAX_COMMAND_LENGTH * 4] = {0};
-                size_t converted_chars = wcstombs(multibyte_search, active_tab->search_buffer, sizeof(multibyte_search) - 1);
-                
-                if (converted_chars == (size_t)-1)
-                {
-                    // Fallback conversion
-                    for (int char_index = 0; char_index < active_tab->search_pos && char_index < sizeof(multibyte_search) - 1; char_index++)
-                    {
-                        multibyte_search[char_index] = (char)active_tab->search_buffer[char_index];
-                    }
-                    multibyte_search[active_tab->search_pos] = '\0';
-                }
-
-                // Perform search with updated term
-                wchar_t found_command[MAX_COMMAND_LENGTH] = {0};
-                int search_result = search_history(active_tab, active_tab->search_buffer, found_command, 0);
-
-                if (search_result == 1)
-                {
-                    char multibyte_found[MAX_COMMAND_LENGTH * 4] = {0};
-                    wcstombs(multibyte_found, found_command, sizeof(multibyte_found) - 1);
-                    multibyte_found[sizeof(multibyte_found) - 1] = '\0';
-                    snprintf(search_prompt, sizeof(search_prompt), "(reverse-i-search)`%s': %s", multibyte_search, multibyte_found);
-                }
-                else
-                {
-                    snprintf(search_prompt, sizeof(search_prompt), "(reverse-i-search)`%s': ", multibyte_search);
-                }
-
-                update_command_display_with_prompt(active_tab, search_prompt);
-            }
-            else
-            {
-                // No more characters to delete - show empty search prompt
-                update_command_display_with_prompt(active_tab, "(reverse-i-search)`': ");
-            }
+    case XK_BackSpace:
+    case XK_Delete:
+        if (active_tab->search_mode)
+        {
+            // Backspace in search mode: remove last search character and search again
+            line_editor_backspace(&active_tab->search_buffer);
+            refresh_search_prompt(active_tab);
         }
         else
         {
-            // Backspace in normal mode: delete character before cursor
-            if (active_tab->cursor_buffer_pos > 0)
+            LineEditor *editor = &active_tab->editor;
+            if (alt_pressed)
             {
-                // Shift characters left to overwrite deleted character
-                for (int char_index = active_tab->cursor_buffer_pos - 1; char_index < active_tab->command_length; char_index++)
-                {
-                    active_tab->current_command[char_index] = active_tab->current_command[char_index + 1];
-                }
-                active_tab->command_length--;
-                active_tab->cursor_buffer_pos--;
+                // Alt+Backspace: delete the word before the cursor
+                size_t word_start = line_editor_word_left(editor);
+                line_editor_delete(editor, word_start, editor->cursor - word_start);
+                update_command_display(active_tab);
+            }
+            else if (line_editor_backspace(editor))
+            {
+                // Backspace in normal mode: delete character before cursor
                 update_command_display(active_tab);
             }
         }
         break;
 
     case XK_Left:
-        // Move cursor left
-        if (!active_tab->search_mode && active_tab->cursor_buffer_pos > 0)
+        // Move cursor left (Ctrl+Left: to the start of the previous word)
+        if (!active_tab->search_mode && active_tab->editor.cursor > 0)
         {
-            active_tab->cursor_buffer_pos--;
+            if (control_pressed)
+                line_editor_set_cursor(&active_tab->editor, line_editor_word_left(&active_tab->editor));
+            else
+                line_editor_set_cursor(&active_tab->editor, active_tab->editor.cursor - 1);
             update_command_display(active_tab);
         }
         break;
 
     case XK_Right:
-        // Move cursor right
-        if (!active_tab->search_mode && active_tab->cursor_buffer_pos < active_tab->command_length)
+        // Move cursor right (Ctrl+Right: to the end of the next word)
+        if (!active_tab->search_mode && active_tab->editor.cursor < line_editor_length(&active_tab->editor))
         {
-            active_tab->cursor_buffer_pos++;
+            if (control_pressed)
+                line_editor_set_cursor(&active_tab->editor, line_editor_word_right(&active_tab->editor));
+            else
+                line_editor_set_cursor(&active_tab->editor, active_tab->editor.cursor + 1);
             update_command_display(active_tab);
         }
         break;
 
     case XK_Up:
-        // Navigate command history backwards
-        if (!active_tab->search_mode && active_tab->history_current > 0)
+        if (active_tab->search_mode)
+            break;
+
+        // Ctrl+Up: Jump to the previous command's output
+        if (control_pressed)
+        {
+            jump_to_command_block(active_tab, -1);
+            break;
+        }
+
+        // Inside a multi-line command: move to the same column of the previous line
+        if (line_editor_line_start(&active_tab->editor, active_tab->editor.cursor) > 0)
+        {
+            LineEditor *editor = &active_tab->editor;
+            size_t line_start = line_editor_line_start(editor, editor->cursor);
+            size_t column = editor->cursor - line_start;
+            size_t previous_start = line_editor_line_start(editor, line_start - 1);
+            size_t previous_length = (line_start - 1) - previous_start;
+            line_editor_set_cursor(editor, previous_start + (column < previous_length ? column : previous_length));
+            update_command_display(active_tab);
+        }
+        // Otherwise navigate command history backwards
+        else if (active_tab->history_current > 0)
         {
             active_tab->history_current--;
-            wcscpy(active_tab->current_command, active_tab->command_history[active_tab->history_current]);
-            active_tab->command_length = wcslen(active_tab->current_command);
-            active_tab->cursor_buffer_pos = active_tab->command_length;
+            line_editor_set_text(&active_tab->editor, active_tab->command_history[active_tab->history_current]);
             update_command_display(active_tab);
         }
         break;
 
     case XK_Down:
-        // Navigate command history forwards
-        if (!active_tab->search_mode)
+        if (active_tab->search_mode)
+            break;
+
+        // Ctrl+Down: Jump to the next command's output
+        if (control_pressed)
         {
-            if (active_tab->history_current < active_tab->history_count - 1)
-            {
-                active_tab->history_current++;
-                wcscpy(active_tab->current_command, active_tab->command_history[active_tab->history_current]);
-                active_tab->command_length = wcslen(active_tab->current_command);
-                active_tab->cursor_buffer_pos = active_tab->command_length;
-            }
-            else if (active_tab->history_current == active_tab->history_count - 1)
+            jump_to_command_block(active_tab, 1);
+            break;
+        }
+
+        // Inside a multi-line command: move to the same column of the next line
+        if (line_editor_line_end(&active_tab->editor, active_tab->editor.cursor) < line_editor_length(&active_tab->editor))
+        {
+            LineEditor *editor = &active_tab->editor;
+            size_t column = editor->cursor - line_editor_line_start(editor, editor->cursor);
+            size_t next_start = line_editor_line_end(editor, editor->cursor) + 1;
+            size_t next_length = line_editor_line_end(editor, next_start) - next_start;
+            line_editor_set_cursor(editor, next_start + (column < next_length ? column : next_length));
+        }
+        // Otherwise navigate command history forwards
+        else if (active_tab->history_current < active_tab->history_count - 1)
+        {
+            active_tab->history_current++;
+            line_editor_set_text(&active_tab->editor, active_tab->command_history[active_tab->history_current]);
+        }
+        else if (active_tab->history_current == active_tab->history_count - 1)
+        {
+            // Reached the end - clear command for new input
+            active_tab->history_current = active_tab->history_count;
+            line_editor_clear(&active_tab->editor);
+        }
+        update_command_display(active_tab);
+        break;
+
+    case XK_z:
+        if (control_pressed)
+        {
+            // Ctrl+Z: Stop the foreground job; the event loop moves it to the job list
+            CommandJob *foreground_job = find_foreground_job(active_tab);
+            if (foreground_job != NULL)
             {
-                // Reached the end - clear command for new input
-                active_tab->history_current = active_tab->history_count;
-                memset(active_tab->current_command, 0, MAX_COMMAND_LENGTH * sizeof(wchar_t));
-                active_tab->command_length = 0;
-                active_tab->cursor_buffer_pos = 0;
+                printf("Ctrl+Z detected - stopping '%s'\n", foreground_job->command);
+                signal_command_job(foreground_job, SIGTSTP);
             }
-            update_command_display(active_tab);
+            break;
         }
-        break;
+        goto default_case;
 
     case XK_a:
         if (control_pressed && !active_tab->search_mode)
         {
-            // Ctrl+A: Move cursor to beginning of line
-            active_tab->cursor_buffer_pos = 0;
+            // Ctrl+A: Move cursor to beginning of the current line
+            line_editor_set_cursor(&active_tab->editor,
+                                   line_editor_line_start(&active_tab->editor, active_tab->editor.cursor));
             update_command_display(active_tab);
             break;
         }
@@ -3894,13 +15328,87 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
     case XK_e:
         if (control_pressed && !active_tab->search_mode)
         {
-            // Ctrl+E: Move cursor to end of line
-            active_tab->cursor_buffer_pos = active_tab->command_length;
+            // Ctrl+E: Move cursor to end of the current line
+            line_editor_set_cursor(&active_tab->editor,
+                                   line_editor_line_end(&active_tab->editor, active_tab->editor.cursor));
+            update_command_display(active_tab);
+            break;
+        }
+        goto default_case;
+
+    case XK_b:
+    case XK_f:
+    case XK_F:
+        if (control_pressed && shift_pressed && !alt_pressed && key_symbol == XK_F && !active_tab->search_mode)
+        {
+            // Ctrl+Shift+F: Search every tab's scrollback and history
+            enter_global_search(active_tab);
+            break;
+        }
+        if (control_pressed && !alt_pressed && key_symbol == XK_f && !active_tab->search_mode)
+        {
+            // Ctrl+F: Search the scrollback
+            enter_find_mode(active_tab);
+            break;
+        }
+        if (alt_pressed && !control_pressed && !active_tab->search_mode)
+        {
+            // Alt+B / Alt+F: Move cursor back / forward one word
+            if (key_symbol == XK_b)
+                line_editor_set_cursor(&active_tab->editor, line_editor_word_left(&active_tab->editor));
+            else
+                line_editor_set_cursor(&active_tab->editor, line_editor_word_right(&active_tab->editor));
             update_command_display(active_tab);
             break;
         }
         goto default_case;
 
+    case XK_c:
+    case XK_C:
+        if (control_pressed && shift_pressed)
+        {
+            // Ctrl+Shift+C: Copy the mouse selection to CLIPBOARD
+            if (display != NULL)
+                copy_selection_to_clipboard(display, window, active_tab, key_time);
+            break;
+        }
+        if (control_pressed)
+        {
+            // Ctrl+C: Interrupt the foreground job or stop multiWatch in this tab
+            CommandJob *foreground_job = find_foreground_job(active_tab);
+            if (foreground_job != NULL)
+            {
+                printf("Ctrl+C detected - interrupting '%s'\n", foreground_job->command);
+                signal_command_job(foreground_job, SIGINT);
+            }
+            else if (multiwatch_mode && multiwatch_tab_id == active_tab->tab_id)
+            {
+                stop_multiwatch(active_tab, "Ctrl+C received - stopping multiWatch");
+            }
+            break;
+        }
+        goto default_case;
+
+    case XK_v:
+    case XK_V:
+        if (control_pressed && shift_pressed)
+        {
+            // Ctrl+Shift+V: Paste the CLIPBOARD selection
+            if (display != NULL)
+                request_paste(display, window, active_tab, clipboard_atom, key_time);
+            break;
+        }
+        goto default_case;
+
+    case XK_Insert:
+        if (shift_pressed)
+        {
+            // Shift+Insert: Paste the PRIMARY selection
+            if (display != NULL)
+                request_paste(display, window, active_tab, XA_PRIMARY, key_time);
+        }
+        break;
+
     case XK_r:
         if (control_pressed && !active_tab->search_mode)
         {
@@ -3912,17 +15420,9 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
 
     case XK_space:
         // Insert space character
-        if (!active_tab->search_mode && active_tab->command_length < MAX_COMMAND_LENGTH - 1)
+        if (!active_tab->search_mode)
         {
-            // Make space for new character
-            for (int char_index = active_tab->command_length; char_index > active_tab->cursor_buffer_pos; char_index--)
-            {
-                active_tab->current_command[char_index] = active_tab->current_command[char_index - 1];
-            }
-            active_tab->current_command[active_tab->cursor_buffer_pos] = L' ';
-            active_tab->command_length++;
-            active_tab->current_command[active_tab->command_length] = L'\0';
-            active_tab->cursor_buffer_pos++;
+            line_editor_insert(&active_tab->editor, L" ", 1);
             update_command_display(active_tab);
         }
         break;
@@ -3948,8 +15448,8 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
     case XK_End:
         if (control_pressed && !active_tab->search_mode)
         {
-            // Ctrl+End: Move cursor to end of line (same as Ctrl+E)
-            active_tab->cursor_buffer_pos = active_tab->command_length;
+            // Ctrl+End: Move cursor to end of the whole command
+            line_editor_set_cursor(&active_tab->editor, line_editor_length(&active_tab->editor));
             update_command_display(active_tab);
             break;
         }
@@ -3965,8 +15465,8 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
     case XK_Home:
         if (control_pressed && !active_tab->search_mode)
         {
-            // Ctrl+Home: Move cursor to beginning of line (same as Ctrl+A)
-            active_tab->cursor_buffer_pos = 0;
+            // Ctrl+Home: Move cursor to beginning of the whole command
+            line_editor_set_cursor(&active_tab->editor, 0);
             update_command_display(active_tab);
             break;
         }
@@ -3988,45 +15488,10 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
             // Character input in search mode: add to search buffer
             if (wide_character != L'\0' && iswprint(wide_character))
             {
-                if (active_tab->search_pos < MAX_COMMAND_LENGTH - 1)
-                {
-                    active_tab->search_buffer[active_tab->search_pos] = wide_character;
-                    active_tab->search_pos++;
-                    active_tab->search_buffer[active_tab->search_pos] = L'\0';
-
-                    // Update search display with current results
-                    char search_prompt[256];
-                    char multibyte_search[MAX_COMMAND_LENGTH * 4] = {0};
-
-                    // Convert search term for display
-                    size_t converted_chars = wcstombs(multibyte_search, active_tab->search_buffer, sizeof(multibyte_search) - 1);
-                    if (converted_chars == (size_t)-1)
-                    {
-                        // Fallback conversion
-                        for (int char_index = 0; char_index < active_tab->search_pos && char_index < sizeof(multibyte_search) - 1; char_index++)
-                        {
-                            multibyte_search[char_index] = (char)active_tab->search_buffer[char_index];
-                        }
-                        multibyte_search[active_tab->search_pos] = '\0';
-                    }
-
-                    wchar_t found_command[MAX_COMMAND_LENGTH] = {0};
-                    int search_result = search_history(active_tab, active_tab->search_buffer, found_command, 0);
+                line_editor_insert(&active_tab->search_buffer, &wide_character, 1);
 
-                    if (search_result == 1)
-                    {
-                        char multibyte_found[MAX_COMMAND_LENGTH * 4] = {0};
-                        wcstombs(multibyte_found, found_command, sizeof(multibyte_found) - 1);
-                        multibyte_found[sizeof(multibyte_found) - 1] = '\0';
-                        snprintf(search_prompt, sizeof(search_prompt), "(reverse-i-search)`%s': %s", multibyte_search, multibyte_found);
-                    }
-                    else
-                    {
-                        snprintf(search_prompt, sizeof(search_prompt), "(reverse-i-search)`%s': ", multibyte_search);
-                    }
-
-                    update_command_display_with_prompt(active_tab, search_prompt);
-                }
+                // Update search display with current results
+                refresh_search_prompt(active_tab);
             }
         }
         else
@@ -4034,17 +15499,9 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
             // Character input in normal mode: add to command buffer
             if (wide_character != L'\0' && iswprint(wide_character) && !control_pressed)
             {
-                if (active_tab->command_length < MAX_COMMAND_LENGTH - 1)
+                // Insert at the cursor - O(1) amortized, the gap buffer grows as needed
+                if (line_editor_insert(&active_tab->editor, &wide_character, 1) == 0)
                 {
-                    // Make space for new character at cursor position
-                    for (int char_index = active_tab->command_length; char_index > active_tab->cursor_buffer_pos; char_index--)
-                    {
-                        active_tab->current_command[char_index] = active_tab->current_command[char_index - 1];
-                    }
-                    active_tab->current_command[active_tab->cursor_buffer_pos] = wide_character;
-                    active_tab->command_length++;
-                    active_tab->current_command[active_tab->command_length] = L'\0';
-                    active_tab->cursor_buffer_pos++;
                     update_command_display(active_tab);
                 }
             }
@@ -4059,6 +15516,24 @@ void handle_keypress(Display *display, Window window, GC gc, XKeyEvent *key_even
     }
 }
 
+// Function to apply one key to the active tab (display is NULL when a detached server got it from a client)
+void handle_key_input(Display *display, Window window, GC gc, KeySym key_symbol, unsigned int state,
+                      const char *key_buffer, int buffer_length, Time key_time)
+{
+    // A recording keeps the key itself; what it does is replayed by applying it again
+    AttachKeyMessage key;
+    memset(&key, 0, sizeof(key));
+    key.keysym = (uint32_t)key_symbol;
+    key.state = state;
+    key.text_length = buffer_length < ATTACH_KEY_TEXT ? (uint32_t)buffer_length : ATTACH_KEY_TEXT;
+    memcpy(key.text, key_buffer, key.text_length);
+    record_input(RECORD_KEY, &key, sizeof(key), NULL, 0);
+
+    recording_input_depth++;
+    apply_key_input(display, window, gc, key_symbol, state, key_buffer, buffer_length, key_time);
+    recording_input_depth--;
+}
+
 // Updated signal handlers for graceful process management
 
 /**
@@ -4114,21 +15589,10 @@ void handle_sigtstp(int sig)
             bg_processes[bg_job_count].pid = active_tab->foreground_pid;
             strcpy(bg_processes[bg_job_count].status, "Stopped");
 
-            // Convert the current command from wide characters to multibyte for storage
-            char multibyte_command[MAX_COMMAND_LENGTH * 4];
-            size_t converted_chars = wcstombs(multibyte_command, active_tab->current_command, sizeof(multibyte_command) - 1);
-            
-            if (converted_chars == (size_t)-1)
-            {
-                // Conversion failed - use fallback description
-                strcpy(bg_processes[bg_job_count].command, "unknown");
-            }
-            else
-            {
-                // Safe copy of command string with null termination
-                strncpy(bg_processes[bg_job_count].command, multibyte_command, MAX_COMMAND_LENGTH - 1);
-                bg_processes[bg_job_count].command[MAX_COMMAND_LENGTH - 1] = '\0';
-            }
+            // Record the running job's command line (the editor is never converted here)
+            CommandJob *stopped_job = find_job_by_pid(active_tab->foreground_pid);
+            snprintf(bg_processes[bg_job_count].command, MAX_COMMAND_LENGTH, "%s",
+                     stopped_job != NULL ? stopped_job->command : "unknown");
 
             // Assign unique job ID and increment job counter
             bg_processes[bg_job_count].job_id = ++job_counter;
@@ -4212,7 +15676,7 @@ static int x11_error_handler(Display *display, XErrorEvent *error_event)
     return 0;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     // Step 1: Initialize localization for Unicode and internationalization support
     if (setlocale(LC_ALL, "") == NULL)
@@ -4245,16 +15709,183 @@ int main()
         fprintf(stderr, "Warning: Failed to set SIGSEGV (segmentation fault) handler\n");
     }
 
+    // `--server` keeps the tabs in a background process; `--attach` shows them in this window;
+    // `--single-instance` hands the launch to a running instance when there is one
+    int attach_requested = 0;
+    const char *replay_path = NULL;
+    int replay_paced = 0;
+    int replay_show = 0;
+    int exit_status = 0;
+    const char *bench_suite = NULL;
+    char **bench_names = NULL;
+    int bench_name_count = 0;
+    const char *single_instance_choice = getenv("MYTERM_SINGLE_INSTANCE");
+    int single_instance = single_instance_choice && strcmp(single_instance_choice, "1") == 0;
+    if (argc > 1 && strcmp(argv[1], "--single-instance") == 0)
+    {
+        single_instance = 1;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--server") == 0)
+    {
+        int started = start_server();
+        if (started > 0)
+            printf("A server is already running on %s\n", attach_socket_path);
+        if (started != 0)
+            return started > 0 ? 0 : 1;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--attach") == 0)
+    {
+        attach_requested = 1;
+    }
+    else if (argc > 2 && strcmp(argv[1], "--replay") == 0)
+    {
+        // `--replay FILE [--paced] [--show]` re-runs a MYTERM_RECORD recording
+        replay_path = argv[2];
+        for (int arg_index = 3; arg_index < argc; arg_index++)
+        {
+            if (strcmp(argv[arg_index], "--paced") == 0)
+                replay_paced = 1;
+            else if (strcmp(argv[arg_index], "--show") == 0)
+                replay_show = 1;
+            else
+                replay_path = NULL;
+        }
+    }
+    else if (argc > 2 && strcmp(argv[1], "--bench") == 0 &&
+             (strcmp(argv[2], "render") == 0 || strcmp(argv[2], "commands") == 0))
+    {
+        // `--bench render|commands [WORKLOAD...]` measures the renderer (on the current display)
+        // or command execution (headless)
+        bench_suite = argv[2];
+        bench_names = argv + 3;
+        bench_name_count = argc - 3;
+    }
+    if (argc > 1 && !server_mode && !attach_requested && !replay_path && !bench_suite &&
+        strcmp(argv[1], "--single-instance") != 0)
+    {
+        fprintf(stderr,
+                "Usage: %s [--server | --attach | --single-instance | --replay FILE [--paced] [--show] |"
+                " --bench render|commands [WORKLOAD...]]\n",
+                argv[0]);
+        return 1;
+    }
+
+    // A single-instance launch that finds the instance is done before anything is allocated;
+    // otherwise this process becomes the instance and listens on the shared path
+    if (single_instance && !server_mode && !attach_requested)
+    {
+        char instance_path[PATH_MAX];
+        single_instance_socket_path(instance_path, sizeof(instance_path));
+        if (open_in_running_instance(instance_path) == 0)
+        {
+            return 0;
+        }
+        setenv("MYTERM_CONTROL_SOCKET", instance_path, 1);
+        setenv("MYTERM_CONTROL", "1", 1);
+    }
+
     // Step 4: Initialize the text buffer system and create first tab
     printf("Initializing text buffer system...\n");
     initialize_text_buffer();
 
+    // An attached window only mirrors the server's screen: no session, no commands of its own
+    if (attach_requested && connect_to_server(argv[0]) != 0)
+    {
+        exit(1);
+    }
+
+    // Reopen the previous session's tabs (MYTERM_SESSION=0 starts fresh and saves nothing)
+    const char *session_choice = getenv("MYTERM_SESSION");
+    if (session_choice && strcmp(session_choice, "0") == 0)
+    {
+        session_enabled = 0;
+    }
+
+    // Hidden tabs hibernate after MYTERM_HIBERNATE_MINUTES (0 disables it; a recording turns it off)
+    // - read before any mode is dispatched, so a server honours it too
+    const char *hibernate_minutes = getenv("MYTERM_HIBERNATE_MINUTES");
+    if (hibernate_minutes && *hibernate_minutes)
+    {
+        hibernate_idle_ms = atoll(hibernate_minutes) * 60 * 1000;
+    }
+
+    // Resident scrollback of all tabs is capped at MYTERM_MEMORY_BUDGET_MB (0 disables spilling)
+    const char *budget_megabytes = getenv("MYTERM_MEMORY_BUDGET_MB");
+    if (budget_megabytes && *budget_megabytes)
+    {
+        memory_budget_bytes = (size_t)atoll(budget_megabytes) * 1024 * 1024;
+    }
+
+    // Recordings, replays and benchmarks all start from a fresh session so they see the same tabs
+    const char *record_path = getenv("MYTERM_RECORD");
+    if (replay_path || bench_suite || (record_path && *record_path && attach_server.fd < 0))
+    {
+        session_enabled = 0;
+    }
+    restore_session();
+    if (!replay_path && !bench_suite && record_path && *record_path && attach_server.fd < 0 && start_recording(record_path) != 0)
+    {
+        exit(1);
+    }
+
+    // Trace frames, commands, reads and queries (MYTERM_TRACE=FILE); the reader thread records too
+    const char *trace_choice = getenv("MYTERM_TRACE");
+    if (trace_choice && *trace_choice && attach_server.fd < 0 && start_trace(trace_choice) != 0)
+    {
+        exit(1);
+    }
+
+    // Start the thread that drains child output off the UI thread (a replay starts no commands)
+    if (attach_server.fd < 0 && !replay_path && start_io_reader() == -1)
+    {
+        fprintf(stderr, "Error: Cannot start I/O reader thread\n");
+        exit(1);
+    }
+
+    // Scripts reach the tabs through the control socket (MYTERM_CONTROL=0 turns it off)
+    const char *control_choice = getenv("MYTERM_CONTROL");
+    if (attach_server.fd < 0 && !replay_path && !bench_suite && !(control_choice && strcmp(control_choice, "0") == 0))
+    {
+        start_control_socket();
+    }
+
+    // Hardware counters per phase (MYTERM_PERF=1; the benchmarks open them on their own)
+    const char *perf_choice = getenv("MYTERM_PERF");
+    if (perf_choice && strcmp(perf_choice, "1") == 0 && start_perf_counters() != 0)
+    {
+        printf("Warning: Hardware counters unavailable: %s\n", perf_unavailable_reason);
+    }
+
     // Step 5: Initialize background jobs tracking system
     printf("Initializing background jobs system...\n");
     memset(bg_processes, 0, sizeof(bg_processes));
     job_counter = 0;
     bg_job_count = 0;
 
+    // A headless replay needs no display
+    if (replay_path && !replay_show)
+    {
+        exit_status = run_replay(replay_path, replay_paced, NULL, None, NULL);
+        cleanup_resources(NULL, None, NULL);
+        return exit_status;
+    }
+
+    // Neither does the command benchmark
+    if (bench_suite && strcmp(bench_suite, "commands") == 0)
+    {
+        exit_status = run_command_benchmark(bench_names, bench_name_count);
+        cleanup_resources(NULL, None, NULL);
+        return exit_status;
+    }
+
+    // A server has no window; it runs until `exit` or SIGTERM
+    if (server_mode)
+    {
+        run_server();
+        cleanup_resources(NULL, None, NULL);
+        return 0;
+    }
+
     // Step 6: Connect to X11 display server
     printf("Connecting to X11 display server...\n");
     display = XOpenDisplay(NULL);
@@ -4304,14 +15935,28 @@ int main()
 
     XSetForeground(display, graphics_context, BlackPixel(display, screen));
 
+    // Optional software rasterizer backend (MYTERM_RENDERER=shm); falls back to Xlib
+    const char *renderer_choice = getenv("MYTERM_RENDERER");
+    if (renderer_choice && strcmp(renderer_choice, "shm") == 0)
+    {
+        set_renderer(display, window, graphics_context, RENDERER_SHM);
+    }
+
     // Step 10: Select which events the window will receive
-    XSelectInput(display, window,
-                 ExposureMask |        // Window expose/redraw events
-                 KeyPressMask |        // Keyboard key press events
-                 KeyReleaseMask |      // Keyboard key release events  
-                 ButtonPressMask |     // Mouse button events
-                 StructureNotifyMask   // Window resize/move events
-    );
+    // Only events we actually handle are selected (expose, key presses, mouse
+    // buttons, button-1 drags for selection, focus); key releases and structure
+    // notifications were never used and only doubled the event traffic.
+    // PropertyChangeMask is added only while a paste is being transferred.
+    XSelectInput(display, window, WINDOW_EVENT_MASK);
+
+    // Held keys repeat as a plain stream of KeyPress events (no synthetic releases)
+    Bool autorepeat_supported = False;
+    XkbSetDetectableAutoRepeat(display, True, &autorepeat_supported);
+    x_round_trips++;
+    if (!autorepeat_supported)
+    {
+        printf("Warning: Detectable autorepeat not supported by this X server\n");
+    }
 
     // Step 11: Make the window visible
     XMapWindow(display, window);
@@ -4326,10 +15971,26 @@ int main()
     XSetErrorHandler(x11_error_handler);
 
     // Step 14: Enable proper window close protocol (WM_DELETE_WINDOW)
-    Atom window_delete_atom = XInternAtom(display, "WM_DELETE_WINDOW", False);
-    if (window_delete_atom != None)
-    {
-        XSetWMProtocols(display, window, &window_delete_atom, 1);
+    // All atoms (window protocol and paste) are interned in a single round trip
+    // and cached for the event loop
+    char *atom_names[8] = {"WM_PROTOCOLS", "WM_DELETE_WINDOW", "CLIPBOARD", "UTF8_STRING",
+                           "INCR", "MYTERM_PASTE", "TARGETS", "_NET_ACTIVE_WINDOW"};
+    Atom interned_atoms[8] = {None, None, None, None, None, None, None, None};
+    XInternAtoms(display, atom_names, 8, False, interned_atoms);
+    x_round_trips++;
+    wm_protocols_atom = interned_atoms[0];
+    wm_delete_window_atom = interned_atoms[1];
+    clipboard_atom = interned_atoms[2];
+    utf8_string_atom = interned_atoms[3];
+    incr_atom = interned_atoms[4];
+    paste_property_atom = interned_atoms[5];
+    targets_atom = interned_atoms[6];
+    net_active_window_atom = interned_atoms[7];
+    if (wm_protocols_atom != None && wm_delete_window_atom != None)
+    {
+        // Equivalent to XSetWMProtocols() without its extra XInternAtom round trip
+        XChangeProperty(display, window, wm_protocols_atom, XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *)&wm_delete_window_atom, 1);
         printf("Window close protocol enabled\n");
     }
     else
@@ -4351,17 +16012,47 @@ int main()
     printf("  Ctrl+Z         - Stop/suspend current process\n");
     printf("  Ctrl+A         - Move cursor to start of line\n");
     printf("  Ctrl+E         - Move cursor to end of line\n");
+    printf("  Ctrl+Shift+V   - Paste clipboard (middle click / Shift+Insert: primary)\n");
+    printf("  Ctrl+Shift+C   - Copy mouse selection to clipboard\n");
     printf("  Page Up/Down   - Scroll through output history\n");
     printf("  Click tabs     - Switch tabs with mouse\n");
     printf("  Mouse wheel    - Scroll through output\n");
     printf("  ESC            - Exit application\n");
     printf("\nReady for commands...\n\n");
 
+    // An attached window hands its input to the server and draws what comes back
+    if (attach_server.fd >= 0)
+    {
+        run_attached_client(display, window, graphics_context);
+        goto cleanup_and_exit;
+    }
+
+    // `--replay FILE --show` paints the recorded frames into this window
+    if (replay_path)
+    {
+        exit_status = run_replay(replay_path, replay_paced, display, window, graphics_context);
+        goto cleanup_and_exit;
+    }
+
+    // `--bench render` draws its workloads into this window and reports the numbers
+    if (bench_suite)
+    {
+        exit_status = run_render_benchmark(display, window, graphics_context, bench_names, bench_name_count);
+        goto cleanup_and_exit;
+    }
+
     // Step 16: Main event processing loop
     while (1)
     {
-        // Check if there are pending X11 events to process
-        if (XPending(display) > 0)
+        // Protocol accounting for this iteration (reported by the 'renderer' built-in)
+        unsigned long frame_request_start = XNextRequest(display);
+        unsigned long frame_round_trip_start = x_round_trips;
+        int frame_keystrokes = 0;
+
+        // Process every pending X11 event first so input never waits behind child output.
+        // A burst of key presses (autorepeat, fast typing over a slow link) is applied
+        // to the line editor in full before the single repaint at the end of the iteration.
+        while (XPending(display) > 0)
         {
             XNextEvent(display, &event);
 
@@ -4370,63 +16061,122 @@ int main()
             case Expose:
                 // Window needs redrawing (exposed, resized, etc.)
                 printf("Debug: Expose event - redrawing window contents\n");
+                record_input(RECORD_EXPOSE, NULL, 0, NULL, 0);
                 draw_text_buffer(display, window, graphics_context);
                 break;
 
             case KeyPress:
                 // Keyboard key pressed - handle text input and commands
                 handle_keypress(display, window, graphics_context, &event.xkey);
+                frame_keystrokes++;
+                break;
+
+            case FocusIn:
+                window_has_focus = 1;
+                break;
+
+            case FocusOut:
+                window_has_focus = 0;
                 break;
 
             case ButtonPress:
                 // Mouse button pressed
-                if (event.xbutton.y < CHAR_HEIGHT)
+                if (event.xbutton.y < CHAR_HEIGHT || event.xbutton.button == 4 || event.xbutton.button == 5)
                 {
-                    // Click in tab header area - handle tab switching
-                    handle_tab_click(event.xbutton.x);
+                    // Click in tab header area (tab switching) or mouse wheel (scrolling)
+                    handle_button_input(event.xbutton.x, event.xbutton.y, event.xbutton.button);
                     draw_text_buffer(display, window, graphics_context);
                 }
                 else
                 {
-                    // Click in main content area or mouse wheel events
-                    if (event.xbutton.button == 4)
-                    {
-                        // Mouse wheel up - scroll buffer up
-                        scroll_up(&tabs[active_tab_index]);
-                        draw_text_buffer(display, window, graphics_context);
-                    }
-                    else if (event.xbutton.button == 5)
+                    // Click in main content area
+                    if (event.xbutton.button == Button2)
                     {
-                        // Mouse wheel down - scroll buffer down
-                        scroll_down(&tabs[active_tab_index]);
-                        draw_text_buffer(display, window, graphics_context);
+                        // Middle click - paste the PRIMARY selection into the command line
+                        request_paste(display, window, &tabs[active_tab_index], XA_PRIMARY, event.xbutton.time);
                     }
                     else
                     {
-                        // Regular mouse click - focus on window
-                        printf("Debug: Mouse click - focusing window\n");
-                        XSetInputFocus(display, window, RevertToParent, CurrentTime);
+                        // Regular mouse click - focus on window (only if it does not have focus yet)
+                        if (!window_has_focus)
+                        {
+                            printf("Debug: Mouse click - focusing window\n");
+                            XSetInputFocus(display, window, RevertToParent, CurrentTime);
+                        }
+
+                        // Left button starts a selection (double click: word, triple click: line)
+                        if (event.xbutton.button == Button1)
+                        {
+                            handle_selection_press(display, &event.xbutton);
+                        }
                     }
                 }
                 break;
 
-            case ConfigureNotify:
-                // Window configuration changed (resized, moved)
-                // Note: Currently we don't handle resizing, but the event is captured
+            case MotionNotify:
+                // Drag with button 1 held - only the latest position matters for this frame
+                handle_selection_motion(&event.xmotion);
+                break;
+
+            case ButtonRelease:
+                if (event.xbutton.button == Button1)
+                {
+                    handle_selection_release(display, window, &event.xbutton);
+                }
+                break;
+
+            case SelectionRequest:
+                // Another client wants our PRIMARY/CLIPBOARD text - extracted only now
+                handle_selection_request(display, &event.xselectionrequest);
+                break;
+
+            case SelectionClear:
+                // Another client took over one of our selections
+                handle_selection_clear(&event.xselectionclear);
                 break;
 
             case ClientMessage:
                 // Handle window manager messages (like close request)
                 {
-                    Atom window_delete_atom = XInternAtom(display, "WM_DELETE_WINDOW", False);
-                    if (window_delete_atom != None &&
-                        event.xclient.data.l[0] == window_delete_atom)
+                    // Compare against the atoms cached at startup - no round trip here
+                    if (wm_delete_window_atom != None &&
+                        event.xclient.message_type == wm_protocols_atom &&
+                        (Atom)event.xclient.data.l[0] == wm_delete_window_atom)
                     {
                         printf("Window close request received - initiating graceful shutdown\n");
                         goto cleanup_and_exit;
                     }
                 }
                 break;
+
+            case SelectionNotify:
+                // Selection owner answered a paste request
+                if (handle_selection_notify(display, window, &event.xselection))
+                {
+                    redraw_pending = 1;
+                }
+                break;
+
+            case PropertyNotify:
+                // A requestor took the last chunk of a selection we serve, or the
+                // next chunk of an INCR paste arrived on our own window
+                if (handle_selection_transfer_property(display, &event.xproperty))
+                {
+                    break;
+                }
+                if (handle_paste_property(display, window, &event.xproperty))
+                {
+                    redraw_pending = 1;
+                }
+                break;
+
+            default:
+                // Completion of an XShmPutImage the rasterizer may still be waiting on
+                if (event.type == shm_completion_event_type)
+                {
+                    shm_put_pending = 0;
+                }
+                break;
             }
         }
 
@@ -4485,11 +16235,82 @@ int main()
             which_signal = 0;
         }
 
-        // Brief sleep to prevent excessive CPU usage in event loop
-        usleep(10000); // 10 milliseconds
+        // Step 18: Consume child output gathered by the reader thread and reap jobs
+        if (service_child_io())
+        {
+            redraw_pending = 1;
+        }
+        if (service_global_search())
+        {
+            redraw_pending = 1;
+        }
+        service_scrollback_compression();
+        service_tab_hibernation();
+        service_session_journal();
+        service_control_socket();
+        if (raise_window_requested)
+        {
+            // A single-instance launch opened a tab: raise the window and ask the WM for focus
+            raise_window_requested = 0;
+            XMapRaised(display, window);
+            if (net_active_window_atom != None)
+            {
+                XEvent activate;
+                memset(&activate, 0, sizeof(activate));
+                activate.xclient.type = ClientMessage;
+                activate.xclient.window = window;
+                activate.xclient.message_type = net_active_window_atom;
+                activate.xclient.format = 32;
+                activate.xclient.data.l[0] = 1;      // Source: an application
+                activate.xclient.data.l[1] = CurrentTime;
+                XSendEvent(display, RootWindow(display, screen), False,
+                           SubstructureRedirectMask | SubstructureNotifyMask, &activate);
+            }
+        }
+        if (quit_requested)
+        {
+            printf("exit built-in - initiating graceful shutdown\n");
+            goto cleanup_and_exit;
+        }
+
+        // Step 19: Present at most one frame for everything handled above and
+        // send the whole batch of requests with a single flush
+        if (redraw_pending)
+        {
+            redraw_pending = 0;
+            record_effect(RECORD_FRAME, NULL, 0);
+            present_frame(display, window, graphics_context);
+        }
+        XFlush(display);
+
+        if (frame_keystrokes > 0)
+        {
+            keystroke_count += frame_keystrokes;
+            keystroke_requests += XNextRequest(display) - frame_request_start;
+            keystroke_round_trips += x_round_trips - frame_round_trip_start;
+        }
+
+        // Step 20: Sleep until X input, new child output, or the next frame tick
+        struct pollfd wait_fds[2 + 1 + MAX_CONTROL_CLIENTS];
+        wait_fds[0].fd = ConnectionNumber(display);
+        wait_fds[0].events = POLLIN;
+        wait_fds[1].fd = ui_notify_pipe[0];
+        wait_fds[1].events = POLLIN;
+        int wait_count = 2 + control_poll_fds(wait_fds + 2);
+
+        int wait_timeout = IDLE_INTERVAL_MS;
+        if (io_backlog_pending())
+        {
+            wait_timeout = 0; // A ring still holds more than one frame's budget
+        }
+        else if (jobs_pending())
+        {
+            wait_timeout = FRAME_INTERVAL_MS; // Reap and enforce deadlines promptly
+        }
+        poll(wait_fds, wait_count, wait_timeout);
     }
 
-// Step 18: Cleanup and exit label
+// Step 21: Cleanup and exit label
 cleanup_and_exit:
     printf("Initiating application shutdown...\n");
     
@@ -4497,5 +16318,5 @@ cleanup_and_exit:
     cleanup_resources(display, window, graphics_context);
     
     printf("X11 Shell Terminal exited successfully.\n");
-    return 0;
+    return exit_status;
 }